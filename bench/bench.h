@@ -0,0 +1,82 @@
+#ifndef UJAVAC_BENCH_H_
+#define UJAVAC_BENCH_H_
+
+#include "ujavac.h"
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+// Runs f the given number of times and returns the fastest
+// wall time in seconds, which is the least noisy estimate.
+template <class F> double bench_best_seconds(u32 reps, F &&f)
+{
+    double best = 0;
+    for (u32 i = 0; i < reps; i++)
+    {
+        auto start = std::chrono::steady_clock::now();
+        f();
+        std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+        if (!i || elapsed.count() < best)
+        {
+            best = elapsed.count();
+        }
+    }
+
+    return best;
+}
+
+inline void bench_report_throughput(std::string_view name, u64 bytes, double seconds)
+{
+    println("{:<48} {:>9.3f} GB/s", name, bytes / seconds / 1e9);
+}
+
+inline void bench_report_rate(std::string_view name, u64 items, double seconds)
+{
+    println("{:<48} {:>9.3f} M/s", name, items / seconds / 1e6);
+}
+
+inline void bench_report_speedup(std::string_view name, double factor)
+{
+    println("{:<48} {:>9.2f} x", name, factor);
+}
+
+inline void bench_report_latency(std::string_view name, double seconds)
+{
+    println("{:<48} {:>9.3f} ms", name, seconds * 1e3);
+}
+
+inline void bench_report_memory(std::string_view name, u64 bytes)
+{
+    println("{:<48} {:>9.3f} MB", name, bytes / 1e6);
+}
+
+inline void bench_report_bytes_per_item(std::string_view name, u64 bytes, u64 items)
+{
+    println("{:<48} {:>9.2f} B", name, items ? double(bytes) / items : 0.0);
+}
+
+// Synthetic corpora shared by the benchmark suites
+std::string bench_ascii_corpus(u64 size);
+std::string bench_mixed_corpus(u64 size);
+std::string bench_comment_corpus(u64 size);
+std::string bench_unicode_identifier_corpus(u64 size);
+// Every other character spelled as a \uXXXX escape
+std::string bench_escape_corpus(u64 size);
+// Megabyte-long lines
+std::string bench_long_line_corpus(u64 size);
+// Varied classes from a pseudo-random generator; the same seed always
+// gives the same source
+std::string bench_generated_corpus(u64 size, u64 seed);
+// One of the given number of units of a project whose classes extend and
+// refer to each other's, in a few cycles
+std::string bench_project_unit(u32 index, u32 units, u64 size);
+
+void run_daemon_benchmarks();
+void run_decode_benchmarks();
+void run_driver_benchmarks();
+void run_frontend_benchmarks();
+void run_keyword_benchmarks();
+
+#endif
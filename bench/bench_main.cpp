@@ -0,0 +1,40 @@
+#include "bench.h"
+
+#include <cstring>
+
+namespace
+{
+struct bench_suite
+{
+    const char *name;
+    void (*run)();
+};
+
+constexpr bench_suite bench_suites[] = {
+    {"daemon", run_daemon_benchmarks},
+    {"decode", run_decode_benchmarks},
+    {"driver", run_driver_benchmarks},
+    {"frontend", run_frontend_benchmarks},
+    {"keyword", run_keyword_benchmarks},
+};
+} // namespace
+
+int main(int argc, char **argv)
+{
+    for (auto &suite : bench_suites)
+    {
+        bool selected = argc < 2;
+        for (int i = 1; i < argc; i++)
+        {
+            selected |= !std::strcmp(argv[i], suite.name);
+        }
+
+        if (selected)
+        {
+            println("# {}", suite.name);
+            suite.run();
+        }
+    }
+
+    return 0;
+}
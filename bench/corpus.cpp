@@ -0,0 +1,340 @@
+#include "bench.h"
+
+#include <algorithm>
+
+namespace
+{
+// Each corpus is a single compilation unit: the header once, then the
+// fragment as many times as it takes, with # standing for the number of
+// the copy so that every copy declares a class of its own
+constexpr std::string_view ascii_header = R"(package org.example.service;
+
+import java.util.List;
+import java.util.Map;
+
+)";
+
+constexpr std::string_view ascii_fragment = R"(/**
+ * Resolves accounts by identifier and caches the results.
+ */
+public final class AccountResolver# implements Resolver {
+    private final Map<String, Account> cache;
+    private int lookups;
+
+    public Account resolve(String id) {
+        // Fast path: already cached
+        Account account = cache.get(id);
+        if (account == null) {
+            account = repository.load(id, 0x1F, 42L);
+            cache.put(id, account);
+        }
+        lookups++;
+        return account;
+    }
+}
+)";
+
+constexpr std::string_view mixed_header = R"(package org.example.i18n;
+
+)";
+
+constexpr std::string_view mixed_fragment = R"(/**
+ * Локализованные сообщения для пользовательского интерфейса.
+ * 用户界面的本地化消息。
+ */
+public final class Messages# {
+    // Приветствие по умолчанию
+    private static final String GREETING = "Здравствуйте, мир";
+    private static final String FAREWELL = "再见，世界";
+
+    public String greet(String name) {
+        return GREETING + ", " + name + " ☺";
+    }
+}
+)";
+
+constexpr std::string_view comment_fragment = R"(/*
+ * Copyright (c) 2024 Example Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ */
+
+/**
+ * Returns the number of elements in this collection. If this collection
+ * contains more than {@code Integer.MAX_VALUE} elements, returns
+ * {@code Integer.MAX_VALUE}.
+ *
+ * @return the number of elements in this collection
+ */
+interface Sized# { int size(); } // see also isEmpty()
+
+)";
+
+constexpr std::string_view unicode_identifier_header = R"(package org.example.geometrie;
+
+)";
+
+constexpr std::string_view unicode_identifier_fragment = R"(public final class Fläche# {
+    private final double größe;
+    private final double ширина;
+    private final double 高度;
+
+    public Fläche#(double größe, double ширина, double 高度) {
+        this.größe = größe;
+        this.ширина = ширина;
+        this.高度 = 高度;
+    }
+
+    public double объём() {
+        return größe * ширина * 高度;
+    }
+}
+)";
+
+const char *const generated_types[] = {"int", "long", "double", "String", "boolean", "List<String>"};
+const char *const generated_words[] = {"account", "buffer", "count", "delta", "entry", "factor", "group",
+                                       "handle", "index", "limit", "mode", "node", "offset", "parent",
+                                       "queue", "result", "state", "total", "value", "weight"};
+
+// xorshift64, so every corpus is the same on every machine
+struct CorpusRandom
+{
+    u64 state;
+
+    u32 next(u32 bound)
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return u32(state % bound);
+    }
+
+    template <class T, u64 N> const T &pick(const T (&items)[N])
+    {
+        return items[next(N)];
+    }
+};
+
+void append_generated_method(std::string &out, CorpusRandom &random, u32 index)
+{
+    out.append(std::format("    /**\n     * Computes the {} of the {}.\n     */\n", random.pick(generated_words),
+                           random.pick(generated_words)));
+    out.append(std::format("    public long {}{}(long base, int limit) {{\n", random.pick(generated_words), index));
+
+    u32 statements = 2 + random.next(8);
+    for (u32 i = 0; i < statements; i++)
+    {
+        switch (random.next(6))
+        {
+        case 0:
+            out.append(std::format("        long v{} = {} * 0x{:X}L + {};\n", i, random.next(1000), random.next(65536),
+                                   random.next(100)));
+            break;
+        case 1:
+            out.append(std::format("        String s{} = \"{} {}\\t{}\";\n", i, random.pick(generated_words),
+                                   random.pick(generated_words), random.next(1000)));
+            break;
+        case 2:
+            out.append(std::format("        for (int i = 0; i < limit; i++) {{\n"
+                                   "            total += i % {};\n"
+                                   "        }}\n",
+                                   1 + random.next(16)));
+            break;
+        case 3:
+            out.append(std::format("        // {} the {} before it's read\n", random.pick(generated_words),
+                                   random.pick(generated_words)));
+            break;
+        case 4:
+            out.append(std::format("        double d{} = {}.{}e{} / {}.5;\n", i, random.next(100), random.next(1000),
+                                   random.next(10), 1 + random.next(9)));
+            break;
+        default:
+            out.append(std::format("        if (limit >= {} && limit != '{}') {{\n"
+                                   "            return base + {};\n"
+                                   "        }}\n",
+                                   random.next(100), char('a' + random.next(26)), random.next(1000)));
+            break;
+        }
+    }
+
+    out.append("        return total;\n    }\n\n");
+}
+
+std::string repeat_to(std::string_view header, std::string_view fragment, u64 size)
+{
+    std::string out;
+    out.reserve(size + fragment.size());
+    out.append(header);
+    for (u32 copy = 0; out.size() < size; copy++)
+    {
+        for (std::string_view rest = fragment; !rest.empty();)
+        {
+            u64 marker = std::min(rest.find('#'), rest.size());
+            out.append(rest.substr(0, marker));
+            if (marker < rest.size())
+            {
+                out.append(std::to_string(copy));
+                marker++;
+            }
+
+            rest.remove_prefix(marker);
+        }
+    }
+
+    return out;
+}
+
+// Every other character spelled as a Unicode escape, which is allowed
+// anywhere in a source file, line terminators aside
+std::string escape_every_other(std::string_view text)
+{
+    std::string out;
+    for (u64 i = 0; i < text.size(); i++)
+    {
+        char c = text[i];
+        if (c != '\n' && c != '\\' && c != '#' && i % 2)
+        {
+            out.append(std::format("\\u{:04x}", u32(c)));
+        }
+        else
+        {
+            out.push_back(c);
+        }
+    }
+
+    return out;
+}
+} // namespace
+
+std::string bench_ascii_corpus(u64 size)
+{
+    return repeat_to(ascii_header, ascii_fragment, size);
+}
+
+std::string bench_comment_corpus(u64 size)
+{
+    return repeat_to({}, comment_fragment, size);
+}
+
+std::string bench_mixed_corpus(u64 size)
+{
+    return repeat_to(mixed_header, mixed_fragment, size);
+}
+
+std::string bench_unicode_identifier_corpus(u64 size)
+{
+    return repeat_to(unicode_identifier_header, unicode_identifier_fragment, size);
+}
+
+std::string bench_escape_corpus(u64 size)
+{
+    return repeat_to(escape_every_other(ascii_header), escape_every_other(ascii_fragment), size);
+}
+
+std::string bench_long_line_corpus(u64 size)
+{
+    constexpr u64 LINE_SIZE = 1024 * 1024;
+
+    std::string out;
+    out.reserve(size + LINE_SIZE);
+    for (u32 copy = 0; out.size() < size; copy++)
+    {
+        out.append(std::format("class Long{} {{ long f(long a, long b) {{ return a", copy));
+        for (u64 start = out.size(); out.size() - start < LINE_SIZE;)
+        {
+            out.append(" + b * 0x1F - (a ^ 42L)");
+        }
+
+        out.append("; } }\n");
+    }
+
+    return out;
+}
+
+std::string bench_generated_corpus(u64 size, u64 seed)
+{
+    CorpusRandom random{seed * 0x9E3779B97F4A7C15 + 1};
+    std::string out;
+    out.reserve(size + 4096);
+
+    out.append(std::format("package org.example.gen{};\n\nimport java.util.List;\n\n", random.next(100)));
+    for (u32 type = 0; out.size() < size; type++)
+    {
+        // Named after the seed too, so that units with different seeds
+        // never declare the same class
+        out.append(std::format("public class Generated{}_{} {{\n", seed, type));
+
+        u32 fields = 1 + random.next(6);
+        for (u32 i = 0; i < fields; i++)
+        {
+            out.append(std::format("    private {} {}{};\n", random.pick(generated_types), random.pick(generated_words),
+                                   i));
+        }
+
+        out.append("    private long total;\n\n");
+
+        u32 methods = 1 + random.next(8);
+        for (u32 i = 0; i < methods && out.size() < size; i++)
+        {
+            append_generated_method(out, random, i);
+        }
+
+        out.append("}\n\n");
+    }
+
+    return out;
+}
+
+std::string bench_project_unit(u32 index, u32 units, u64 size)
+{
+    CorpusRandom random{index * 0x9E3779B97F4A7C15 + 1};
+    std::string out;
+    out.reserve(size + 4096);
+
+    out.append("package org.example.project;\n\nimport java.util.List;\n\n");
+    if (index)
+    {
+        out.append(std::format("public class Unit{} extends Unit{} {{\n", index, random.next(index)));
+    }
+    else
+    {
+        out.append("public class Unit0 {\n");
+    }
+
+    // Fields of earlier units' types, and every so often of the next few
+    // units' too, so that they form small cycles
+    u32 fields = random.next(4);
+    for (u32 i = 0; i < fields && index; i++)
+    {
+        out.append(std::format("    private Unit{} unit{};\n", random.next(index), i));
+    }
+
+    if (index % 16 == 0)
+    {
+        for (u32 next = index + 1; next < std::min(index + 5, units); next++)
+        {
+            out.append(std::format("    private Unit{} next{};\n", next, next));
+        }
+    }
+    else if (index % 16 <= 4)
+    {
+        out.append(std::format("    private Unit{} first;\n", index - index % 16));
+    }
+
+    out.append("    private long total;\n\n");
+    for (u32 i = 0; out.size() < size; i++)
+    {
+        append_generated_method(out, random, i);
+    }
+
+    out.append("}\n");
+    return out;
+}
@@ -0,0 +1,84 @@
+#include "bench.h"
+
+#ifdef _WIN32
+
+void run_daemon_benchmarks()
+{
+    println("daemon benchmarks need Unix sockets, skipped");
+}
+
+#else
+
+#include <csignal>
+#include <filesystem>
+#include <fstream>
+#include <spawn.h>
+#include <sys/wait.h>
+#include <thread>
+#include <vector>
+
+extern char **environ;
+
+namespace
+{
+constexpr u64 SOURCE_SIZE = 64 * 1024;
+constexpr u32 REPS = 20;
+
+// Runs the compiler as a separate process and waits for it, the way a
+// build tool would
+int spawn_ujavac(std::vector<const char *> args)
+{
+    args.insert(args.begin(), UJAVAC_EXE);
+    args.push_back(nullptr);
+
+    pid_t pid;
+    if (posix_spawn(&pid, UJAVAC_EXE, nullptr, nullptr, const_cast<char **>(args.data()), environ))
+    {
+        return -1;
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+} // namespace
+
+void run_daemon_benchmarks()
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "ujavac_daemon_bench";
+    std::filesystem::create_directories(dir);
+    std::string source = (dir / "Bench.java").string();
+    std::string socket = (dir / "daemon.sock").string();
+    std::ofstream{source} << bench_ascii_corpus(SOURCE_SIZE);
+
+    double cold = bench_best_seconds(REPS, [&] { spawn_ujavac({source.c_str()}); });
+    bench_report_latency("daemon/cold-process", cold);
+
+    pid_t daemon;
+    const char *daemon_args[] = {UJAVAC_EXE, "--daemon", socket.c_str(), "--idle-timeout", "60", nullptr};
+    if (posix_spawn(&daemon, UJAVAC_EXE, nullptr, nullptr, const_cast<char **>(daemon_args), environ))
+    {
+        println("can't start {}, skipped", UJAVAC_EXE);
+        return;
+    }
+
+    // Wait for the daemon to start listening
+    char *request[] = {source.data()};
+    int exit_code;
+    for (u32 i = 0; i < 500 && !daemon_request(socket.c_str(), 1, request, exit_code); i++)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    double client = bench_best_seconds(REPS, [&] { spawn_ujavac({"--connect", socket.c_str(), source.c_str()}); });
+    bench_report_latency("daemon/warm-client-process", client);
+
+    double warm = bench_best_seconds(REPS, [&] { daemon_request(socket.c_str(), 1, request, exit_code); });
+    bench_report_latency("daemon/warm-request", warm);
+
+    kill(daemon, SIGTERM);
+    waitpid(daemon, nullptr, 0);
+    std::filesystem::remove_all(dir);
+}
+
+#endif
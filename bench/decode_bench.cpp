@@ -0,0 +1,86 @@
+#include "bench.h"
+
+#include <span>
+
+namespace
+{
+constexpr u64 CORPUS_SIZE = 16 * 1024 * 1024;
+constexpr u32 REPS = 5;
+
+std::span<const u8> as_bytes(const std::string &s)
+{
+    return {reinterpret_cast<const u8 *>(s.data()), s.size()};
+}
+
+// Scans the whole buffer with the active ascii_run kernel,
+// stepping over each byte that terminates a run.
+u64 scan_all(std::span<const u8> bytes)
+{
+    u64 runs = 0;
+    for (u64 pos = 0; pos < bytes.size(); pos++)
+    {
+        pos += simd_kernels().ascii_run(bytes.data() + pos, bytes.size() - pos);
+        runs++;
+    }
+
+    return runs;
+}
+
+void bench_lex(std::string_view corpus_name, const std::string &corpus)
+{
+    CompilerOptions options;
+    auto bytes = as_bytes(corpus);
+
+    options.ascii_fast_path = false;
+    double slow = bench_best_seconds(REPS, [&] {
+        Compiler compiler{"<bench>", "", options};
+        compiler.lex(bytes);
+    });
+    bench_report_throughput(std::format("lex/{}/decoder", corpus_name), bytes.size(), slow);
+
+    options.ascii_fast_path = true;
+    for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2})
+    {
+        if (!set_simd_level(level))
+        {
+            continue;
+        }
+
+        double fast = bench_best_seconds(REPS, [&] {
+            Compiler compiler{"<bench>", "", options};
+            compiler.lex(bytes);
+        });
+        bench_report_throughput(std::format("lex/{}/fast-path-{}", corpus_name, simd_level_name(level)),
+                                bytes.size(), fast);
+    }
+}
+} // namespace
+
+void run_decode_benchmarks()
+{
+    auto ascii = bench_ascii_corpus(CORPUS_SIZE);
+    auto mixed = bench_mixed_corpus(CORPUS_SIZE);
+    SimdLevel detected = simd_kernels().level;
+
+    for (auto level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2})
+    {
+        if (!set_simd_level(level))
+        {
+            continue;
+        }
+
+        for (auto [name, corpus] : {std::pair{"ascii", &ascii}, std::pair{"mixed", &mixed}})
+        {
+            volatile u64 sink = 0;
+            double seconds = bench_best_seconds(REPS, [&] { sink = scan_all(as_bytes(*corpus)); });
+            bench_report_throughput(std::format("ascii_run/{}/{}", name, simd_level_name(level)), corpus->size(),
+                                    seconds);
+        }
+    }
+
+    bench_lex("ascii", ascii);
+    bench_lex("mixed", mixed);
+    bench_lex("comments", bench_comment_corpus(CORPUS_SIZE));
+
+    set_simd_level(detected);
+}
@@ -0,0 +1,227 @@
+#include "bench.h"
+
+#include <filesystem>
+#include <fstream>
+#include <tbb/info.h>
+#include <vector>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+constexpr u32 FILE_COUNT = 2000;
+constexpr u64 FILE_SIZE = 8 * 1024;
+constexpr u32 PROJECT_FILE_COUNT = 10000;
+constexpr u64 PROJECT_FILE_SIZE = 2 * 1024;
+constexpr u32 REPS = 3;
+
+// Drops the files from the page cache, as far as an unprivileged
+// process can, so that the next run has to go to the disk for them
+bool evict_from_page_cache(const std::vector<std::string> &paths)
+{
+#ifdef _WIN32
+    return false;
+#else
+    for (const std::string &path : paths)
+    {
+        int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0)
+        {
+            return false;
+        }
+
+        fdatasync(fd);
+        int error = posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED);
+        close(fd);
+        if (error)
+        {
+            return false;
+        }
+    }
+
+    return true;
+#endif
+}
+
+// Units whose classes depend on each other's, so that most of them have
+// to wait for others before they're analyzed
+void bench_dependencies(const std::filesystem::path &dir)
+{
+    std::filesystem::path project = dir / "project";
+    std::filesystem::create_directories(project);
+
+    std::vector<std::string> paths;
+    u64 bytes = 0;
+    for (u32 i = 0; i < PROJECT_FILE_COUNT; i++)
+    {
+        std::string source = bench_project_unit(i, PROJECT_FILE_COUNT, PROJECT_FILE_SIZE);
+        paths.push_back((project / std::format("Unit{}.java", i)).string());
+        std::ofstream{paths.back(), std::ios::binary} << source;
+        bytes += source.size();
+    }
+
+    std::vector<const char *> inputs;
+    for (const std::string &path : paths)
+    {
+        inputs.push_back(path.c_str());
+    }
+
+    CompilerOptions options;
+    options.memory_output = true;
+    CompilerManager::DependencyStats stats{};
+
+    double seconds = bench_best_seconds(REPS, [&] {
+        CompilerManager manager{inputs, options};
+        manager.run();
+        stats = manager.dependency_stats();
+    });
+
+    std::string name = std::format("driver/{}-dependent-files", PROJECT_FILE_COUNT);
+    bench_report_throughput(name, bytes, seconds);
+    bench_report_latency(name + "/critical-path", stats.critical_path_seconds);
+    bench_report_speedup(name + "/parallelism",
+                         stats.critical_path_seconds > 0 ? stats.work_seconds / stats.critical_path_seconds : 1.0);
+}
+} // namespace
+
+// CompilerManager::run() over thousands of files, from one thread up
+// to every core, to show how the driver scales
+void run_driver_benchmarks()
+{
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "ujavac_driver_bench";
+    std::filesystem::create_directories(dir);
+
+    std::vector<std::string> paths;
+    u64 bytes = 0;
+    for (u32 i = 0; i < FILE_COUNT; i++)
+    {
+        std::string source = bench_generated_corpus(FILE_SIZE, i);
+        paths.push_back((dir / std::format("Generated{}.java", i)).string());
+        std::ofstream{paths.back(), std::ios::binary} << source;
+        bytes += source.size();
+    }
+
+    std::vector<const char *> inputs;
+    for (const std::string &path : paths)
+    {
+        inputs.push_back(path.c_str());
+    }
+
+    u32 max_threads = u32(tbb::info::default_concurrency());
+    double single = 0;
+
+    for (u32 threads = 1;; threads = std::min(2 * threads, max_threads))
+    {
+        CompilerOptions options;
+        options.threads = threads;
+
+        double seconds = bench_best_seconds(REPS, [&] {
+            CompilerManager manager{inputs, options};
+            manager.run();
+        });
+
+        if (threads == 1)
+        {
+            single = seconds;
+        }
+
+        std::string name = std::format("driver/{}-files/{}-threads", FILE_COUNT, threads);
+        bench_report_throughput(name, bytes, seconds);
+        bench_report_speedup(name, single / seconds);
+
+        if (threads == max_threads)
+        {
+            break;
+        }
+    }
+
+    // The same without writing any class files, to tell the driver's
+    // own cost from the file system's
+    {
+        CompilerOptions options;
+        options.memory_output = true;
+
+        double seconds = bench_best_seconds(REPS, [&] {
+            CompilerManager manager{inputs, options};
+            manager.run();
+        });
+        bench_report_throughput(std::format("driver/{}-files/memory-output", FILE_COUNT), bytes, seconds);
+    }
+
+    // The same files found by walking their directory, as they're
+    // compiled, rather than named one by one
+    {
+        CompilerOptions options;
+        options.memory_output = true;
+        options.source_paths = {dir.string()};
+        SourceDiscovery::Stats stats{};
+
+        double seconds = bench_best_seconds(REPS, [&] {
+            CompilerManager manager{{}, options};
+            manager.run();
+            stats = manager.discovery_stats();
+        });
+
+        std::string name = std::format("driver/{}-files/source-path", FILE_COUNT);
+        bench_report_throughput(name, bytes, seconds);
+        bench_report_latency(name + "/discovery", stats.seconds);
+    }
+
+    // Every class file streamed into one jar, instead of a file each
+    for (bool deflate : {false, true})
+    {
+        std::string jar = (dir / "bench.jar").string();
+        CompilerOptions options;
+        options.output_jar = jar.c_str();
+        options.jar_deflate = deflate;
+
+        double seconds = bench_best_seconds(REPS, [&] {
+            CompilerManager manager{inputs, options};
+            manager.run();
+        });
+        bench_report_throughput(
+            std::format("driver/{}-files/output-jar-{}", FILE_COUNT, deflate ? "deflated" : "stored"), bytes,
+            seconds);
+    }
+
+    // Reading ahead with and without a cold page cache, where it
+    // matters most
+    for (u32 depth : {0u, CompilerOptions{}.prefetch_depth})
+    {
+        CompilerOptions options;
+        options.prefetch_depth = depth;
+
+        double warm = bench_best_seconds(REPS, [&] {
+            CompilerManager manager{inputs, options};
+            manager.run();
+        });
+        bench_report_throughput(std::format("driver/{}-files/prefetch-{}/warm", FILE_COUNT, depth), bytes, warm);
+
+        double cold = 0;
+        for (u32 i = 0; i < REPS; i++)
+        {
+            if (!evict_from_page_cache(paths))
+            {
+                cold = 0;
+                break;
+            }
+
+            double seconds = bench_best_seconds(1, [&] {
+                CompilerManager manager{inputs, options};
+                manager.run();
+            });
+            cold = i ? std::min(cold, seconds) : seconds;
+        }
+
+        if (cold > 0)
+        {
+            bench_report_throughput(std::format("driver/{}-files/prefetch-{}/cold", FILE_COUNT, depth), bytes, cold);
+        }
+    }
+
+    bench_dependencies(dir);
+    std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,190 @@
+#include "bench.h"
+
+#include <filesystem>
+#include <fstream>
+#include <span>
+#include <tbb/info.h>
+#include <vector>
+
+namespace
+{
+constexpr u64 CORPUS_SIZE = 4 * 1024 * 1024;
+constexpr u64 GENERATED_SIZE = 10 * 1024 * 1024;
+constexpr u32 REPS = 3;
+
+struct Corpus
+{
+    const char *name;
+    std::string text;
+};
+
+void bench_lex(const Corpus &corpus)
+{
+    // Always on one thread, for comparison with the chunked lexer
+    CompilerOptions options;
+    options.chunked_lex_threshold = 0;
+    std::span<const u8> bytes{reinterpret_cast<const u8 *>(corpus.text.data()), corpus.text.size()};
+    u32 tokens = 0;
+    u64 memory = 0;
+
+    double seconds = bench_best_seconds(REPS, [&] {
+        Compiler compiler{"<bench>", "", options};
+        compiler.lex(bytes);
+        tokens = compiler.tokens().size();
+        memory = compiler.tokens().memory_usage();
+    });
+
+    bench_report_throughput(std::format("frontend/lex/{}", corpus.name), bytes.size(), seconds);
+    bench_report_rate(std::format("frontend/lex/{}/tokens", corpus.name), tokens, seconds);
+    bench_report_memory(std::format("frontend/lex/{}/token-memory", corpus.name), memory);
+}
+
+// Tokens pulled one at a time, looking two ahead as the parser does at
+// most, against the whole buffer lexed up front above
+void bench_lex_stream(const Corpus &corpus)
+{
+    CompilerOptions options;
+    std::span<const u8> bytes{reinterpret_cast<const u8 *>(corpus.text.data()), corpus.text.size()};
+    u32 tokens = 0;
+    u64 memory = 0;
+    bool ok = true;
+
+    double seconds = bench_best_seconds(REPS, [&] {
+        DiagnosticBuffer diagnostics;
+        TokenStream stream{bytes, diagnostics, options};
+        tokens = 0;
+        while (stream.peek() != TokenKind::EndOfFile)
+        {
+            stream.peek(2);
+            stream.advance();
+            tokens++;
+        }
+
+        ok &= stream.ok();
+        memory = std::max(memory, stream.memory_usage());
+    });
+
+    if (!ok)
+    {
+        println(stderr, "frontend/lex-stream/{}: corpus doesn't lex", corpus.name);
+    }
+
+    bench_report_throughput(std::format("frontend/lex-stream/{}", corpus.name), bytes.size(), seconds);
+    bench_report_rate(std::format("frontend/lex-stream/{}/tokens", corpus.name), tokens, seconds);
+    bench_report_memory(std::format("frontend/lex-stream/{}/token-memory", corpus.name), memory);
+}
+
+// The same input split into chunks lexed in parallel, as done for huge
+// inputs; on one core this shows the overhead of splitting and merging
+void bench_lex_chunked(const Corpus &corpus)
+{
+    CompilerOptions options;
+    std::span<const u8> bytes{reinterpret_cast<const u8 *>(corpus.text.data()), corpus.text.size()};
+    u64 chunk_size = std::max(u64(bytes.size()) / (4 * tbb::info::default_concurrency()), u64(256 * 1024));
+
+    double seconds = bench_best_seconds(REPS, [&] {
+        TokenBuffer tokens;
+        DiagnosticBuffer diagnostics;
+        lex_chunked(bytes, tokens, diagnostics, options, nullptr, chunk_size);
+    });
+
+    bench_report_throughput(std::format("frontend/lex-chunked/{}", corpus.name), bytes.size(), seconds);
+}
+
+// Tokens are lexed once up front, so only building the tree is timed
+void bench_parse(const Corpus &corpus)
+{
+    CompilerOptions options;
+    options.chunked_lex_threshold = 0;
+    std::span<const u8> bytes{reinterpret_cast<const u8 *>(corpus.text.data()), corpus.text.size()};
+    Compiler compiler{"<bench>", "", options};
+    compiler.lex(bytes);
+
+    u32 nodes = 0;
+    u64 memory = 0;
+    bool ok = true;
+    double seconds = bench_best_seconds(REPS, [&] {
+        Arena arena;
+        Ast ast{arena};
+        DiagnosticBuffer diagnostics;
+        Parser parser{compiler.tokens(), ast, diagnostics};
+        ok &= parser.run();
+        nodes = ast.size();
+        memory = ast.memory_usage();
+    });
+
+    if (!ok)
+    {
+        println(stderr, "frontend/parse/{}: corpus doesn't parse", corpus.name);
+    }
+
+    bench_report_throughput(std::format("frontend/parse/{}", corpus.name), bytes.size(), seconds);
+    bench_report_rate(std::format("frontend/parse/{}/nodes", corpus.name), nodes, seconds);
+    bench_report_bytes_per_item(std::format("frontend/parse/{}/bytes-per-node", corpus.name), memory, nodes);
+}
+
+// Whole compilations from a file on disk, then each phase on its own
+void bench_compile(const Corpus &corpus, const std::filesystem::path &dir)
+{
+    CompilerOptions options;
+    std::string input = (dir / std::format("{}.java", corpus.name)).string();
+    std::string output = (dir / std::format("{}.class", corpus.name)).string();
+    std::ofstream{input, std::ios::binary} << corpus.text;
+
+    double seconds = bench_best_seconds(REPS, [&] {
+        Compiler compiler{input.c_str(), output.c_str(), options};
+        compiler.compile();
+    });
+    bench_report_throughput(std::format("frontend/compile/{}", corpus.name), corpus.text.size(), seconds);
+
+    double phase_seconds[COMPILE_PHASE_COUNT];
+    for (u32 rep = 0; rep < REPS; rep++)
+    {
+        Compiler compiler{input.c_str(), output.c_str(), options};
+        for (u32 phase = 0; phase < COMPILE_PHASE_COUNT; phase++)
+        {
+            double elapsed = bench_best_seconds(1, [&] { compiler.run_phase(CompilePhase(phase)); });
+            phase_seconds[phase] = rep ? std::min(phase_seconds[phase], elapsed) : elapsed;
+        }
+
+        compiler.finish();
+    }
+
+    for (u32 phase = 0; phase < COMPILE_PHASE_COUNT; phase++)
+    {
+        bench_report_throughput(std::format("frontend/{}/{}", compile_phase_name(CompilePhase(phase)), corpus.name),
+                                corpus.text.size(), phase_seconds[phase]);
+    }
+}
+} // namespace
+
+void run_frontend_benchmarks()
+{
+    const Corpus corpora[] = {
+        {"ascii", bench_ascii_corpus(CORPUS_SIZE)},
+        {"comments", bench_comment_corpus(CORPUS_SIZE)},
+        {"mixed", bench_mixed_corpus(CORPUS_SIZE)},
+        {"unicode-identifiers", bench_unicode_identifier_corpus(CORPUS_SIZE)},
+        {"escapes", bench_escape_corpus(CORPUS_SIZE)},
+        {"long-lines", bench_long_line_corpus(CORPUS_SIZE)},
+        {"generated-10mb", bench_generated_corpus(GENERATED_SIZE, 1)},
+    };
+
+    for (const Corpus &corpus : corpora)
+    {
+        bench_lex(corpus);
+        bench_lex_chunked(corpus);
+        bench_lex_stream(corpus);
+        bench_parse(corpus);
+    }
+
+    std::filesystem::path dir = std::filesystem::temp_directory_path() / "ujavac_frontend_bench";
+    std::filesystem::create_directories(dir);
+
+    for (const Corpus &corpus : corpora)
+    {
+        bench_compile(corpus, dir);
+    }
+
+    std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,90 @@
+#include "bench.h"
+
+#include <vector>
+
+namespace
+{
+constexpr u64 CORPUS_SIZE = 4 * 1024 * 1024;
+constexpr u32 REPS = 5;
+
+// Splits the corpus into IdentifierChars-shaped words
+std::vector<std::string_view> identifier_words(const std::string &corpus)
+{
+    auto is_word_char = [](char c) {
+        return c >= 'A' && c <= 'Z' || c >= 'a' && c <= 'z' || c >= '0' && c <= '9' || c == '$' || c == '_';
+    };
+
+    std::vector<std::string_view> words;
+    for (u64 pos = 0; pos < corpus.size();)
+    {
+        if (!is_word_char(corpus[pos]))
+        {
+            pos++;
+            continue;
+        }
+
+        u64 start = pos;
+        while (pos < corpus.size() && is_word_char(corpus[pos]))
+        {
+            pos++;
+        }
+
+        words.emplace_back(corpus.data() + start, pos - start);
+    }
+
+    return words;
+}
+
+// What token disambiguation looked like before: one string
+// comparison per keyword until something matches
+TokenKind lookup_keyword_naive(std::string_view chars)
+{
+    for (auto &keyword : keywords())
+    {
+        if (keyword.text == chars)
+        {
+            return keyword.kind;
+        }
+    }
+
+    return TokenKind::Identifier;
+}
+
+template <class F> void bench_lookup(std::string_view name, const std::vector<std::string_view> &words, F &&lookup)
+{
+    volatile u32 sink = 0;
+    double seconds = bench_best_seconds(REPS, [&] {
+        u32 keyword_count = 0;
+        for (auto word : words)
+        {
+            keyword_count += lookup(word) != TokenKind::Identifier;
+        }
+
+        sink = keyword_count;
+    });
+
+    bench_report_rate(name, words.size(), seconds);
+}
+} // namespace
+
+void run_keyword_benchmarks()
+{
+    auto corpus = bench_ascii_corpus(CORPUS_SIZE);
+    auto words = identifier_words(corpus);
+
+    std::vector<std::string_view> keyword_words;
+    for (auto &keyword : keywords())
+    {
+        keyword_words.push_back(keyword.text);
+    }
+
+    while (keyword_words.size() < words.size())
+    {
+        keyword_words.push_back(keyword_words[keyword_words.size() % keywords().size()]);
+    }
+
+    bench_lookup("keyword/corpus/naive", words, lookup_keyword_naive);
+    bench_lookup("keyword/corpus/perfect-hash", words, lookup_keyword);
+    bench_lookup("keyword/keywords-only/naive", keyword_words, lookup_keyword_naive);
+    bench_lookup("keyword/keywords-only/perfect-hash", keyword_words, lookup_keyword);
+}
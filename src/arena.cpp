@@ -0,0 +1,118 @@
+#include "ujavac.h"
+
+namespace
+{
+constexpr u64 ARENA_PAGE_SIZE = 64 * 1024;
+// Pages kept per thread once released; anything beyond that, e.g.
+// after an unusually large unit, goes back to the heap
+constexpr u64 ARENA_POOL_MAX_PAGES = 256;
+
+struct PagePool
+{
+    std::vector<u8 *> pages;
+
+    ~PagePool()
+    {
+        for (u8 *page : pages)
+        {
+            delete[] page;
+        }
+    }
+};
+
+tbb::enumerable_thread_specific<PagePool> g_page_pools;
+
+u8 *acquire_page()
+{
+    std::vector<u8 *> &pages = g_page_pools.local().pages;
+    if (pages.empty())
+    {
+        return new u8[ARENA_PAGE_SIZE];
+    }
+
+    u8 *page = pages.back();
+    pages.pop_back();
+    return page;
+}
+
+void release_page(u8 *page, u64 size)
+{
+    // Oversized pages are never pooled
+    std::vector<u8 *> &pages = g_page_pools.local().pages;
+    if (size != ARENA_PAGE_SIZE || pages.size() >= ARENA_POOL_MAX_PAGES)
+    {
+        delete[] page;
+        return;
+    }
+
+    pages.push_back(page);
+}
+} // namespace
+
+Arena::~Arena()
+{
+    release();
+}
+
+void *Arena::allocate_slow(u64 size, u64 align)
+{
+    // Move on to the next page; pages left over from a rewind are
+    // used again if the allocation fits
+    if (m_page < m_pages.size())
+    {
+        m_page++;
+    }
+
+    m_offset = 0;
+
+    if (m_page == m_pages.size() || align_offset(m_pages[m_page], 0, align) + size > m_pages[m_page].size)
+    {
+        u64 page_size = ARENA_PAGE_SIZE;
+        u8 *data;
+
+        if (size + align > ARENA_PAGE_SIZE)
+        {
+            page_size = size + align;
+            data = new u8[page_size];
+        }
+        else
+        {
+            data = acquire_page();
+        }
+
+        m_pages.insert(m_pages.begin() + m_page, {data, page_size});
+    }
+
+    return allocate(size, align);
+}
+
+void Arena::rewind(Mark mark)
+{
+    m_page = mark.page;
+    m_offset = mark.offset;
+    m_live_bytes = mark.live_bytes;
+}
+
+void Arena::release()
+{
+    for (const Page &page : m_pages)
+    {
+        release_page(page.data, page.size);
+    }
+
+    m_pages.clear();
+    m_page = 0;
+    m_offset = 0;
+    m_live_bytes = 0;
+}
+
+u64 Arena::reserved_bytes() const
+{
+    u64 bytes = 0;
+    for (const Page &page : m_pages)
+    {
+        bytes += page.size;
+    }
+
+    return bytes;
+}
@@ -0,0 +1,198 @@
+#include "ujavac.h"
+
+#include <bit>
+#include <filesystem>
+#include <format>
+#include <random>
+
+namespace fs = std::filesystem;
+
+namespace
+{
+constexpr u64 XXH_PRIME64_1 = 0x9E3779B185EBCA87;
+constexpr u64 XXH_PRIME64_2 = 0xC2B2AE3D27D4EB4F;
+constexpr u64 XXH_PRIME64_3 = 0x165667B19E3779F9;
+constexpr u64 XXH_PRIME64_4 = 0x85EBCA77C2B2AE63;
+constexpr u64 XXH_PRIME64_5 = 0x27D4EB2F165667C5;
+
+// XXH64 reads its input as little-endian words; compilers turn these
+// into single loads on little-endian targets
+u64 read_u64(const u8 *p)
+{
+    u64 v = 0;
+    for (u32 i = 0; i < 8; i++)
+    {
+        v |= u64(p[i]) << (8 * i);
+    }
+
+    return v;
+}
+
+u32 read_u32(const u8 *p)
+{
+    return u32(p[0]) | u32(p[1]) << 8 | u32(p[2]) << 16 | u32(p[3]) << 24;
+}
+
+u64 xxh64_round(u64 acc, u64 input)
+{
+    acc += input * XXH_PRIME64_2;
+    acc = std::rotl(acc, 31);
+    return acc * XXH_PRIME64_1;
+}
+
+u64 xxh64_merge_round(u64 acc, u64 val)
+{
+    acc ^= xxh64_round(0, val);
+    return acc * XXH_PRIME64_1 + XXH_PRIME64_4;
+}
+} // namespace
+
+u64 xxh64(const void *data, u64 size, u64 seed)
+{
+    const u8 *p = static_cast<const u8 *>(data);
+    const u8 *end = p + size;
+    u64 h;
+
+    if (size >= 32)
+    {
+        u64 v1 = seed + XXH_PRIME64_1 + XXH_PRIME64_2;
+        u64 v2 = seed + XXH_PRIME64_2;
+        u64 v3 = seed;
+        u64 v4 = seed - XXH_PRIME64_1;
+
+        for (; end - p >= 32; p += 32)
+        {
+            v1 = xxh64_round(v1, read_u64(p));
+            v2 = xxh64_round(v2, read_u64(p + 8));
+            v3 = xxh64_round(v3, read_u64(p + 16));
+            v4 = xxh64_round(v4, read_u64(p + 24));
+        }
+
+        h = std::rotl(v1, 1) + std::rotl(v2, 7) + std::rotl(v3, 12) + std::rotl(v4, 18);
+        h = xxh64_merge_round(h, v1);
+        h = xxh64_merge_round(h, v2);
+        h = xxh64_merge_round(h, v3);
+        h = xxh64_merge_round(h, v4);
+    }
+    else
+    {
+        h = seed + XXH_PRIME64_5;
+    }
+
+    h += size;
+
+    for (; end - p >= 8; p += 8)
+    {
+        h ^= xxh64_round(0, read_u64(p));
+        h = std::rotl(h, 27) * XXH_PRIME64_1 + XXH_PRIME64_4;
+    }
+
+    if (end - p >= 4)
+    {
+        h ^= u64(read_u32(p)) * XXH_PRIME64_1;
+        h = std::rotl(h, 23) * XXH_PRIME64_2 + XXH_PRIME64_3;
+        p += 4;
+    }
+
+    for (; p < end; p++)
+    {
+        h ^= *p * XXH_PRIME64_5;
+        h = std::rotl(h, 11) * XXH_PRIME64_1;
+    }
+
+    h ^= h >> 33;
+    h *= XXH_PRIME64_2;
+    h ^= h >> 29;
+    h *= XXH_PRIME64_3;
+    h ^= h >> 32;
+    return h;
+}
+
+bool BuildCache::open(const char *dir)
+{
+    std::error_code ec;
+    fs::create_directories(dir, ec);
+    if (ec)
+    {
+        return false;
+    }
+
+    m_dir = dir;
+
+    // A new compiler version may change any output. No option affects
+    // the outputs yet; any that does has to be part of the fingerprint.
+    std::string fingerprint = std::format("ujavac {}", UJAVAC_VERSION);
+    m_seed = xxh64(fingerprint.data(), fingerprint.size());
+    return true;
+}
+
+u64 BuildCache::key(std::span<const u8> source, std::string_view file_name) const
+{
+    return xxh64(source.data(), source.size(), xxh64(file_name.data(), file_name.size(), m_seed));
+}
+
+std::string BuildCache::entry_path(u64 key) const
+{
+    return std::format("{}/{:016x}", m_dir, key);
+}
+
+bool BuildCache::restore(u64 key, const char *path)
+{
+    fs::path entry = entry_path(key);
+    std::error_code ec;
+
+    if (!fs::is_regular_file(entry, ec))
+    {
+        m_misses++;
+        return false;
+    }
+
+    // Outputs are always replaced as a whole, never written in place,
+    // so sharing the cached file with a hardlink is safe
+    fs::remove(path, ec);
+    fs::create_hard_link(entry, path, ec);
+    if (ec && !fs::copy_file(entry, path, fs::copy_options::overwrite_existing, ec))
+    {
+        m_misses++;
+        return false;
+    }
+
+    m_hits++;
+    return true;
+}
+
+void BuildCache::store(u64 key, const char *path)
+{
+    fs::path entry = entry_path(key);
+    std::error_code ec;
+
+    if (fs::exists(entry, ec))
+    {
+        return;
+    }
+
+    // Entries are filled in under a private name and then renamed into
+    // place, so concurrent builds never see one half written
+    static const u64 process_tag = std::random_device{}();
+    static std::atomic<u64> temp_counter;
+    fs::path temp = std::format("{}.tmp{:x}.{}", entry.string(), process_tag, temp_counter++);
+
+    fs::create_hard_link(path, temp, ec);
+    if (ec)
+    {
+        fs::copy_file(path, temp, ec);
+    }
+
+    if (!ec)
+    {
+        fs::rename(temp, entry, ec);
+    }
+
+    if (ec)
+    {
+        fs::remove(temp, ec);
+        return;
+    }
+
+    m_stores++;
+}
@@ -0,0 +1,377 @@
+#include "ujavac.h"
+
+#include <cstring>
+
+namespace
+{
+// JVMS 4.4
+constexpr u8 CONSTANT_UTF8 = 1;
+constexpr u8 CONSTANT_INTEGER = 3;
+constexpr u8 CONSTANT_CLASS = 7;
+constexpr u8 CONSTANT_STRING = 8;
+constexpr u8 CONSTANT_FIELD_REF = 9;
+constexpr u8 CONSTANT_METHOD_REF = 10;
+constexpr u8 CONSTANT_NAME_AND_TYPE = 12;
+
+constexpr u32 CONSTANT_POOL_MAX_COUNT = 0xFFFF;
+constexpr u32 CONSTANT_UTF8_MAX_LENGTH = 0xFFFF;
+constexpr u32 CONSTANT_POOL_INITIAL_TABLE_SIZE = 64;
+
+// JVMS 4.4.7: NUL takes two bytes, and code points above the BMP are
+// encoded as their two surrogates, three bytes each. Anything that
+// isn't a four-byte sequence is copied as is.
+void append_modified_utf8(std::vector<u8> &out, std::string_view text)
+{
+    for (u64 i = 0; i < text.size(); i++)
+    {
+        u8 c = u8(text[i]);
+        if (c == 0)
+        {
+            out.push_back(0xC0);
+            out.push_back(0x80);
+        }
+        else if ((c & 0xF8) == 0xF0 && text.size() - i >= 4)
+        {
+            u32 cp = (c & 0x07) << 18 | (u8(text[i + 1]) & 0x3F) << 12 | (u8(text[i + 2]) & 0x3F) << 6 |
+                     (u8(text[i + 3]) & 0x3F);
+            u32 high = 0xD800 + ((cp - 0x10000) >> 10);
+            u32 low = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+
+            for (u32 unit : {high, low})
+            {
+                out.push_back(u8(0xE0 | unit >> 12));
+                out.push_back(u8(0x80 | (unit >> 6 & 0x3F)));
+                out.push_back(u8(0x80 | (unit & 0x3F)));
+            }
+
+            i += 3;
+        }
+        else
+        {
+            out.push_back(c);
+        }
+    }
+}
+} // namespace
+
+ConstantPool::ConstantPool()
+{
+    // Index zero isn't used
+    m_entry_offsets.push_back(0);
+    m_table.resize(CONSTANT_POOL_INITIAL_TABLE_SIZE);
+}
+
+u16 ConstantPool::add(const u8 *entry, u32 size)
+{
+    u32 mask = u32(m_table.size()) - 1;
+    u32 slot = u32(xxh64(entry, size)) & mask;
+
+    for (;; slot = (slot + 1) & mask)
+    {
+        u16 index = m_table[slot];
+        if (!index)
+        {
+            break;
+        }
+
+        u32 begin = m_entry_offsets[index];
+        u32 end = index + 1u < m_entry_offsets.size() ? m_entry_offsets[index + 1] : u32(m_bytes.size());
+        if (end - begin == size && !std::memcmp(m_bytes.data() + begin, entry, size))
+        {
+            return index;
+        }
+    }
+
+    if (m_entry_offsets.size() == CONSTANT_POOL_MAX_COUNT)
+    {
+        m_full = true;
+        return 0;
+    }
+
+    u16 index = u16(m_entry_offsets.size());
+    m_entry_offsets.push_back(u32(m_bytes.size()));
+    m_bytes.insert(m_bytes.end(), entry, entry + size);
+    m_table[slot] = index;
+
+    // Kept at most half full, so that probes stay short
+    if (2 * m_entry_offsets.size() > m_table.size())
+    {
+        std::vector<u16> table(2 * m_table.size());
+        mask = u32(table.size()) - 1;
+
+        for (u32 i = 1; i < m_entry_offsets.size(); i++)
+        {
+            u32 begin = m_entry_offsets[i];
+            u32 end = i + 1 < m_entry_offsets.size() ? m_entry_offsets[i + 1] : u32(m_bytes.size());
+            u32 s = u32(xxh64(m_bytes.data() + begin, end - begin)) & mask;
+            while (table[s])
+            {
+                s = (s + 1) & mask;
+            }
+
+            table[s] = u16(i);
+        }
+
+        m_table = std::move(table);
+    }
+
+    return index;
+}
+
+u16 ConstantPool::add_pair(u8 tag, u16 first, u16 second)
+{
+    if (!first || !second)
+    {
+        return 0;
+    }
+
+    u8 entry[] = {tag, u8(first >> 8), u8(first), u8(second >> 8), u8(second)};
+    return add(entry, sizeof(entry));
+}
+
+u16 ConstantPool::utf8(std::string_view text)
+{
+    std::vector<u8> entry{CONSTANT_UTF8, 0, 0};
+    append_modified_utf8(entry, text);
+
+    u64 length = entry.size() - 3;
+    if (length > CONSTANT_UTF8_MAX_LENGTH)
+    {
+        return 0;
+    }
+
+    entry[1] = u8(length >> 8);
+    entry[2] = u8(length);
+    return add(entry.data(), u32(entry.size()));
+}
+
+u16 ConstantPool::integer(s32 value)
+{
+    u32 bits = u32(value);
+    u8 entry[] = {CONSTANT_INTEGER, u8(bits >> 24), u8(bits >> 16), u8(bits >> 8), u8(bits)};
+    return add(entry, sizeof(entry));
+}
+
+u16 ConstantPool::class_ref(std::string_view name)
+{
+    u16 name_index = utf8(name);
+    if (!name_index)
+    {
+        return 0;
+    }
+
+    u8 entry[] = {CONSTANT_CLASS, u8(name_index >> 8), u8(name_index)};
+    return add(entry, sizeof(entry));
+}
+
+u16 ConstantPool::string(std::string_view text)
+{
+    u16 text_index = utf8(text);
+    if (!text_index)
+    {
+        return 0;
+    }
+
+    u8 entry[] = {CONSTANT_STRING, u8(text_index >> 8), u8(text_index)};
+    return add(entry, sizeof(entry));
+}
+
+u16 ConstantPool::name_and_type(std::string_view name, std::string_view descriptor)
+{
+    return add_pair(CONSTANT_NAME_AND_TYPE, utf8(name), utf8(descriptor));
+}
+
+u16 ConstantPool::field_ref(std::string_view owner, std::string_view name, std::string_view descriptor)
+{
+    return add_pair(CONSTANT_FIELD_REF, class_ref(owner), name_and_type(name, descriptor));
+}
+
+u16 ConstantPool::method_ref(std::string_view owner, std::string_view name, std::string_view descriptor)
+{
+    return add_pair(CONSTANT_METHOD_REF, class_ref(owner), name_and_type(name, descriptor));
+}
+
+namespace
+{
+// Bounds-checked big-endian reads; once a read runs past the end, every
+// later one returns zero and ok() stays false
+class ClassFileReader
+{
+  public:
+    explicit ClassFileReader(std::span<const u8> data) : m_data(data)
+    {
+    }
+
+    u8 u1()
+    {
+        return fits(1) ? m_data[m_pos++] : 0;
+    }
+
+    u16 u2()
+    {
+        if (!fits(2))
+        {
+            return 0;
+        }
+
+        u16 value = u16(m_data[m_pos] << 8 | m_data[m_pos + 1]);
+        m_pos += 2;
+        return value;
+    }
+
+    u32 u4()
+    {
+        u32 high = u2();
+        return high << 16 | u2();
+    }
+
+    void skip(u64 size)
+    {
+        if (fits(size))
+        {
+            m_pos += size;
+        }
+    }
+
+    u64 pos() const
+    {
+        return m_pos;
+    }
+
+    bool ok() const
+    {
+        return m_ok;
+    }
+
+  private:
+    bool fits(u64 size)
+    {
+        m_ok &= m_data.size() - m_pos >= size;
+        return m_ok;
+    }
+
+    std::span<const u8> m_data;
+    u64 m_pos = 0;
+    bool m_ok = true;
+};
+
+// JVMS 4.4, the tags not built by ConstantPool
+constexpr u8 CONSTANT_FLOAT = 4;
+constexpr u8 CONSTANT_LONG = 5;
+constexpr u8 CONSTANT_DOUBLE = 6;
+constexpr u8 CONSTANT_INTERFACE_METHOD_REF = 11;
+constexpr u8 CONSTANT_METHOD_HANDLE = 15;
+constexpr u8 CONSTANT_METHOD_TYPE = 16;
+constexpr u8 CONSTANT_DYNAMIC = 17;
+constexpr u8 CONSTANT_INVOKE_DYNAMIC = 18;
+constexpr u8 CONSTANT_MODULE = 19;
+constexpr u8 CONSTANT_PACKAGE = 20;
+
+bool read_members(ClassFileReader &in, std::span<const std::string_view> texts, bool is_method,
+                  std::vector<ClassFileMember> &members)
+{
+    u16 count = in.u2();
+    for (u32 i = 0; i < count && in.ok(); i++)
+    {
+        u16 access_flags = in.u2();
+        u16 name = in.u2();
+        u16 descriptor = in.u2();
+        if (name >= texts.size() || descriptor >= texts.size() || texts[name].data() == nullptr ||
+            texts[descriptor].data() == nullptr)
+        {
+            return false;
+        }
+
+        members.push_back({texts[name], texts[descriptor], access_flags, is_method});
+
+        u16 attributes = in.u2();
+        for (u32 j = 0; j < attributes && in.ok(); j++)
+        {
+            in.u2();
+            in.skip(in.u4());
+        }
+    }
+
+    return in.ok();
+}
+} // namespace
+
+bool read_class_file(std::span<const u8> data, ClassFileSummary &summary)
+{
+    ClassFileReader in{data};
+    if (in.u4() != 0xCAFEBABE)
+    {
+        return false;
+    }
+
+    in.u2();
+    in.u2();
+
+    // Text of each Utf8 entry and the name index of each Class entry,
+    // by pool index
+    u16 count = in.u2();
+    std::vector<std::string_view> texts(count);
+    std::vector<u16> class_names(count);
+
+    for (u32 i = 1; i < count && in.ok(); i++)
+    {
+        switch (in.u1())
+        {
+        case CONSTANT_UTF8: {
+            u16 size = in.u2();
+            u64 pos = in.pos();
+            in.skip(size);
+            texts[i] = {reinterpret_cast<const char *>(data.data() + pos), size};
+            break;
+        }
+        case CONSTANT_CLASS:
+            class_names[i] = in.u2();
+            break;
+        case CONSTANT_STRING:
+        case CONSTANT_METHOD_TYPE:
+        case CONSTANT_MODULE:
+        case CONSTANT_PACKAGE:
+            in.skip(2);
+            break;
+        case CONSTANT_METHOD_HANDLE:
+            in.skip(3);
+            break;
+        case CONSTANT_INTEGER:
+        case CONSTANT_FLOAT:
+        case CONSTANT_FIELD_REF:
+        case CONSTANT_METHOD_REF:
+        case CONSTANT_INTERFACE_METHOD_REF:
+        case CONSTANT_NAME_AND_TYPE:
+        case CONSTANT_DYNAMIC:
+        case CONSTANT_INVOKE_DYNAMIC:
+            in.skip(4);
+            break;
+        case CONSTANT_LONG:
+        case CONSTANT_DOUBLE:
+            // These take up two indexes
+            in.skip(8);
+            i++;
+            break;
+        default:
+            return false;
+        }
+    }
+
+    auto class_name = [&](u16 index) -> std::string_view {
+        return index < count && class_names[index] < count ? texts[class_names[index]] : std::string_view{};
+    };
+
+    summary.access_flags = in.u2();
+    summary.name = class_name(in.u2());
+    u16 super_class = in.u2();
+    summary.super_class = super_class ? class_name(super_class) : std::string_view{};
+    if (summary.name.data() == nullptr || (super_class && summary.super_class.data() == nullptr))
+    {
+        return false;
+    }
+
+    in.skip(2 * u64(in.u2()));
+
+    summary.members.clear();
+    return read_members(in, texts, false, summary.members) && read_members(in, texts, true, summary.members);
+}
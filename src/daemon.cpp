@@ -0,0 +1,394 @@
+#include "ujavac.h"
+
+#ifdef _WIN32
+
+int daemon_serve(const char *, u32, DaemonHandler)
+{
+    println(stderr, "error: --daemon is not supported on this platform");
+    return 1;
+}
+
+bool daemon_request(const char *, int, char **, int &)
+{
+    return false;
+}
+
+#else
+
+#include <cerrno>
+#include <climits>
+#include <csignal>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+namespace
+{
+// A request is its length, then the working directory and each
+// argument, all NUL-terminated. The client's stdin, stdout and stderr
+// travel along with the length, so that the compiler writes to them
+// directly. The reply is the exit code, a single byte.
+constexpr u32 DAEMON_MAX_REQUEST = 1024 * 1024;
+constexpr u32 DAEMON_STREAMS = 3;
+
+volatile std::sig_atomic_t g_stop_signal = 0;
+
+void on_stop_signal(int signal)
+{
+    g_stop_signal = signal;
+}
+
+bool make_address(const char *path, sockaddr_un &address)
+{
+    if (std::strlen(path) >= sizeof(address.sun_path))
+    {
+        println(stderr, "error: socket path too long: {}", path);
+        return false;
+    }
+
+    address = {};
+    address.sun_family = AF_UNIX;
+    std::strcpy(address.sun_path, path);
+    return true;
+}
+
+int connect_to(const sockaddr_un &address)
+{
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+    {
+        return -1;
+    }
+
+    if (connect(fd, reinterpret_cast<const sockaddr *>(&address), sizeof(address)) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+bool read_all(int fd, void *data, u64 size)
+{
+    u8 *p = static_cast<u8 *>(data);
+    while (size)
+    {
+        ssize_t n = read(fd, p, size);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+bool write_all(int fd, const void *data, u64 size)
+{
+    const u8 *p = static_cast<const u8 *>(data);
+    while (size)
+    {
+        ssize_t n = send(fd, p, size, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+
+        if (n <= 0)
+        {
+            return false;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+// Receives the request length together with the client's streams
+bool receive_header(int fd, u32 &size, int (&streams)[DAEMON_STREAMS])
+{
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(streams))] = {};
+    iovec iov{&size, sizeof(size)};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t n;
+    do
+    {
+        n = recvmsg(fd, &message, MSG_CMSG_CLOEXEC);
+    } while (n < 0 && errno == EINTR);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+    {
+        return false;
+    }
+
+    u32 count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+    std::memcpy(streams, CMSG_DATA(cmsg), std::min(count, DAEMON_STREAMS) * sizeof(int));
+
+    if (n != sizeof(size) || count != DAEMON_STREAMS || (message.msg_flags & MSG_CTRUNC))
+    {
+        for (u32 i = 0; i < std::min(count, DAEMON_STREAMS); i++)
+        {
+            close(streams[i]);
+        }
+
+        return false;
+    }
+
+    return true;
+}
+
+bool send_header(int fd, u32 size)
+{
+    int streams[DAEMON_STREAMS] = {STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO};
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(streams))] = {};
+    iovec iov{&size, sizeof(size)};
+    msghdr message{};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(streams));
+    std::memcpy(CMSG_DATA(cmsg), streams, sizeof(streams));
+
+    ssize_t n;
+    do
+    {
+        n = sendmsg(fd, &message, MSG_NOSIGNAL);
+    } while (n < 0 && errno == EINTR);
+
+    return n == sizeof(size);
+}
+
+// Runs one request with the client's streams and working directory
+// standing in for the daemon's own, and returns its exit code
+u8 serve_request(int fd, DaemonHandler handler)
+{
+    u32 size;
+    int streams[DAEMON_STREAMS];
+    if (!receive_header(fd, size, streams))
+    {
+        return 1;
+    }
+
+    std::vector<char> request;
+    std::vector<char *> argv;
+    bool valid = size && size <= DAEMON_MAX_REQUEST;
+    if (valid)
+    {
+        request.resize(size);
+        valid = read_all(fd, request.data(), size) && request.back() == '\0';
+    }
+
+    if (valid)
+    {
+        for (u32 i = 0; i < size; i += std::strlen(&request[i]) + 1)
+        {
+            argv.push_back(&request[i]);
+        }
+
+        // The first string is the working directory, which takes the
+        // place of the program name
+        valid = argv.size() >= 1 && argv[0][0] == '/';
+    }
+
+    int saved[DAEMON_STREAMS];
+    char saved_cwd[PATH_MAX];
+    u8 exit_code = 1;
+
+    if (valid && getcwd(saved_cwd, sizeof(saved_cwd)))
+    {
+        std::fflush(stdout);
+        std::fflush(stderr);
+
+        for (u32 i = 0; i < DAEMON_STREAMS; i++)
+        {
+            saved[i] = dup(i);
+            dup2(streams[i], i);
+        }
+
+        if (chdir(argv[0]) == 0)
+        {
+            argv.push_back(nullptr);
+            exit_code = u8(handler(int(argv.size() - 1), argv.data()));
+        }
+        else
+        {
+            println(stderr, "error: can't change to directory {}: {}", argv[0], std::strerror(errno));
+        }
+
+        std::fflush(stdout);
+        std::fflush(stderr);
+
+        for (u32 i = 0; i < DAEMON_STREAMS; i++)
+        {
+            dup2(saved[i], i);
+            close(saved[i]);
+        }
+
+        if (chdir(saved_cwd) != 0)
+        {
+            println(stderr, "warning: can't change back to directory {}", saved_cwd);
+        }
+    }
+
+    for (int stream : streams)
+    {
+        close(stream);
+    }
+
+    return exit_code;
+}
+} // namespace
+
+int daemon_serve(const char *socket_path, u32 idle_seconds, DaemonHandler handler)
+{
+    sockaddr_un address;
+    if (!make_address(socket_path, address))
+    {
+        return 1;
+    }
+
+    // A socket file left behind by a daemon that didn't shut down
+    // cleanly is replaced; a live one is left alone
+    int existing = connect_to(address);
+    if (existing >= 0)
+    {
+        close(existing);
+        println(stderr, "error: a daemon is already listening on {}", socket_path);
+        return 1;
+    }
+
+    unlink(socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+    {
+        println(stderr, "error: can't create socket: {}", std::strerror(errno));
+        return 1;
+    }
+
+    // Only the user who started the daemon may send it requests
+    mode_t old_umask = umask(0177);
+    int bound = bind(listener, reinterpret_cast<const sockaddr *>(&address), sizeof(address));
+    umask(old_umask);
+
+    if (bound < 0 || listen(listener, SOMAXCONN) < 0)
+    {
+        println(stderr, "error: can't listen on {}: {}", socket_path, std::strerror(errno));
+        close(listener);
+        return 1;
+    }
+
+    struct sigaction action{};
+    action.sa_handler = on_stop_signal;
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    // Requests run one at a time, since each one takes over the
+    // process's streams and working directory. A compilation is
+    // parallel on its own, so they wouldn't gain much from overlapping.
+    while (!g_stop_signal)
+    {
+        pollfd ready{listener, POLLIN, 0};
+        int n = poll(&ready, 1, idle_seconds ? int(std::min(idle_seconds, u32(INT_MAX / 1000)) * 1000) : -1);
+        if (n == 0)
+        {
+            break;
+        }
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+
+            break;
+        }
+
+        int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+        if (client < 0)
+        {
+            continue;
+        }
+
+        u8 exit_code = serve_request(client, handler);
+        write_all(client, &exit_code, 1);
+        close(client);
+    }
+
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
+
+bool daemon_request(const char *socket_path, int argc, char **argv, int &exit_code)
+{
+    sockaddr_un address;
+    if (!make_address(socket_path, address))
+    {
+        return false;
+    }
+
+    int fd = connect_to(address);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd)))
+    {
+        close(fd);
+        return false;
+    }
+
+    std::string request{cwd, std::strlen(cwd) + 1};
+    for (int i = 0; i < argc; i++)
+    {
+        request.append(argv[i], std::strlen(argv[i]) + 1);
+    }
+
+    std::fflush(stdout);
+    std::fflush(stderr);
+
+    u8 reply;
+    if (request.size() > DAEMON_MAX_REQUEST || !send_header(fd, u32(request.size())) ||
+        !write_all(fd, request.data(), request.size()) || !read_all(fd, &reply, 1))
+    {
+        // The daemon may have started on the request, so it can't
+        // just be run again here
+        println(stderr, "error: daemon on {} failed to complete the request", socket_path);
+        reply = 1;
+    }
+
+    close(fd);
+    exit_code = reply;
+    return true;
+}
+
+#endif
@@ -0,0 +1,301 @@
+#include "ujavac.h"
+
+#include <algorithm>
+#include <format>
+
+namespace
+{
+struct DiagnosticInfo
+{
+    DiagnosticCode code;
+    Severity severity;
+    const char *name;
+    // Formatted with the diagnostic's argument, which may go unused
+    const char *message;
+};
+
+constexpr DiagnosticInfo diagnostic_infos[] = {
+    {DiagnosticCode::ReadError, Severity::Error, "read-error", "error reading input file"},
+    {DiagnosticCode::WriteError, Severity::Error, "write-error", "error writing output file"},
+    {DiagnosticCode::TooManyConstants, Severity::Error, "too-many-constants", "too many constants"},
+    {DiagnosticCode::ConstantTooLong, Severity::Error, "constant-too-long", "constant string too long"},
+    {DiagnosticCode::InputTooLarge, Severity::Error, "input-too-large", "input file too large"},
+    {DiagnosticCode::InvalidUtf8, Severity::Error, "invalid-utf8", "invalid UTF-8 byte: {:#x}"},
+    {DiagnosticCode::IllegalUnicodeEscapeChar, Severity::Error, "illegal-unicode-escape-char",
+     "unexpected character in Unicode escape: {}"},
+    {DiagnosticCode::ExpectedBmpUnicodeEscape, Severity::Error, "expected-bmp-unicode-escape",
+     "expected BMP Unicode escape"},
+    {DiagnosticCode::InvalidUnicodeEscape, Severity::Error, "invalid-unicode-escape",
+     "invalid Unicode escape sequence"},
+    {DiagnosticCode::UnterminatedUnicodeEscape, Severity::Error, "unterminated-unicode-escape",
+     "unexpected end of Unicode escape sequence"},
+    {DiagnosticCode::IllegalCharacter, Severity::Error, "illegal-character", "illegal character: '\\u{:04x}'"},
+    {DiagnosticCode::UnexpectedConst, Severity::Error, "unexpected-const", "unexpected const"},
+    {DiagnosticCode::UnexpectedGoto, Severity::Error, "unexpected-goto", "unexpected goto"},
+    {DiagnosticCode::IllegalUnderscore, Severity::Error, "illegal-underscore", "illegal underscore"},
+    {DiagnosticCode::MalformedHexLiteral, Severity::Error, "malformed-hex-literal",
+     "hexadecimal numbers must contain at least one hexadecimal digit"},
+    {DiagnosticCode::MalformedBinaryLiteral, Severity::Error, "malformed-binary-literal",
+     "binary numbers must contain at least one binary digit"},
+    {DiagnosticCode::MalformedIntegerLiteral, Severity::Error, "malformed-integer-literal",
+     "malformed integer literal"},
+    {DiagnosticCode::IllegalOctalDigit, Severity::Error, "illegal-octal-digit", "illegal digit in an octal literal"},
+    {DiagnosticCode::MalformedFloatLiteral, Severity::Error, "malformed-float-literal",
+     "malformed floating-point literal"},
+    {DiagnosticCode::IllegalEscape, Severity::Error, "illegal-escape", "illegal escape character"},
+    {DiagnosticCode::EmptyCharLiteral, Severity::Error, "empty-char-literal", "empty character literal"},
+    {DiagnosticCode::UnclosedCharLiteral, Severity::Error, "unclosed-char-literal", "unclosed character literal"},
+    {DiagnosticCode::UnclosedStringLiteral, Severity::Error, "unclosed-string-literal", "unclosed string literal"},
+    {DiagnosticCode::UnclosedComment, Severity::Error, "unclosed-comment", "unclosed comment"},
+    {DiagnosticCode::UnclosedTextBlock, Severity::Error, "unclosed-text-block", "unclosed text block"},
+    {DiagnosticCode::IllegalTextBlockOpen, Severity::Error, "illegal-text-block-open",
+     "illegal text block open delimiter sequence, missing line terminator"},
+    {DiagnosticCode::InconsistentTextBlockIndentation, Severity::Warning, "inconsistent-text-block-indentation",
+     "inconsistent white space indentation"},
+    {DiagnosticCode::ExpectedToken, Severity::Error, "expected-token", "{} expected"},
+    {DiagnosticCode::IllegalStartOfExpression, Severity::Error, "illegal-start-of-expression",
+     "illegal start of expression"},
+    {DiagnosticCode::IllegalStartOfType, Severity::Error, "illegal-start-of-type", "illegal start of type"},
+    {DiagnosticCode::ExpectedTypeDeclaration, Severity::Error, "expected-type-declaration",
+     "class, interface, enum, or record expected"},
+    {DiagnosticCode::NotAStatement, Severity::Error, "not-a-statement", "not a statement"},
+    {DiagnosticCode::ElseWithoutIf, Severity::Error, "else-without-if", "'else' without 'if'"},
+    {DiagnosticCode::TryWithoutCatch, Severity::Error, "try-without-catch",
+     "'try' without 'catch', 'finally' or resource declarations"},
+    {DiagnosticCode::RepeatedModifier, Severity::Error, "repeated-modifier", "repeated modifier"},
+    {DiagnosticCode::NestingTooDeep, Severity::Error, "nesting-too-deep", "code nested too deeply"},
+    {DiagnosticCode::DuplicateClass, Severity::Error, "duplicate-class", "duplicate class: {}"},
+};
+
+static_assert(std::size(diagnostic_infos) == u32(DiagnosticCode::DuplicateClass) + 1);
+
+constexpr bool diagnostic_infos_in_order()
+{
+    for (u32 i = 0; i < std::size(diagnostic_infos); i++)
+    {
+        if (u32(diagnostic_infos[i].code) != i)
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+static_assert(diagnostic_infos_in_order());
+} // namespace
+
+void append_json_string(std::string &out, std::string_view text)
+{
+    out.push_back('"');
+
+    for (char c : text)
+    {
+        switch (c)
+        {
+        case '"':
+            out.append("\\\"");
+            break;
+        case '\\':
+            out.append("\\\\");
+            break;
+        case '\n':
+            out.append("\\n");
+            break;
+        case '\r':
+            out.append("\\r");
+            break;
+        case '\t':
+            out.append("\\t");
+            break;
+        default:
+            if (u8(c) < 0x20)
+            {
+                out.append(std::format("\\u{:04x}", u32(u8(c))));
+            }
+            else
+            {
+                out.push_back(c);
+            }
+        }
+    }
+
+    out.push_back('"');
+}
+
+Severity diagnostic_severity(DiagnosticCode code)
+{
+    return diagnostic_infos[u32(code)].severity;
+}
+
+const char *diagnostic_name(DiagnosticCode code)
+{
+    return diagnostic_infos[u32(code)].name;
+}
+
+void format_diagnostic(std::string &out, const char *file, const Diagnostic &diagnostic, DiagnosticFormat format)
+{
+    const DiagnosticInfo &info = diagnostic_infos[u32(diagnostic.code)];
+    const char *severity = diagnostic.severity == Severity::Error ? "error" : "warning";
+    std::string message;
+    if (diagnostic.code == DiagnosticCode::ExpectedToken)
+    {
+        // The argument is a token kind, quoted unless it's a description
+        std::string_view text = token_kind_text(TokenKind(diagnostic.arg));
+        std::string quoted = text.starts_with('<') ? std::string(text) : std::format("'{}'", text);
+        message = std::vformat(info.message, std::make_format_args(quoted));
+    }
+    else if (diagnostic.code == DiagnosticCode::DuplicateClass)
+    {
+        // The argument is the binary name in internal form, shown as
+        // it's written in the source
+        std::string name{global_interner().text(Symbol(diagnostic.arg))};
+        std::replace(name.begin(), name.end(), '/', '.');
+        std::replace(name.begin(), name.end(), '$', '.');
+        message = std::vformat(info.message, std::make_format_args(name));
+    }
+    else
+    {
+        message = std::vformat(info.message, std::make_format_args(diagnostic.arg));
+    }
+
+    if (format == DiagnosticFormat::Json)
+    {
+        out.append("{\"file\":");
+        append_json_string(out, file);
+
+        if (diagnostic.offset != Diagnostic::NO_OFFSET)
+        {
+            out.append(std::format(",\"offset\":{},\"line\":{},\"col\":{}", diagnostic.offset, diagnostic.line,
+                                   diagnostic.col));
+        }
+
+        out.append(std::format(",\"severity\":\"{}\",\"code\":\"{}\",\"message\":", severity, info.name));
+        append_json_string(out, message);
+        out.append("}\n");
+    }
+    else if (diagnostic.offset != Diagnostic::NO_OFFSET)
+    {
+        out.append(std::format("{}:{}:{}: {}: {}\n", file, diagnostic.line, diagnostic.col, severity, message));
+    }
+    else
+    {
+        out.append(std::format("{}: {}: {}\n", file, severity, message));
+    }
+}
+
+void DiagnosticBuffer::report(DiagnosticCode code, u32 offset, u32 arg)
+{
+    Severity severity = diagnostic_severity(code);
+    records.push_back({offset, 0, 0, severity, code, arg});
+
+    if (severity == Severity::Error)
+    {
+        errors++;
+    }
+    else
+    {
+        warnings++;
+    }
+}
+
+void DiagnosticBuffer::append(const DiagnosticBuffer &other)
+{
+    records.insert(records.end(), other.records.begin(), other.records.end());
+    errors += other.errors;
+    warnings += other.warnings;
+}
+
+void DiagnosticBuffer::resolve_positions(const TokenBuffer &tokens, std::span<const u8> src)
+{
+    for (Diagnostic &diagnostic : records)
+    {
+        if (diagnostic.offset != Diagnostic::NO_OFFSET)
+        {
+            SourcePosition pos = tokens.position(diagnostic.offset, src);
+            diagnostic.line = pos.line;
+            diagnostic.col = pos.col;
+        }
+    }
+}
+
+DiagnosticEngine::DiagnosticEngine(const InputList &inputs, const CompilerOptions &options)
+    : m_inputs(inputs), m_options(options)
+{
+    add_units(u32(inputs.size()));
+}
+
+void DiagnosticEngine::add_units(u32 count)
+{
+    m_units.grow_to_at_least(count);
+    m_submitted.grow_to_at_least(count);
+    m_unit_count.store(count, std::memory_order_release);
+}
+
+void DiagnosticEngine::submit(u32 unit, DiagnosticBuffer &&buffer)
+{
+    m_errors.fetch_add(buffer.errors, std::memory_order_relaxed);
+    m_warnings.fetch_add(buffer.warnings, std::memory_order_relaxed);
+    m_units[unit] = std::move(buffer);
+    m_submitted[unit].store(true);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+
+    // Whoever holds the lock writes out every unit that's ready, so
+    // there's no need to wait for it if it's taken
+    std::unique_lock lock{m_write_mutex, std::try_to_lock};
+    while (lock.owns_lock())
+    {
+        u32 next = m_next_unit.load(std::memory_order_relaxed);
+        u32 count = m_unit_count.load(std::memory_order_acquire);
+        for (; next < count && m_submitted[next].load(std::memory_order_acquire); next++)
+        {
+            write_unit(next);
+        }
+
+        m_next_unit.store(next, std::memory_order_relaxed);
+        lock.unlock();
+
+        // A unit submitted just before the unlock may have missed the
+        // lock and relied on this thread to write it. Anything that
+        // still slips through is written by flush().
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (next < count && m_submitted[next].load(std::memory_order_acquire))
+        {
+            lock.try_lock();
+        }
+    }
+}
+
+void DiagnosticEngine::flush()
+{
+    std::lock_guard lock{m_write_mutex};
+
+    u32 next = m_next_unit.load(std::memory_order_relaxed);
+    for (u32 count = m_unit_count.load(std::memory_order_acquire); next < count; next++)
+    {
+        if (m_submitted[next].load(std::memory_order_acquire))
+        {
+            write_unit(next);
+        }
+    }
+
+    m_next_unit.store(next, std::memory_order_relaxed);
+}
+
+void DiagnosticEngine::write_unit(u32 unit)
+{
+    DiagnosticBuffer &buffer = m_units[unit];
+    if (buffer.records.empty())
+    {
+        return;
+    }
+
+    std::string out;
+    for (const Diagnostic &diagnostic : buffer.records)
+    {
+        format_diagnostic(out, m_inputs[unit], diagnostic, m_options.diagnostic_format);
+    }
+
+    std::fwrite(out.data(), 1, out.size(), stderr);
+    buffer = {};
+}
@@ -0,0 +1,227 @@
+#include "ujavac.h"
+
+#include <filesystem>
+
+#include <tbb/task_arena.h>
+#include <tbb/tick_count.h>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// Room for hundreds of entries, so that most directories take a single
+// call to list
+constexpr u32 DIRECTORY_BUFFER_SIZE = 64 * 1024;
+
+bool is_java_source(std::string_view name)
+{
+    return name.size() > 5 && name.ends_with(".java");
+}
+
+#ifdef __linux__
+// Layout of struct linux_dirent64, which no user space header declares
+constexpr u32 DIRENT_RECLEN_OFFSET = 16;
+constexpr u32 DIRENT_TYPE_OFFSET = 18;
+constexpr u32 DIRENT_NAME_OFFSET = 19;
+
+bool list_directory(const std::string &path, std::vector<std::string> &files, std::vector<std::string> &directories)
+{
+    int fd = open(path.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    std::vector<char> buffer(DIRECTORY_BUFFER_SIZE);
+    bool ok = true;
+    for (;;)
+    {
+        long size = syscall(SYS_getdents64, fd, buffer.data(), buffer.size());
+        if (size <= 0)
+        {
+            ok = !size;
+            break;
+        }
+
+        for (long offset = 0; offset < size;)
+        {
+            const char *entry = buffer.data() + offset;
+            u16 length;
+            std::memcpy(&length, entry + DIRENT_RECLEN_OFFSET, sizeof(length));
+            offset += length;
+
+            u8 type = u8(entry[DIRENT_TYPE_OFFSET]);
+            std::string_view name{entry + DIRENT_NAME_OFFSET};
+            if (name == "." || name == "..")
+            {
+                continue;
+            }
+
+            // Some file systems leave the type out, and links need a look
+            // at what they point to
+            if (type == DT_UNKNOWN || (type == DT_LNK && is_java_source(name)))
+            {
+                struct stat info;
+                if (fstatat(fd, name.data(), &info, type == DT_LNK ? 0 : AT_SYMLINK_NOFOLLOW))
+                {
+                    continue;
+                }
+
+                if (S_ISREG(info.st_mode))
+                {
+                    type = DT_REG;
+                }
+                else
+                {
+                    type = S_ISDIR(info.st_mode) && type == DT_UNKNOWN ? DT_DIR : DT_UNKNOWN;
+                }
+            }
+
+            if (type == DT_DIR)
+            {
+                directories.emplace_back(name);
+            }
+            else if (type == DT_REG && is_java_source(name))
+            {
+                files.emplace_back(name);
+            }
+        }
+    }
+
+    close(fd);
+    return ok;
+}
+#else
+bool list_directory(const std::string &path, std::vector<std::string> &files, std::vector<std::string> &directories)
+{
+    std::error_code ec;
+    for (std::filesystem::directory_iterator it{path, ec}, end; !ec && it != end; it.increment(ec))
+    {
+        std::string name = it->path().filename().string();
+        if (it->is_directory(ec) && !it->is_symlink(ec))
+        {
+            directories.push_back(std::move(name));
+        }
+        else if (is_java_source(name) && it->is_regular_file(ec))
+        {
+            files.push_back(std::move(name));
+        }
+    }
+
+    return !ec;
+}
+#endif
+} // namespace
+
+SourceDiscovery::SourceDiscovery(std::vector<std::string> roots, u32 threads) : m_roots(std::move(roots))
+{
+    m_thread = std::thread([this, threads] {
+        tbb::tick_count start = tbb::tick_count::now();
+        tbb::task_arena arena{threads ? s32(threads) : tbb::task_arena::automatic};
+        arena.execute([this] {
+            tbb::task_group group;
+            for (const std::string &root : m_roots)
+            {
+                // Paths found under it are joined to the root with a
+                // separator of their own
+                std::string directory = root;
+                while (directory.size() > 1 && (directory.ends_with('/') || directory.ends_with('\\')))
+                {
+                    directory.pop_back();
+                }
+
+                u32 root_size = u32(directory.size()) + !directory.ends_with('/');
+                group.run([this, &group, directory = std::move(directory), root_size] {
+                    walk(directory, root_size, group);
+                });
+            }
+
+            group.wait();
+        });
+
+        std::lock_guard lock{m_mutex};
+        m_done = true;
+        m_seconds = (tbb::tick_count::now() - start).seconds();
+        m_found.notify_all();
+    });
+}
+
+SourceDiscovery::~SourceDiscovery()
+{
+    stop();
+}
+
+void SourceDiscovery::walk(const std::string &directory, u32 root_size, tbb::task_group &group)
+{
+    if (m_stopping)
+    {
+        return;
+    }
+
+    std::vector<std::string> files;
+    std::vector<std::string> directories;
+    if (!list_directory(directory, files, directories))
+    {
+        m_unreadable++;
+        return;
+    }
+
+    m_directories++;
+
+    // Subdirectories go first, so that other threads can start on them
+    // while this one hands out the files
+    std::string prefix = directory.ends_with('/') ? directory : directory + '/';
+    for (const std::string &name : directories)
+    {
+        group.run([this, &group, path = prefix + name, root_size] { walk(path, root_size, group); });
+    }
+
+    if (files.empty())
+    {
+        return;
+    }
+
+    // In name order, at least within a directory
+    std::sort(files.begin(), files.end());
+    std::lock_guard lock{m_mutex};
+    for (const std::string &name : files)
+    {
+        m_sources.push_back({prefix + name, root_size});
+    }
+
+    m_found.notify_all();
+}
+
+bool SourceDiscovery::next(Source &source)
+{
+    std::unique_lock lock{m_mutex};
+    m_found.wait(lock, [this] { return m_taken < m_sources.size() || m_done; });
+    if (m_taken == m_sources.size())
+    {
+        return false;
+    }
+
+    source = std::move(m_sources[m_taken++]);
+    return true;
+}
+
+void SourceDiscovery::stop()
+{
+    m_stopping = true;
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+SourceDiscovery::Stats SourceDiscovery::stats() const
+{
+    std::lock_guard lock{m_mutex};
+    return {u32(m_sources.size()), m_directories, m_unreadable, m_seconds};
+}
@@ -0,0 +1,176 @@
+#include "ujavac.h"
+
+#include <algorithm>
+
+namespace
+{
+constexpr u32 UNVISITED = ~u32(0);
+} // namespace
+
+DependencyGraph::DependencyGraph(std::span<const std::vector<u32>> dependencies)
+{
+    u32 count = u32(dependencies.size());
+    m_components.resize(count);
+    m_component_starts.push_back(0);
+
+    // Tarjan's algorithm, with a stack of its own so that a long chain
+    // of units can't overflow the thread's. A component is complete once
+    // the search is back at its first unit, by which time every
+    // component it depends on is complete too: numbering them in that
+    // order puts dependencies first.
+    std::vector<u32> index(count, UNVISITED);
+    std::vector<u32> low(count);
+    std::vector<bool> on_stack(count);
+    std::vector<u32> stack;
+    // Units being searched, with how many of their dependencies are done
+    std::vector<std::pair<u32, u32>> search;
+    u32 next_index = 0;
+
+    for (u32 root = 0; root < count; root++)
+    {
+        if (index[root] != UNVISITED)
+        {
+            continue;
+        }
+
+        index[root] = low[root] = next_index++;
+        stack.push_back(root);
+        on_stack[root] = true;
+        search.push_back({root, 0});
+
+        while (!search.empty())
+        {
+            auto &[unit, done] = search.back();
+            if (done < dependencies[unit].size())
+            {
+                u32 dependency = dependencies[unit][done++];
+                if (index[dependency] == UNVISITED)
+                {
+                    index[dependency] = low[dependency] = next_index++;
+                    stack.push_back(dependency);
+                    on_stack[dependency] = true;
+                    search.push_back({dependency, 0});
+                }
+                else if (on_stack[dependency])
+                {
+                    low[unit] = std::min(low[unit], index[dependency]);
+                }
+
+                continue;
+            }
+
+            u32 finished = unit;
+            search.pop_back();
+            if (!search.empty())
+            {
+                u32 parent = search.back().first;
+                low[parent] = std::min(low[parent], low[finished]);
+            }
+
+            if (low[finished] != index[finished])
+            {
+                continue;
+            }
+
+            u32 component = component_count();
+            u32 member;
+            do
+            {
+                member = stack.back();
+                stack.pop_back();
+                on_stack[member] = false;
+                m_components[member] = component;
+                m_units.push_back(member);
+            } while (member != finished);
+
+            m_component_starts.push_back(u32(m_units.size()));
+        }
+    }
+
+    // Edges between components, each once, and between units for the
+    // count
+    std::vector<u32> last_component(component_count(), UNVISITED);
+    std::vector<u32> last_unit(count, UNVISITED);
+    m_dependency_starts.push_back(0);
+
+    for (u32 component = 0; component < component_count(); component++)
+    {
+        for (u32 unit : units(component))
+        {
+            for (u32 dependency : dependencies[unit])
+            {
+                if (dependency != unit && last_unit[dependency] != unit)
+                {
+                    last_unit[dependency] = unit;
+                    m_edges++;
+                }
+
+                u32 target = m_components[dependency];
+                if (target != component && last_component[target] != component)
+                {
+                    last_component[target] = component;
+                    m_dependencies.push_back(target);
+                }
+            }
+        }
+
+        m_dependency_starts.push_back(u32(m_dependencies.size()));
+    }
+}
+
+double DependencyGraph::critical_path(std::span<const double> costs, std::vector<u32> &path) const
+{
+    path.clear();
+    if (!component_count())
+    {
+        return 0;
+    }
+
+    // Components come after their dependencies, so a single pass finds
+    // the most costly chain ending at each
+    std::vector<double> finish(component_count());
+    std::vector<u32> previous(component_count(), UNVISITED);
+    u32 last = 0;
+
+    for (u32 component = 0; component < component_count(); component++)
+    {
+        double start = 0;
+        for (u32 dependency : dependencies(component))
+        {
+            if (finish[dependency] > start)
+            {
+                start = finish[dependency];
+                previous[component] = dependency;
+            }
+        }
+
+        finish[component] = start + costs[component];
+        if (finish[component] > finish[last])
+        {
+            last = component;
+        }
+    }
+
+    for (u32 component = last; component != UNVISITED; component = previous[component])
+    {
+        path.push_back(component);
+    }
+
+    std::reverse(path.begin(), path.end());
+    return finish[last];
+}
+
+std::vector<double> DependencyGraph::bottom_levels(std::span<const double> costs) const
+{
+    // Backwards, every component that depends on one is done before it
+    std::vector<double> levels(costs.begin(), costs.end());
+    for (u32 component = component_count(); component-- > 0;)
+    {
+        for (u32 dependency : dependencies(component))
+        {
+            levels[dependency] = std::max(levels[dependency], costs[dependency] + levels[component]);
+        }
+    }
+
+    return levels;
+}
@@ -0,0 +1,215 @@
+#include "ujavac.h"
+
+#include <utility>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// Chunk size used by the read() fallback when the input size
+// is not known up front (pipes, character devices, etc).
+constexpr u64 READ_CHUNK_SIZE = 256 * 1024;
+} // namespace
+
+SourceBuffer::SourceBuffer(SourceBuffer &&other) noexcept
+{
+    *this = std::move(other);
+}
+
+SourceBuffer &SourceBuffer::operator=(SourceBuffer &&other) noexcept
+{
+    if (this != &other)
+    {
+        close();
+
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_strategy = other.m_strategy;
+        m_storage = std::move(other.m_storage);
+    }
+
+    return *this;
+}
+
+SourceBuffer::~SourceBuffer()
+{
+    close();
+}
+
+const char *SourceBuffer::strategy_name(InputStrategy strategy)
+{
+    switch (strategy)
+    {
+    case InputStrategy::MemoryMap:
+        return "mmap";
+    case InputStrategy::Read:
+        return "read";
+    case InputStrategy::IoUring:
+        return "io_uring";
+    }
+
+    return "unknown";
+}
+
+void SourceBuffer::close()
+{
+    if (m_strategy == InputStrategy::MemoryMap && m_data)
+    {
+#ifdef _WIN32
+        UnmapViewOfFile(m_data);
+#else
+        munmap(const_cast<u8 *>(m_data), m_size);
+#endif
+    }
+
+    m_data = nullptr;
+    m_size = 0;
+    m_strategy = InputStrategy::Read;
+    m_storage.clear();
+}
+
+void SourceBuffer::adopt(std::vector<u8> &&contents, InputStrategy strategy)
+{
+    close();
+
+    m_storage = std::move(contents);
+    m_data = m_storage.data();
+    m_size = m_storage.size();
+    m_strategy = strategy;
+}
+
+#ifdef _WIN32
+bool SourceBuffer::open(const char *path, bool map)
+{
+    close();
+
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                              FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return false;
+    }
+
+    LARGE_INTEGER size;
+    if (map && GetFileType(file) == FILE_TYPE_DISK && GetFileSizeEx(file, &size) && size.QuadPart > 0)
+    {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping)
+        {
+            void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping);
+
+            if (view)
+            {
+                CloseHandle(file);
+                m_data = static_cast<const u8 *>(view);
+                m_size = size.QuadPart;
+                m_strategy = InputStrategy::MemoryMap;
+                return true;
+            }
+        }
+    }
+
+    bool ok = true;
+    for (;;)
+    {
+        u64 used = m_storage.size();
+        m_storage.resize(used + READ_CHUNK_SIZE);
+
+        DWORD n = 0;
+        if (!ReadFile(file, m_storage.data() + used, DWORD(READ_CHUNK_SIZE), &n, nullptr))
+        {
+            ok = GetLastError() == ERROR_BROKEN_PIPE;
+            n = 0;
+        }
+
+        m_storage.resize(used + n);
+        if (!n)
+        {
+            break;
+        }
+    }
+
+    CloseHandle(file);
+    m_data = m_storage.data();
+    m_size = m_storage.size();
+    return ok;
+}
+#else
+bool SourceBuffer::open(const char *path, bool map)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        return false;
+    }
+
+    struct stat st;
+    bool is_regular = fstat(fd, &st) == 0 && S_ISREG(st.st_mode);
+
+    // Only regular, non-empty files can be mapped; everything
+    // else (pipes, devices, /proc entries) goes through read()
+    if (map && is_regular && st.st_size > 0)
+    {
+        void *view = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (view != MAP_FAILED)
+        {
+            madvise(view, st.st_size, MADV_SEQUENTIAL);
+            ::close(fd);
+
+            m_data = static_cast<const u8 *>(view);
+            m_size = st.st_size;
+            m_strategy = InputStrategy::MemoryMap;
+            return true;
+        }
+    }
+
+    if (is_regular)
+    {
+        // One extra byte so that EOF is observed without a reallocation
+        m_storage.reserve(st.st_size + 1);
+    }
+
+    bool ok = true;
+    for (;;)
+    {
+        u64 used = m_storage.size();
+        u64 chunk = m_storage.capacity() > used ? m_storage.capacity() - used : READ_CHUNK_SIZE;
+        m_storage.resize(used + chunk);
+
+        ssize_t n = ::read(fd, m_storage.data() + used, chunk);
+        if (n < 0 && errno == EINTR)
+        {
+            m_storage.resize(used);
+            continue;
+        }
+
+        if (n < 0)
+        {
+            ok = false;
+            n = 0;
+        }
+
+        m_storage.resize(used + n);
+        if (!n)
+        {
+            break;
+        }
+    }
+
+    ::close(fd);
+    m_data = m_storage.data();
+    m_size = m_storage.size();
+    return ok;
+}
+#endif
@@ -0,0 +1,99 @@
+#include "ujavac.h"
+
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+// Identifiers are short, so a chunk holds thousands of them. Longer
+// texts get a chunk of their own.
+constexpr u64 INTERNER_CHUNK_SIZE = 64 * 1024;
+} // namespace
+
+Interner::Interner()
+{
+    m_texts.push_back({});
+    m_table.insert({std::string_view{}, 0});
+}
+
+char *Interner::store(ThreadStorage &storage, std::string_view text)
+{
+    if (storage.chunks.empty() || storage.chunks.back().size - storage.used < text.size())
+    {
+        u64 size = std::max(INTERNER_CHUNK_SIZE, u64(text.size()));
+        storage.chunks.push_back({std::make_unique<char[]>(size), size});
+        storage.used = 0;
+        storage.bytes += size;
+    }
+
+    char *dst = storage.chunks.back().data.get() + storage.used;
+    std::memcpy(dst, text.data(), text.size());
+    storage.used += text.size();
+    return dst;
+}
+
+Symbol Interner::intern(std::string_view text)
+{
+    ThreadStorage &storage = m_storage.local();
+    storage.lookups++;
+
+    {
+        decltype(m_table)::const_accessor found;
+        if (m_table.find(found, text))
+        {
+            storage.hits++;
+            return found->second;
+        }
+    }
+
+    // The key has to point at storage that outlives the caller's
+    // buffer before it's inserted. Other threads that look it up
+    // meanwhile wait on the element until its symbol is assigned.
+    std::string_view stored{store(storage, text), text.size()};
+
+    decltype(m_table)::accessor slot;
+    if (!m_table.insert(slot, stored))
+    {
+        // Another thread inserted the same text first; the copy is
+        // still the last one in the chunk and can be taken back
+        storage.used -= text.size();
+        storage.hits++;
+        return slot->second;
+    }
+
+    slot->second = Symbol(m_texts.push_back(stored) - m_texts.begin());
+    return slot->second;
+}
+
+Symbol Interner::find(std::string_view text) const
+{
+    decltype(m_table)::const_accessor found;
+    return m_table.find(found, text) ? found->second : 0;
+}
+
+Interner::Stats Interner::stats() const
+{
+    Stats stats{};
+    // Not counting the empty string
+    stats.symbols = m_texts.size() - 1;
+
+    for (const ThreadStorage &storage : m_storage)
+    {
+        stats.lookups += storage.lookups;
+        stats.hits += storage.hits;
+        stats.storage_bytes += storage.bytes;
+    }
+
+    // Each element is a separately allocated node behind a bucket
+    // pointer; the exact layout is internal to TBB
+    stats.table_bytes = m_table.bucket_count() * sizeof(void *) +
+                        m_table.size() * (sizeof(decltype(m_table)::value_type) + 2 * sizeof(void *)) +
+                        m_texts.capacity() * sizeof(std::string_view);
+    return stats;
+}
+
+Interner &global_interner()
+{
+    static Interner interner;
+    return interner;
+}
@@ -0,0 +1,392 @@
+#include "ujavac.h"
+
+#include <array>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+
+#ifdef UJAVAC_ZLIB
+#include <zlib.h>
+#endif
+
+namespace
+{
+// PKWARE APPNOTE 4.3
+constexpr u32 ZIP_LOCAL_HEADER_SIGNATURE = 0x04034B50;
+constexpr u32 ZIP_CENTRAL_HEADER_SIGNATURE = 0x02014B50;
+constexpr u32 ZIP_END_SIGNATURE = 0x06054B50;
+constexpr u32 ZIP64_END_SIGNATURE = 0x06064B50;
+constexpr u32 ZIP64_LOCATOR_SIGNATURE = 0x07064B50;
+constexpr u16 ZIP64_EXTRA_TAG = 0x0001;
+
+constexpr u16 ZIP_VERSION = 20;
+constexpr u16 ZIP64_VERSION = 45;
+// Names are UTF-8
+constexpr u16 ZIP_FLAGS = 0x0800;
+constexpr u16 ZIP_STORED = 0;
+constexpr u16 ZIP_DEFLATED = 8;
+// Every entry has the earliest DOS date, 1980-01-01 00:00, so that
+// building again gives the same jar
+constexpr u16 ZIP_TIME = 0;
+constexpr u16 ZIP_DATE = 1 << 5 | 1;
+
+constexpr u16 ZIP_MAX_U16 = 0xFFFF;
+constexpr u32 ZIP_MAX_U32 = 0xFFFFFFFF;
+
+constexpr u64 JAR_WRITE_BUFFER_SIZE = 1024 * 1024;
+
+constexpr std::string_view JAR_MANIFEST_NAME = "META-INF/MANIFEST.MF";
+
+void put_u16(std::vector<u8> &out, u16 value)
+{
+    out.push_back(u8(value));
+    out.push_back(u8(value >> 8));
+}
+
+void put_u32(std::vector<u8> &out, u32 value)
+{
+    put_u16(out, u16(value));
+    put_u16(out, u16(value >> 16));
+}
+
+void put_u64(std::vector<u8> &out, u64 value)
+{
+    put_u32(out, u32(value));
+    put_u32(out, u32(value >> 32));
+}
+
+// Raw deflate, as zip entries hold it. False if it doesn't make the
+// contents any smaller, in which case they're better stored.
+bool deflate_contents(std::span<const u8> contents, std::vector<u8> &out)
+{
+#ifdef UJAVAC_ZLIB
+    z_stream stream{};
+    if (deflateInit2(&stream, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+    {
+        return false;
+    }
+
+    out.resize(deflateBound(&stream, uLong(contents.size())));
+    stream.next_in = const_cast<Bytef *>(contents.data());
+    stream.avail_in = uInt(contents.size());
+    stream.next_out = out.data();
+    stream.avail_out = uInt(out.size());
+
+    bool ok = deflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out < contents.size();
+    out.resize(stream.total_out);
+    deflateEnd(&stream);
+    return ok;
+#else
+    (void)contents;
+    (void)out;
+    return false;
+#endif
+}
+} // namespace
+
+u32 crc32(std::span<const u8> data, u32 crc)
+{
+#ifdef UJAVAC_ZLIB
+    return u32(::crc32(crc, data.data(), uInt(data.size())));
+#else
+    static constexpr auto table = [] {
+        std::array<u32, 256> table{};
+        for (u32 i = 0; i < 256; i++)
+        {
+            u32 c = i;
+            for (u32 bit = 0; bit < 8; bit++)
+            {
+                c = c & 1 ? 0xEDB88320 ^ (c >> 1) : c >> 1;
+            }
+
+            table[i] = c;
+        }
+
+        return table;
+    }();
+
+    crc = ~crc;
+    for (u8 byte : data)
+    {
+        crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+    }
+
+    return ~crc;
+#endif
+}
+
+bool jar_deflate_supported()
+{
+#ifdef UJAVAC_ZLIB
+    return true;
+#else
+    return false;
+#endif
+}
+
+JarWriter::~JarWriter()
+{
+    if (m_file)
+    {
+        finish(false);
+    }
+
+    for (Entry *entry = m_added.exchange(nullptr); entry;)
+    {
+        Entry *next = entry->next;
+        delete entry;
+        entry = next;
+    }
+}
+
+bool JarWriter::open(const char *path, u32 entry_count, bool deflate)
+{
+    static const u64 process_tag = std::random_device{}();
+    m_path = path;
+    m_temp_path = std::format("{}.tmp{:x}", path, process_tag);
+    m_deflate = deflate && jar_deflate_supported();
+
+    m_file = std::fopen(m_temp_path.c_str(), "wb");
+    if (!m_file)
+    {
+        return false;
+    }
+
+    std::setvbuf(m_file, nullptr, _IOFBF, JAR_WRITE_BUFFER_SIZE);
+    m_waiting.resize(entry_count);
+
+    std::string manifest = std::format("Manifest-Version: 1.0\r\nCreated-By: ujavac {}\r\n\r\n", UJAVAC_VERSION);
+    std::span<const u8> contents{reinterpret_cast<const u8 *>(manifest.data()), manifest.size()};
+    Entry entry{0, std::string(JAR_MANIFEST_NAME), {}, crc32(contents), u32(contents.size()), false, nullptr};
+    entry.data.assign(contents.begin(), contents.end());
+    write_entry(entry);
+    return !m_write_failed;
+}
+
+void JarWriter::add(u32 order, std::string name, std::span<const u8> contents)
+{
+    Entry *entry = new Entry{order, std::move(name), {}, crc32(contents), u32(contents.size()), false, nullptr};
+
+    // Compressing is most of the work, and runs on the worker
+    entry->deflated = m_deflate && deflate_contents(contents, entry->data);
+    if (!entry->deflated)
+    {
+        entry->data.assign(contents.begin(), contents.end());
+    }
+
+    push(entry);
+    drain();
+}
+
+void JarWriter::skip(u32 order)
+{
+    push(new Entry{order, {}, {}, 0, 0, false, nullptr});
+    drain();
+}
+
+void JarWriter::push(Entry *entry)
+{
+    Entry *head = m_added.load(std::memory_order_relaxed);
+    do
+    {
+        entry->next = head;
+    } while (!m_added.compare_exchange_weak(head, entry));
+}
+
+void JarWriter::take_added()
+{
+    for (Entry *entry = m_added.exchange(nullptr); entry;)
+    {
+        // Units found while compiling come after the expected ones
+        if (entry->order >= m_waiting.size())
+        {
+            m_waiting.resize(entry->order + 1);
+        }
+
+        Entry *next = entry->next;
+        m_waiting[entry->order].reset(entry);
+        entry = next;
+    }
+}
+
+void JarWriter::drain()
+{
+    // A thread that finds another one draining leaves its entry to it;
+    // the drainer checks for new entries once more after letting go
+    while (!m_draining.test_and_set())
+    {
+        take_added();
+
+        for (; m_next < m_waiting.size() && m_waiting[m_next]; m_next++)
+        {
+            if (!m_waiting[m_next]->name.empty())
+            {
+                write_entry(*m_waiting[m_next]);
+            }
+
+            m_waiting[m_next].reset();
+        }
+
+        m_draining.clear();
+        if (!m_added.load())
+        {
+            break;
+        }
+    }
+}
+
+void JarWriter::write_bytes(const void *data, u64 size)
+{
+    if (size && std::fwrite(data, 1, size, m_file) != size)
+    {
+        m_write_failed = true;
+    }
+
+    m_offset += size;
+}
+
+void JarWriter::write_entry(const Entry &entry)
+{
+    // Two units declaring the same class can't both be in the jar;
+    // the first one in order is kept
+    if (!m_names.insert(entry.name).second)
+    {
+        m_duplicates++;
+        return;
+    }
+
+    std::vector<u8> header;
+    put_u32(header, ZIP_LOCAL_HEADER_SIGNATURE);
+    put_u16(header, ZIP_VERSION);
+    put_u16(header, ZIP_FLAGS);
+    put_u16(header, entry.deflated ? ZIP_DEFLATED : ZIP_STORED);
+    put_u16(header, ZIP_TIME);
+    put_u16(header, ZIP_DATE);
+    put_u32(header, entry.crc);
+    put_u32(header, u32(entry.data.size()));
+    put_u32(header, entry.size);
+    put_u16(header, u16(entry.name.size()));
+    put_u16(header, 0);
+    header.insert(header.end(), entry.name.begin(), entry.name.end());
+
+    m_directory.push_back({entry.name, entry.crc, u32(entry.data.size()), entry.size, entry.deflated, m_offset});
+    write_bytes(header.data(), header.size());
+    write_bytes(entry.data.data(), entry.data.size());
+}
+
+bool JarWriter::finish(bool keep)
+{
+    if (keep)
+    {
+        // Entries of units that never finished are left out
+        while (m_draining.test_and_set())
+        {
+        }
+
+        take_added();
+
+        for (; m_next < m_waiting.size(); m_next++)
+        {
+            if (m_waiting[m_next] && !m_waiting[m_next]->name.empty())
+            {
+                write_entry(*m_waiting[m_next]);
+            }
+
+            m_waiting[m_next].reset();
+        }
+
+        m_draining.clear();
+
+        u64 directory_offset = m_offset;
+        std::vector<u8> out;
+        for (const DirectoryEntry &entry : m_directory)
+        {
+            bool zip64 = entry.offset >= ZIP_MAX_U32;
+            put_u32(out, ZIP_CENTRAL_HEADER_SIGNATURE);
+            put_u16(out, zip64 ? ZIP64_VERSION : ZIP_VERSION);
+            put_u16(out, zip64 ? ZIP64_VERSION : ZIP_VERSION);
+            put_u16(out, ZIP_FLAGS);
+            put_u16(out, entry.deflated ? ZIP_DEFLATED : ZIP_STORED);
+            put_u16(out, ZIP_TIME);
+            put_u16(out, ZIP_DATE);
+            put_u32(out, entry.crc);
+            put_u32(out, entry.compressed_size);
+            put_u32(out, entry.size);
+            put_u16(out, u16(entry.name.size()));
+            put_u16(out, zip64 ? 12 : 0);
+            // Comment length, disk, internal and external attributes
+            put_u16(out, 0);
+            put_u16(out, 0);
+            put_u16(out, 0);
+            put_u32(out, 0);
+            put_u32(out, zip64 ? ZIP_MAX_U32 : u32(entry.offset));
+            out.insert(out.end(), entry.name.begin(), entry.name.end());
+
+            if (zip64)
+            {
+                put_u16(out, ZIP64_EXTRA_TAG);
+                put_u16(out, 8);
+                put_u64(out, entry.offset);
+            }
+
+            if (out.size() >= JAR_WRITE_BUFFER_SIZE)
+            {
+                write_bytes(out.data(), out.size());
+                out.clear();
+            }
+        }
+
+        write_bytes(out.data(), out.size());
+        out.clear();
+
+        u64 directory_size = m_offset - directory_offset;
+        u64 count = m_directory.size();
+        bool zip64 = count >= ZIP_MAX_U16 || directory_offset >= ZIP_MAX_U32 || directory_size >= ZIP_MAX_U32;
+
+        if (zip64)
+        {
+            u64 end_offset = m_offset;
+            put_u32(out, ZIP64_END_SIGNATURE);
+            put_u64(out, 44);
+            put_u16(out, ZIP64_VERSION);
+            put_u16(out, ZIP64_VERSION);
+            put_u32(out, 0);
+            put_u32(out, 0);
+            put_u64(out, count);
+            put_u64(out, count);
+            put_u64(out, directory_size);
+            put_u64(out, directory_offset);
+
+            put_u32(out, ZIP64_LOCATOR_SIGNATURE);
+            put_u32(out, 0);
+            put_u64(out, end_offset);
+            put_u32(out, 1);
+        }
+
+        put_u32(out, ZIP_END_SIGNATURE);
+        put_u16(out, 0);
+        put_u16(out, 0);
+        put_u16(out, u16(std::min<u64>(count, ZIP_MAX_U16)));
+        put_u16(out, u16(std::min<u64>(count, ZIP_MAX_U16)));
+        put_u32(out, u32(std::min<u64>(directory_size, ZIP_MAX_U32)));
+        put_u32(out, u32(std::min<u64>(directory_offset, ZIP_MAX_U32)));
+        put_u16(out, 0);
+        write_bytes(out.data(), out.size());
+    }
+
+    bool ok = !std::ferror(m_file) & !std::fclose(m_file) & !m_write_failed;
+    m_file = nullptr;
+
+    std::error_code ec;
+    if (keep && ok)
+    {
+        std::filesystem::rename(m_temp_path, m_path, ec);
+    }
+
+    if (!keep || !ok || ec)
+    {
+        std::remove(m_temp_path.c_str());
+    }
+
+    return ok && !ec;
+}
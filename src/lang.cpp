@@ -1,406 +1,1086 @@
 #include "ujavac.h"
 
+#include <algorithm>
 #include <atomic>
 #include <cstdio>
+#include <cstring>
+#include <deque>
+#include <filesystem>
 #include <format>
+#include <numeric>
 
+#include <tbb/flow_graph.h>
 #include <tbb/parallel_for.h>
+#include <tbb/parallel_for_each.h>
+#include <tbb/parallel_pipeline.h>
+#include <tbb/task_arena.h>
+#include <tbb/task_group.h>
+#include <tbb/tick_count.h>
 
-constexpr bool is_dec_digit(u32 c)
+namespace
 {
-    return c >= '0' && c <= '9';
-}
+// Chunks per thread when lexing a huge input; a few more than one, so
+// that a chunk that takes long doesn't hold up the rest
+constexpr u64 LEX_CHUNKS_PER_THREAD = 4;
+constexpr u64 LEX_MIN_CHUNK_SIZE = 1024 * 1024;
+// Larger inputs aren't read ahead but mapped when their unit starts, so
+// that the window of read-ahead inputs can't take up too much memory
+constexpr u64 PREFETCH_MAX_FILE_SIZE = 4 * 1024 * 1024;
+
+// JVMS 4.1
+constexpr u32 CLASS_FILE_MAGIC = 0xCAFEBABE;
+// Java 17
+constexpr u16 CLASS_FILE_MAJOR_VERSION = 61;
+// Everything but the constant pool of a skeleton class file
+constexpr u64 CLASS_FILE_HEADER_SIZE = 64;
+
+// JVMS 4.1-B
+constexpr u16 ACC_PUBLIC = 0x0001;
+constexpr u16 ACC_FINAL = 0x0010;
+constexpr u16 ACC_SUPER = 0x0020;
+constexpr u16 ACC_INTERFACE = 0x0200;
+constexpr u16 ACC_ABSTRACT = 0x0400;
+constexpr u16 ACC_ANNOTATION = 0x2000;
+constexpr u16 ACC_ENUM = 0x4000;
 
-constexpr bool is_identifier_ignorable(u32 c)
+// The class file emitted for a unit until there's code generation: the
+// first top-level type, without any members
+struct SkeletonClass
 {
-    return c <= 0x08 || c >= 0x0E && c <= 0x01B || c >= 0x7F && c <= 0x9F;
+    // Internal form, with the package
+    std::string name;
+    u16 access_flags;
+    std::string_view super_class;
+    std::vector<std::string_view> interfaces;
+};
+
+SkeletonClass find_skeleton_class(const Ast &ast, const ClassTable &classes, u32 entry, std::string_view package,
+                                  const char *input)
+{
+    const Interner &interner = global_interner();
+
+    // Without a type, the class is named after the file
+    if (entry == ClassRef::NO_SOURCE)
+    {
+        std::string name{package};
+        name.append(name.empty() ? "" : "/").append(std::filesystem::path(input).stem().string());
+        return {std::move(name), ACC_SUPER, "java/lang/Object", {}};
+    }
+
+    const SourceClass &source = classes[entry];
+    NodeKind kind = ast.kinds[source.node];
+    SkeletonClass skeleton{std::string(interner.text(source.name)), ACC_SUPER, "java/lang/Object", {}};
+
+    if (kind == NodeKind::InterfaceDecl || kind == NodeKind::AnnotationDecl)
+    {
+        skeleton.access_flags = ACC_INTERFACE | ACC_ABSTRACT;
+        if (kind == NodeKind::AnnotationDecl)
+        {
+            skeleton.access_flags |= ACC_ANNOTATION;
+            skeleton.interfaces.push_back("java/lang/annotation/Annotation");
+        }
+    }
+    else if (kind == NodeKind::EnumDecl)
+    {
+        skeleton.access_flags |= ACC_FINAL | ACC_ENUM;
+        skeleton.super_class = "java/lang/Enum";
+    }
+    else if (kind == NodeKind::RecordDecl)
+    {
+        skeleton.access_flags |= ACC_FINAL;
+        skeleton.super_class = "java/lang/Record";
+    }
+    else if (source.super_class)
+    {
+        skeleton.super_class = interner.text(source.super_class.name);
+    }
+
+    for (ClassRef interface : source.interfaces)
+    {
+        skeleton.interfaces.push_back(interner.text(interface.name));
+    }
+
+    u32 modifiers = ast.lhs[source.node] ? ast.lhs[ast.lhs[source.node]] : 0;
+    if (modifiers & MODIFIER_PUBLIC)
+    {
+        skeleton.access_flags |= ACC_PUBLIC;
+    }
+
+    if (modifiers & MODIFIER_ABSTRACT)
+    {
+        skeleton.access_flags |= ACC_ABSTRACT;
+    }
+
+    if (modifiers & MODIFIER_FINAL)
+    {
+        skeleton.access_flags |= ACC_FINAL;
+    }
+
+    return skeleton;
 }
+} // namespace
 
-// JLS 3.8, "Java letter" definition
-// TODO add Unicode support
-constexpr bool is_identifier_start(u32 c)
+const char *compile_phase_name(CompilePhase phase)
 {
-    return c >= 'A' && c <= 'Z' || c >= 'a' && c <= 'z' || c == '$' || c == '_';
+    switch (phase)
+    {
+    case CompilePhase::Read:
+        return "read";
+    case CompilePhase::Lex:
+        return "lex";
+    case CompilePhase::Parse:
+        return "parse";
+    case CompilePhase::Enter:
+        return "enter";
+    case CompilePhase::Analyze:
+        return "analyze";
+    case CompilePhase::Emit:
+        return "emit";
+    case CompilePhase::Write:
+        return "write";
+    }
+
+    return "";
 }
 
-// JLS 3.8, "Java letter-or-digit" definition
-// TODO add Unicode support
-constexpr bool is_identifier_part(u32 c)
+Compiler::Compiler(const char *input, const char *output, const CompilerOptions &options,
+                   const std::atomic_bool *cancelled, OutputWriter *writer, u32 output_order)
+    : m_input(input), m_output(output), m_options(options), m_cancelled(cancelled), m_writer(writer),
+      m_output_order(output_order)
 {
-    return is_identifier_start(c) || is_dec_digit(c) || is_identifier_ignorable(c);
 }
 
-// JLS 3.6
-constexpr bool is_whitespace(u32 c)
+bool Compiler::lex(std::span<const u8> src)
 {
-    return c == ' ' || c == '\t' || c == '\f' || c == '\r' || c == '\n';
+    m_src = src;
+
+    // A huge input would keep one thread busy long after the others
+    // have run out of units
+    u32 threads = tbb::this_task_arena::max_concurrency();
+    if (m_options.chunked_lex_threshold && src.size() >= m_options.chunked_lex_threshold && threads > 1)
+    {
+        u64 chunk_size = std::max(src.size() / (LEX_CHUNKS_PER_THREAD * threads), LEX_MIN_CHUNK_SIZE);
+        return lex_chunked(src, m_tokens, m_diagnostics, m_options, m_cancelled, chunk_size);
+    }
+
+    Lexer lexer{src, m_tokens, m_arena, m_diagnostics, m_options, m_cancelled};
+    return lexer.run();
 }
 
-constexpr bool is_hex_digit(u32 c)
+void Compiler::dump_tokens() const
 {
-    return c >= 'A' && c <= 'F' || c >= 'a' && c <= 'f' || is_dec_digit(c);
+    // Built up front so that output from parallel units doesn't interleave
+    std::string out = std::format("[tokens {}]\n", m_input);
+
+    for (u32 i = 0; i < m_tokens.size(); i++)
+    {
+        SourcePosition pos = m_tokens.position(m_tokens.offsets[i], m_src);
+        out.append(std::format("{}:{} {} ", pos.line, pos.col, token_kind_name(m_tokens.kinds[i])));
+
+        for (u8 c : m_src.subspan(m_tokens.offsets[i], m_tokens.lengths[i]))
+        {
+            switch (c)
+            {
+            case '\n':
+                out.append("\\n");
+                break;
+            case '\r':
+                out.append("\\r");
+                break;
+            case '\t':
+                out.append("\\t");
+                break;
+            default:
+                out.push_back(char(c));
+            }
+        }
+
+        out.push_back('\n');
+    }
+
+    print("{}", out);
 }
 
-constexpr bool is_ascii(u32 c)
+void Compiler::use_source(SourceBuffer &&source)
 {
-    return c < 0x80;
+    m_source = std::move(source);
+    m_source_ready = true;
 }
 
-constexpr bool is_utf16_high_surrogate(u16 c)
+bool Compiler::read()
 {
-    return c >= 0xD800 && c <= 0xDBFF;
+    if (!m_source_ready && !m_source.open(m_input))
+    {
+        m_diagnostics.report(DiagnosticCode::ReadError, Diagnostic::NO_OFFSET);
+        return false;
+    }
+
+    m_src = m_source.bytes();
+
+    if (m_options.verbose)
+    {
+        println("[reading {} ({} bytes, {})]", m_input, m_src.size(), SourceBuffer::strategy_name(m_source.strategy()));
+    }
+
+    return true;
 }
 
-constexpr bool is_utf16_low_surrogate(u16 c)
+bool Compiler::parse()
 {
-    return c >= 0xDC00 && c <= 0xDFFF;
+    Parser parser{m_tokens, m_ast, m_diagnostics, m_cancelled};
+    if (!parser.run() || cancelled())
+    {
+        return false;
+    }
+
+    if (m_options.verbose)
+    {
+        println("[parsed {} ({} nodes, {} bytes of syntax tree)]", m_input, m_ast.size(), m_ast.memory_usage());
+    }
+
+    return true;
 }
 
-Compiler::Compiler(const char *input, const char *output) : m_input(input), m_output(output)
+bool Compiler::emit()
 {
+    u32 entry = ClassRef::NO_SOURCE;
+    for (u32 node : m_ast.list(m_ast.rhs[0]))
+    {
+        if (is_type_declaration(m_ast.kinds[node]))
+        {
+            auto declared = std::find_if(m_declared.begin(), m_declared.end(),
+                                         [node](const DeclaredClass &type) { return type.node == node; });
+            entry = declared->entry;
+            break;
+        }
+    }
+
+    SkeletonClass skeleton =
+        find_skeleton_class(m_ast, *m_classes, entry, global_interner().text(m_package), m_input);
+    ConstantPool pool;
+    u16 this_class = pool.class_ref(skeleton.name);
+    u16 super_class = pool.class_ref(skeleton.super_class);
+    std::vector<u16> interfaces;
+    for (std::string_view interface : skeleton.interfaces)
+    {
+        interfaces.push_back(pool.class_ref(interface));
+    }
+
+    u16 source_file_attribute = pool.utf8("SourceFile");
+    u16 source_file = pool.utf8(std::filesystem::path(m_input).filename().string());
+
+    if (!this_class || !super_class || std::count(interfaces.begin(), interfaces.end(), 0) ||
+        !source_file_attribute || !source_file)
+    {
+        m_diagnostics.report(pool.full() ? DiagnosticCode::TooManyConstants : DiagnosticCode::ConstantTooLong,
+                             Diagnostic::NO_OFFSET);
+        return false;
+    }
+
+    // JVMS 4.1
+    ClassFileBuffer out;
+    out.contents().reserve(CLASS_FILE_HEADER_SIZE + 2 * interfaces.size() + pool.bytes().size());
+    out.u4(CLASS_FILE_MAGIC);
+    out.u2(0);
+    out.u2(CLASS_FILE_MAJOR_VERSION);
+    out.u2(pool.count());
+    out.bytes(pool.bytes());
+    out.u2(skeleton.access_flags);
+    out.u2(this_class);
+    out.u2(super_class);
+    out.u2(u16(interfaces.size()));
+    for (u16 interface : interfaces)
+    {
+        out.u2(interface);
+    }
+
+    // No fields or methods
+    out.u2(0);
+    out.u2(0);
+
+    out.u2(1);
+    out.u2(source_file_attribute);
+    out.u4(2);
+    out.u2(source_file);
+
+    m_class_file = std::move(out.contents());
+    m_class_name = std::move(skeleton.name);
+    return true;
 }
 
-bool Compiler::ascii_token_contains(std::string_view token) const
+bool Compiler::write()
 {
-    return std::string_view(m_ascii_tok_buf, m_ascii_tok_buf_len) == token;
+    bool written = m_writer ? m_writer->write(m_output_order, m_output, m_class_name, std::move(m_class_file))
+                            : write_file_atomically(m_output, m_class_file);
+    m_class_file = {};
+
+    if (!written)
+    {
+        m_diagnostics.report(DiagnosticCode::WriteError, Diagnostic::NO_OFFSET);
+        return false;
+    }
+
+    return true;
 }
 
-void Compiler::push_diagnostic(std::string_view msg)
+bool Compiler::run_phase(CompilePhase phase)
 {
-    println(stderr, "{}:{}:{}: {}", m_input, m_line_num, m_col_num, msg);
+    if (cancelled())
+    {
+        return false;
+    }
+
+    if (m_options.parse_only && phase > CompilePhase::Parse)
+    {
+        return true;
+    }
+
+    switch (phase)
+    {
+    case CompilePhase::Read:
+        return read();
+    case CompilePhase::Lex:
+        if (!lex(m_src) || cancelled())
+        {
+            return false;
+        }
+
+        if (m_options.verbose)
+        {
+            println("[lexed {} ({} tokens, {} lines, {} bytes of token storage)]", m_input, m_tokens.size(),
+                    m_tokens.line_starts.size(), m_tokens.memory_usage());
+        }
+
+        if (m_options.dump_tokens)
+        {
+            dump_tokens();
+        }
+
+        return true;
+    case CompilePhase::Parse:
+        return parse();
+    case CompilePhase::Enter:
+        return enter();
+    case CompilePhase::Analyze:
+        return analyze();
+    case CompilePhase::Emit:
+        return emit();
+    case CompilePhase::Write:
+        return write();
+    }
+
+    return false;
 }
 
-void Compiler::ascii_token_append(char c)
+void Compiler::finish()
 {
-    if (!m_ascii_tok_buf_len)
+    // Positions are resolved while the source is still around
+    m_diagnostics.resolve_positions(m_tokens, m_src);
+
+    if (m_options.verbose)
     {
-        m_ascii_tok_buf_line_num = m_line_num;
-        m_ascii_tok_buf_col_num = m_col_num;
+        println("[arena {} ({} bytes peak, {} bytes total, {} bytes reserved)]", m_input, m_arena.peak_bytes(),
+                m_arena.total_bytes(), m_arena.reserved_bytes());
+    }
+
+    // Supertypes that weren't resolved by now never will be, as this
+    // compiler won't be around to do it
+    for (const DeclaredClass &declared : m_declared)
+    {
+        SourceClass &source = (*m_classes)[declared.entry];
+        if (source.state != SupertypeState::Resolved)
+        {
+            source.state = SupertypeState::Resolved;
+        }
     }
 
-    m_ascii_tok_buf[m_ascii_tok_buf_len++] = c;
+    m_declared = {};
+    m_imports = {};
+    m_resolved_names = {};
+
+    // The tree's storage goes back with the rest of the arena
+    m_ast = Ast{m_arena};
+    m_arena.release();
 }
 
 bool Compiler::compile()
 {
-    std::FILE *src_file = std::fopen(m_input, "rb");
-    std::FILE *dst_file = std::fopen(m_output, "wb");
-    int src_file_ch = 0;
-    bool compilation_successful = false;
+    bool compilation_successful = true;
 
-    if (!src_file || !dst_file)
+    for (u32 phase = 0; phase < COMPILE_PHASE_COUNT && compilation_successful; phase++)
     {
-        goto finish;
+        compilation_successful = run_phase(CompilePhase(phase));
     }
 
-    m_raw_unicode = 0;
-    m_raw_unicode_remaining = 0;
-    m_line_num = 1;
-    m_col_num = 1;
-    prev_raw_cr = false;
-    m_esc_utf16_len = 0;
-    m_esc_utf16_remaining = 0;
-    m_prev_from_esc = false;
-    m_prev_backslash = false;
-    m_raw_backslash_count = 0;
-    m_ascii_tok_buf_len = 0;
-    m_lexer_item = LexerItem::WhiteSpace;
-    m_prev_trad_comment_end_star = false;
-    m_ascii_tok_buf_line_num = 0;
-    m_ascii_tok_buf_col_num = 0;
+    finish();
+    return compilation_successful;
+}
 
-    while (src_file_ch != EOF)
+CompilerManager::CompilerManager(std::span<const char *> inputs, const CompilerOptions &options)
+    : m_inputs(inputs.begin(), inputs.end()), m_options(options),
+      m_writer(options.memory_output ? OutputMode::Memory : OutputMode::Disk), m_diagnostics(m_inputs, options)
+{
+    m_outputs.reserve(inputs.size());
+    for (const auto &input : inputs)
     {
-        src_file_ch = std::fgetc(src_file);
+        m_outputs.push_back(output_path(input, 0));
+    }
 
-        if (src_file_ch == EOF && std::ferror(src_file))
+    // Unreadable inputs count as empty; they fail right away anyway
+    m_input_sizes.reserve(inputs.size());
+    for (const auto &input : inputs)
+    {
+        std::error_code ec;
+        u64 size = std::filesystem::file_size(input, ec);
+        m_input_sizes.push_back(ec ? 0 : size);
+    }
+
+    m_schedule.resize(inputs.size());
+    std::iota(m_schedule.begin(), m_schedule.end(), 0);
+    std::stable_sort(m_schedule.begin(), m_schedule.end(),
+                     [this](u32 a, u32 b) { return m_input_sizes[a] > m_input_sizes[b]; });
+
+    m_unit_seconds.resize(inputs.size());
+
+    // Cached outputs are hardlinked from disk, which memory and jar
+    // outputs can't be; parsing alone has no outputs at all
+    if (options.cache_dir && !options.memory_output && !options.output_jar && !options.parse_only)
+    {
+        m_use_cache = m_cache.open(options.cache_dir);
+        if (!m_use_cache)
         {
-            push_diagnostic("error reading input file");
-            goto finish;
+            println(stderr, "warning: can't use cache directory {}, compiling without it", options.cache_dir);
         }
+    }
+}
+
+std::string CompilerManager::output_path(std::string_view input, u32 root_size) const
+{
+    std::string s{input};
+    if (s.ends_with(".java"))
+    {
+        s.resize(s.size() - 5);
+    }
 
-        // A single UTF-8 encoding character from the input
-        // stream. All input starts from this representation.
-        // TODO handle EOF condition correctly (JLS 3.5)
-        u8 raw_utf8 = src_file_ch == EOF ? 0 : src_file_ch;
+    s.append(".class");
 
-        if (!m_raw_unicode_remaining)
+    // Until packages are known, the output tree mirrors the source
+    // directories, which match them in a conventional layout; sources
+    // found under a source path are placed relative to it
+    if (m_options.output_dir)
+    {
+        std::filesystem::path relative;
+        for (const std::filesystem::path &part :
+             std::filesystem::path(s.substr(root_size)).lexically_normal().relative_path())
         {
-            // FIXME error handling must be proper
-            if (raw_utf8 == 0x80)
+            if (!relative.empty() || part != "..")
             {
-                push_diagnostic(std::format("invalid UTF-8 byte: {:#x}", raw_utf8));
-                goto finish;
+                relative /= part;
             }
-
-            for (m_raw_unicode_remaining = 1; raw_utf8 & (0x80 >> m_raw_unicode_remaining); ++m_raw_unicode_remaining)
-                ;
-            m_raw_unicode = raw_utf8;
-        }
-        else
-        {
-            m_raw_unicode = (m_raw_unicode << 6) | (raw_utf8 & 0x30);
         }
 
-        if (--m_raw_unicode_remaining)
-        {
-            continue;
-        }
+        s = (std::filesystem::path(m_options.output_dir) / relative).string();
+    }
 
-        // JLS 3.4
-        if (m_raw_unicode == '\r' || m_raw_unicode == '\n' && !prev_raw_cr)
-        {
-            m_line_num++;
-            m_col_num = 1;
+    return s;
+}
 
-            prev_raw_cr = m_raw_unicode == '\r';
-        }
-        else
+u32 CompilerManager::add_input(SourceDiscovery::Source &&source)
+{
+    u32 i = u32(m_inputs.size());
+    m_outputs.push_back(output_path(source.path, source.root_size));
+    m_input_sizes.push_back(0);
+    m_unit_seconds.push_back(0);
+    m_inputs.push_back(m_found_inputs.push_back(std::move(source.path))->c_str());
+    m_diagnostics.add_units(i + 1);
+    return i;
+}
+
+struct CompilerManager::Unit
+{
+    u32 index;
+    // Place in the schedule, and so among the outputs of a jar
+    u32 order;
+    Compiler compiler;
+    bool ok = true;
+    // Restored from the build cache, so emitting and writing are skipped
+    bool cached = false;
+    u64 cache_key = 0;
+    double seconds = 0;
+};
+
+namespace
+{
+struct StageStats
+{
+    std::atomic<u64> units = 0;
+    std::atomic<u64> bytes = 0;
+    std::atomic<u64> busy_ns = 0;
+    // Units done with the previous stage but not yet started on this one
+    std::atomic<u32> queued = 0;
+    std::atomic<u32> max_queued = 0;
+
+    void enqueue()
+    {
+        u32 depth = ++queued;
+        u32 max = max_queued.load(std::memory_order_relaxed);
+        while (depth > max && !max_queued.compare_exchange_weak(max, depth, std::memory_order_relaxed))
         {
-            m_col_num++;
         }
+    }
+
+    void record(u64 unit_bytes, double seconds)
+    {
+        units.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(unit_bytes, std::memory_order_relaxed);
+        busy_ns.fetch_add(u64(seconds * 1e9), std::memory_order_relaxed);
+    }
+};
+} // namespace
 
-        // The input character after reconstruction
-        // and Unicode escape sequence processing.
-        // Lexing happens from this representation.
-        u32 unicode = 0;
+u8 CompilerManager::run()
+{
+    std::atomic_bool status = true;
+    u32 started = 0;
+    std::atomic<u32> finished = 0;
+    // Cancelling the pipeline abandons the units in flight, which are
+    // then cleaned up from here
+    tbb::concurrent_vector<std::unique_ptr<Unit>> units(m_inputs.size());
+    tbb::task_arena arena{m_options.threads ? s32(m_options.threads) : tbb::task_arena::automatic};
+    tbb::task_group_context context;
+    StageStats stages[COMPILE_PHASE_COUNT];
+    tbb::tick_count start = tbb::tick_count::now();
+    m_dependency_stats = {};
+    m_discovery_stats = {};
+
+    if (m_options.trace_file || m_options.time_report)
+    {
+        m_tracer.enable();
+    }
 
-        if (m_esc_utf16_remaining)
+    // The walk starts right away, to get ahead of the units waiting on it
+    std::unique_ptr<SourceDiscovery> discovery;
+    if (!m_options.source_paths.empty())
+    {
+        for (const std::string &path : m_options.source_paths)
         {
-            // The start of a Unicode escape sequence can contain more than one "u"
-            if (m_esc_utf16_remaining == 4 && m_raw_unicode == 'u')
+            std::error_code ec;
+            if (!std::filesystem::is_directory(path, ec))
             {
-                continue;
+                println(stderr, "error: invalid source path: {}", path);
+                return 1;
             }
+        }
 
-            --m_esc_utf16_remaining;
+        discovery = std::make_unique<SourceDiscovery>(m_options.source_paths, m_options.threads);
+    }
 
-            u16 val;
-            switch (m_raw_unicode)
-            {
-            case 'a':
-            case 'b':
-            case 'c':
-            case 'd':
-            case 'e':
-            case 'f':
-                m_raw_unicode -= 'a' - 'A';
-            case 'A':
-            case 'B':
-            case 'C':
-            case 'D':
-            case 'E':
-            case 'F':
-                val = m_raw_unicode - 'A';
-                break;
-            case '0':
-            case '1':
-            case '2':
-            case '3':
-            case '4':
-            case '5':
-            case '6':
-            case '7':
-            case '8':
-            case '9':
-                val = m_raw_unicode - '0';
-                break;
-            default:
-                push_diagnostic(std::format("unexpected character in Unicode escape: {}", m_raw_unicode));
-                goto finish;
-            }
+    // A source that's both named and found is compiled once, as named
+    auto absolute_path = [](const char *path) {
+        std::error_code ec;
+        return std::filesystem::absolute(path, ec).lexically_normal().string();
+    };
 
-            m_esc_utf16[m_esc_utf16_len] |= val << (4 * m_esc_utf16_remaining);
+    std::unordered_set<std::string> named;
+    for (u32 i = 0; discovery && i < m_inputs.size(); i++)
+    {
+        named.insert(absolute_path(m_inputs[i]));
+    }
 
-            if (!m_esc_utf16_remaining)
+    u32 found_taken = 0;
+    auto next_found = [&](SourceDiscovery::Source &found) {
+        while (discovery && discovery->next(found))
+        {
+            found_taken++;
+            if (named.empty() || !named.contains(absolute_path(found.path.c_str())))
             {
-                m_prev_from_esc = true;
-                m_esc_utf16_len++;
+                return true;
+            }
+        }
 
-                if (m_esc_utf16_len == 1)
-                {
-                    if (is_utf16_high_surrogate(m_esc_utf16[0]))
-                    {
-                        // We expect a low surrogate to follow; parse it now
-                        continue;
-                    }
-
-                    if (is_utf16_low_surrogate(m_esc_utf16[0]))
-                    {
-                        push_diagnostic("expected BMP Unicode escape");
-                        goto finish;
-                    }
-
-                    unicode = m_esc_utf16[0];
-                }
-                else if (m_esc_utf16_len == 2)
-                {
-                    if (!is_utf16_high_surrogate(m_esc_utf16[0]) || !is_utf16_low_surrogate(m_esc_utf16[1]))
-                    {
-                        push_diagnostic("invalid Unicode escape sequence");
-                        goto finish;
-                    }
+        return false;
+    };
 
-                    unicode = 0x10000 + (u32(m_esc_utf16[0] & 0x3FF) << 10) | (m_esc_utf16[1] & 0x3FF);
-                }
+    if (m_options.system && std::strcmp(m_options.system, "none"))
+    {
+        std::string error;
+        if (!m_system_index.open(m_options.system, m_options.cache_dir, error))
+        {
+            println(stderr, "error: illegal argument for --system: {}", error);
+            return 1;
+        }
 
-                m_esc_utf16_len = 0;
-            }
+        if (m_options.verbose)
+        {
+            const SystemIndex::Stats &stats = m_system_index.stats();
+            println("[{} system index of {} in {:.3f} ms: {} packages, {} classes, {} members, {} bytes]",
+                    stats.built ? "built" : "opened", m_options.system, stats.seconds * 1000, stats.packages,
+                    stats.classes, stats.members, stats.bytes);
         }
-        // JLS 3.3
-        else if (m_prev_backslash && m_raw_unicode == 'u' && (m_raw_backslash_count % 2 == 0 || m_prev_from_esc))
+    }
+
+    if (m_options.output_jar && !m_options.parse_only && !m_writer.open_jar(m_options.output_jar, u32(m_inputs.size()), m_options.jar_deflate))
+    {
+        println(stderr, "error: can't write {}", m_options.output_jar);
+        return 1;
+    }
+
+    // Every unit in flight holds its source and tokens, so only a few
+    // more than there are threads may be in the pipeline at once
+    u32 max_in_flight = 2 * arena.max_concurrency();
+
+    std::unique_ptr<InputPrefetcher> prefetcher;
+    if (m_options.prefetch_depth)
+    {
+        std::vector<const char *> paths;
+        paths.reserve(m_schedule.size());
+        for (u32 i : m_schedule)
         {
-            m_esc_utf16_remaining = 4;
-            m_prev_backslash = false;
-            continue;
+            paths.push_back(m_input_sizes[i] <= PREFETCH_MAX_FILE_SIZE ? m_inputs[i] : nullptr);
         }
-        else if (m_raw_unicode == '\\')
+
+        prefetcher = std::make_unique<InputPrefetcher>(std::move(paths), m_options.prefetch_depth);
+    }
+
+    // Reading is the serial input stage, taking units largest first, so
+    // that I/O for one unit overlaps with lexing and the like of others.
+    // Units found under the source paths come after, waiting on the walk.
+    auto read = tbb::make_filter<void, Unit *>(tbb::filter_mode::serial_in_order, [&, this](tbb::flow_control &fc) {
+        SourceDiscovery::Source found;
+        if (m_cancelled || (started >= m_schedule.size() && !next_found(found)))
         {
-            m_raw_backslash_count++;
-            m_prev_backslash = true;
-            continue;
+            fc.stop();
+            return static_cast<Unit *>(nullptr);
         }
 
-        if (m_esc_utf16_len)
+        u32 order = started++;
+        u32 i = order < m_schedule.size() ? m_schedule[order] : add_input(std::move(found));
+        if (i == units.size())
         {
-            // If we get here, then the UTF-16 decoder was
-            // waiting on a low surrogate which never came
-            push_diagnostic("unexpected end of Unicode escape sequence");
-            goto finish;
+            units.emplace_back();
         }
 
-        m_prev_from_esc = false;
+        units[i].reset(new Unit{i, order, {m_inputs[i], m_outputs[i].c_str(), m_options, &m_cancelled, &m_writer, order}});
+        Unit *unit = units[i].get();
+        unit->compiler.use_class_table(m_classes, i);
 
-        if (m_lexer_item == LexerItem::EndOfLineComment && (unicode == '\r' || unicode == '\n'))
+        PhaseTimer timer{m_tracer, CompilePhase::Read, i};
+        SourceBuffer source;
+        if (prefetcher && prefetcher->next(source))
         {
-            m_lexer_item = LexerItem::WhiteSpace;
-            continue;
+            unit->compiler.use_source(std::move(source));
         }
 
-        if (m_lexer_item == LexerItem::TraditionalComment)
+        unit->ok = unit->compiler.run_phase(CompilePhase::Read);
+        m_input_sizes[i] = unit->compiler.source().size();
+        unit->seconds = timer.stop(unit->compiler.source().size());
+        stages[u32(CompilePhase::Read)].record(unit->compiler.source().size(), unit->seconds);
+
+        stages[u32(CompilePhase::Lex)].enqueue();
+        return unit;
+    });
+
+    auto run_phase = [&](Unit &unit, CompilePhase phase) {
+        if (unit.ok && !unit.cached)
         {
-            if (m_prev_trad_comment_end_star && unicode == '/')
-            {
-                m_lexer_item = LexerItem::WhiteSpace;
-                m_prev_trad_comment_end_star = false;
-            }
-            else if (unicode == '*')
+            PhaseTimer timer{m_tracer, phase, unit.index};
+            unit.ok = unit.compiler.run_phase(phase);
+            double seconds = timer.stop(unit.compiler.source().size());
+
+            unit.seconds += seconds;
+            stages[u32(phase)].record(unit.compiler.source().size(), seconds);
+        }
+    };
+
+    auto complete = [&, this](Unit &unit) {
+        u32 i = unit.index;
+        finish_unit(unit, status, context);
+        units[i].reset();
+        finished++;
+    };
+
+    auto stage = [&](CompilePhase phase) {
+        return tbb::make_filter<Unit *, Unit *>(tbb::filter_mode::parallel, [&, phase](Unit *unit) {
+            stages[u32(phase)].queued--;
+            run_phase(*unit, phase);
+
+            if (phase < CompilePhase::Enter)
             {
-                m_prev_trad_comment_end_star = true;
+                stages[u32(phase) + 1].enqueue();
             }
 
-            continue;
-        }
+            return unit;
+        });
+    };
 
-        if (m_lexer_item == LexerItem::EndOfLineComment)
+    // Units that entered their classes wait, trees and all, until every
+    // unit has; the others are done
+    auto collect = tbb::make_filter<Unit *, void>(tbb::filter_mode::parallel, [&, this](Unit *unit) {
+        if (!unit->ok || m_options.parse_only)
         {
-            continue;
+            complete(*unit);
         }
+    });
 
-        if (ascii_token_contains("/") && (unicode == '/' || unicode == '*'))
+    // The phases after Enter, for the units of one component of the
+    // dependency graph
+    auto analyze_component = [&, this](std::span<const u32> members) {
+        // Where units depend on each other, each one needs the others'
+        // supertypes before it's analyzed. That's quick, and the order
+        // in which they're resolved is up to the units, so it's serial.
+        if (members.size() > 1)
         {
-            m_lexer_item = unicode == '/' ? LexerItem::EndOfLineComment : LexerItem::TraditionalComment;
-            m_ascii_tok_buf_len = 0;
-            continue;
+            for (u32 i : members)
+            {
+                if (units[i] && units[i]->ok)
+                {
+                    units[i]->compiler.resolve_supertypes();
+                }
+            }
         }
 
-        if (m_lexer_item == LexerItem::WhiteSpace && is_identifier_start(unicode))
-        {
-            m_lexer_item = LexerItem::IdentifierChars;
+        auto finish_phases = [&, this](u32 i) {
+            Unit *unit = units[i].get();
+            if (!unit)
+            {
+                return;
+            }
 
-            if (is_ascii(unicode))
+            run_phase(*unit, CompilePhase::Analyze);
+
+            // Class files name supertypes that may come from other units,
+            // so the names they resolved to go into the key with the source
+            if (unit->ok && m_use_cache)
             {
-                ascii_token_append(unicode);
+                u64 source_key =
+                    m_cache.key(unit->compiler.source(), std::filesystem::path(m_inputs[i]).filename().string());
+                unit->cache_key = xxh64(&source_key, sizeof(source_key), unit->compiler.resolution_key());
+                unit->cached = m_cache.restore(unit->cache_key, m_outputs[i].c_str());
             }
-            else
+
+            run_phase(*unit, CompilePhase::Emit);
+            run_phase(*unit, CompilePhase::Write);
+            complete(*unit);
+        };
+
+        if (members.size() == 1)
+        {
+            finish_phases(members[0]);
+        }
+        else
+        {
+            tbb::parallel_for_each(members.begin(), members.end(), finish_phases);
+        }
+    };
+
+    // Each component starts as soon as the ones it depends on are done
+    auto analyze = [&, this] {
+        tbb::tick_count graph_start = tbb::tick_count::now();
+        std::vector<std::vector<u32>> dependencies(units.size());
+        tbb::parallel_for(u32(0), u32(units.size()), [&](u32 i) {
+            if (units[i])
             {
-                // Only identifiers can contain non-ASCII characters
-                m_lexer_item = LexerItem::Identifier;
+                units[i]->compiler.find_dependencies(dependencies[i]);
+            }
+        });
 
-                // TODO implement
+        DependencyGraph graph{dependencies};
+        double graph_seconds = (tbb::tick_count::now() - graph_start).seconds();
+        u32 components = graph.component_count();
+        std::vector<double> sizes(components);
+        std::vector<double> seconds(components);
+        for (u32 component = 0; component < components; component++)
+        {
+            for (u32 i : graph.units(component))
+            {
+                sizes[component] += double(m_input_sizes[i]);
             }
         }
-        else if (m_lexer_item == LexerItem::IdentifierChars && is_identifier_part(unicode))
+
+        tbb::flow::graph flow{context};
+        std::deque<tbb::flow::continue_node<tbb::flow::continue_msg>> nodes;
+        std::vector<u32> roots;
+        for (u32 component = 0; component < components; component++)
         {
-            if (is_ascii(unicode))
+            nodes.emplace_back(flow, [&, component](const tbb::flow::continue_msg &) {
+                tbb::tick_count begin = tbb::tick_count::now();
+                analyze_component(graph.units(component));
+                seconds[component] = (tbb::tick_count::now() - begin).seconds();
+                return tbb::flow::continue_msg();
+            });
+
+            for (u32 dependency : graph.dependencies(component))
             {
-                ascii_token_append(unicode);
+                tbb::flow::make_edge(nodes[dependency], nodes[component]);
             }
-            else
-            {
-                // Only identifiers can contain non-ASCII characters
-                m_lexer_item = LexerItem::Identifier;
 
-                // TODO implement
+            if (graph.dependencies(component).empty())
+            {
+                roots.push_back(component);
             }
         }
-        else if (m_ascii_tok_buf_len == 0 && unicode == '/')
+
+        // Components at the head of the longest chains go first, with
+        // input size standing in for the time they'll take, so that a
+        // chain doesn't start late and hold up the end (LPT again)
+        std::vector<double> levels = graph.bottom_levels(sizes);
+        std::stable_sort(roots.begin(), roots.end(), [&](u32 a, u32 b) { return levels[a] > levels[b]; });
+        for (u32 component : roots)
         {
-            ascii_token_append(unicode);
+            nodes[component].try_put(tbb::flow::continue_msg());
         }
-        else if(m_lexer_item == LexerItem::IdentifierChars && is_whitespace(unicode))
+
+        flow.wait_for_all();
+
+        DependencyStats &stats = m_dependency_stats;
+        std::vector<u32> path;
+        stats.units = u32(units.size());
+        stats.edges = graph.edge_count();
+        stats.components = components;
+        for (u32 component = 0; component < components; component++)
         {
-            // Perform token disambugation
-            if (ascii_token_contains("const"))
-            {
-                push_diagnostic("unexpected const");
-                goto finish;
-            }
-            else if (ascii_token_contains("goto"))
+            u32 size = u32(graph.units(component).size());
+            stats.cycles += size > 1;
+            stats.largest_component = std::max(stats.largest_component, size);
+        }
+
+        stats.work_seconds = std::accumulate(seconds.begin(), seconds.end(), 0.0);
+        stats.critical_path_seconds = graph.critical_path(seconds, path);
+        stats.critical_path_components = u32(path.size());
+
+        if (m_options.verbose)
+        {
+            println("[dependency graph of {} units in {:.2f} ms: {} edges, {} components, {} cyclic, largest {} units]",
+                    stats.units, graph_seconds * 1000, stats.edges, stats.components, stats.cycles,
+                    stats.largest_component);
+            println("[critical path of {} components: {:.2f} ms of {:.2f} ms analyzing onwards ({:.1f}x parallelism)]",
+                    stats.critical_path_components, stats.critical_path_seconds * 1000, stats.work_seconds * 1000,
+                    stats.critical_path_seconds > 0 ? stats.work_seconds / stats.critical_path_seconds : 1.0);
+        }
+    };
+
+    arena.execute([&] {
+        tbb::parallel_pipeline(max_in_flight,
+                               read & stage(CompilePhase::Lex) & stage(CompilePhase::Parse) &
+                                   stage(CompilePhase::Enter) & collect,
+                               context);
+
+        // Nothing is written before every unit is entered, so by then
+        // every output is known
+        if (!m_options.parse_only && !context.is_group_execution_cancelled())
+        {
+            if (m_options.output_dir && !m_options.memory_output && !m_options.output_jar)
             {
-                push_diagnostic("unexpected goto");
-                goto finish;
+                create_output_directories();
             }
+
+            analyze();
         }
+    });
+
+    if (discovery)
+    {
+        discovery->stop();
+        m_discovery_stats = discovery->stats();
     }
 
-    compilation_successful = true;
+    double makespan = (tbb::tick_count::now() - start).seconds();
 
-finish:
-    if (src_file)
+    m_diagnostics.flush();
+
+    u32 errors = m_diagnostics.error_count();
+    u32 warnings = m_diagnostics.warning_count();
+
+    if (m_options.werror && warnings)
     {
-        std::fclose(src_file);
+        status = false;
     }
 
-    if (dst_file)
+    // A failed build leaves no jar behind, as it does no class files
+    if (!m_writer.finish(status))
     {
-        std::fclose(dst_file);
+        println(stderr, "error: can't write {}", m_options.output_jar);
+        status = false;
     }
 
-    return compilation_successful;
-}
+    if (m_options.diagnostic_format == DiagnosticFormat::Text)
+    {
+        if (m_options.werror && warnings)
+        {
+            println(stderr, "error: warnings found and -Werror specified");
+            errors++;
+        }
 
-CompilerManager::CompilerManager(std::span<const char *> inputs) : m_inputs(inputs)
-{
-    m_outputs.reserve(inputs.size());
-    for (const auto &input : inputs)
+        if (errors)
+        {
+            println(stderr, "{} error{}", errors, errors == 1 ? "" : "s");
+        }
+
+        if (warnings)
+        {
+            println(stderr, "{} warning{}", warnings, warnings == 1 ? "" : "s");
+        }
+
+        // Sources found but never taken count too
+        u32 unit_count = u32(m_inputs.size()) + m_discovery_stats.files - found_taken;
+        u32 skipped = m_skipped + unit_count - finished;
+        if (skipped)
+        {
+            println(stderr, "{} of {} unit{} skipped after the first failure", skipped, unit_count,
+                    unit_count == 1 ? "" : "s");
+        }
+    }
+
+    if (m_options.verbose && !m_unit_seconds.empty())
+    {
+        // No schedule can beat the total work spread evenly across all
+        // threads, nor finish before its longest unit
+        u32 threads = arena.max_concurrency();
+        double work = std::accumulate(m_unit_seconds.begin(), m_unit_seconds.end(), 0.0);
+        double longest = *std::max_element(m_unit_seconds.begin(), m_unit_seconds.end());
+        double ideal = std::max(work / threads, longest);
+        println("[scheduled {} units on {} threads: makespan {:.2f} ms, ideal {:.2f} ms ({:.1f}% efficiency)]",
+                m_inputs.size(), threads, makespan * 1000, ideal * 1000, makespan > 0 ? 100 * ideal / makespan : 100.0);
+    }
+
+    if (m_options.verbose)
     {
-        std::string s = input;
-        if (s.ends_with(".java"))
+        for (u32 phase = 0; phase < COMPILE_PHASE_COUNT; phase++)
         {
-            s.resize(s.size() - 5);
+            // Only the pipelined phases have queues
+            const StageStats &stats = stages[phase];
+            double busy = stats.busy_ns * 1e-9;
+            std::string queue =
+                phase <= u32(CompilePhase::Enter) ? std::format(", max queue {}", stats.max_queued.load()) : "";
+            println("[stage {}: {} units, {:.2f} ms busy, {:.1f} MB/s{}]", compile_phase_name(CompilePhase(phase)),
+                    stats.units.load(), busy * 1000, busy > 0 ? stats.bytes * 1e-6 / busy : 0.0, queue);
         }
 
-        s.append(".class");
-        m_outputs.push_back(s);
+        Interner::Stats stats = global_interner().stats();
+        println("[interned {} symbols ({} lookups, {:.1f}% hits, {} bytes of storage, ~{} bytes of table)]",
+                stats.symbols, stats.lookups, stats.lookups ? 100.0 * stats.hits / stats.lookups : 0.0,
+                stats.storage_bytes, stats.table_bytes);
     }
-}
 
-u8 CompilerManager::run() const
-{
-    std::atomic_bool status = true;
-    tbb::parallel_for(u32(0), u32(m_inputs.size()), [&, this](u32 i) {
-        bool expected = true;
-        status.compare_exchange_strong(expected, compile_unit(i));
-    });
+    if (m_options.verbose && discovery)
+    {
+        const SourceDiscovery::Stats &stats = m_discovery_stats;
+        println("[discovered {} sources in {} directories in {:.2f} ms{}]", stats.files, stats.directories,
+                stats.seconds * 1000, stats.unreadable ? std::format(", {} unreadable", stats.unreadable) : "");
+    }
+
+    if (m_options.time_report)
+    {
+        m_tracer.print_time_report();
+
+        // The walk's own time, which units may have waited on
+        if (discovery)
+        {
+            println("{:<10} {:>8} {:>12.3f}", "discover", m_discovery_stats.files, m_discovery_stats.seconds * 1000);
+        }
+    }
+
+    if (m_options.trace_file && !m_tracer.write_chrome_trace(m_options.trace_file, m_inputs))
+    {
+        println(stderr, "error: can't write trace file {}", m_options.trace_file);
+        status = false;
+    }
+
+    if (m_options.verbose && prefetcher)
+    {
+        println("[prefetched {} of {} inputs with {}, depth {}]", prefetcher->prefetched(), m_inputs.size(),
+                prefetcher->backend_name(), m_options.prefetch_depth);
+    }
+
+    if (m_options.output_jar && status && m_writer.jar_duplicates())
+    {
+        println(stderr, "warning: left {} duplicate class{} out of {}", m_writer.jar_duplicates(),
+                m_writer.jar_duplicates() == 1 ? "" : "es", m_options.output_jar);
+    }
+
+    if (m_options.verbose && m_options.output_jar && !m_options.parse_only && status)
+    {
+        println("[wrote {} with {} entries ({}), {} bytes of class files]", m_options.output_jar,
+                m_writer.jar_entries(), m_options.jar_deflate && jar_deflate_supported() ? "deflated" : "stored",
+                m_writer.bytes_written());
+    }
+
+    if (m_options.verbose && m_use_cache)
+    {
+        BuildCache::Stats stats = m_cache.stats();
+        println("[cache {}: {} hits, {} misses, {} stored]", m_options.cache_dir, stats.hits, stats.misses,
+                stats.stores);
+    }
 
     // Invert the status when returning to match traditional
     // OS process error code conventions, where 0 means success
     return !status.load();
 }
 
-bool CompilerManager::compile_unit(u32 i) const
+void CompilerManager::create_output_directories()
+{
+    std::vector<std::filesystem::path> directories;
+    for (const std::string &output : m_outputs)
+    {
+        directories.push_back(std::filesystem::path(output).parent_path());
+    }
+
+    std::sort(directories.begin(), directories.end());
+    directories.erase(std::unique(directories.begin(), directories.end()), directories.end());
+
+    // Creating a directory that another thread just created isn't an
+    // error, and one that can't be created fails the units writing to it
+    tbb::parallel_for_each(directories.begin(), directories.end(), [](const std::filesystem::path &directory) {
+        std::error_code ec;
+        std::filesystem::create_directories(directory, ec);
+    });
+}
+
+void CompilerManager::finish_unit(Unit &unit, std::atomic_bool &status, tbb::task_group_context &context)
 {
-    Compiler compiler{m_inputs[i], m_outputs[i].c_str()};
-    return compiler.compile();
+    Compiler &compiler = unit.compiler;
+    compiler.finish();
+
+    bool compilation_successful = unit.ok;
+
+    // Units that were interrupted count as skipped, not failed
+    if (!compilation_successful && compiler.cancelled() && !compiler.diagnostics().errors)
+    {
+        m_skipped++;
+    }
+
+    // With -Werror, a warning fails the unit just like an error
+    if (m_options.werror && compiler.diagnostics().warnings)
+    {
+        compilation_successful = false;
+    }
+
+    // Only clean units are cached, so that a hit that skips emitting
+    // can't hide anything it would have reported
+    if (m_use_cache && unit.ok && !unit.cached && compiler.diagnostics().records.empty())
+    {
+        m_cache.store(unit.cache_key, m_outputs[unit.index].c_str());
+    }
+
+    // A jar's entries go out in order, so the ones after a unit that
+    // wrote nothing mustn't wait for it
+    if (!unit.ok || unit.cached)
+    {
+        m_writer.skip(unit.order);
+    }
+
+    m_diagnostics.submit(unit.index, std::move(compiler.diagnostics()));
+    m_unit_seconds[unit.index] = unit.seconds;
+
+    if (!compilation_successful)
+    {
+        status = false;
+
+        // Units that haven't been read yet are dropped, and units in
+        // flight notice the flag and stop early
+        if (m_options.fail_fast && !m_cancelled.exchange(true))
+        {
+            context.cancel_group_execution();
+        }
+    }
 }
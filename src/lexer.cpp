@@ -0,0 +1,2233 @@
+#include "ujavac.h"
+#include "unicode_tables.h"
+
+#include <algorithm>
+#include <cstring>
+#include <format>
+#include <limits>
+
+#include <tbb/parallel_for.h>
+
+// Bytes lexed between checks for cancellation
+constexpr u64 CANCEL_POLL_INTERVAL = 64 * 1024;
+
+constexpr bool is_dec_digit(u32 c)
+{
+    return c >= '0' && c <= '9';
+}
+
+// Looks up a property bit in the generated tables; two loads for any
+// code point
+constexpr bool unicode_property(u32 c, const u64 (UnicodeBlock::*words)[4])
+{
+    const UnicodeBlock &block = unicode_blocks[unicode_block_index[c >> UNICODE_BLOCK_SHIFT]];
+    u32 bit = c & ((1u << UNICODE_BLOCK_SHIFT) - 1);
+    return (block.*words)[bit / 64] >> (bit % 64) & 1;
+}
+
+constexpr bool is_identifier_ignorable(u32 c)
+{
+    if (c < 0x80)
+    {
+        return c <= 0x08 || c >= 0x0E && c <= 0x1B || c == 0x7F;
+    }
+
+    return c < UNICODE_CODE_POINTS && unicode_property(c, &UnicodeBlock::identifier_ignorable);
+}
+
+// JLS 3.8, "Java letter" definition
+constexpr bool is_identifier_start(u32 c)
+{
+    if (c < 0x80)
+    {
+        return c >= 'A' && c <= 'Z' || c >= 'a' && c <= 'z' || c == '$' || c == '_';
+    }
+
+    return c < UNICODE_CODE_POINTS && unicode_property(c, &UnicodeBlock::identifier_start);
+}
+
+// JLS 3.8, "Java letter-or-digit" definition
+constexpr bool is_identifier_part(u32 c)
+{
+    if (c < 0x80)
+    {
+        return is_identifier_start(c) || is_dec_digit(c) || is_identifier_ignorable(c);
+    }
+
+    return c < UNICODE_CODE_POINTS && unicode_property(c, &UnicodeBlock::identifier_part);
+}
+
+static_assert(is_identifier_start(0x00E4) && is_identifier_start(0x4E2D) && is_identifier_start(0x20AC));
+static_assert(is_identifier_part(0x0301) && is_identifier_part(0x0660) && is_identifier_part(0x200B));
+static_assert(!is_identifier_start(0x0301) && !is_identifier_part(0x00A0) && !is_identifier_part(0x2028));
+static_assert(is_identifier_ignorable(0x200B) && !is_identifier_ignorable(0x00E4));
+
+// JLS 3.6
+constexpr bool is_whitespace(u32 c)
+{
+    return c == ' ' || c == '\t' || c == '\f' || c == '\r' || c == '\n';
+}
+
+constexpr bool is_hex_digit(u32 c)
+{
+    return c >= 'A' && c <= 'F' || c >= 'a' && c <= 'f' || is_dec_digit(c);
+}
+
+constexpr bool is_ascii(u32 c)
+{
+    return c < 0x80;
+}
+
+constexpr bool is_utf16_high_surrogate(u16 c)
+{
+    return c >= 0xD800 && c <= 0xDBFF;
+}
+
+constexpr bool is_utf16_low_surrogate(u16 c)
+{
+    return c >= 0xDC00 && c <= 0xDFFF;
+}
+
+constexpr Keyword keyword_list[] = {
+    {"abstract", TokenKind::KwAbstract},
+    {"assert", TokenKind::KwAssert},
+    {"boolean", TokenKind::KwBoolean},
+    {"break", TokenKind::KwBreak},
+    {"byte", TokenKind::KwByte},
+    {"case", TokenKind::KwCase},
+    {"catch", TokenKind::KwCatch},
+    {"char", TokenKind::KwChar},
+    {"class", TokenKind::KwClass},
+    {"const", TokenKind::KwConst},
+    {"continue", TokenKind::KwContinue},
+    {"default", TokenKind::KwDefault},
+    {"do", TokenKind::KwDo},
+    {"double", TokenKind::KwDouble},
+    {"else", TokenKind::KwElse},
+    {"enum", TokenKind::KwEnum},
+    {"extends", TokenKind::KwExtends},
+    {"final", TokenKind::KwFinal},
+    {"finally", TokenKind::KwFinally},
+    {"float", TokenKind::KwFloat},
+    {"for", TokenKind::KwFor},
+    {"if", TokenKind::KwIf},
+    {"goto", TokenKind::KwGoto},
+    {"implements", TokenKind::KwImplements},
+    {"import", TokenKind::KwImport},
+    {"instanceof", TokenKind::KwInstanceof},
+    {"int", TokenKind::KwInt},
+    {"interface", TokenKind::KwInterface},
+    {"long", TokenKind::KwLong},
+    {"native", TokenKind::KwNative},
+    {"new", TokenKind::KwNew},
+    {"package", TokenKind::KwPackage},
+    {"private", TokenKind::KwPrivate},
+    {"protected", TokenKind::KwProtected},
+    {"public", TokenKind::KwPublic},
+    {"return", TokenKind::KwReturn},
+    {"short", TokenKind::KwShort},
+    {"static", TokenKind::KwStatic},
+    {"strictfp", TokenKind::KwStrictfp},
+    {"super", TokenKind::KwSuper},
+    {"switch", TokenKind::KwSwitch},
+    {"synchronized", TokenKind::KwSynchronized},
+    {"this", TokenKind::KwThis},
+    {"throw", TokenKind::KwThrow},
+    {"throws", TokenKind::KwThrows},
+    {"transient", TokenKind::KwTransient},
+    {"try", TokenKind::KwTry},
+    {"void", TokenKind::KwVoid},
+    {"volatile", TokenKind::KwVolatile},
+    {"while", TokenKind::KwWhile},
+    {"_", TokenKind::KwUnderscore},
+    {"exports", TokenKind::KwExports},
+    {"module", TokenKind::KwModule},
+    {"open", TokenKind::KwOpen},
+    {"opens", TokenKind::KwOpens},
+    {"permits", TokenKind::KwPermits},
+    {"provides", TokenKind::KwProvides},
+    {"record", TokenKind::KwRecord},
+    {"requires", TokenKind::KwRequires},
+    {"sealed", TokenKind::KwSealed},
+    {"to", TokenKind::KwTo},
+    {"transitive", TokenKind::KwTransitive},
+    {"uses", TokenKind::KwUses},
+    {"var", TokenKind::KwVar},
+    {"when", TokenKind::KwWhen},
+    {"with", TokenKind::KwWith},
+    {"yield", TokenKind::KwYield},
+    {"true", TokenKind::TrueLiteral},
+    {"false", TokenKind::FalseLiteral},
+    {"null", TokenKind::NullLiteral},
+};
+
+constexpr u32 KEYWORD_MAX_LEN = sizeof("synchronized") - 1;
+constexpr u32 KEYWORD_HASH_BITS = 9;
+constexpr u8 KEYWORD_SLOT_EMPTY = 0xFF;
+
+static_assert(std::size(keyword_list) < KEYWORD_SLOT_EMPTY);
+
+// The length together with the first two and last two characters
+// tells every keyword apart, so the hash never needs to see the rest
+constexpr u64 keyword_key(std::string_view chars)
+{
+    u64 n = chars.size();
+    u64 second = n > 1;
+    u64 second_last = n - 1 - second;
+
+    return n | u64(u8(chars[0])) << 8 | u64(u8(chars[second])) << 16 | u64(u8(chars[second_last])) << 24 |
+           u64(u8(chars[n - 1])) << 32;
+}
+
+constexpr u32 keyword_hash(u64 key, u64 mul)
+{
+    u64 x = key * mul;
+    x ^= x >> 32;
+    x *= mul;
+    return x >> (64 - KEYWORD_HASH_BITS);
+}
+
+struct KeywordTable
+{
+    u64 mul;
+    u8 slots[1 << KEYWORD_HASH_BITS];
+};
+
+// Searches for a multiplier under which keyword_hash() is
+// collision-free over all keywords, i.e. a perfect hash
+constexpr KeywordTable make_keyword_table()
+{
+    KeywordTable table{};
+
+    for (table.mul = 0x9E3779B97F4A7C15;; table.mul += 2)
+    {
+        bool perfect = true;
+
+        for (auto &slot : table.slots)
+        {
+            slot = KEYWORD_SLOT_EMPTY;
+        }
+
+        for (u32 i = 0; i < std::size(keyword_list) && perfect; i++)
+        {
+            u8 &slot = table.slots[keyword_hash(keyword_key(keyword_list[i].text), table.mul)];
+            perfect = slot == KEYWORD_SLOT_EMPTY;
+            slot = i;
+        }
+
+        if (perfect)
+        {
+            return table;
+        }
+    }
+}
+
+constexpr KeywordTable keyword_table = make_keyword_table();
+
+std::span<const Keyword> keywords()
+{
+    return keyword_list;
+}
+
+TokenKind lookup_keyword(std::string_view chars)
+{
+    if (chars.empty() || chars.size() > KEYWORD_MAX_LEN)
+    {
+        return TokenKind::Identifier;
+    }
+
+    u8 slot = keyword_table.slots[keyword_hash(keyword_key(chars), keyword_table.mul)];
+    if (slot == KEYWORD_SLOT_EMPTY || keyword_list[slot].text != chars)
+    {
+        return TokenKind::Identifier;
+    }
+
+    return keyword_list[slot].kind;
+}
+
+// Decodes one UTF-8 sequence (RFC 3629) starting at src[pos]. Returns
+// its length in bytes, or zero if the sequence is malformed: truncated,
+// overlong, a surrogate, or beyond U+10FFFF.
+static u32 decode_utf8(std::span<const u8> src, u64 pos, u32 &raw_unicode)
+{
+    u8 lead = src[pos];
+    u32 len;
+    u8 lo = 0x80;
+    u8 hi = 0xBF;
+
+    if (lead < 0x80)
+    {
+        raw_unicode = lead;
+        return 1;
+    }
+    else if (lead >= 0xC2 && lead <= 0xDF)
+    {
+        len = 2;
+        raw_unicode = lead & 0x1F;
+    }
+    else if (lead >= 0xE0 && lead <= 0xEF)
+    {
+        len = 3;
+        raw_unicode = lead & 0x0F;
+        lo = lead == 0xE0 ? 0xA0 : lo;
+        hi = lead == 0xED ? 0x9F : hi;
+    }
+    else if (lead >= 0xF0 && lead <= 0xF4)
+    {
+        len = 4;
+        raw_unicode = lead & 0x07;
+        lo = lead == 0xF0 ? 0x90 : lo;
+        hi = lead == 0xF4 ? 0x8F : hi;
+    }
+    else
+    {
+        return 0;
+    }
+
+    if (src.size() - pos < len)
+    {
+        return 0;
+    }
+
+    for (u32 i = 1; i < len; i++)
+    {
+        u8 cont = src[pos + i];
+
+        // Only the first continuation byte has a narrowed range
+        if (cont < (i == 1 ? lo : 0x80) || cont > (i == 1 ? hi : 0xBF))
+        {
+            return 0;
+        }
+
+        raw_unicode = (raw_unicode << 6) | (cont & 0x3F);
+    }
+
+    return len;
+}
+
+constexpr bool is_octal_digit(u32 c)
+{
+    return c >= '0' && c <= '7';
+}
+
+constexpr bool is_binary_digit(u32 c)
+{
+    return c == '0' || c == '1';
+}
+
+constexpr bool is_ascii_letter(u32 c)
+{
+    return c >= 'A' && c <= 'Z' || c >= 'a' && c <= 'z';
+}
+
+constexpr bool is_ascii_identifier_part(u32 c)
+{
+    return is_ascii_letter(c) || is_dec_digit(c) || c == '_' || c == '$';
+}
+
+constexpr bool is_radix_digit(u32 c, u32 radix)
+{
+    switch (radix)
+    {
+    case 16:
+        return is_hex_digit(c);
+    case 8:
+        return is_octal_digit(c);
+    case 2:
+        return is_binary_digit(c);
+    default:
+        return is_dec_digit(c);
+    }
+}
+
+// JLS 3.10.6, white space that counts towards indentation
+constexpr bool is_text_block_space(u32 c)
+{
+    return c == ' ' || c == '\t' || c == '\f';
+}
+
+constexpr const char *token_kind_names[] = {
+    "Identifier",
+    "KwAbstract",
+    "KwAssert",
+    "KwBoolean",
+    "KwBreak",
+    "KwByte",
+    "KwCase",
+    "KwCatch",
+    "KwChar",
+    "KwClass",
+    "KwConst",
+    "KwContinue",
+    "KwDefault",
+    "KwDo",
+    "KwDouble",
+    "KwElse",
+    "KwEnum",
+    "KwExtends",
+    "KwFinal",
+    "KwFinally",
+    "KwFloat",
+    "KwFor",
+    "KwIf",
+    "KwGoto",
+    "KwImplements",
+    "KwImport",
+    "KwInstanceof",
+    "KwInt",
+    "KwInterface",
+    "KwLong",
+    "KwNative",
+    "KwNew",
+    "KwPackage",
+    "KwPrivate",
+    "KwProtected",
+    "KwPublic",
+    "KwReturn",
+    "KwShort",
+    "KwStatic",
+    "KwStrictfp",
+    "KwSuper",
+    "KwSwitch",
+    "KwSynchronized",
+    "KwThis",
+    "KwThrow",
+    "KwThrows",
+    "KwTransient",
+    "KwTry",
+    "KwVoid",
+    "KwVolatile",
+    "KwWhile",
+    "KwUnderscore",
+    "KwExports",
+    "KwModule",
+    "KwOpen",
+    "KwOpens",
+    "KwPermits",
+    "KwProvides",
+    "KwRecord",
+    "KwRequires",
+    "KwSealed",
+    "KwTo",
+    "KwTransitive",
+    "KwUses",
+    "KwVar",
+    "KwWhen",
+    "KwWith",
+    "KwYield",
+    "TrueLiteral",
+    "FalseLiteral",
+    "NullLiteral",
+    "IntegerLiteral",
+    "FloatingPointLiteral",
+    "CharacterLiteral",
+    "StringLiteral",
+    "TextBlock",
+    "LParen",
+    "RParen",
+    "LBrace",
+    "RBrace",
+    "LBracket",
+    "RBracket",
+    "Semicolon",
+    "Comma",
+    "Dot",
+    "Ellipsis",
+    "At",
+    "ColonColon",
+    "Assign",
+    "Greater",
+    "Less",
+    "Bang",
+    "Tilde",
+    "Question",
+    "Colon",
+    "Arrow",
+    "EqualEqual",
+    "GreaterEqual",
+    "LessEqual",
+    "BangEqual",
+    "AmpAmp",
+    "BarBar",
+    "PlusPlus",
+    "MinusMinus",
+    "Plus",
+    "Minus",
+    "Star",
+    "Slash",
+    "Amp",
+    "Bar",
+    "Caret",
+    "Percent",
+    "LessLess",
+    "GreaterGreater",
+    "GreaterGreaterGreater",
+    "PlusEqual",
+    "MinusEqual",
+    "StarEqual",
+    "SlashEqual",
+    "AmpEqual",
+    "BarEqual",
+    "CaretEqual",
+    "PercentEqual",
+    "LessLessEqual",
+    "GreaterGreaterEqual",
+    "GreaterGreaterGreaterEqual",
+    "EndOfFile",
+};
+
+static_assert(std::size(token_kind_names) == u32(TokenKind::EndOfFile) + 1);
+
+const char *token_kind_name(TokenKind kind)
+{
+    return token_kind_names[u32(kind)];
+}
+
+constexpr const char *token_kind_texts[] = {
+    "<identifier>",
+    "abstract",
+    "assert",
+    "boolean",
+    "break",
+    "byte",
+    "case",
+    "catch",
+    "char",
+    "class",
+    "const",
+    "continue",
+    "default",
+    "do",
+    "double",
+    "else",
+    "enum",
+    "extends",
+    "final",
+    "finally",
+    "float",
+    "for",
+    "if",
+    "goto",
+    "implements",
+    "import",
+    "instanceof",
+    "int",
+    "interface",
+    "long",
+    "native",
+    "new",
+    "package",
+    "private",
+    "protected",
+    "public",
+    "return",
+    "short",
+    "static",
+    "strictfp",
+    "super",
+    "switch",
+    "synchronized",
+    "this",
+    "throw",
+    "throws",
+    "transient",
+    "try",
+    "void",
+    "volatile",
+    "while",
+    "_",
+    "exports",
+    "module",
+    "open",
+    "opens",
+    "permits",
+    "provides",
+    "record",
+    "requires",
+    "sealed",
+    "to",
+    "transitive",
+    "uses",
+    "var",
+    "when",
+    "with",
+    "yield",
+    "true",
+    "false",
+    "null",
+    "<integer literal>",
+    "<floating-point literal>",
+    "<character literal>",
+    "<string literal>",
+    "<text block>",
+    "(",
+    ")",
+    "{",
+    "}",
+    "[",
+    "]",
+    ";",
+    ",",
+    ".",
+    "...",
+    "@",
+    "::",
+    "=",
+    ">",
+    "<",
+    "!",
+    "~",
+    "?",
+    ":",
+    "->",
+    "==",
+    ">=",
+    "<=",
+    "!=",
+    "&&",
+    "||",
+    "++",
+    "--",
+    "+",
+    "-",
+    "*",
+    "/",
+    "&",
+    "|",
+    "^",
+    "%",
+    "<<",
+    ">>",
+    ">>>",
+    "+=",
+    "-=",
+    "*=",
+    "/=",
+    "&=",
+    "|=",
+    "^=",
+    "%=",
+    "<<=",
+    ">>=",
+    ">>>=",
+    "<EOF>",
+};
+
+static_assert(std::size(token_kind_texts) == u32(TokenKind::EndOfFile) + 1);
+
+const char *token_kind_text(TokenKind kind)
+{
+    return token_kind_texts[u32(kind)];
+}
+
+// Operators and the multi-character separator "::", packed into an
+// integer so that lookup is a single switch
+constexpr u32 pack_operator(std::string_view text)
+{
+    u32 packed = 0;
+    for (char c : text)
+    {
+        packed = packed << 8 | u8(c);
+    }
+
+    return packed;
+}
+
+static bool lookup_operator(std::string_view text, TokenKind &kind)
+{
+    if (text.size() > sizeof(u32))
+    {
+        return false;
+    }
+
+    switch (pack_operator(text))
+    {
+    case pack_operator("::"):
+        kind = TokenKind::ColonColon;
+        break;
+    case pack_operator("="):
+        kind = TokenKind::Assign;
+        break;
+    case pack_operator(">"):
+        kind = TokenKind::Greater;
+        break;
+    case pack_operator("<"):
+        kind = TokenKind::Less;
+        break;
+    case pack_operator("!"):
+        kind = TokenKind::Bang;
+        break;
+    case pack_operator("~"):
+        kind = TokenKind::Tilde;
+        break;
+    case pack_operator("?"):
+        kind = TokenKind::Question;
+        break;
+    case pack_operator(":"):
+        kind = TokenKind::Colon;
+        break;
+    case pack_operator("->"):
+        kind = TokenKind::Arrow;
+        break;
+    case pack_operator("=="):
+        kind = TokenKind::EqualEqual;
+        break;
+    case pack_operator(">="):
+        kind = TokenKind::GreaterEqual;
+        break;
+    case pack_operator("<="):
+        kind = TokenKind::LessEqual;
+        break;
+    case pack_operator("!="):
+        kind = TokenKind::BangEqual;
+        break;
+    case pack_operator("&&"):
+        kind = TokenKind::AmpAmp;
+        break;
+    case pack_operator("||"):
+        kind = TokenKind::BarBar;
+        break;
+    case pack_operator("++"):
+        kind = TokenKind::PlusPlus;
+        break;
+    case pack_operator("--"):
+        kind = TokenKind::MinusMinus;
+        break;
+    case pack_operator("+"):
+        kind = TokenKind::Plus;
+        break;
+    case pack_operator("-"):
+        kind = TokenKind::Minus;
+        break;
+    case pack_operator("*"):
+        kind = TokenKind::Star;
+        break;
+    case pack_operator("/"):
+        kind = TokenKind::Slash;
+        break;
+    case pack_operator("&"):
+        kind = TokenKind::Amp;
+        break;
+    case pack_operator("|"):
+        kind = TokenKind::Bar;
+        break;
+    case pack_operator("^"):
+        kind = TokenKind::Caret;
+        break;
+    case pack_operator("%"):
+        kind = TokenKind::Percent;
+        break;
+    case pack_operator("<<"):
+        kind = TokenKind::LessLess;
+        break;
+    case pack_operator(">>"):
+        kind = TokenKind::GreaterGreater;
+        break;
+    case pack_operator(">>>"):
+        kind = TokenKind::GreaterGreaterGreater;
+        break;
+    case pack_operator("+="):
+        kind = TokenKind::PlusEqual;
+        break;
+    case pack_operator("-="):
+        kind = TokenKind::MinusEqual;
+        break;
+    case pack_operator("*="):
+        kind = TokenKind::StarEqual;
+        break;
+    case pack_operator("/="):
+        kind = TokenKind::SlashEqual;
+        break;
+    case pack_operator("&="):
+        kind = TokenKind::AmpEqual;
+        break;
+    case pack_operator("|="):
+        kind = TokenKind::BarEqual;
+        break;
+    case pack_operator("^="):
+        kind = TokenKind::CaretEqual;
+        break;
+    case pack_operator("%="):
+        kind = TokenKind::PercentEqual;
+        break;
+    case pack_operator("<<="):
+        kind = TokenKind::LessLessEqual;
+        break;
+    case pack_operator(">>="):
+        kind = TokenKind::GreaterGreaterEqual;
+        break;
+    case pack_operator(">>>="):
+        kind = TokenKind::GreaterGreaterGreaterEqual;
+        break;
+    default:
+        return false;
+    }
+
+    return true;
+}
+
+template <class String> void append_utf8(String &out, u32 c)
+{
+    if (c < 0x80)
+    {
+        out.push_back(char(c));
+    }
+    else if (c < 0x800)
+    {
+        out.push_back(char(0xC0 | c >> 6));
+        out.push_back(char(0x80 | c & 0x3F));
+    }
+    else if (c < 0x10000)
+    {
+        out.push_back(char(0xE0 | c >> 12));
+        out.push_back(char(0x80 | c >> 6 & 0x3F));
+        out.push_back(char(0x80 | c & 0x3F));
+    }
+    else
+    {
+        out.push_back(char(0xF0 | c >> 18));
+        out.push_back(char(0x80 | c >> 12 & 0x3F));
+        out.push_back(char(0x80 | c >> 6 & 0x3F));
+        out.push_back(char(0x80 | c & 0x3F));
+    }
+}
+
+// JLS 3.10.1, 3.10.2; digits is the literal's text with underscores removed
+static bool classify_number(std::string_view text, std::string_view digits, TokenKind &kind, DiagnosticCode &error)
+{
+    u32 radix = 10;
+    u32 prefix = 0;
+
+    if (text.size() > 1 && text[0] == '0' && (text[1] | 0x20) == 'x')
+    {
+        radix = 16;
+        prefix = 2;
+    }
+    else if (text.size() > 1 && text[0] == '0' && (text[1] | 0x20) == 'b')
+    {
+        radix = 2;
+        prefix = 2;
+    }
+
+    // Underscores may only appear between digits
+    for (u64 i = prefix; i < text.size(); i++)
+    {
+        if (text[i] != '_')
+        {
+            continue;
+        }
+
+        u64 j = i;
+        while (j < text.size() && text[j] == '_')
+        {
+            j++;
+        }
+
+        if (i == prefix || j == text.size() || !is_radix_digit(text[i - 1], radix) || !is_radix_digit(text[j], radix))
+        {
+            error = DiagnosticCode::IllegalUnderscore;
+            return false;
+        }
+
+        i = j;
+    }
+
+    digits.remove_prefix(prefix);
+
+    auto all_digits = [](std::string_view s, u32 radix) {
+        for (char c : s)
+        {
+            if (!is_radix_digit(c, radix))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    };
+
+    char suffix = digits.empty() ? 0 : digits.back() | 0x20;
+    u64 exponent = digits.find_first_of(radix == 16 ? "pP" : "eE");
+    bool is_float = digits.find('.') != std::string_view::npos || exponent != std::string_view::npos ||
+                    radix == 10 && (suffix == 'f' || suffix == 'd');
+
+    if (!is_float || radix == 2)
+    {
+        std::string_view body = digits;
+        if (suffix == 'l')
+        {
+            body.remove_suffix(1);
+        }
+
+        if (body.empty() || !all_digits(body, radix))
+        {
+            switch (radix)
+            {
+            case 16:
+                error = DiagnosticCode::MalformedHexLiteral;
+                return false;
+            case 2:
+                error = DiagnosticCode::MalformedBinaryLiteral;
+                return false;
+            default:
+                error = DiagnosticCode::MalformedIntegerLiteral;
+                return false;
+            }
+        }
+
+        // Leading zeros make an octal literal (JLS 3.10.1)
+        if (radix == 10 && body.size() > 1 && body[0] == '0' && !all_digits(body, 8))
+        {
+            error = DiagnosticCode::IllegalOctalDigit;
+            return false;
+        }
+
+        kind = TokenKind::IntegerLiteral;
+        return true;
+    }
+
+    std::string_view mantissa = digits.substr(0, exponent);
+    std::string_view rest = exponent == std::string_view::npos ? std::string_view{} : digits.substr(exponent + 1);
+
+    if (exponent == std::string_view::npos && (suffix == 'f' || suffix == 'd'))
+    {
+        mantissa.remove_suffix(1);
+    }
+    else if (!rest.empty() && (suffix == 'f' || suffix == 'd'))
+    {
+        rest.remove_suffix(1);
+    }
+
+    // Hexadecimal floating-point literals require a binary exponent
+    if (radix == 16 && exponent == std::string_view::npos)
+    {
+        error = DiagnosticCode::MalformedFloatLiteral;
+        return false;
+    }
+
+    u64 dot = mantissa.find('.');
+    std::string_view whole = mantissa.substr(0, dot);
+    std::string_view fraction = dot == std::string_view::npos ? std::string_view{} : mantissa.substr(dot + 1);
+
+    if (whole.size() + fraction.size() == 0 || !all_digits(whole, radix) || !all_digits(fraction, radix))
+    {
+        error = DiagnosticCode::MalformedFloatLiteral;
+        return false;
+    }
+
+    if (exponent != std::string_view::npos)
+    {
+        if (!rest.empty() && (rest[0] == '+' || rest[0] == '-'))
+        {
+            rest.remove_prefix(1);
+        }
+
+        if (rest.empty() || !all_digits(rest, 10))
+        {
+            error = DiagnosticCode::MalformedFloatLiteral;
+            return false;
+        }
+    }
+
+    kind = TokenKind::FloatingPointLiteral;
+    return true;
+}
+
+// JLS 3.10.7; text blocks also allow escaping a line terminator
+static bool interpret_escapes(std::string_view raw, ArenaString &out, bool text_block)
+{
+    for (u64 i = 0; i < raw.size(); i++)
+    {
+        if (raw[i] != '\\')
+        {
+            out.push_back(raw[i]);
+            continue;
+        }
+
+        // The lexer never ends a literal on an escaping backslash
+        char c = raw[++i];
+        switch (c)
+        {
+        case 'b':
+            out.push_back('\b');
+            break;
+        case 's':
+            out.push_back(' ');
+            break;
+        case 't':
+            out.push_back('\t');
+            break;
+        case 'n':
+            out.push_back('\n');
+            break;
+        case 'f':
+            out.push_back('\f');
+            break;
+        case 'r':
+            out.push_back('\r');
+            break;
+        case '"':
+        case '\'':
+        case '\\':
+            out.push_back(c);
+            break;
+        case '\n':
+            if (!text_block)
+            {
+                return false;
+            }
+            break;
+        default: {
+            if (!is_octal_digit(c))
+            {
+                return false;
+            }
+
+            // \[0-3][0-7][0-7] or \[0-7][0-7]
+            u32 max_len = c <= '3' ? 3 : 2;
+            u32 value = c - '0';
+            for (u32 len = 1; len < max_len && i + 1 < raw.size() && is_octal_digit(raw[i + 1]); len++)
+            {
+                value = value * 8 + raw[++i] - '0';
+            }
+
+            append_utf8(out, value);
+            break;
+        }
+        }
+    }
+
+    return true;
+}
+
+// JLS 3.10.6, removes incidental white space from the content of a
+// text block and normalizes its line terminators to LF. Returns false
+// if the lines mix different white space in their indentation.
+static bool strip_text_block(std::string_view raw, ArenaString &out, Arena &arena)
+{
+    ArenaVector<std::string_view> lines{arena};
+    ArenaString normalized{arena};
+
+    for (u64 i = 0; i < raw.size(); i++)
+    {
+        if (raw[i] == '\r')
+        {
+            normalized.push_back('\n');
+            i += i + 1 < raw.size() && raw[i + 1] == '\n';
+        }
+        else
+        {
+            normalized.push_back(raw[i]);
+        }
+    }
+
+    for (u64 start = 0;;)
+    {
+        u64 end = normalized.find('\n', start);
+        lines.push_back(std::string_view(normalized).substr(start, end - start));
+
+        if (end == std::string::npos)
+        {
+            break;
+        }
+
+        start = end + 1;
+    }
+
+    auto indent_of = [](std::string_view line) {
+        u64 indent = 0;
+        while (indent < line.size() && is_text_block_space(line[indent]))
+        {
+            indent++;
+        }
+
+        return indent;
+    };
+
+    // The line holding the closing delimiter always counts, even
+    // when blank, so that it can control the indentation
+    u64 min_indent = ~u64(0);
+    std::string_view longest_indent;
+    bool consistent = true;
+    for (u64 i = 0; i < lines.size(); i++)
+    {
+        u64 indent = indent_of(lines[i]);
+        if (indent < lines[i].size() || i + 1 == lines.size())
+        {
+            min_indent = std::min(min_indent, indent);
+
+            // The removed indentation is only well defined if all lines
+            // agree on it, e.g. don't mix tabs and spaces
+            std::string_view line_indent = lines[i].substr(0, indent);
+            u64 common = std::min(longest_indent.size(), line_indent.size());
+            consistent &= longest_indent.substr(0, common) == line_indent.substr(0, common);
+            if (line_indent.size() > longest_indent.size())
+            {
+                longest_indent = line_indent;
+            }
+        }
+    }
+
+    for (u64 i = 0; i < lines.size(); i++)
+    {
+        std::string_view line = lines[i];
+
+        if (indent_of(line) == line.size())
+        {
+            line = {};
+        }
+        else
+        {
+            line.remove_prefix(min_indent);
+            while (is_text_block_space(line.back()))
+            {
+                line.remove_suffix(1);
+            }
+        }
+
+        out.append(line);
+        if (i + 1 < lines.size())
+        {
+            out.push_back('\n');
+        }
+    }
+
+    return consistent;
+}
+
+void TokenBuffer::clear()
+{
+    kinds.clear();
+    offsets.clear();
+    lengths.clear();
+    values.clear();
+    line_starts.clear();
+    value_chars.clear();
+    value_ends.clear();
+
+    // Value zero is the empty placeholder used by valueless tokens
+    value_ends.push_back(0);
+}
+
+u32 TokenBuffer::add_value(std::string_view text)
+{
+    value_chars.append(text);
+    value_ends.push_back(value_chars.size());
+    return value_ends.size() - 1;
+}
+
+std::string_view TokenBuffer::value(u32 index) const
+{
+    u32 begin = index ? value_ends[index - 1] : 0;
+    return std::string_view(value_chars).substr(begin, value_ends[index] - begin);
+}
+
+void TokenBuffer::append(const TokenBuffer &other)
+{
+    // Literal values are numbered from one in each buffer
+    u32 value_base = value_ends.size() - 1;
+    u32 chars_base = value_chars.size();
+
+    kinds.insert(kinds.end(), other.kinds.begin(), other.kinds.end());
+    offsets.insert(offsets.end(), other.offsets.begin(), other.offsets.end());
+    lengths.insert(lengths.end(), other.lengths.begin(), other.lengths.end());
+
+    values.reserve(values.size() + other.values.size());
+    for (u32 i = 0; i < other.size(); i++)
+    {
+        bool literal = other.kinds[i] >= TokenKind::IntegerLiteral && other.kinds[i] <= TokenKind::TextBlock;
+        values.push_back(literal ? other.values[i] + value_base : other.values[i]);
+    }
+
+    line_starts.insert(line_starts.end(), other.line_starts.begin(), other.line_starts.end());
+
+    value_chars.append(other.value_chars);
+    for (u32 i = 1; i < other.value_ends.size(); i++)
+    {
+        value_ends.push_back(chars_base + other.value_ends[i]);
+    }
+}
+
+SourcePosition TokenBuffer::position(u32 offset, std::span<const u8> src) const
+{
+    auto next_line = std::upper_bound(line_starts.begin(), line_starts.end(), offset);
+    u32 line = next_line - line_starts.begin();
+    u32 line_start = line ? next_line[-1] : 0;
+    u32 col = 1;
+
+    // Count code points, i.e. everything except continuation bytes
+    for (u32 i = line_start; i < offset && i < src.size(); i++)
+    {
+        col += (src[i] & 0xC0) != 0x80;
+    }
+
+    return {std::max(line, 1u), col};
+}
+
+u64 TokenBuffer::memory_usage() const
+{
+    return kinds.capacity() * sizeof(TokenKind) + offsets.capacity() * sizeof(u32) +
+           lengths.capacity() * sizeof(u32) + values.capacity() * sizeof(u32) + line_starts.capacity() * sizeof(u32) +
+           value_chars.capacity() + value_ends.capacity() * sizeof(u32);
+}
+
+Lexer::Lexer(std::span<const u8> src, TokenBuffer &tokens, Arena &arena, DiagnosticBuffer &diagnostics,
+             const CompilerOptions &options, const std::atomic_bool *cancelled)
+    : m_src(src), m_tokens(tokens), m_arena(arena), m_diagnostics(diagnostics), m_options(options),
+      m_interner(global_interner()), m_cancelled(cancelled)
+{
+}
+
+bool Lexer::fail(u32 offset, DiagnosticCode code, u32 arg)
+{
+    m_diagnostics.report(code, offset, arg);
+    return false;
+}
+
+// JLS 3.4; lines after a CR LF pair start behind the LF
+void Lexer::track_line(u32 raw_unicode, u64 pos)
+{
+    if (raw_unicode == '\n' || raw_unicode == '\r' && (pos + 1 == m_src.size() || m_src[pos + 1] != '\n'))
+    {
+        m_tokens.line_starts.push_back(pos + 1);
+    }
+}
+
+// Length of the input prefix which the lexer would consume without any
+// effect besides advancing the position, given its current state.
+u64 Lexer::skippable_run(u64 pos, u64 end) const
+{
+    const SimdKernels &simd = simd_kernels();
+    const u8 *data = m_src.data() + pos;
+    u64 size = end - pos;
+
+    switch (m_lexer_item)
+    {
+    case LexerItem::TraditionalComment:
+        // A pending "*" could be completed by the first byte
+        return m_prev_trad_comment_end_star ? 0 : simd.comment_run(data, size);
+    case LexerItem::EndOfLineComment:
+        return simd.line_comment_run(data, size);
+    case LexerItem::WhiteSpace:
+        return simd.whitespace_run(data, size);
+    default:
+        return 0;
+    }
+}
+
+// Unicode escape processing (JLS 3.3) on a single reconstructed
+// code point; completed characters are handed to the lexer.
+bool Lexer::unescape(u32 raw_unicode, u32 begin, u32 end)
+{
+    if (m_esc_utf16_remaining)
+    {
+        // The start of a Unicode escape sequence can contain more than one "u"
+        if (m_esc_utf16_remaining == 4 && raw_unicode == 'u')
+        {
+            return true;
+        }
+
+        if (!is_hex_digit(raw_unicode))
+        {
+            return fail(begin, DiagnosticCode::IllegalUnicodeEscapeChar, raw_unicode);
+        }
+
+        --m_esc_utf16_remaining;
+
+        u16 val = is_dec_digit(raw_unicode) ? raw_unicode - '0' : (raw_unicode | 0x20) - 'a' + 10;
+        m_esc_utf16[m_esc_utf16_len] |= val << (4 * m_esc_utf16_remaining);
+
+        if (m_esc_utf16_remaining)
+        {
+            return true;
+        }
+
+        m_esc_utf16_len++;
+
+        // The input character after reconstruction
+        // and Unicode escape sequence processing.
+        // Lexing happens from this representation.
+        u32 unicode;
+
+        if (m_esc_utf16_len == 1)
+        {
+            if (is_utf16_high_surrogate(m_esc_utf16[0]))
+            {
+                // We expect a low surrogate to follow; parse it now
+                return true;
+            }
+
+            if (is_utf16_low_surrogate(m_esc_utf16[0]))
+            {
+                return fail(m_esc_begin, DiagnosticCode::ExpectedBmpUnicodeEscape);
+            }
+
+            unicode = m_esc_utf16[0];
+        }
+        else
+        {
+            if (!is_utf16_high_surrogate(m_esc_utf16[0]) || !is_utf16_low_surrogate(m_esc_utf16[1]))
+            {
+                return fail(m_esc_begin, DiagnosticCode::InvalidUnicodeEscape);
+            }
+
+            unicode = 0x10000 + (u32(m_esc_utf16[0] & 0x3FF) << 10) | (m_esc_utf16[1] & 0x3FF);
+        }
+
+        m_esc_utf16_len = 0;
+
+        // A character produced by an escape never
+        // starts another escape, even a backslash
+        return lex_char(unicode, m_esc_begin, end);
+    }
+
+    if (m_prev_backslash)
+    {
+        m_prev_backslash = false;
+
+        // A backslash is only eligible to start an escape when it is
+        // preceded by an even number of contiguous raw backslashes
+        if (raw_unicode == 'u' && m_raw_backslash_count % 2 == 1)
+        {
+            m_raw_backslash_count = 0;
+            m_esc_utf16_remaining = 4;
+            m_esc_utf16[m_esc_utf16_len] = 0;
+
+            // The low half of a surrogate pair extends the high half
+            if (!m_esc_utf16_len)
+            {
+                m_esc_begin = m_backslash_begin;
+            }
+
+            return true;
+        }
+
+        if (m_esc_utf16_len)
+        {
+            // If we get here, then the UTF-16 decoder was
+            // waiting on a low surrogate which never came
+            return fail(m_esc_begin, DiagnosticCode::UnterminatedUnicodeEscape);
+        }
+
+        if (!lex_char('\\', m_backslash_begin, m_backslash_begin + 1))
+        {
+            return false;
+        }
+    }
+
+    if (raw_unicode == '\\')
+    {
+        m_raw_backslash_count++;
+        m_prev_backslash = true;
+        m_backslash_begin = begin;
+        return true;
+    }
+
+    m_raw_backslash_count = 0;
+
+    if (m_esc_utf16_len)
+    {
+        return fail(m_esc_begin, DiagnosticCode::UnterminatedUnicodeEscape);
+    }
+
+    return lex_char(raw_unicode, begin, end);
+}
+
+void Lexer::append_text(u32 unicode)
+{
+    append_utf8(m_tok_text, unicode);
+}
+
+void Lexer::emit(TokenKind kind, u32 value)
+{
+    m_tokens.push(kind, m_tok_begin, m_tok_end - m_tok_begin, value);
+}
+
+bool Lexer::start_token(u32 unicode, u32 begin, u32 end)
+{
+    m_tok_begin = begin;
+    m_tok_end = end;
+    m_tok_text.clear();
+
+    if (is_whitespace(unicode))
+    {
+        return true;
+    }
+
+    if (is_identifier_start(unicode))
+    {
+        m_lexer_item = is_ascii(unicode) ? LexerItem::IdentifierChars : LexerItem::Identifier;
+        append_text(unicode);
+        return true;
+    }
+
+    if (is_dec_digit(unicode))
+    {
+        m_lexer_item = LexerItem::NumericLiteral;
+        m_num_radix = 10;
+        m_num_dot = false;
+        m_num_exponent = false;
+        append_text(unicode);
+        return true;
+    }
+
+    TokenKind kind;
+    switch (unicode)
+    {
+    case '(':
+        kind = TokenKind::LParen;
+        break;
+    case ')':
+        kind = TokenKind::RParen;
+        break;
+    case '{':
+        kind = TokenKind::LBrace;
+        break;
+    case '}':
+        kind = TokenKind::RBrace;
+        break;
+    case '[':
+        kind = TokenKind::LBracket;
+        break;
+    case ']':
+        kind = TokenKind::RBracket;
+        break;
+    case ';':
+        kind = TokenKind::Semicolon;
+        break;
+    case ',':
+        kind = TokenKind::Comma;
+        break;
+    case '@':
+        kind = TokenKind::At;
+        break;
+    case '.':
+        m_lexer_item = LexerItem::Dot;
+        return true;
+    case '\'':
+        m_lexer_item = LexerItem::CharacterLiteral;
+        m_lit_backslash = false;
+        return true;
+    case '"':
+        m_lexer_item = LexerItem::StringLiteral;
+        m_lit_backslash = false;
+        return true;
+    default:
+        append_text(unicode);
+        if (is_ascii(unicode) && lookup_operator(m_tok_text, kind))
+        {
+            m_lexer_item = LexerItem::Operator;
+            return true;
+        }
+
+        return fail(begin, DiagnosticCode::IllegalCharacter, unicode);
+    }
+
+    emit(kind);
+    return true;
+}
+
+bool Lexer::end_identifier()
+{
+    TokenKind kind = m_lexer_item == LexerItem::IdentifierChars ? lookup_keyword(m_tok_text) : TokenKind::Identifier;
+
+    // Perform token disambugation
+    if (kind == TokenKind::KwConst)
+    {
+        return fail(m_tok_begin, DiagnosticCode::UnexpectedConst);
+    }
+    else if (kind == TokenKind::KwGoto)
+    {
+        return fail(m_tok_begin, DiagnosticCode::UnexpectedGoto);
+    }
+
+    // Contextual keywords can still turn out to be identifiers
+    bool has_name = kind == TokenKind::Identifier || is_contextual_keyword(kind);
+    emit(kind, has_name ? m_interner.intern(m_tok_text) : 0);
+    return true;
+}
+
+void Lexer::end_operator()
+{
+    // Operators are only ever extended into other valid operators
+    TokenKind kind;
+    lookup_operator(m_tok_text, kind);
+    emit(kind);
+}
+
+bool Lexer::continues_number(u32 unicode) const
+{
+    if (is_dec_digit(unicode) || unicode == '_')
+    {
+        return true;
+    }
+
+    if (unicode == '.')
+    {
+        return !m_num_dot && !m_num_exponent && m_num_radix != 2;
+    }
+
+    // A sign only belongs to the literal right after an exponent indicator
+    if (unicode == '+' || unicode == '-')
+    {
+        return m_num_exponent && (m_tok_text.back() | 0x20) == (m_num_radix == 16 ? 'p' : 'e');
+    }
+
+    return is_ascii_letter(unicode);
+}
+
+bool Lexer::end_number()
+{
+    ArenaScope scratch{m_arena};
+    ArenaString value{m_arena};
+
+    for (char c : m_tok_text)
+    {
+        if (c != '_')
+        {
+            value.push_back(c);
+        }
+    }
+
+    TokenKind kind;
+    DiagnosticCode error;
+    if (!classify_number(m_tok_text, value, kind, error))
+    {
+        return fail(m_tok_begin, error);
+    }
+
+    emit(kind, m_tokens.add_value(value));
+    return true;
+}
+
+bool Lexer::end_quoted(TokenKind kind)
+{
+    ArenaScope scratch{m_arena};
+    std::string_view raw = m_tok_text;
+    ArenaString stripped{m_arena};
+    ArenaString value{m_arena};
+
+    if (kind == TokenKind::TextBlock)
+    {
+        if (!strip_text_block(raw, stripped, m_arena))
+        {
+            m_diagnostics.report(DiagnosticCode::InconsistentTextBlockIndentation, m_tok_begin);
+        }
+
+        raw = stripped;
+    }
+
+    if (!interpret_escapes(raw, value, kind == TokenKind::TextBlock))
+    {
+        return fail(m_tok_begin, DiagnosticCode::IllegalEscape);
+    }
+
+    if (kind == TokenKind::CharacterLiteral)
+    {
+        if (value.empty())
+        {
+            return fail(m_tok_begin, DiagnosticCode::EmptyCharLiteral);
+        }
+
+        // Exactly one UTF-16 code unit, so no supplementary characters
+        if (u8(value[0]) >= 0xF0 || value.size() > 1 + (u8(value[0]) >= 0xC0) + (u8(value[0]) >= 0xE0))
+        {
+            return fail(m_tok_begin, DiagnosticCode::UnclosedCharLiteral);
+        }
+    }
+
+    emit(kind, m_tokens.add_value(value));
+    m_lexer_item = LexerItem::WhiteSpace;
+    return true;
+}
+
+bool Lexer::lex_char(u32 unicode, u32 begin, u32 end)
+{
+    // A character that ends the current token is dispatched
+    // again in the white space state, where it starts the next
+    for (;;)
+    {
+        switch (m_lexer_item)
+        {
+        case LexerItem::WhiteSpace:
+            return start_token(unicode, begin, end);
+
+        case LexerItem::TraditionalComment:
+            if (m_prev_trad_comment_end_star && unicode == '/')
+            {
+                m_lexer_item = LexerItem::WhiteSpace;
+                m_prev_trad_comment_end_star = false;
+            }
+            else
+            {
+                m_prev_trad_comment_end_star = unicode == '*';
+            }
+
+            return true;
+
+        case LexerItem::EndOfLineComment:
+            if (unicode == '\r' || unicode == '\n')
+            {
+                m_lexer_item = LexerItem::WhiteSpace;
+            }
+
+            return true;
+
+        case LexerItem::IdentifierChars:
+        case LexerItem::Identifier:
+            if (is_identifier_part(unicode))
+            {
+                // Only identifiers can contain non-ASCII characters
+                if (!is_ascii(unicode))
+                {
+                    m_lexer_item = LexerItem::Identifier;
+                }
+
+                // Identifiers are the same regardless of ignorable characters
+                if (!is_identifier_ignorable(unicode))
+                {
+                    append_text(unicode);
+                }
+
+                m_tok_end = end;
+                return true;
+            }
+
+            if (!end_identifier())
+            {
+                return false;
+            }
+
+            break;
+
+        case LexerItem::Operator:
+            if (m_tok_text == "/" && (unicode == '/' || unicode == '*'))
+            {
+                m_lexer_item = unicode == '/' ? LexerItem::EndOfLineComment : LexerItem::TraditionalComment;
+                m_prev_trad_comment_end_star = false;
+                return true;
+            }
+
+            if (is_ascii(unicode))
+            {
+                TokenKind kind;
+                m_tok_text.push_back(char(unicode));
+
+                if (lookup_operator(m_tok_text, kind))
+                {
+                    m_tok_end = end;
+                    return true;
+                }
+
+                m_tok_text.pop_back();
+            }
+
+            end_operator();
+            break;
+
+        case LexerItem::Dot:
+            if (is_dec_digit(unicode))
+            {
+                m_lexer_item = LexerItem::NumericLiteral;
+                m_num_radix = 10;
+                m_num_dot = true;
+                m_num_exponent = false;
+                m_tok_text = ".";
+                append_text(unicode);
+                m_tok_end = end;
+                return true;
+            }
+
+            if (unicode == '.')
+            {
+                m_lexer_item = LexerItem::DotDot;
+                m_dot2_begin = begin;
+                m_tok_end = end;
+                return true;
+            }
+
+            emit(TokenKind::Dot);
+            break;
+
+        case LexerItem::DotDot:
+            if (unicode == '.')
+            {
+                m_tok_end = end;
+                emit(TokenKind::Ellipsis);
+                m_lexer_item = LexerItem::WhiteSpace;
+                return true;
+            }
+            else
+            {
+                // Not an ellipsis but two dots, of which the second
+                // may still start a floating-point literal
+                u32 dot2_end = m_tok_end;
+                m_tok_end = m_dot2_begin;
+                emit(TokenKind::Dot);
+
+                m_tok_begin = m_dot2_begin;
+                m_tok_end = dot2_end;
+                m_lexer_item = LexerItem::Dot;
+                continue;
+            }
+
+        case LexerItem::NumericLiteral:
+            if (continues_number(unicode))
+            {
+                u32 lower = unicode | 0x20;
+
+                if (unicode == '.')
+                {
+                    m_num_dot = true;
+                }
+                else if (m_tok_text == "0" && (lower == 'x' || lower == 'b'))
+                {
+                    m_num_radix = lower == 'x' ? 16 : 2;
+                }
+                else if (m_num_radix == 16 ? lower == 'p' : m_num_radix == 10 && lower == 'e')
+                {
+                    m_num_exponent = true;
+                }
+
+                append_text(unicode);
+                m_tok_end = end;
+                return true;
+            }
+
+            if (!end_number())
+            {
+                return false;
+            }
+
+            break;
+
+        case LexerItem::CharacterLiteral:
+        case LexerItem::StringLiteral: {
+            bool is_char = m_lexer_item == LexerItem::CharacterLiteral;
+            m_tok_end = end;
+
+            if (unicode == '\r' || unicode == '\n')
+            {
+                return fail(m_tok_begin, is_char ? DiagnosticCode::UnclosedCharLiteral : DiagnosticCode::UnclosedStringLiteral);
+            }
+
+            if (!m_lit_backslash && unicode == (is_char ? '\'' : '"'))
+            {
+                if (!is_char && m_tok_text.empty())
+                {
+                    m_lexer_item = LexerItem::EmptyString;
+                    return true;
+                }
+
+                return end_quoted(is_char ? TokenKind::CharacterLiteral : TokenKind::StringLiteral);
+            }
+
+            m_lit_backslash = !m_lit_backslash && unicode == '\\';
+            append_text(unicode);
+            return true;
+        }
+
+        case LexerItem::EmptyString:
+            if (unicode == '"')
+            {
+                m_lexer_item = LexerItem::TextBlockOpen;
+                m_tok_end = end;
+                return true;
+            }
+
+            emit(TokenKind::StringLiteral, m_tokens.add_value(""));
+            break;
+
+        case LexerItem::TextBlockOpen:
+            m_tok_end = end;
+
+            if (is_text_block_space(unicode))
+            {
+                return true;
+            }
+
+            if (unicode == '\r' || unicode == '\n')
+            {
+                m_lexer_item = LexerItem::TextBlock;
+                m_lit_backslash = false;
+                m_tb_quotes = 0;
+                m_tb_skip_lf = unicode == '\r';
+                return true;
+            }
+
+            return fail(m_tok_begin, DiagnosticCode::IllegalTextBlockOpen);
+
+        case LexerItem::TextBlock:
+            m_tok_end = end;
+
+            // The opening line terminator isn't part of the content
+            if (m_tb_skip_lf && unicode == '\n')
+            {
+                m_tb_skip_lf = false;
+                return true;
+            }
+
+            m_tb_skip_lf = false;
+
+            // Quotes are held back until it's clear they don't close the block
+            if (!m_lit_backslash && unicode == '"')
+            {
+                return ++m_tb_quotes < 3 || end_quoted(TokenKind::TextBlock);
+            }
+
+            m_tok_text.append(m_tb_quotes, '"');
+            m_tb_quotes = 0;
+
+            m_lit_backslash = !m_lit_backslash && unicode == '\\';
+            append_text(unicode);
+            return true;
+        }
+
+        m_lexer_item = LexerItem::WhiteSpace;
+    }
+}
+
+bool Lexer::finish()
+{
+    if (m_esc_utf16_remaining || m_esc_utf16_len)
+    {
+        return fail(m_esc_begin, DiagnosticCode::UnterminatedUnicodeEscape);
+    }
+
+    if (m_prev_backslash)
+    {
+        m_prev_backslash = false;
+
+        if (!lex_char('\\', m_backslash_begin, m_backslash_begin + 1))
+        {
+            return false;
+        }
+    }
+
+    u32 eof = m_src.size();
+
+    switch (m_lexer_item)
+    {
+    case LexerItem::TraditionalComment:
+        return fail(m_tok_begin, DiagnosticCode::UnclosedComment);
+    case LexerItem::CharacterLiteral:
+        return fail(m_tok_begin, DiagnosticCode::UnclosedCharLiteral);
+    case LexerItem::StringLiteral:
+        return fail(m_tok_begin, DiagnosticCode::UnclosedStringLiteral);
+    case LexerItem::TextBlockOpen:
+    case LexerItem::TextBlock:
+        return fail(m_tok_begin, DiagnosticCode::UnclosedTextBlock);
+    default:
+        // White space ends whatever token is still pending
+        if (!lex_char(' ', eof, eof))
+        {
+            return false;
+        }
+    }
+
+    m_tok_begin = eof;
+    m_tok_end = eof;
+    emit(TokenKind::EndOfFile);
+    return true;
+}
+
+void Lexer::reset()
+{
+    m_tokens.clear();
+    m_esc_utf16_len = 0;
+    m_esc_utf16_remaining = 0;
+    m_prev_backslash = false;
+    m_raw_backslash_count = 0;
+    m_lexer_item = LexerItem::WhiteSpace;
+    m_prev_trad_comment_end_star = false;
+    m_tok_begin = 0;
+    m_tok_end = 0;
+    m_tok_text.clear();
+}
+
+bool Lexer::run()
+{
+    return start() && scan(0, m_src.size()) && finish();
+}
+
+bool Lexer::start()
+{
+    reset();
+
+    if (m_src.size() > std::numeric_limits<u32>::max())
+    {
+        return fail(0, DiagnosticCode::InputTooLarge);
+    }
+
+    // JLS 3.5, a trailing Ctrl-Z is ignored
+    if (!m_src.empty() && m_src.back() == 0x1A)
+    {
+        m_src = m_src.first(m_src.size() - 1);
+    }
+
+    m_tokens.line_starts.push_back(0);
+    return true;
+}
+
+void Lexer::start_chunk()
+{
+    reset();
+}
+
+bool Lexer::at_chunk_boundary() const
+{
+    return m_lexer_item == LexerItem::WhiteSpace && !m_esc_utf16_remaining && !m_esc_utf16_len && !m_prev_backslash;
+}
+
+bool Lexer::scan(u64 begin, u64 end)
+{
+    const SimdKernels &simd = simd_kernels();
+    u64 pos = begin;
+    // End of the last ASCII run found; the per-byte loop below may
+    // leave a run early and resume it without rescanning
+    u64 ascii_end = begin;
+    // Cancellation is only checked once per block of input
+    u64 next_poll = begin + CANCEL_POLL_INTERVAL;
+
+    while (pos < end)
+    {
+        if (pos >= next_poll)
+        {
+            if (m_cancelled && m_cancelled->load(std::memory_order_relaxed))
+            {
+                return false;
+            }
+
+            next_poll = pos + CANCEL_POLL_INTERVAL;
+        }
+
+        // Fast path: with the escape decoder idle, runs of ASCII without
+        // backslashes are neither UTF-8 sequences nor escapes and go
+        // straight to the lexer
+        if (m_options.ascii_fast_path && !m_esc_utf16_remaining && !m_esc_utf16_len && !m_prev_backslash)
+        {
+            // Comments and white space are skipped without visiting
+            // each byte; escapes and non-ASCII stop the skip so that
+            // e.g. \u000a still terminates a line comment (JLS 3.3)
+            u64 run = skippable_run(pos, end);
+            if (run)
+            {
+                simd.collect_newlines(m_src.data() + pos, run, pos, m_tokens.line_starts);
+
+                if (m_lexer_item == LexerItem::TraditionalComment)
+                {
+                    m_prev_trad_comment_end_star = m_src[pos + run - 1] == '*';
+                }
+
+                m_raw_backslash_count = 0;
+                pos += run;
+                continue;
+            }
+
+            if (pos >= ascii_end)
+            {
+                ascii_end = pos + simd.ascii_run(m_src.data() + pos, end - pos);
+            }
+
+            run = ascii_end - pos;
+            if (run)
+            {
+                m_raw_backslash_count = 0;
+
+                for (u64 run_end = pos + run; pos < run_end;)
+                {
+                    // The rest of an identifier is appended in one go
+                    if (m_lexer_item == LexerItem::IdentifierChars)
+                    {
+                        u64 chars_end = pos;
+                        while (chars_end < run_end && is_ascii_identifier_part(m_src[chars_end]))
+                        {
+                            chars_end++;
+                        }
+
+                        m_tok_text.append(reinterpret_cast<const char *>(m_src.data() + pos), chars_end - pos);
+                        m_tok_end = chars_end;
+                        pos = chars_end;
+
+                        if (pos == run_end)
+                        {
+                            break;
+                        }
+                    }
+
+                    u8 c = m_src[pos];
+                    track_line(c, pos);
+
+                    if (!lex_char(c, pos, pos + 1))
+                    {
+                        return false;
+                    }
+
+                    pos++;
+
+                    // Return to the bulk skip once a comment starts, or
+                    // at a line break where indentation likely follows
+                    if (m_lexer_item == LexerItem::TraditionalComment ||
+                        m_lexer_item == LexerItem::EndOfLineComment || c == '\n')
+                    {
+                        break;
+                    }
+                }
+
+                continue;
+            }
+        }
+
+        // A single Unicode code point reconstructed from
+        // the UTF-8 input. All input starts from this form.
+        u32 raw_unicode;
+        u32 len = decode_utf8(m_src, pos, raw_unicode);
+
+        if (!len)
+        {
+            return fail(pos, DiagnosticCode::InvalidUtf8, m_src[pos]);
+        }
+
+        track_line(raw_unicode, pos);
+
+        if (!unescape(raw_unicode, pos, pos + len))
+        {
+            return false;
+        }
+
+        pos += len;
+    }
+
+    return true;
+}
+
+namespace
+{
+struct LexChunk
+{
+    Arena arena;
+    TokenBuffer tokens;
+    DiagnosticBuffer diagnostics;
+    Lexer lexer;
+    bool ok = true;
+
+    LexChunk(std::span<const u8> src, const CompilerOptions &options, const std::atomic_bool *cancelled)
+        : lexer(src, tokens, arena, diagnostics, options, cancelled)
+    {
+    }
+};
+} // namespace
+
+bool lex_chunked(std::span<const u8> src, TokenBuffer &tokens, DiagnosticBuffer &diagnostics,
+                 const CompilerOptions &options, const std::atomic_bool *cancelled, u64 chunk_size)
+{
+    tokens.clear();
+
+    if (src.size() > std::numeric_limits<u32>::max())
+    {
+        diagnostics.report(DiagnosticCode::InputTooLarge, 0);
+        return false;
+    }
+
+    // JLS 3.5, a trailing Ctrl-Z is ignored
+    if (!src.empty() && src.back() == 0x1A)
+    {
+        src = src.first(src.size() - 1);
+    }
+
+    // Chunks start just past a line feed, where most code is outside
+    // of any token. Inputs without line feeds stay in one piece.
+    std::vector<u64> bounds{0};
+    for (u64 target = std::max(chunk_size, u64(1)); target < src.size(); target = bounds.back() + chunk_size)
+    {
+        const void *lf = std::memchr(src.data() + target - 1, '\n', src.size() - target + 1);
+        u64 bound = lf ? static_cast<const u8 *>(lf) - src.data() + 1 : src.size();
+        if (bound >= src.size())
+        {
+            break;
+        }
+
+        bounds.push_back(bound);
+    }
+
+    bounds.push_back(src.size());
+    u32 chunk_count = bounds.size() - 1;
+
+    std::vector<std::unique_ptr<LexChunk>> chunks(chunk_count);
+    tbb::parallel_for(u32(0), chunk_count, [&](u32 i) {
+        chunks[i] = std::make_unique<LexChunk>(src, options, cancelled);
+        chunks[i]->lexer.start_chunk();
+        chunks[i]->ok = chunks[i]->lexer.scan(bounds[i], bounds[i + 1]);
+    });
+
+    // The first chunk did start at the start. Every later chunk is kept
+    // if the one before it ended at a boundary; otherwise that one goes
+    // on lexing through it, from the state it actually ended in.
+    std::vector<LexChunk *> kept{chunks[0].get()};
+    LexChunk *current = chunks[0].get();
+
+    for (u32 i = 1; i < chunk_count && current->ok; i++)
+    {
+        if (current->lexer.at_chunk_boundary())
+        {
+            current = chunks[i].get();
+            kept.push_back(current);
+        }
+        else
+        {
+            current->ok = current->lexer.scan(bounds[i], bounds[i + 1]);
+        }
+    }
+
+    if (current->ok)
+    {
+        current->ok = current->lexer.finish();
+    }
+
+    tokens.line_starts.push_back(0);
+    for (LexChunk *chunk : kept)
+    {
+        tokens.append(chunk->tokens);
+        diagnostics.append(chunk->diagnostics);
+    }
+
+    return current->ok;
+}
+
+TokenStream::TokenStream(std::span<const u8> src, DiagnosticBuffer &diagnostics, const CompilerOptions &options,
+                         const std::atomic_bool *cancelled, u64 slice_size)
+    : m_src(src), m_slice_size(std::max(slice_size, u64(1))),
+      m_lexer(src, m_tokens, m_arena, diagnostics, options, cancelled)
+{
+    m_ok = m_lexer.start();
+    m_done = !m_ok;
+}
+
+TokenKind TokenStream::peek(u32 ahead)
+{
+    return fill(ahead + 1) ? m_tokens.kinds[m_pos + ahead] : TokenKind::EndOfFile;
+}
+
+void TokenStream::advance()
+{
+    if (fill(1))
+    {
+        m_pos++;
+    }
+}
+
+u32 TokenStream::offset(u32 ahead) const
+{
+    return m_tokens.offsets[m_pos + ahead];
+}
+
+u32 TokenStream::length(u32 ahead) const
+{
+    return m_tokens.lengths[m_pos + ahead];
+}
+
+u32 TokenStream::value(u32 ahead) const
+{
+    return m_tokens.values[m_pos + ahead];
+}
+
+std::string_view TokenStream::literal(u32 ahead) const
+{
+    return m_tokens.value(value(ahead));
+}
+
+SourcePosition TokenStream::position(u32 ahead) const
+{
+    SourcePosition position = m_tokens.position(offset(ahead), m_src);
+    position.line += m_dropped_lines;
+    return position;
+}
+
+u64 TokenStream::memory_usage() const
+{
+    return m_tokens.memory_usage();
+}
+
+bool TokenStream::fill(u32 count)
+{
+    while (m_tokens.size() - m_pos < count && !m_done)
+    {
+        compact();
+
+        if (m_scanned == m_lexer.size())
+        {
+            m_ok = m_lexer.finish();
+            m_done = true;
+            break;
+        }
+
+        // Same cut as lex_chunked(), except that the lexer carries on
+        // across it instead of starting over
+        u64 end = m_lexer.size();
+        u64 target = m_scanned + m_slice_size;
+        if (target < end)
+        {
+            const void *lf = std::memchr(m_src.data() + target - 1, '\n', end - target + 1);
+            end = lf ? static_cast<const u8 *>(lf) - m_src.data() + 1 : end;
+        }
+
+        m_ok = m_lexer.scan(m_scanned, end);
+        m_scanned = end;
+        m_done = !m_ok;
+    }
+
+    return m_tokens.size() - m_pos >= count;
+}
+
+void TokenStream::compact()
+{
+    if (!m_pos)
+    {
+        return;
+    }
+
+    // Lines before the one the next token starts on are no longer needed
+    // for positions; with every token consumed, that's wherever the last
+    // one ended
+    u32 pending = m_tokens.size() - m_pos;
+    u32 cut = pending ? m_tokens.offsets[m_pos] : m_tokens.offsets[m_pos - 1] + m_tokens.lengths[m_pos - 1];
+    std::vector<u32> &lines = m_tokens.line_starts;
+    u32 dropped = std::upper_bound(lines.begin(), lines.end(), cut) - lines.begin() - 1;
+    lines.erase(lines.begin(), lines.begin() + dropped);
+    m_dropped_lines += dropped;
+
+    // Values are added in token order, so those of pending literals are
+    // the tail of the pool
+    u32 first_value = m_tokens.value_ends.size();
+    for (u32 i = m_pos; i < m_tokens.size(); i++)
+    {
+        if (m_tokens.kinds[i] >= TokenKind::IntegerLiteral && m_tokens.kinds[i] <= TokenKind::TextBlock)
+        {
+            first_value = m_tokens.values[i];
+            break;
+        }
+    }
+
+    u32 value_base = first_value - 1;
+    u32 chars_base = m_tokens.value_ends[value_base];
+    for (u32 i = m_pos; i < m_tokens.size(); i++)
+    {
+        if (m_tokens.kinds[i] >= TokenKind::IntegerLiteral && m_tokens.kinds[i] <= TokenKind::TextBlock)
+        {
+            m_tokens.values[i] -= value_base;
+        }
+    }
+
+    m_tokens.value_chars.erase(0, chars_base);
+    m_tokens.value_ends.erase(m_tokens.value_ends.begin() + 1, m_tokens.value_ends.begin() + first_value);
+    for (u32 i = 1; i < m_tokens.value_ends.size(); i++)
+    {
+        m_tokens.value_ends[i] -= chars_base;
+    }
+
+    m_tokens.kinds.erase(m_tokens.kinds.begin(), m_tokens.kinds.begin() + m_pos);
+    m_tokens.offsets.erase(m_tokens.offsets.begin(), m_tokens.offsets.begin() + m_pos);
+    m_tokens.lengths.erase(m_tokens.lengths.begin(), m_tokens.lengths.begin() + m_pos);
+    m_tokens.values.erase(m_tokens.values.begin(), m_tokens.values.begin() + m_pos);
+    m_pos = 0;
+}
@@ -1,7 +1,9 @@
 #include "ujavac.h"
 
+#include <charconv>
 #include <cstdio>
 #include <cstring>
+#include <deque>
 #include <format>
 #include <utility>
 #include <vector>
@@ -14,6 +16,10 @@
 
 namespace
 {
+// Long enough to span the gaps in a build, short enough not to leave
+// daemons behind for good
+constexpr u32 DEFAULT_IDLE_SECONDS = 15 * 60;
+
 bool is_file_terminal(std::FILE *f)
 {
 #ifdef _WIN32
@@ -25,8 +31,24 @@ bool is_file_terminal(std::FILE *f)
 
 enum class prog_opt
 {
+    cache_dir,
+    connect,
+    daemon,
+    destination,
+    diagnostics_format,
+    dump_tokens,
+    fail_fast,
     help,
+    idle_timeout,
+    jar_compression,
+    jobs,
+    output_jar,
+    parse_only,
+    prefetch,
+    source_path,
     system,
+    time_report,
+    trace,
     verbose,
     version,
     werror
@@ -42,8 +64,25 @@ struct prog_opt_desc
 };
 
 constexpr prog_opt_desc prog_opt_descs[] = {
+    {prog_opt::cache_dir, {"--cache-dir"}, "Reuse outputs of unchanged sources from this directory", "<directory>"},
+    {prog_opt::connect, {"--connect"}, "Have the daemon listening on this socket do the compiling", "<socket>"},
+    {prog_opt::daemon, {"--daemon"}, "Serve compile requests on this socket until idle", "<socket>"},
+    {prog_opt::destination, {"-d"}, "Specify where to place generated class files", "<directory>"},
+    {prog_opt::diagnostics_format, {"--diagnostics-format"}, "Format of warnings and errors", "text|json"},
+    {prog_opt::dump_tokens, {"-Xdump-tokens"}, "Print the tokens of each source file", nullptr, true},
+    {prog_opt::fail_fast, {"--fail-fast"}, "Stop compiling after the first failure, implied by -Werror"},
     {prog_opt::help, {"--help", "-help", "-?"}, "Show this help message"},
+    {prog_opt::idle_timeout, {"--idle-timeout"}, "Seconds the daemon waits for requests, 0 for no limit", "<seconds>"},
+    {prog_opt::jar_compression, {"--jar-compression"}, "Compression of --output-jar entries", "deflate|stored"},
+    {prog_opt::jobs, {"-J"}, "Limit the number of worker threads, also as -J<n>", "<n>"},
+    {prog_opt::output_jar, {"--output-jar"}, "Write every class file into this jar instead", "<file>"},
+    {prog_opt::parse_only, {"-Xparse-only"}, "Stop after parsing each source file", nullptr, true},
+    {prog_opt::prefetch, {"--prefetch"}, "Number of inputs to read ahead, 0 to disable", "<n>"},
+    {prog_opt::source_path, {"--source-path", "-sourcepath"}, "Also compile every .java file under these directories",
+     "<path>"},
     {prog_opt::system, {"--system"}, "Override location of system modules", "<jdk>|none"},
+    {prog_opt::time_report, {"--time-report"}, "Print the time spent in each phase of compiling"},
+    {prog_opt::trace, {"--trace"}, "Write a Chrome trace of each unit's phases, also as --trace=<file>", "<file>"},
     {
         prog_opt::verbose,
         {"-verbose"},
@@ -66,9 +105,16 @@ void print_help()
 {
     print_usage();
     println("where possible options include:");
+    println("{:<41}{}", "  @<filename>", "Read options and source files from this file");
 
     for (auto &desc : prog_opt_descs)
     {
+        // Extra options are for debugging the compiler itself
+        if (desc.extra)
+        {
+            continue;
+        }
+
         u32 line_len = 0;
 
         for (u32 i = 0; i < std::size(desc.keys); i++)
@@ -119,11 +165,130 @@ void print_help()
 
 void print_version()
 {
-    println("ujavac 1.0.0");
+    println("ujavac {}", UJAVAC_VERSION);
 }
-} // namespace
 
-int main(int argc, char **argv)
+bool parse_jobs(const char *text, u32 &jobs)
+{
+    const char *end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, jobs);
+    if (ec != std::errc{} || ptr != end || !jobs)
+    {
+        println(stderr, "error: invalid number of threads: {}", text);
+        return false;
+    }
+
+    return true;
+}
+
+bool parse_idle_timeout(const char *text, u32 &seconds)
+{
+    const char *end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, seconds);
+    if (ec != std::errc{} || ptr != end)
+    {
+        println(stderr, "error: invalid idle timeout: {}", text);
+        return false;
+    }
+
+    return true;
+}
+
+bool parse_prefetch(const char *text, u32 &depth)
+{
+    const char *end = text + std::strlen(text);
+    auto [ptr, ec] = std::from_chars(text, end, depth);
+    if (ec != std::errc{} || ptr != end)
+    {
+        println(stderr, "error: invalid prefetch depth: {}", text);
+        return false;
+    }
+
+    return true;
+}
+
+// Directories separated as in a class path, leaving out empty ones
+void split_source_path(std::string_view path, std::vector<std::string> &directories)
+{
+#ifdef _WIN32
+    constexpr char separator = ';';
+#else
+    constexpr char separator = ':';
+#endif
+
+    while (!path.empty())
+    {
+        u64 end = std::min<u64>(path.find(separator), path.size());
+        if (end)
+        {
+            directories.emplace_back(path.substr(0, end));
+        }
+
+        path.remove_prefix(std::min<u64>(end + 1, path.size()));
+    }
+}
+
+// Arguments of an @file as javac takes them: separated by white space,
+// in single or double quotes where they contain any, with # starting a
+// comment to the end of the line. They're not expanded again.
+bool read_argument_file(const char *path, std::deque<std::string> &arguments)
+{
+    SourceBuffer source;
+    if (!source.open(path, false))
+    {
+        return false;
+    }
+
+    std::span<const u8> bytes = source.bytes();
+    std::string argument;
+    bool in_argument = false;
+    for (u64 i = 0; i < bytes.size(); i++)
+    {
+        char c = char(bytes[i]);
+        if (c == '"' || c == '\'')
+        {
+            // A quote left open ends with its line
+            for (i++; i < bytes.size() && bytes[i] != c && bytes[i] != '\n'; i++)
+            {
+                argument.push_back(char(bytes[i]));
+            }
+
+            in_argument = true;
+        }
+        else if (c == '#' && !in_argument)
+        {
+            while (i + 1 < bytes.size() && bytes[i + 1] != '\n')
+            {
+                i++;
+            }
+        }
+        else if (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f')
+        {
+            if (in_argument)
+            {
+                arguments.push_back(std::move(argument));
+                argument.clear();
+                in_argument = false;
+            }
+        }
+        else
+        {
+            argument.push_back(c);
+            in_argument = true;
+        }
+    }
+
+    if (in_argument)
+    {
+        arguments.push_back(std::move(argument));
+    }
+
+    return true;
+}
+
+// Runs a command line, either the process's own or one sent to the
+// daemon, which is then served
+int run_command(int argc, char **argv, bool served)
 {
     if (argc < 2)
     {
@@ -135,10 +300,61 @@ int main(int argc, char **argv)
         return 2;
     }
 
+    // Arguments in @files take their place, so that a long list of
+    // sources needn't fit on the command line
+    std::deque<std::string> file_arguments;
+    std::vector<char *> arguments{argv[0]};
+    for (u32 i = 1; i < argc; i++)
+    {
+        if (argv[i][0] != '@')
+        {
+            arguments.push_back(argv[i]);
+            continue;
+        }
+
+        u64 first = file_arguments.size();
+        if (!read_argument_file(argv[i] + 1, file_arguments))
+        {
+            println(stderr, "error: can't read argument file {}", argv[i] + 1);
+            return 1;
+        }
+
+        for (u64 j = first; j < file_arguments.size(); j++)
+        {
+            arguments.push_back(file_arguments[j].data());
+        }
+    }
+
+    argc = int(arguments.size());
+    argv = arguments.data();
+
+    CompilerOptions options;
     std::vector<const char *> inputs;
+    const char *daemon_socket = nullptr;
+    const char *connect_socket = nullptr;
+    u32 connect_index = 0;
+    u32 idle_seconds = DEFAULT_IDLE_SECONDS;
     for (u32 i = 1; i < argc; i++)
     {
         auto arg = argv[i];
+
+        // The thread count can also be attached, as in -J8
+        if (!std::strncmp(arg, "-J", 2) && arg[2])
+        {
+            if (!parse_jobs(arg + 2, options.threads))
+            {
+                return 1;
+            }
+
+            continue;
+        }
+
+        if (!std::strncmp(arg, "--trace=", 8))
+        {
+            options.trace_file = arg + 8;
+            continue;
+        }
+
         for (auto &desc : prog_opt_descs)
         {
             for (auto &key : desc.keys)
@@ -153,6 +369,14 @@ int main(int argc, char **argv)
                         return 1;
                     }
 
+                    // The daemon serves one request at a time, so it
+                    // can't wait on another one
+                    if (served && (desc.id == prog_opt::daemon || desc.id == prog_opt::connect))
+                    {
+                        println(stderr, "error: {} can't be sent to the daemon", arg);
+                        return 1;
+                    }
+
                     switch (desc.id)
                     {
                     case prog_opt::help:
@@ -161,6 +385,105 @@ int main(int argc, char **argv)
                     case prog_opt::version:
                         print_version();
                         return 0;
+                    case prog_opt::diagnostics_format: {
+                        auto param = argv[++i];
+                        if (!std::strcmp(param, "text"))
+                        {
+                            options.diagnostic_format = DiagnosticFormat::Text;
+                        }
+                        else if (!std::strcmp(param, "json"))
+                        {
+                            options.diagnostic_format = DiagnosticFormat::Json;
+                        }
+                        else
+                        {
+                            println(stderr, "error: invalid diagnostics format: {}", param);
+                            return 1;
+                        }
+                        break;
+                    }
+                    case prog_opt::jar_compression: {
+                        auto param = argv[++i];
+                        if (!std::strcmp(param, "deflate"))
+                        {
+                            options.jar_deflate = true;
+                            if (!jar_deflate_supported())
+                            {
+                                println(stderr, "warning: built without zlib, jar entries are stored");
+                            }
+                        }
+                        else if (!std::strcmp(param, "stored"))
+                        {
+                            options.jar_deflate = false;
+                        }
+                        else
+                        {
+                            println(stderr, "error: invalid jar compression: {}", param);
+                            return 1;
+                        }
+                        break;
+                    }
+                    case prog_opt::cache_dir:
+                        options.cache_dir = argv[++i];
+                        break;
+                    case prog_opt::source_path:
+                        split_source_path(argv[++i], options.source_paths);
+                        break;
+                    case prog_opt::system:
+                        options.system = argv[++i];
+                        break;
+                    case prog_opt::output_jar:
+                        options.output_jar = argv[++i];
+                        break;
+                    case prog_opt::destination:
+                        options.output_dir = argv[++i];
+                        break;
+                    case prog_opt::connect:
+                        connect_index = i;
+                        connect_socket = argv[++i];
+                        break;
+                    case prog_opt::daemon:
+                        daemon_socket = argv[++i];
+                        break;
+                    case prog_opt::idle_timeout:
+                        if (!parse_idle_timeout(argv[++i], idle_seconds))
+                        {
+                            return 1;
+                        }
+                        break;
+                    case prog_opt::jobs:
+                        if (!parse_jobs(argv[++i], options.threads))
+                        {
+                            return 1;
+                        }
+                        break;
+                    case prog_opt::prefetch:
+                        if (!parse_prefetch(argv[++i], options.prefetch_depth))
+                        {
+                            return 1;
+                        }
+                        break;
+                    case prog_opt::trace:
+                        options.trace_file = argv[++i];
+                        break;
+                    case prog_opt::time_report:
+                        options.time_report = true;
+                        break;
+                    case prog_opt::dump_tokens:
+                        options.dump_tokens = true;
+                        break;
+                    case prog_opt::parse_only:
+                        options.parse_only = true;
+                        break;
+                    case prog_opt::fail_fast:
+                        options.fail_fast = true;
+                        break;
+                    case prog_opt::verbose:
+                        options.verbose = true;
+                        break;
+                    case prog_opt::werror:
+                        options.werror = true;
+                        break;
                     }
 
                     goto outer;
@@ -173,6 +496,61 @@ int main(int argc, char **argv)
     outer:;
     }
 
-    CompilerManager cm{inputs};
+    // Any warning fails the build, so there's no point in going on
+    if (options.werror)
+    {
+        options.fail_fast = true;
+    }
+
+    if (daemon_socket)
+    {
+        if (connect_socket)
+        {
+            println(stderr, "error: --daemon can't be combined with --connect");
+            return 1;
+        }
+
+        if (!inputs.empty() || !options.source_paths.empty())
+        {
+            println(stderr, "error: --daemon takes no source files; they're sent with --connect");
+            return 1;
+        }
+
+        return daemon_serve(daemon_socket, idle_seconds,
+                            [](int argc, char **argv) { return run_command(argc, argv, true); });
+    }
+
+    if (connect_socket)
+    {
+        // Everything but --connect itself goes to the daemon
+        std::vector<char *> forwarded;
+        for (u32 i = 1; i < argc; i++)
+        {
+            if (i != connect_index && i != connect_index + 1)
+            {
+                forwarded.push_back(argv[i]);
+            }
+        }
+
+        int exit_code;
+        if (daemon_request(connect_socket, int(forwarded.size()), forwarded.data(), exit_code))
+        {
+            return exit_code;
+        }
+
+        // Without a daemon the build still has to go on
+        if (options.verbose)
+        {
+            println("[no daemon on {}, compiling in-process]", connect_socket);
+        }
+    }
+
+    CompilerManager cm{inputs, options};
     return cm.run();
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    return run_command(argc, argv, false);
 }
\ No newline at end of file
@@ -0,0 +1,82 @@
+#include "ujavac.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <random>
+
+bool write_file_atomically(const char *path, std::span<const u8> contents)
+{
+    // Named like the build cache's temporary files, and for the same
+    // reason: concurrent builds must never pick the same name
+    static const u64 process_tag = std::random_device{}();
+    static std::atomic<u64> temp_counter;
+    std::string temp = std::format("{}.tmp{:x}.{}", path, process_tag, temp_counter++);
+
+    std::FILE *f = std::fopen(temp.c_str(), "wb");
+    if (!f)
+    {
+        return false;
+    }
+
+    // Unbuffered, so that the contents go out in one write
+    std::setvbuf(f, nullptr, _IONBF, 0);
+    bool ok = contents.empty() || std::fwrite(contents.data(), 1, contents.size(), f) == contents.size();
+    ok &= !std::fclose(f);
+
+    // The old file may be hardlinked from the build cache, which a
+    // rename leaves alone
+    std::error_code ec;
+    if (ok)
+    {
+        std::filesystem::rename(temp, path, ec);
+    }
+
+    if (!ok || ec)
+    {
+        std::remove(temp.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+bool OutputWriter::open_jar(const char *path, u32 unit_count, bool deflate)
+{
+    m_mode = OutputMode::Jar;
+    m_jar = std::make_unique<JarWriter>();
+    return m_jar->open(path, unit_count, deflate);
+}
+
+bool OutputWriter::write(u32 order, const char *path, std::string_view class_name, std::vector<u8> &&contents)
+{
+    u64 size = contents.size();
+
+    if (m_mode == OutputMode::Jar)
+    {
+        m_jar->add(order, std::format("{}.class", class_name), contents);
+    }
+    else if (m_mode == OutputMode::Memory)
+    {
+        m_files.push_back({path, std::move(contents)});
+    }
+    else if (!write_file_atomically(path, contents))
+    {
+        return false;
+    }
+
+    m_bytes_written += size;
+    return true;
+}
+
+void OutputWriter::skip(u32 order)
+{
+    if (m_jar)
+    {
+        m_jar->skip(order);
+    }
+}
+
+bool OutputWriter::finish(bool keep)
+{
+    return !m_jar || m_jar->finish(keep);
+}
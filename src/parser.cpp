@@ -0,0 +1,3214 @@
+#include "ujavac.h"
+
+namespace
+{
+// Deeper nesting fails the unit rather than overflowing the stack of
+// the worker thread
+constexpr u32 PARSER_MAX_NESTING = 1000;
+// Tokens parsed between checks for cancellation
+constexpr u32 PARSER_CANCEL_POLL_INTERVAL = 16 * 1024;
+
+constexpr const char *node_kind_names[] = {
+    "CompilationUnit",
+    "PackageDecl",
+    "ImportDecl",
+    "ModuleDecl",
+    "RequiresDirective",
+    "ExportsDirective",
+    "OpensDirective",
+    "UsesDirective",
+    "ProvidesDirective",
+    "ClassDecl",
+    "InterfaceDecl",
+    "EnumDecl",
+    "RecordDecl",
+    "AnnotationDecl",
+    "Modifiers",
+    "Annotation",
+    "ElementValuePair",
+    "TypeParameter",
+    "EnumConstant",
+    "ClassBody",
+    "Initializer",
+    "MethodDecl",
+    "ConstructorDecl",
+    "CompactConstructorDecl",
+    "Parameter",
+    "Variables",
+    "VariableDecl",
+    "PrimitiveType",
+    "TypeName",
+    "ParameterizedType",
+    "ArrayType",
+    "VarargsType",
+    "Wildcard",
+    "AnnotatedType",
+    "UnionType",
+    "IntersectionType",
+    "Block",
+    "EmptyStatement",
+    "ExpressionStatement",
+    "If",
+    "While",
+    "DoWhile",
+    "For",
+    "ForEach",
+    "Labeled",
+    "Break",
+    "Continue",
+    "Return",
+    "Throw",
+    "Yield",
+    "Assert",
+    "Synchronized",
+    "Try",
+    "Catch",
+    "Switch",
+    "SwitchCase",
+    "SwitchRule",
+    "DefaultLabel",
+    "Guard",
+    "Identifier",
+    "Literal",
+    "This",
+    "Super",
+    "Select",
+    "ClassLiteral",
+    "MethodCall",
+    "New",
+    "NewArray",
+    "ArrayInitializer",
+    "ArrayAccess",
+    "Unary",
+    "Postfix",
+    "Binary",
+    "Assign",
+    "Conditional",
+    "InstanceOf",
+    "Cast",
+    "Lambda",
+    "MethodReference",
+    "Parenthesized",
+    "SwitchExpression",
+    "TypePattern",
+    "RecordPattern",
+};
+
+static_assert(std::size(node_kind_names) == u32(NodeKind::RecordPattern) + 1);
+
+// Contextual keywords are identifiers wherever they aren't keywords
+constexpr bool is_name(TokenKind kind)
+{
+    return kind == TokenKind::Identifier || is_contextual_keyword(kind);
+}
+
+// Declared variables may also be unnamed, as "_"
+constexpr bool is_variable_name(TokenKind kind)
+{
+    return is_name(kind) || kind == TokenKind::KwUnderscore;
+}
+
+constexpr bool is_primitive_type(TokenKind kind)
+{
+    switch (kind)
+    {
+    case TokenKind::KwBoolean:
+    case TokenKind::KwByte:
+    case TokenKind::KwChar:
+    case TokenKind::KwShort:
+    case TokenKind::KwInt:
+    case TokenKind::KwLong:
+    case TokenKind::KwFloat:
+    case TokenKind::KwDouble:
+        return true;
+    default:
+        return false;
+    }
+}
+
+constexpr bool is_literal(TokenKind kind)
+{
+    return kind >= TokenKind::TrueLiteral && kind <= TokenKind::TextBlock;
+}
+
+constexpr bool is_assignment_operator(TokenKind kind)
+{
+    return kind == TokenKind::Assign ||
+           (kind >= TokenKind::PlusEqual && kind <= TokenKind::GreaterGreaterGreaterEqual);
+}
+
+u32 modifier_flag(TokenKind kind)
+{
+    switch (kind)
+    {
+    case TokenKind::KwPublic:
+        return MODIFIER_PUBLIC;
+    case TokenKind::KwProtected:
+        return MODIFIER_PROTECTED;
+    case TokenKind::KwPrivate:
+        return MODIFIER_PRIVATE;
+    case TokenKind::KwStatic:
+        return MODIFIER_STATIC;
+    case TokenKind::KwAbstract:
+        return MODIFIER_ABSTRACT;
+    case TokenKind::KwFinal:
+        return MODIFIER_FINAL;
+    case TokenKind::KwNative:
+        return MODIFIER_NATIVE;
+    case TokenKind::KwSynchronized:
+        return MODIFIER_SYNCHRONIZED;
+    case TokenKind::KwTransient:
+        return MODIFIER_TRANSIENT;
+    case TokenKind::KwVolatile:
+        return MODIFIER_VOLATILE;
+    case TokenKind::KwStrictfp:
+        return MODIFIER_STRICTFP;
+    default:
+        return 0;
+    }
+}
+
+// JLS 15.17 to 15.24, loosest first; zero for anything that isn't a
+// binary operator
+u32 binary_precedence(TokenKind kind)
+{
+    switch (kind)
+    {
+    case TokenKind::BarBar:
+        return 1;
+    case TokenKind::AmpAmp:
+        return 2;
+    case TokenKind::Bar:
+        return 3;
+    case TokenKind::Caret:
+        return 4;
+    case TokenKind::Amp:
+        return 5;
+    case TokenKind::EqualEqual:
+    case TokenKind::BangEqual:
+        return 6;
+    case TokenKind::Less:
+    case TokenKind::Greater:
+    case TokenKind::LessEqual:
+    case TokenKind::GreaterEqual:
+    case TokenKind::KwInstanceof:
+        return 7;
+    case TokenKind::LessLess:
+    case TokenKind::GreaterGreater:
+    case TokenKind::GreaterGreaterGreater:
+        return 8;
+    case TokenKind::Plus:
+    case TokenKind::Minus:
+        return 9;
+    case TokenKind::Star:
+    case TokenKind::Slash:
+    case TokenKind::Percent:
+        return 10;
+    default:
+        return 0;
+    }
+}
+
+// Counts how deeply the parser has recursed
+class NestingScope
+{
+  public:
+    explicit NestingScope(u32 &depth) : m_depth(depth)
+    {
+        m_depth++;
+    }
+
+    NestingScope(const NestingScope &) = delete;
+    NestingScope &operator=(const NestingScope &) = delete;
+
+    ~NestingScope()
+    {
+        m_depth--;
+    }
+
+  private:
+    u32 &m_depth;
+};
+} // namespace
+
+const char *node_kind_name(NodeKind kind)
+{
+    return node_kind_names[u32(kind)];
+}
+
+u32 Ast::add_list(std::span<const u32> nodes)
+{
+    if (nodes.empty())
+    {
+        return 0;
+    }
+
+    u32 index = u32(extra.size());
+    extra.push_back(u32(nodes.size()));
+    extra.insert(extra.end(), nodes.begin(), nodes.end());
+    return index;
+}
+
+u64 Ast::memory_usage() const
+{
+    return kinds.capacity() * sizeof(NodeKind) + tokens.capacity() * sizeof(u32) + lhs.capacity() * sizeof(u32) +
+           rhs.capacity() * sizeof(u32) + extra.capacity() * sizeof(u32);
+}
+
+Parser::Parser(const TokenBuffer &tokens, Ast &ast, DiagnosticBuffer &diagnostics, const std::atomic_bool *cancelled)
+    : m_tokens(tokens), m_kinds(tokens.kinds.data()), m_size(tokens.size()), m_ast(ast),
+      m_diagnostics(diagnostics), m_cancelled(cancelled), m_non(global_interner().intern("non"))
+{
+}
+
+bool Parser::run()
+{
+    // The lexer always ends with an EndOfFile token
+    if (!m_size)
+    {
+        return false;
+    }
+
+    // Typical code has up to four nodes for every five tokens, and a
+    // word of lists and records for every two, so most units never
+    // grow these
+    u32 nodes = m_size - m_size / 8 + 1;
+    m_ast.kinds.reserve(nodes);
+    m_ast.tokens.reserve(nodes);
+    m_ast.lhs.reserve(nodes);
+    m_ast.rhs.reserve(nodes);
+    m_ast.extra.reserve(m_size / 2 + m_size / 8 + 1);
+
+    m_ast.extra.push_back(0);
+    m_ast.add(NodeKind::CompilationUnit, 0);
+    m_next_poll = PARSER_CANCEL_POLL_INTERVAL;
+    return parse_compilation_unit();
+}
+
+TokenKind Parser::kind() const
+{
+    // What's left of a ">>" or ">>>" that closed some type arguments
+    if (m_split)
+    {
+        return m_kinds[m_pos] == TokenKind::GreaterGreaterGreater && m_split == 1 ? TokenKind::GreaterGreater
+                                                                                  : TokenKind::Greater;
+    }
+
+    return m_kinds[m_pos];
+}
+
+TokenKind Parser::peek(u32 ahead) const
+{
+    return at(m_pos + ahead);
+}
+
+TokenKind Parser::at(u32 token) const
+{
+    return token < m_size ? m_kinds[token] : TokenKind::EndOfFile;
+}
+
+u32 Parser::advance()
+{
+    u32 token = m_pos;
+    if (m_pos + 1 < m_size)
+    {
+        m_pos++;
+    }
+
+    m_split = 0;
+    return token;
+}
+
+bool Parser::accept(TokenKind kind)
+{
+    if (this->kind() != kind)
+    {
+        return false;
+    }
+
+    advance();
+    return true;
+}
+
+bool Parser::expect(TokenKind kind)
+{
+    if (accept(kind))
+    {
+        return true;
+    }
+
+    fail_expected(kind);
+    return false;
+}
+
+// Takes a single ">", which may be part of a ">>" or ">>>" that closes
+// several type argument lists at once
+bool Parser::close_type_arguments()
+{
+    TokenKind kind = this->kind();
+    if (kind == TokenKind::GreaterGreater || kind == TokenKind::GreaterGreaterGreater)
+    {
+        m_split++;
+        return true;
+    }
+
+    return expect(TokenKind::Greater);
+}
+
+u32 Parser::fail(DiagnosticCode code)
+{
+    m_diagnostics.report(code, m_tokens.offsets[m_pos]);
+    return 0;
+}
+
+u32 Parser::fail_expected(TokenKind kind)
+{
+    // Like javac, a missing token is reported right after the one before
+    u32 offset = m_pos ? m_tokens.offsets[m_pos - 1] + m_tokens.lengths[m_pos - 1] : 0;
+    m_diagnostics.report(DiagnosticCode::ExpectedToken, offset, u32(kind));
+    return 0;
+}
+
+bool Parser::poll()
+{
+    if (m_pos < m_next_poll)
+    {
+        return true;
+    }
+
+    m_next_poll = m_pos + PARSER_CANCEL_POLL_INTERVAL;
+    return !m_cancelled || !m_cancelled->load(std::memory_order_relaxed);
+}
+
+u32 Parser::finish_list(u32 mark)
+{
+    u32 list = m_ast.add_list({m_scratch.data() + mark, m_scratch.size() - mark});
+    m_scratch.resize(mark);
+    return list;
+}
+
+u32 Parser::skip_annotations(u32 token) const
+{
+    while (at(token) == TokenKind::At && at(token + 1) != TokenKind::KwInterface)
+    {
+        token++;
+        if (!is_name(at(token)))
+        {
+            return 0;
+        }
+
+        for (token++; at(token) == TokenKind::Dot && is_name(at(token + 1));)
+        {
+            token += 2;
+        }
+
+        if (at(token) == TokenKind::LParen)
+        {
+            for (u32 depth = 0;; token++)
+            {
+                TokenKind kind = at(token);
+                if (kind == TokenKind::LParen)
+                {
+                    depth++;
+                }
+                else if (kind == TokenKind::RParen && !--depth)
+                {
+                    token++;
+                    break;
+                }
+                else if (kind == TokenKind::EndOfFile)
+                {
+                    return 0;
+                }
+            }
+        }
+    }
+
+    return token;
+}
+
+// Only the tokens that can appear between the brackets are checked, not
+// how they're arranged
+u32 Parser::skip_type_arguments(u32 token) const
+{
+    s32 depth = 0;
+    for (;; token++)
+    {
+        switch (at(token))
+        {
+        case TokenKind::Less:
+            depth++;
+            break;
+        case TokenKind::Greater:
+            depth--;
+            break;
+        case TokenKind::GreaterGreater:
+            depth -= 2;
+            break;
+        case TokenKind::GreaterGreaterGreater:
+            depth -= 3;
+            break;
+        case TokenKind::At:
+            token = skip_annotations(token);
+            if (!token)
+            {
+                return 0;
+            }
+
+            token--;
+            continue;
+        case TokenKind::Dot:
+        case TokenKind::Comma:
+        case TokenKind::Question:
+        case TokenKind::KwExtends:
+        case TokenKind::KwSuper:
+        case TokenKind::LBracket:
+        case TokenKind::RBracket:
+            continue;
+        default:
+            if (is_name(at(token)) || is_primitive_type(at(token)))
+            {
+                continue;
+            }
+
+            return 0;
+        }
+
+        if (depth <= 0)
+        {
+            return depth ? 0 : token + 1;
+        }
+    }
+}
+
+u32 Parser::skip_type(u32 token) const
+{
+    token = skip_annotations(token);
+    if (!token)
+    {
+        return 0;
+    }
+
+    if (is_primitive_type(at(token)))
+    {
+        token++;
+    }
+    else if (is_name(at(token)))
+    {
+        for (token++;; token++)
+        {
+            if (at(token) == TokenKind::Less)
+            {
+                token = skip_type_arguments(token);
+                if (!token)
+                {
+                    return 0;
+                }
+            }
+
+            if (at(token) != TokenKind::Dot || (!is_name(at(token + 1)) && at(token + 1) != TokenKind::At))
+            {
+                break;
+            }
+
+            token = skip_annotations(token + 1);
+            if (!token || !is_name(at(token)))
+            {
+                return 0;
+            }
+        }
+    }
+    else
+    {
+        return 0;
+    }
+
+    for (;;)
+    {
+        u32 next = skip_annotations(token);
+        if (!next || at(next) != TokenKind::LBracket || at(next + 1) != TokenKind::RBracket)
+        {
+            return token;
+        }
+
+        token = next + 2;
+    }
+}
+
+// "non-sealed" is lexed as three tokens, which have to touch
+bool Parser::is_non_sealed() const
+{
+    return kind() == TokenKind::Identifier && m_tokens.values[m_pos] == m_non && peek(1) == TokenKind::Minus &&
+           peek(2) == TokenKind::KwSealed && m_tokens.offsets[m_pos] + 3 == m_tokens.offsets[m_pos + 1] &&
+           m_tokens.offsets[m_pos + 1] + 1 == m_tokens.offsets[m_pos + 2];
+}
+
+// "sealed" is a modifier only if more of the declaration's head follows,
+// and otherwise a type name
+bool Parser::is_sealed_modifier() const
+{
+    TokenKind next = peek(1);
+    return modifier_flag(next) || next == TokenKind::KwClass || next == TokenKind::KwInterface ||
+           next == TokenKind::At || next == TokenKind::KwSealed || next == TokenKind::Identifier;
+}
+
+bool Parser::is_type_declaration_start() const
+{
+    switch (kind())
+    {
+    case TokenKind::KwClass:
+    case TokenKind::KwInterface:
+    case TokenKind::KwEnum:
+        return true;
+    case TokenKind::At:
+        return peek(1) == TokenKind::KwInterface;
+    case TokenKind::KwRecord:
+        return is_name(peek(1)) && (peek(2) == TokenKind::LParen || peek(2) == TokenKind::Less);
+    default:
+        return false;
+    }
+}
+
+// JLS 14.4 and 14.3: a declaration starts with modifiers, or with a type
+// followed by the name of a variable
+bool Parser::is_local_declaration_start() const
+{
+    TokenKind kind = this->kind();
+    if (kind == TokenKind::KwFinal || kind == TokenKind::KwAbstract || kind == TokenKind::KwStatic ||
+        kind == TokenKind::KwStrictfp || (kind == TokenKind::At && peek(1) != TokenKind::KwInterface) ||
+        is_type_declaration_start())
+    {
+        return true;
+    }
+
+    if (!is_name(kind) && !is_primitive_type(kind))
+    {
+        return false;
+    }
+
+    u32 next = skip_type(m_pos);
+    return next && is_variable_name(at(next));
+}
+
+// JLS 14.21, as javac decides it: "yield" starts a statement if what
+// follows can only start an expression
+bool Parser::is_yield_statement() const
+{
+    TokenKind next = peek(1);
+    switch (next)
+    {
+    case TokenKind::Plus:
+    case TokenKind::Minus:
+    case TokenKind::Bang:
+    case TokenKind::Tilde:
+    case TokenKind::LParen:
+    case TokenKind::KwUnderscore:
+    case TokenKind::KwNew:
+    case TokenKind::KwSwitch:
+    case TokenKind::KwThis:
+    case TokenKind::KwSuper:
+    case TokenKind::KwVoid:
+        return true;
+    case TokenKind::PlusPlus:
+    case TokenKind::MinusMinus:
+        return peek(2) != TokenKind::Semicolon;
+    default:
+        return is_name(next) || is_literal(next) || is_primitive_type(next);
+    }
+}
+
+bool Parser::is_lambda() const
+{
+    if (m_no_lambda)
+    {
+        return false;
+    }
+
+    if (is_variable_name(kind()))
+    {
+        return peek(1) == TokenKind::Arrow;
+    }
+
+    if (kind() != TokenKind::LParen)
+    {
+        return false;
+    }
+
+    // Parameter lists are short and never hold braces or semicolons,
+    // which keeps this from scanning far
+    for (u32 token = m_pos, depth = 0;; token++)
+    {
+        switch (at(token))
+        {
+        case TokenKind::LParen:
+            depth++;
+            break;
+        case TokenKind::RParen:
+            if (!--depth)
+            {
+                return at(token + 1) == TokenKind::Arrow;
+            }
+            break;
+        case TokenKind::LBrace:
+        case TokenKind::RBrace:
+        case TokenKind::Semicolon:
+        case TokenKind::EndOfFile:
+            return false;
+        default:
+            break;
+        }
+    }
+}
+
+// JLS 15.16: a parenthesized type is a cast if a primitive type, or if
+// followed by something that can only start an operand
+bool Parser::is_cast() const
+{
+    u32 token = m_pos + 1;
+    if (is_primitive_type(at(token)))
+    {
+        u32 end = skip_type(token);
+        return end && at(end) == TokenKind::RParen;
+    }
+
+    u32 end = skip_type(token);
+    while (end && at(end) == TokenKind::Amp)
+    {
+        end = skip_type(end + 1);
+    }
+
+    if (!end || at(end) != TokenKind::RParen)
+    {
+        return false;
+    }
+
+    TokenKind next = at(end + 1);
+    switch (next)
+    {
+    case TokenKind::LParen:
+    case TokenKind::Bang:
+    case TokenKind::Tilde:
+    case TokenKind::KwThis:
+    case TokenKind::KwSuper:
+    case TokenKind::KwNew:
+    case TokenKind::KwSwitch:
+        return true;
+    default:
+        return is_name(next) || is_literal(next) || is_primitive_type(next);
+    }
+}
+
+// JLS 14.30.1: a type followed by a name or a record's components
+bool Parser::is_pattern_start() const
+{
+    if (kind() == TokenKind::KwFinal || (kind() == TokenKind::At && peek(1) != TokenKind::KwInterface))
+    {
+        return true;
+    }
+
+    u32 next = skip_type(m_pos);
+    return next && (is_variable_name(at(next)) || at(next) == TokenKind::LParen);
+}
+
+// JLS 14.8
+bool Parser::is_statement_expression(u32 node) const
+{
+    switch (m_ast.kinds[node])
+    {
+    case NodeKind::Assign:
+    case NodeKind::Postfix:
+    case NodeKind::MethodCall:
+    case NodeKind::New:
+        return true;
+    case NodeKind::Unary: {
+        TokenKind op = m_kinds[m_ast.tokens[node]];
+        return op == TokenKind::PlusPlus || op == TokenKind::MinusMinus;
+    }
+    default:
+        return false;
+    }
+}
+
+// JLS 7.3
+bool Parser::parse_compilation_unit()
+{
+    u32 package = Ast::NONE;
+    bool types_seen = false;
+    u32 mark = u32(m_scratch.size());
+
+    while (kind() != TokenKind::EndOfFile)
+    {
+        if (!poll())
+        {
+            return false;
+        }
+
+        if (accept(TokenKind::Semicolon))
+        {
+            continue;
+        }
+
+        // Annotations may belong to the package, the module or a type
+        u32 modifiers;
+        if (!parse_modifiers(modifiers))
+        {
+            return false;
+        }
+
+        u32 node;
+        if (kind() == TokenKind::KwPackage && !package && m_scratch.size() == mark &&
+            (!modifiers || !m_ast.lhs[modifiers]))
+        {
+            node = package = parse_package(modifiers);
+        }
+        else if (kind() == TokenKind::KwImport && !modifiers && !types_seen)
+        {
+            node = parse_import();
+            if (node)
+            {
+                m_scratch.push_back(node);
+            }
+        }
+        else if (kind() == TokenKind::KwModule ||
+                 (kind() == TokenKind::KwOpen && peek(1) == TokenKind::KwModule))
+        {
+            node = parse_module(modifiers);
+            if (node)
+            {
+                m_scratch.push_back(node);
+            }
+        }
+        else
+        {
+            types_seen = true;
+            node = parse_type_declaration(modifiers);
+            if (node)
+            {
+                m_scratch.push_back(node);
+            }
+        }
+
+        if (!node)
+        {
+            return false;
+        }
+    }
+
+    m_ast.lhs[0] = package;
+    m_ast.rhs[0] = finish_list(mark);
+    return true;
+}
+
+u32 Parser::parse_package(u32 modifiers)
+{
+    u32 token = advance();
+    u32 name = parse_qualified_name();
+    if (!name || !expect(TokenKind::Semicolon))
+    {
+        return 0;
+    }
+
+    return m_ast.add(NodeKind::PackageDecl, token, name, modifiers);
+}
+
+u32 Parser::parse_import()
+{
+    u32 token = advance();
+    u32 flags = accept(TokenKind::KwStatic) ? IMPORT_STATIC : 0;
+
+    if (!is_name(kind()))
+    {
+        return fail_expected(TokenKind::Identifier);
+    }
+
+    u32 name = m_ast.add(NodeKind::Identifier, advance());
+    while (accept(TokenKind::Dot))
+    {
+        if (accept(TokenKind::Star))
+        {
+            flags |= IMPORT_ON_DEMAND;
+            break;
+        }
+
+        if (!is_name(kind()))
+        {
+            return fail_expected(TokenKind::Identifier);
+        }
+
+        name = m_ast.add(NodeKind::Select, advance(), name);
+    }
+
+    if (!expect(TokenKind::Semicolon))
+    {
+        return 0;
+    }
+
+    return m_ast.add(NodeKind::ImportDecl, token, name, flags);
+}
+
+u32 Parser::parse_module(u32 modifiers)
+{
+    accept(TokenKind::KwOpen);
+    u32 token = advance();
+    u32 name = parse_qualified_name();
+    if (!name || !expect(TokenKind::LBrace))
+    {
+        return 0;
+    }
+
+    u32 mark = u32(m_scratch.size());
+    while (!accept(TokenKind::RBrace))
+    {
+        u32 directive = parse_directive();
+        if (!directive)
+        {
+            return 0;
+        }
+
+        m_scratch.push_back(directive);
+    }
+
+    return m_ast.add(NodeKind::ModuleDecl, token, name, m_ast.add_record(ModuleRecord{modifiers, finish_list(mark)}));
+}
+
+// JLS 7.7.1 to 7.7.4
+u32 Parser::parse_directive()
+{
+    u32 token = m_pos;
+    u32 name;
+    u32 list = 0;
+
+    switch (kind())
+    {
+    case TokenKind::KwRequires: {
+        advance();
+        u32 flags = 0;
+        for (;;)
+        {
+            // A module may itself be named "transitive"
+            if (kind() == TokenKind::KwTransitive && is_name(peek(1)))
+            {
+                flags |= REQUIRES_TRANSITIVE;
+            }
+            else if (kind() == TokenKind::KwStatic)
+            {
+                flags |= REQUIRES_STATIC;
+            }
+            else
+            {
+                break;
+            }
+
+            advance();
+        }
+
+        name = parse_qualified_name();
+        if (!name || !expect(TokenKind::Semicolon))
+        {
+            return 0;
+        }
+
+        return m_ast.add(NodeKind::RequiresDirective, token, name, flags);
+    }
+    case TokenKind::KwExports:
+    case TokenKind::KwOpens: {
+        NodeKind node_kind = kind() == TokenKind::KwExports ? NodeKind::ExportsDirective : NodeKind::OpensDirective;
+        advance();
+        name = parse_qualified_name();
+        if (!name || (accept(TokenKind::KwTo) && !parse_name_list(list)) || !expect(TokenKind::Semicolon))
+        {
+            return 0;
+        }
+
+        return m_ast.add(node_kind, token, name, list);
+    }
+    case TokenKind::KwUses:
+        advance();
+        name = parse_qualified_name();
+        if (!name || !expect(TokenKind::Semicolon))
+        {
+            return 0;
+        }
+
+        return m_ast.add(NodeKind::UsesDirective, token, name);
+    case TokenKind::KwProvides:
+        advance();
+        name = parse_qualified_name();
+        if (!name || !expect(TokenKind::KwWith) || !parse_name_list(list) || !expect(TokenKind::Semicolon))
+        {
+            return 0;
+        }
+
+        return m_ast.add(NodeKind::ProvidesDirective, token, name, list);
+    default:
+        return fail_expected(TokenKind::RBrace);
+    }
+}
+
+u32 Parser::parse_qualified_name()
+{
+    if (!is_name(kind()))
+    {
+        return fail_expected(TokenKind::Identifier);
+    }
+
+    u32 name = m_ast.add(NodeKind::Identifier, advance());
+    while (kind() == TokenKind::Dot && is_name(peek(1)))
+    {
+        advance();
+        name = m_ast.add(NodeKind::Select, advance(), name);
+    }
+
+    return name;
+}
+
+bool Parser::parse_name_list(u32 &list)
+{
+    u32 mark = u32(m_scratch.size());
+    do
+    {
+        u32 name = parse_qualified_name();
+        if (!name)
+        {
+            return false;
+        }
+
+        m_scratch.push_back(name);
+    } while (accept(TokenKind::Comma));
+
+    list = finish_list(mark);
+    return true;
+}
+
+// Modifiers and annotations in any order; none at all leaves modifiers
+// at Ast::NONE
+bool Parser::parse_modifiers(u32 &modifiers)
+{
+    u32 token = m_pos;
+    u32 flags = 0;
+    u32 mark = u32(m_scratch.size());
+
+    for (;;)
+    {
+        TokenKind kind = this->kind();
+        u32 flag = modifier_flag(kind);
+        u32 length = 1;
+
+        if (kind == TokenKind::At && peek(1) != TokenKind::KwInterface)
+        {
+            u32 annotation = parse_annotation();
+            if (!annotation)
+            {
+                return false;
+            }
+
+            m_scratch.push_back(annotation);
+            continue;
+        }
+
+        if (kind == TokenKind::KwDefault && peek(1) != TokenKind::Colon && peek(1) != TokenKind::Arrow)
+        {
+            flag = MODIFIER_DEFAULT;
+        }
+        else if (kind == TokenKind::KwSealed && is_sealed_modifier())
+        {
+            flag = MODIFIER_SEALED;
+        }
+        else if (is_non_sealed())
+        {
+            flag = MODIFIER_NON_SEALED;
+            length = 3;
+        }
+
+        if (!flag)
+        {
+            break;
+        }
+
+        if (flags & flag)
+        {
+            fail(DiagnosticCode::RepeatedModifier);
+            return false;
+        }
+
+        flags |= flag;
+        for (u32 i = 0; i < length; i++)
+        {
+            advance();
+        }
+    }
+
+    u32 annotations = finish_list(mark);
+    modifiers = flags || annotations ? m_ast.add(NodeKind::Modifiers, token, flags, annotations) : Ast::NONE;
+    return true;
+}
+
+// JLS 9.7
+u32 Parser::parse_annotation()
+{
+    u32 token = advance();
+    u32 name = parse_qualified_name();
+    if (!name)
+    {
+        return 0;
+    }
+
+    u32 mark = u32(m_scratch.size());
+    if (accept(TokenKind::LParen) && !accept(TokenKind::RParen))
+    {
+        if (is_name(kind()) && peek(1) == TokenKind::Assign)
+        {
+            do
+            {
+                if (!is_name(kind()))
+                {
+                    return fail_expected(TokenKind::Identifier);
+                }
+
+                u32 element = advance();
+                if (!expect(TokenKind::Assign))
+                {
+                    return 0;
+                }
+
+                u32 value = parse_element_value();
+                if (!value)
+                {
+                    return 0;
+                }
+
+                m_scratch.push_back(m_ast.add(NodeKind::ElementValuePair, element, value));
+            } while (accept(TokenKind::Comma));
+        }
+        else
+        {
+            u32 value = parse_element_value();
+            if (!value)
+            {
+                return 0;
+            }
+
+            m_scratch.push_back(value);
+        }
+
+        if (!expect(TokenKind::RParen))
+        {
+            return 0;
+        }
+    }
+
+    return m_ast.add(NodeKind::Annotation, token, name, finish_list(mark));
+}
+
+bool Parser::parse_annotations(u32 &list)
+{
+    u32 mark = u32(m_scratch.size());
+    while (kind() == TokenKind::At && peek(1) != TokenKind::KwInterface)
+    {
+        u32 annotation = parse_annotation();
+        if (!annotation)
+        {
+            return false;
+        }
+
+        m_scratch.push_back(annotation);
+    }
+
+    list = finish_list(mark);
+    return true;
+}
+
+u32 Parser::parse_element_value()
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    if (kind() == TokenKind::At)
+    {
+        return parse_annotation();
+    }
+
+    if (kind() == TokenKind::LBrace)
+    {
+        return parse_array_initializer(true);
+    }
+
+    return parse_conditional();
+}
+
+// JLS 8.1, 8.9, 8.10, 9.1 and 9.6, from the keyword on
+u32 Parser::parse_type_declaration(u32 modifiers)
+{
+    u32 start = m_ast.size();
+    NodeKind node_kind;
+    switch (kind())
+    {
+    case TokenKind::KwClass:
+        node_kind = NodeKind::ClassDecl;
+        break;
+    case TokenKind::KwInterface:
+        node_kind = NodeKind::InterfaceDecl;
+        break;
+    case TokenKind::KwEnum:
+        node_kind = NodeKind::EnumDecl;
+        break;
+    case TokenKind::At:
+        if (peek(1) != TokenKind::KwInterface)
+        {
+            return fail(DiagnosticCode::ExpectedTypeDeclaration);
+        }
+
+        advance();
+        node_kind = NodeKind::AnnotationDecl;
+        break;
+    case TokenKind::KwRecord:
+        if (!is_name(peek(1)))
+        {
+            return fail(DiagnosticCode::ExpectedTypeDeclaration);
+        }
+
+        node_kind = NodeKind::RecordDecl;
+        break;
+    default:
+        return fail(DiagnosticCode::ExpectedTypeDeclaration);
+    }
+
+    advance();
+    if (!is_name(kind()))
+    {
+        return fail_expected(TokenKind::Identifier);
+    }
+
+    u32 name = advance();
+    TypeDeclRecord record{};
+    record.start = start;
+    bool is_class = node_kind == NodeKind::ClassDecl;
+    bool is_interface = node_kind == NodeKind::InterfaceDecl;
+
+    if (kind() == TokenKind::Less && (is_class || is_interface || node_kind == NodeKind::RecordDecl) &&
+        !parse_type_parameters(record.type_parameters))
+    {
+        return 0;
+    }
+
+    if (node_kind == NodeKind::RecordDecl && !parse_formal_parameters(record.components))
+    {
+        return 0;
+    }
+
+    if ((is_class || is_interface) && accept(TokenKind::KwExtends))
+    {
+        if (is_class ? !(record.super_class = parse_type()) : !parse_type_list(record.interfaces))
+        {
+            return 0;
+        }
+    }
+
+    if (!is_interface && node_kind != NodeKind::AnnotationDecl && accept(TokenKind::KwImplements) &&
+        !parse_type_list(record.interfaces))
+    {
+        return 0;
+    }
+
+    if ((is_class || is_interface) && accept(TokenKind::KwPermits) && !parse_type_list(record.permits))
+    {
+        return 0;
+    }
+
+    if (!parse_class_body(node_kind, record.members))
+    {
+        return 0;
+    }
+
+    return m_ast.add(node_kind, name, modifiers, m_ast.add_record(record));
+}
+
+// JLS 8.1.2
+bool Parser::parse_type_parameters(u32 &list)
+{
+    advance();
+    u32 mark = u32(m_scratch.size());
+    do
+    {
+        u32 annotations;
+        if (!parse_annotations(annotations))
+        {
+            return false;
+        }
+
+        if (!is_name(kind()))
+        {
+            fail_expected(TokenKind::Identifier);
+            return false;
+        }
+
+        u32 name = advance();
+        u32 bounds = 0;
+        if (accept(TokenKind::KwExtends))
+        {
+            u32 bounds_mark = u32(m_scratch.size());
+            do
+            {
+                u32 bound = parse_type();
+                if (!bound)
+                {
+                    return false;
+                }
+
+                m_scratch.push_back(bound);
+            } while (accept(TokenKind::Amp));
+
+            bounds = finish_list(bounds_mark);
+        }
+
+        m_scratch.push_back(m_ast.add(NodeKind::TypeParameter, name, annotations, bounds));
+    } while (accept(TokenKind::Comma));
+
+    if (!close_type_arguments())
+    {
+        return false;
+    }
+
+    list = finish_list(mark);
+    return true;
+}
+
+bool Parser::parse_type_list(u32 &list)
+{
+    u32 mark = u32(m_scratch.size());
+    do
+    {
+        u32 type = parse_type();
+        if (!type)
+        {
+            return false;
+        }
+
+        m_scratch.push_back(type);
+    } while (accept(TokenKind::Comma));
+
+    list = finish_list(mark);
+    return true;
+}
+
+// JLS 8.1.7, 8.9.1 and 9.1.5
+bool Parser::parse_class_body(NodeKind type_kind, u32 &members)
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        fail(DiagnosticCode::NestingTooDeep);
+        return false;
+    }
+
+    if (!expect(TokenKind::LBrace))
+    {
+        return false;
+    }
+
+    u32 mark = u32(m_scratch.size());
+    if (type_kind == NodeKind::EnumDecl)
+    {
+        while (is_name(kind()) || kind() == TokenKind::At)
+        {
+            u32 constant = parse_enum_constant();
+            if (!constant)
+            {
+                return false;
+            }
+
+            m_scratch.push_back(constant);
+            if (!accept(TokenKind::Comma))
+            {
+                break;
+            }
+        }
+
+        if (kind() != TokenKind::RBrace && !expect(TokenKind::Semicolon))
+        {
+            return false;
+        }
+    }
+
+    while (!accept(TokenKind::RBrace))
+    {
+        if (kind() == TokenKind::EndOfFile)
+        {
+            fail_expected(TokenKind::RBrace);
+            return false;
+        }
+
+        u32 member;
+        if (!parse_member(type_kind, member))
+        {
+            return false;
+        }
+
+        if (member)
+        {
+            m_scratch.push_back(member);
+        }
+    }
+
+    members = finish_list(mark);
+    return true;
+}
+
+u32 Parser::parse_enum_constant()
+{
+    u32 modifiers;
+    if (!parse_modifiers(modifiers))
+    {
+        return 0;
+    }
+
+    if (!is_name(kind()))
+    {
+        return fail_expected(TokenKind::Identifier);
+    }
+
+    u32 name = advance();
+    EnumConstantRecord record{};
+    if (kind() == TokenKind::LParen && !parse_arguments(record.arguments))
+    {
+        return 0;
+    }
+
+    if (kind() == TokenKind::LBrace)
+    {
+        u32 token = m_pos;
+        u32 members;
+        if (!parse_class_body(NodeKind::ClassDecl, members))
+        {
+            return 0;
+        }
+
+        record.body = m_ast.add(NodeKind::ClassBody, token, Ast::NONE, members);
+    }
+
+    return m_ast.add(NodeKind::EnumConstant, name, modifiers, m_ast.add_record(record));
+}
+
+// JLS 8.2 and 9.1.5; a stray semicolon leaves member at Ast::NONE
+bool Parser::parse_member(NodeKind type_kind, u32 &member)
+{
+    member = Ast::NONE;
+    if (!poll())
+    {
+        return false;
+    }
+
+    if (accept(TokenKind::Semicolon))
+    {
+        return true;
+    }
+
+    u32 token = m_pos;
+    if (kind() == TokenKind::LBrace || (kind() == TokenKind::KwStatic && peek(1) == TokenKind::LBrace))
+    {
+        bool is_static = accept(TokenKind::KwStatic);
+        u32 block = parse_block();
+        member = block ? m_ast.add(NodeKind::Initializer, token, block, is_static) : Ast::NONE;
+        return member;
+    }
+
+    u32 modifiers;
+    if (!parse_modifiers(modifiers))
+    {
+        return false;
+    }
+
+    if (is_type_declaration_start())
+    {
+        member = parse_type_declaration(modifiers);
+        return member;
+    }
+
+    MethodRecord record{};
+    if (kind() == TokenKind::Less && !parse_type_parameters(record.type_parameters))
+    {
+        return false;
+    }
+
+    if (is_name(kind()) && peek(1) == TokenKind::LParen)
+    {
+        member = parse_method(NodeKind::ConstructorDecl, advance(), modifiers, record);
+        return member;
+    }
+
+    if (type_kind == NodeKind::RecordDecl && is_name(kind()) && peek(1) == TokenKind::LBrace)
+    {
+        u32 name = advance();
+        record.body = parse_block();
+        member = record.body ? m_ast.add(NodeKind::CompactConstructorDecl, name, modifiers, m_ast.add_record(record))
+                             : Ast::NONE;
+        return member;
+    }
+
+    u32 type = kind() == TokenKind::KwVoid ? m_ast.add(NodeKind::PrimitiveType, advance()) : parse_type();
+    if (!type)
+    {
+        return false;
+    }
+
+    if (is_name(kind()) && peek(1) == TokenKind::LParen)
+    {
+        record.result = type;
+        member = parse_method(NodeKind::MethodDecl, advance(), modifiers, record);
+        return member;
+    }
+
+    if (record.type_parameters || m_kinds[m_ast.tokens[type]] == TokenKind::KwVoid)
+    {
+        return fail_expected(TokenKind::LParen);
+    }
+
+    u32 declarators;
+    if (!parse_variable_declarators(type, declarators) || !expect(TokenKind::Semicolon))
+    {
+        return false;
+    }
+
+    member = m_ast.add(NodeKind::Variables, token, modifiers, declarators);
+    return true;
+}
+
+// JLS 8.4 and 8.8, from the parameters on
+u32 Parser::parse_method(NodeKind kind, u32 name, u32 modifiers, MethodRecord record)
+{
+    if (!parse_formal_parameters(record.parameters))
+    {
+        return 0;
+    }
+
+    // Brackets after the parameters belong to the result, as in int f()[]
+    if (record.result)
+    {
+        record.result = parse_dims(record.result);
+        if (!record.result)
+        {
+            return 0;
+        }
+    }
+
+    if (accept(TokenKind::KwThrows) && !parse_type_list(record.throws))
+    {
+        return 0;
+    }
+
+    if (accept(TokenKind::KwDefault))
+    {
+        record.default_value = parse_element_value();
+        if (!record.default_value)
+        {
+            return 0;
+        }
+    }
+
+    if (this->kind() == TokenKind::LBrace)
+    {
+        record.body = parse_block();
+        if (!record.body)
+        {
+            return 0;
+        }
+    }
+    else if (!expect(TokenKind::Semicolon))
+    {
+        return 0;
+    }
+
+    return m_ast.add(kind, name, modifiers, m_ast.add_record(record));
+}
+
+bool Parser::parse_formal_parameters(u32 &list)
+{
+    if (!expect(TokenKind::LParen))
+    {
+        return false;
+    }
+
+    u32 mark = u32(m_scratch.size());
+    if (!accept(TokenKind::RParen))
+    {
+        do
+        {
+            u32 parameter = parse_formal_parameter();
+            if (!parameter)
+            {
+                return false;
+            }
+
+            m_scratch.push_back(parameter);
+        } while (accept(TokenKind::Comma));
+
+        if (!expect(TokenKind::RParen))
+        {
+            return false;
+        }
+    }
+
+    list = finish_list(mark);
+    return true;
+}
+
+// JLS 8.4.1, including the receiver parameter
+u32 Parser::parse_formal_parameter()
+{
+    u32 modifiers;
+    if (!parse_modifiers(modifiers))
+    {
+        return 0;
+    }
+
+    u32 type = parse_type();
+    if (!type)
+    {
+        return 0;
+    }
+
+    if (kind() == TokenKind::At || kind() == TokenKind::Ellipsis)
+    {
+        u32 annotations;
+        if (!parse_annotations(annotations))
+        {
+            return 0;
+        }
+
+        u32 token = m_pos;
+        if (!expect(TokenKind::Ellipsis))
+        {
+            return 0;
+        }
+
+        type = m_ast.add(NodeKind::VarargsType, token, type, annotations);
+    }
+
+    if (kind() == TokenKind::KwThis)
+    {
+        return m_ast.add(NodeKind::Parameter, advance(), type, modifiers);
+    }
+
+    if (is_name(kind()) && peek(1) == TokenKind::Dot && peek(2) == TokenKind::KwThis)
+    {
+        advance();
+        advance();
+        return m_ast.add(NodeKind::Parameter, advance(), type, modifiers);
+    }
+
+    u32 name = parse_variable_name();
+    if (!name)
+    {
+        return 0;
+    }
+
+    type = parse_dims(type);
+    return type ? m_ast.add(NodeKind::Parameter, name, type, modifiers) : 0;
+}
+
+// JLS 8.3 and 14.4; brackets after a name belong to its variable only
+bool Parser::parse_variable_declarators(u32 type, u32 &list)
+{
+    u32 mark = u32(m_scratch.size());
+    do
+    {
+        u32 name = parse_variable_name();
+        if (!name)
+        {
+            return false;
+        }
+
+        u32 variable_type = parse_dims(type);
+        if (!variable_type)
+        {
+            return false;
+        }
+
+        u32 initializer = Ast::NONE;
+        if (accept(TokenKind::Assign))
+        {
+            initializer = kind() == TokenKind::LBrace ? parse_array_initializer(false) : parse_expression();
+            if (!initializer)
+            {
+                return false;
+            }
+        }
+
+        m_scratch.push_back(m_ast.add(NodeKind::VariableDecl, name, variable_type, initializer));
+    } while (accept(TokenKind::Comma));
+
+    list = finish_list(mark);
+    return true;
+}
+
+// Token of a declared variable's name
+u32 Parser::parse_variable_name()
+{
+    if (!is_variable_name(kind()))
+    {
+        return fail_expected(TokenKind::Identifier);
+    }
+
+    return advance();
+}
+
+// JLS 4.1, with any annotations and brackets
+u32 Parser::parse_type()
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 token = m_pos;
+    u32 annotations;
+    if (!parse_annotations(annotations))
+    {
+        return 0;
+    }
+
+    u32 type;
+    if (is_primitive_type(kind()))
+    {
+        type = m_ast.add(NodeKind::PrimitiveType, advance());
+    }
+    else if (is_name(kind()))
+    {
+        type = parse_class_type(false);
+    }
+    else
+    {
+        return fail(DiagnosticCode::IllegalStartOfType);
+    }
+
+    if (type && annotations)
+    {
+        type = m_ast.add(NodeKind::AnnotatedType, token, type, annotations);
+    }
+
+    return type ? parse_dims(type) : 0;
+}
+
+// JLS 4.3, e.g. java.util.Map.Entry<K, V>
+u32 Parser::parse_class_type(bool allow_diamond)
+{
+    u32 type = m_ast.add(NodeKind::TypeName, advance());
+    for (;;)
+    {
+        if (kind() == TokenKind::Less)
+        {
+            u32 token = m_pos;
+            u32 arguments;
+            if (!parse_type_arguments(allow_diamond, arguments))
+            {
+                return 0;
+            }
+
+            type = m_ast.add(NodeKind::ParameterizedType, token, type, arguments);
+        }
+
+        if (kind() != TokenKind::Dot || (!is_name(peek(1)) && peek(1) != TokenKind::At))
+        {
+            return type;
+        }
+
+        advance();
+        u32 token = m_pos;
+        u32 annotations;
+        if (!parse_annotations(annotations))
+        {
+            return 0;
+        }
+
+        if (!is_name(kind()))
+        {
+            return fail_expected(TokenKind::Identifier);
+        }
+
+        type = m_ast.add(NodeKind::TypeName, advance(), type);
+        if (annotations)
+        {
+            type = m_ast.add(NodeKind::AnnotatedType, token, type, annotations);
+        }
+    }
+}
+
+// JLS 4.5.1, from the "<" on
+bool Parser::parse_type_arguments(bool allow_diamond, u32 &list)
+{
+    advance();
+    if (allow_diamond && kind() == TokenKind::Greater)
+    {
+        advance();
+        list = 0;
+        return true;
+    }
+
+    u32 mark = u32(m_scratch.size());
+    do
+    {
+        u32 argument = parse_type_argument();
+        if (!argument)
+        {
+            return false;
+        }
+
+        m_scratch.push_back(argument);
+    } while (accept(TokenKind::Comma));
+
+    if (!close_type_arguments())
+    {
+        return false;
+    }
+
+    list = finish_list(mark);
+    return true;
+}
+
+u32 Parser::parse_type_argument()
+{
+    u32 annotations_token = m_pos;
+    u32 annotations;
+    if (!parse_annotations(annotations))
+    {
+        return 0;
+    }
+
+    if (kind() != TokenKind::Question)
+    {
+        u32 type = parse_type();
+        return type && annotations ? m_ast.add(NodeKind::AnnotatedType, annotations_token, type, annotations) : type;
+    }
+
+    u32 token = advance();
+    u32 bound = Ast::NONE;
+    u32 bound_kind = 0;
+    if (accept(TokenKind::KwExtends))
+    {
+        bound_kind = WILDCARD_EXTENDS;
+    }
+    else if (accept(TokenKind::KwSuper))
+    {
+        bound_kind = WILDCARD_SUPER;
+    }
+
+    if (bound_kind)
+    {
+        bound = parse_type();
+        if (!bound)
+        {
+            return 0;
+        }
+    }
+
+    u32 wildcard = m_ast.add(NodeKind::Wildcard, token, bound, bound_kind);
+    return annotations ? m_ast.add(NodeKind::AnnotatedType, annotations_token, wildcard, annotations) : wildcard;
+}
+
+// Brackets after a type, each of which may be annotated
+u32 Parser::parse_dims(u32 type)
+{
+    for (;;)
+    {
+        u32 next = skip_annotations(m_pos);
+        if (!next || at(next) != TokenKind::LBracket || at(next + 1) != TokenKind::RBracket)
+        {
+            return type;
+        }
+
+        u32 annotations;
+        if (!parse_annotations(annotations))
+        {
+            return 0;
+        }
+
+        type = m_ast.add(NodeKind::ArrayType, advance(), type, annotations);
+        advance();
+    }
+}
+
+// JLS 14.2
+u32 Parser::parse_block()
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 token = m_pos;
+    if (!expect(TokenKind::LBrace))
+    {
+        return 0;
+    }
+
+    u32 mark = u32(m_scratch.size());
+    while (!accept(TokenKind::RBrace))
+    {
+        if (kind() == TokenKind::EndOfFile)
+        {
+            return fail_expected(TokenKind::RBrace);
+        }
+
+        u32 statement = parse_block_statement();
+        if (!statement)
+        {
+            return 0;
+        }
+
+        m_scratch.push_back(statement);
+    }
+
+    return m_ast.add(NodeKind::Block, token, Ast::NONE, finish_list(mark));
+}
+
+u32 Parser::parse_block_statement()
+{
+    if (!poll())
+    {
+        return 0;
+    }
+
+    // "yield" and labels come first, as "yield x;" also looks like the
+    // declaration of a variable x of type yield
+    bool labeled = is_name(kind()) && peek(1) == TokenKind::Colon;
+    if (!labeled && !(kind() == TokenKind::KwYield && is_yield_statement()) && is_local_declaration_start())
+    {
+        return parse_local_declaration();
+    }
+
+    return parse_statement();
+}
+
+// JLS 14.3 and 14.4
+u32 Parser::parse_local_declaration()
+{
+    u32 token = m_pos;
+    u32 modifiers;
+    if (!parse_modifiers(modifiers))
+    {
+        return 0;
+    }
+
+    if (is_type_declaration_start())
+    {
+        return parse_type_declaration(modifiers);
+    }
+
+    u32 type = parse_type();
+    u32 declarators;
+    if (!type || !parse_variable_declarators(type, declarators) || !expect(TokenKind::Semicolon))
+    {
+        return 0;
+    }
+
+    return m_ast.add(NodeKind::Variables, token, modifiers, declarators);
+}
+
+// JLS 14.5
+u32 Parser::parse_statement()
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 token = m_pos;
+    switch (kind())
+    {
+    case TokenKind::LBrace:
+        return parse_block();
+    case TokenKind::Semicolon:
+        return m_ast.add(NodeKind::EmptyStatement, advance());
+    case TokenKind::KwIf: {
+        advance();
+        if (!expect(TokenKind::LParen))
+        {
+            return 0;
+        }
+
+        u32 condition = parse_expression();
+        if (!condition || !expect(TokenKind::RParen))
+        {
+            return 0;
+        }
+
+        BranchRecord record{};
+        record.then = parse_statement();
+        if (!record.then)
+        {
+            return 0;
+        }
+
+        if (accept(TokenKind::KwElse))
+        {
+            record.otherwise = parse_statement();
+            if (!record.otherwise)
+            {
+                return 0;
+            }
+        }
+
+        return m_ast.add(NodeKind::If, token, condition, m_ast.add_record(record));
+    }
+    case TokenKind::KwWhile: {
+        advance();
+        if (!expect(TokenKind::LParen))
+        {
+            return 0;
+        }
+
+        u32 condition = parse_expression();
+        if (!condition || !expect(TokenKind::RParen))
+        {
+            return 0;
+        }
+
+        u32 body = parse_statement();
+        return body ? m_ast.add(NodeKind::While, token, condition, body) : 0;
+    }
+    case TokenKind::KwDo: {
+        advance();
+        u32 body = parse_statement();
+        if (!body || !expect(TokenKind::KwWhile) || !expect(TokenKind::LParen))
+        {
+            return 0;
+        }
+
+        u32 condition = parse_expression();
+        if (!condition || !expect(TokenKind::RParen) || !expect(TokenKind::Semicolon))
+        {
+            return 0;
+        }
+
+        return m_ast.add(NodeKind::DoWhile, token, body, condition);
+    }
+    case TokenKind::KwFor:
+        return parse_for();
+    case TokenKind::KwTry:
+        return parse_try();
+    case TokenKind::KwSwitch:
+        return parse_switch(false);
+    case TokenKind::KwSynchronized: {
+        advance();
+        if (!expect(TokenKind::LParen))
+        {
+            return 0;
+        }
+
+        u32 lock = parse_expression();
+        if (!lock || !expect(TokenKind::RParen))
+        {
+            return 0;
+        }
+
+        u32 block = parse_block();
+        return block ? m_ast.add(NodeKind::Synchronized, token, lock, block) : 0;
+    }
+    case TokenKind::KwReturn:
+    case TokenKind::KwThrow: {
+        NodeKind node_kind = kind() == TokenKind::KwReturn ? NodeKind::Return : NodeKind::Throw;
+        advance();
+        u32 expression = Ast::NONE;
+        if (node_kind == NodeKind::Throw || kind() != TokenKind::Semicolon)
+        {
+            expression = parse_expression();
+            if (!expression)
+            {
+                return 0;
+            }
+        }
+
+        return expect(TokenKind::Semicolon) ? m_ast.add(node_kind, token, expression) : 0;
+    }
+    case TokenKind::KwBreak:
+    case TokenKind::KwContinue: {
+        NodeKind node_kind = kind() == TokenKind::KwBreak ? NodeKind::Break : NodeKind::Continue;
+        advance();
+        u32 label = is_name(kind()) ? advance() : 0;
+        return expect(TokenKind::Semicolon) ? m_ast.add(node_kind, token, label) : 0;
+    }
+    case TokenKind::KwAssert: {
+        advance();
+        u32 condition = parse_expression();
+        if (!condition)
+        {
+            return 0;
+        }
+
+        u32 message = Ast::NONE;
+        if (accept(TokenKind::Colon))
+        {
+            message = parse_expression();
+            if (!message)
+            {
+                return 0;
+            }
+        }
+
+        return expect(TokenKind::Semicolon) ? m_ast.add(NodeKind::Assert, token, condition, message) : 0;
+    }
+    case TokenKind::KwElse:
+        return fail(DiagnosticCode::ElseWithoutIf);
+    default:
+        break;
+    }
+
+    if (is_name(kind()) && peek(1) == TokenKind::Colon)
+    {
+        advance();
+        advance();
+        u32 statement = parse_statement();
+        return statement ? m_ast.add(NodeKind::Labeled, token, statement) : 0;
+    }
+
+    if (kind() == TokenKind::KwYield && is_yield_statement())
+    {
+        advance();
+        u32 expression = parse_expression();
+        if (!expression || !expect(TokenKind::Semicolon))
+        {
+            return 0;
+        }
+
+        return m_ast.add(NodeKind::Yield, token, expression);
+    }
+
+    u32 expression = parse_expression();
+    if (!expression)
+    {
+        return 0;
+    }
+
+    if (!is_statement_expression(expression))
+    {
+        m_pos = token;
+        m_split = 0;
+        return fail(DiagnosticCode::NotAStatement);
+    }
+
+    return expect(TokenKind::Semicolon) ? m_ast.add(NodeKind::ExpressionStatement, token, expression) : 0;
+}
+
+// JLS 14.14
+u32 Parser::parse_for()
+{
+    u32 token = advance();
+    if (!expect(TokenKind::LParen))
+    {
+        return 0;
+    }
+
+    ForRecord record{};
+    u32 mark = u32(m_scratch.size());
+
+    if (is_local_declaration_start())
+    {
+        u32 variables_token = m_pos;
+        u32 modifiers;
+        if (!parse_modifiers(modifiers))
+        {
+            return 0;
+        }
+
+        u32 type = parse_type();
+        if (!type)
+        {
+            return 0;
+        }
+
+        if (is_variable_name(kind()) && peek(1) == TokenKind::Colon)
+        {
+            u32 variable = m_ast.add(NodeKind::VariableDecl, advance(), type);
+            advance();
+
+            ForEachRecord each{};
+            u32 variables = m_ast.add(NodeKind::Variables, variables_token, modifiers, m_ast.add_list({&variable, 1}));
+            each.iterable = parse_expression();
+            if (!each.iterable || !expect(TokenKind::RParen))
+            {
+                return 0;
+            }
+
+            each.body = parse_statement();
+            return each.body ? m_ast.add(NodeKind::ForEach, token, variables, m_ast.add_record(each)) : 0;
+        }
+
+        u32 declarators;
+        if (!parse_variable_declarators(type, declarators))
+        {
+            return 0;
+        }
+
+        m_scratch.push_back(m_ast.add(NodeKind::Variables, variables_token, modifiers, declarators));
+    }
+    else if (kind() != TokenKind::Semicolon)
+    {
+        do
+        {
+            u32 expression_token = m_pos;
+            u32 expression = parse_expression();
+            if (!expression)
+            {
+                return 0;
+            }
+
+            if (!is_statement_expression(expression))
+            {
+                m_pos = expression_token;
+                m_split = 0;
+                return fail(DiagnosticCode::NotAStatement);
+            }
+
+            m_scratch.push_back(m_ast.add(NodeKind::ExpressionStatement, expression_token, expression));
+        } while (accept(TokenKind::Comma));
+    }
+
+    record.init = finish_list(mark);
+    if (!expect(TokenKind::Semicolon))
+    {
+        return 0;
+    }
+
+    if (kind() != TokenKind::Semicolon)
+    {
+        record.condition = parse_expression();
+        if (!record.condition)
+        {
+            return 0;
+        }
+    }
+
+    if (!expect(TokenKind::Semicolon))
+    {
+        return 0;
+    }
+
+    if (kind() != TokenKind::RParen)
+    {
+        do
+        {
+            u32 expression_token = m_pos;
+            u32 expression = parse_expression();
+            if (!expression)
+            {
+                return 0;
+            }
+
+            if (!is_statement_expression(expression))
+            {
+                m_pos = expression_token;
+                m_split = 0;
+                return fail(DiagnosticCode::NotAStatement);
+            }
+
+            m_scratch.push_back(m_ast.add(NodeKind::ExpressionStatement, expression_token, expression));
+        } while (accept(TokenKind::Comma));
+    }
+
+    record.update = finish_list(mark);
+    if (!expect(TokenKind::RParen))
+    {
+        return 0;
+    }
+
+    record.body = parse_statement();
+    return record.body ? m_ast.add(NodeKind::For, token, Ast::NONE, m_ast.add_record(record)) : 0;
+}
+
+// JLS 14.20
+u32 Parser::parse_try()
+{
+    u32 token = advance();
+    TryRecord record{};
+    bool has_resources = false;
+
+    if (accept(TokenKind::LParen))
+    {
+        has_resources = true;
+        u32 mark = u32(m_scratch.size());
+        while (!accept(TokenKind::RParen))
+        {
+            u32 resource;
+            if (is_local_declaration_start())
+            {
+                u32 variables_token = m_pos;
+                u32 modifiers;
+                if (!parse_modifiers(modifiers))
+                {
+                    return 0;
+                }
+
+                u32 type = parse_type();
+                u32 name = type ? parse_variable_name() : 0;
+                if (!name || !expect(TokenKind::Assign))
+                {
+                    return 0;
+                }
+
+                u32 initializer = parse_expression();
+                if (!initializer)
+                {
+                    return 0;
+                }
+
+                u32 variable = m_ast.add(NodeKind::VariableDecl, name, type, initializer);
+                resource = m_ast.add(NodeKind::Variables, variables_token, modifiers, m_ast.add_list({&variable, 1}));
+            }
+            else
+            {
+                resource = parse_expression();
+                if (!resource)
+                {
+                    return 0;
+                }
+            }
+
+            m_scratch.push_back(resource);
+            if (kind() != TokenKind::RParen && !expect(TokenKind::Semicolon))
+            {
+                return 0;
+            }
+        }
+
+        record.resources = finish_list(mark);
+    }
+
+    u32 block = parse_block();
+    if (!block)
+    {
+        return 0;
+    }
+
+    u32 mark = u32(m_scratch.size());
+    while (kind() == TokenKind::KwCatch)
+    {
+        u32 catch_token = advance();
+        if (!expect(TokenKind::LParen))
+        {
+            return 0;
+        }
+
+        u32 modifiers;
+        if (!parse_modifiers(modifiers))
+        {
+            return 0;
+        }
+
+        u32 type = parse_type();
+        if (!type)
+        {
+            return 0;
+        }
+
+        if (kind() == TokenKind::Bar)
+        {
+            u32 union_token = m_pos;
+            u32 alternatives_mark = u32(m_scratch.size());
+            m_scratch.push_back(type);
+            while (accept(TokenKind::Bar))
+            {
+                u32 alternative = parse_type();
+                if (!alternative)
+                {
+                    return 0;
+                }
+
+                m_scratch.push_back(alternative);
+            }
+
+            type = m_ast.add(NodeKind::UnionType, union_token, Ast::NONE, finish_list(alternatives_mark));
+        }
+
+        u32 name = parse_variable_name();
+        if (!name || !expect(TokenKind::RParen))
+        {
+            return 0;
+        }
+
+        u32 parameter = m_ast.add(NodeKind::Parameter, name, type, modifiers);
+        u32 catch_block = parse_block();
+        if (!catch_block)
+        {
+            return 0;
+        }
+
+        m_scratch.push_back(m_ast.add(NodeKind::Catch, catch_token, parameter, catch_block));
+    }
+
+    record.catches = finish_list(mark);
+    if (accept(TokenKind::KwFinally))
+    {
+        record.finally_block = parse_block();
+        if (!record.finally_block)
+        {
+            return 0;
+        }
+    }
+
+    if (!has_resources && !record.catches && !record.finally_block)
+    {
+        m_pos = token;
+        return fail(DiagnosticCode::TryWithoutCatch);
+    }
+
+    return m_ast.add(NodeKind::Try, token, block, m_ast.add_record(record));
+}
+
+// JLS 14.11 and 15.28; rules and groups of statements can't be mixed,
+// which is left to later passes
+u32 Parser::parse_switch(bool expression)
+{
+    u32 token = advance();
+    if (!expect(TokenKind::LParen))
+    {
+        return 0;
+    }
+
+    u32 selector = parse_expression();
+    if (!selector || !expect(TokenKind::RParen) || !expect(TokenKind::LBrace))
+    {
+        return 0;
+    }
+
+    u32 mark = u32(m_scratch.size());
+    while (!accept(TokenKind::RBrace))
+    {
+        u32 case_token = m_pos;
+        u32 labels_mark = u32(m_scratch.size());
+
+        if (kind() == TokenKind::KwDefault)
+        {
+            m_scratch.push_back(m_ast.add(NodeKind::DefaultLabel, advance()));
+        }
+        else if (accept(TokenKind::KwCase))
+        {
+            do
+            {
+                u32 label = parse_case_label();
+                if (!label)
+                {
+                    return 0;
+                }
+
+                m_scratch.push_back(label);
+            } while (accept(TokenKind::Comma));
+        }
+        else
+        {
+            return fail_expected(TokenKind::KwCase);
+        }
+
+        u32 labels = finish_list(labels_mark);
+
+        if (kind() == TokenKind::Arrow)
+        {
+            advance();
+            u32 body_token = m_pos;
+            u32 body;
+            if (kind() == TokenKind::LBrace)
+            {
+                body = parse_block();
+            }
+            else if (kind() == TokenKind::KwThrow)
+            {
+                body = parse_statement();
+            }
+            else
+            {
+                body = parse_expression();
+                if (body && !expression && !is_statement_expression(body))
+                {
+                    m_pos = body_token;
+                    m_split = 0;
+                    return fail(DiagnosticCode::NotAStatement);
+                }
+
+                if (!body || !expect(TokenKind::Semicolon))
+                {
+                    return 0;
+                }
+
+                body = m_ast.add(NodeKind::ExpressionStatement, body_token, body);
+            }
+
+            if (!body)
+            {
+                return 0;
+            }
+
+            m_scratch.push_back(m_ast.add(NodeKind::SwitchRule, case_token, labels, body));
+            continue;
+        }
+
+        if (!expect(TokenKind::Colon))
+        {
+            return 0;
+        }
+
+        u32 statements_mark = u32(m_scratch.size());
+        while (kind() != TokenKind::KwCase && kind() != TokenKind::KwDefault && kind() != TokenKind::RBrace)
+        {
+            if (kind() == TokenKind::EndOfFile)
+            {
+                return fail_expected(TokenKind::RBrace);
+            }
+
+            u32 statement = parse_block_statement();
+            if (!statement)
+            {
+                return 0;
+            }
+
+            m_scratch.push_back(statement);
+        }
+
+        u32 statements = finish_list(statements_mark);
+        m_scratch.push_back(m_ast.add(NodeKind::SwitchCase, case_token, labels, statements));
+    }
+
+    return m_ast.add(expression ? NodeKind::SwitchExpression : NodeKind::Switch, token, selector, finish_list(mark));
+}
+
+// JLS 14.11.1
+u32 Parser::parse_case_label()
+{
+    if (kind() == TokenKind::KwDefault)
+    {
+        return m_ast.add(NodeKind::DefaultLabel, advance());
+    }
+
+    // The arrow after a label isn't a lambda's
+    bool no_lambda = m_no_lambda;
+    m_no_lambda = true;
+    u32 label;
+
+    if (is_pattern_start())
+    {
+        label = parse_pattern();
+        if (label && kind() == TokenKind::KwWhen)
+        {
+            u32 token = advance();
+            u32 condition = parse_expression();
+            label = condition ? m_ast.add(NodeKind::Guard, token, label, condition) : 0;
+        }
+    }
+    else
+    {
+        label = parse_conditional();
+    }
+
+    m_no_lambda = no_lambda;
+    return label;
+}
+
+// JLS 14.30.1
+u32 Parser::parse_pattern()
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    if (kind() == TokenKind::KwUnderscore && (peek(1) == TokenKind::Comma || peek(1) == TokenKind::RParen))
+    {
+        return m_ast.add(NodeKind::TypePattern, advance());
+    }
+
+    u32 modifiers;
+    if (!parse_modifiers(modifiers))
+    {
+        return 0;
+    }
+
+    u32 type = parse_type();
+    if (!type)
+    {
+        return 0;
+    }
+
+    if (kind() != TokenKind::LParen)
+    {
+        u32 name = parse_variable_name();
+        return name ? m_ast.add(NodeKind::TypePattern, name, type, modifiers) : 0;
+    }
+
+    u32 token = advance();
+    u32 mark = u32(m_scratch.size());
+    if (!accept(TokenKind::RParen))
+    {
+        do
+        {
+            u32 pattern = parse_pattern();
+            if (!pattern)
+            {
+                return 0;
+            }
+
+            m_scratch.push_back(pattern);
+        } while (accept(TokenKind::Comma));
+
+        if (!expect(TokenKind::RParen))
+        {
+            return 0;
+        }
+    }
+
+    return m_ast.add(NodeKind::RecordPattern, token, type, finish_list(mark));
+}
+
+// JLS 15.26
+u32 Parser::parse_expression()
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 target = parse_conditional();
+    if (!target || !is_assignment_operator(kind()))
+    {
+        return target;
+    }
+
+    u32 token = advance();
+    u32 value = parse_expression();
+    return value ? m_ast.add(NodeKind::Assign, token, target, value) : 0;
+}
+
+// JLS 15.25
+u32 Parser::parse_conditional()
+{
+    u32 condition = parse_binary(1);
+    if (!condition || kind() != TokenKind::Question)
+    {
+        return condition;
+    }
+
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 token = advance();
+    BranchRecord record{};
+    record.then = parse_expression();
+    if (!record.then || !expect(TokenKind::Colon))
+    {
+        return 0;
+    }
+
+    record.otherwise = parse_conditional();
+    return record.otherwise ? m_ast.add(NodeKind::Conditional, token, condition, m_ast.add_record(record)) : 0;
+}
+
+// JLS 15.17 to 15.24 by precedence climbing; operators of the same
+// precedence are taken in a loop, so long chains don't recurse
+u32 Parser::parse_binary(u32 min_precedence)
+{
+    u32 left = parse_unary();
+    while (left)
+    {
+        TokenKind op = kind();
+        u32 precedence = binary_precedence(op);
+        if (precedence < min_precedence || !precedence)
+        {
+            break;
+        }
+
+        u32 token = advance();
+        if (op == TokenKind::KwInstanceof)
+        {
+            u32 target = is_pattern_start() ? parse_pattern() : parse_type();
+            left = target ? m_ast.add(NodeKind::InstanceOf, token, left, target) : 0;
+            continue;
+        }
+
+        u32 right = parse_binary(precedence + 1);
+        left = right ? m_ast.add(NodeKind::Binary, token, left, right) : 0;
+    }
+
+    return left;
+}
+
+// JLS 15.15 and 15.14
+u32 Parser::parse_unary()
+{
+    switch (kind())
+    {
+    case TokenKind::PlusPlus:
+    case TokenKind::MinusMinus:
+    case TokenKind::Plus:
+    case TokenKind::Minus:
+    case TokenKind::Bang:
+    case TokenKind::Tilde: {
+        NestingScope nesting{m_depth};
+        if (m_depth > PARSER_MAX_NESTING)
+        {
+            return fail(DiagnosticCode::NestingTooDeep);
+        }
+
+        u32 token = advance();
+        u32 operand = parse_unary();
+        return operand ? m_ast.add(NodeKind::Unary, token, operand) : 0;
+    }
+    default:
+        break;
+    }
+
+    if (is_lambda())
+    {
+        return parse_lambda();
+    }
+
+    if (kind() == TokenKind::LParen && is_cast())
+    {
+        return parse_cast();
+    }
+
+    u32 expression = parse_primary();
+    while (expression && (kind() == TokenKind::PlusPlus || kind() == TokenKind::MinusMinus))
+    {
+        expression = m_ast.add(NodeKind::Postfix, advance(), expression);
+    }
+
+    return expression;
+}
+
+// JLS 15.16
+u32 Parser::parse_cast()
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 token = advance();
+    u32 type = parse_type();
+    if (!type)
+    {
+        return 0;
+    }
+
+    if (kind() == TokenKind::Amp)
+    {
+        u32 intersection_token = m_pos;
+        u32 mark = u32(m_scratch.size());
+        m_scratch.push_back(type);
+        while (accept(TokenKind::Amp))
+        {
+            u32 bound = parse_type();
+            if (!bound)
+            {
+                return 0;
+            }
+
+            m_scratch.push_back(bound);
+        }
+
+        type = m_ast.add(NodeKind::IntersectionType, intersection_token, Ast::NONE, finish_list(mark));
+    }
+
+    if (!expect(TokenKind::RParen))
+    {
+        return 0;
+    }
+
+    u32 operand = parse_unary();
+    return operand ? m_ast.add(NodeKind::Cast, token, type, operand) : 0;
+}
+
+// JLS 15.27
+u32 Parser::parse_lambda()
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 parameters = 0;
+    if (is_variable_name(kind()))
+    {
+        u32 parameter = m_ast.add(NodeKind::Parameter, advance());
+        parameters = m_ast.add_list({&parameter, 1});
+    }
+    else if (is_variable_name(peek(1)) && (peek(2) == TokenKind::Comma || peek(2) == TokenKind::RParen))
+    {
+        // Parameters without types
+        advance();
+        u32 mark = u32(m_scratch.size());
+        do
+        {
+            u32 name = parse_variable_name();
+            if (!name)
+            {
+                return 0;
+            }
+
+            m_scratch.push_back(m_ast.add(NodeKind::Parameter, name));
+        } while (accept(TokenKind::Comma));
+
+        if (!expect(TokenKind::RParen))
+        {
+            return 0;
+        }
+
+        parameters = finish_list(mark);
+    }
+    else if (!parse_formal_parameters(parameters))
+    {
+        return 0;
+    }
+
+    u32 token = m_pos;
+    if (!expect(TokenKind::Arrow))
+    {
+        return 0;
+    }
+
+    // The body of a lambda in a case label ends at the label's arrow
+    bool no_lambda = m_no_lambda;
+    m_no_lambda = false;
+    u32 body = kind() == TokenKind::LBrace ? parse_block() : parse_expression();
+    m_no_lambda = no_lambda;
+
+    return body ? m_ast.add(NodeKind::Lambda, token, parameters, body) : 0;
+}
+
+// JLS 15.8 to 15.13
+u32 Parser::parse_primary()
+{
+    u32 token = m_pos;
+    u32 expression;
+    TokenKind kind = this->kind();
+
+    if (is_literal(kind))
+    {
+        expression = m_ast.add(NodeKind::Literal, advance());
+    }
+    else if (is_name(kind))
+    {
+        // Types that can't be taken for names: Foo<Bar>::new, int[].class
+        u32 type_end = peek(1) == TokenKind::Less || peek(1) == TokenKind::LBracket ? skip_type(m_pos) : 0;
+        if (type_end && type_end > m_pos + 1 &&
+            (at(type_end) == TokenKind::ColonColon ||
+             (at(type_end) == TokenKind::Dot && at(type_end + 1) == TokenKind::KwClass)))
+        {
+            expression = parse_type_expression();
+        }
+        else
+        {
+            expression = m_ast.add(NodeKind::Identifier, advance());
+            if (this->kind() == TokenKind::LParen)
+            {
+                expression = parse_call(expression, 0);
+            }
+        }
+    }
+    else
+    {
+        switch (kind)
+        {
+        case TokenKind::KwThis:
+        case TokenKind::KwSuper:
+            expression = m_ast.add(kind == TokenKind::KwThis ? NodeKind::This : NodeKind::Super, advance());
+            if (this->kind() == TokenKind::LParen)
+            {
+                expression = parse_call(expression, 0);
+            }
+            break;
+        case TokenKind::LParen: {
+            advance();
+            u32 inner = parse_expression();
+            if (!inner || !expect(TokenKind::RParen))
+            {
+                return 0;
+            }
+
+            expression = m_ast.add(NodeKind::Parenthesized, token, inner);
+            break;
+        }
+        case TokenKind::KwNew:
+            expression = parse_new(Ast::NONE);
+            break;
+        case TokenKind::KwSwitch: {
+            // A switch in an expression may hold lambdas of its own
+            bool no_lambda = m_no_lambda;
+            m_no_lambda = false;
+            expression = parse_switch(true);
+            m_no_lambda = no_lambda;
+            break;
+        }
+        case TokenKind::KwVoid:
+        case TokenKind::KwBoolean:
+        case TokenKind::KwByte:
+        case TokenKind::KwChar:
+        case TokenKind::KwShort:
+        case TokenKind::KwInt:
+        case TokenKind::KwLong:
+        case TokenKind::KwFloat:
+        case TokenKind::KwDouble:
+            expression = parse_type_expression();
+            break;
+        default:
+            return fail(DiagnosticCode::IllegalStartOfExpression);
+        }
+    }
+
+    return expression ? parse_selectors(expression) : 0;
+}
+
+// A type in an expression, followed by ".class" or "::"
+u32 Parser::parse_type_expression()
+{
+    u32 type = kind() == TokenKind::KwVoid ? m_ast.add(NodeKind::PrimitiveType, advance()) : parse_type();
+    if (!type)
+    {
+        return 0;
+    }
+
+    if (kind() == TokenKind::ColonColon)
+    {
+        return parse_method_reference(type);
+    }
+
+    if (kind() == TokenKind::Dot && peek(1) == TokenKind::KwClass)
+    {
+        advance();
+        return m_ast.add(NodeKind::ClassLiteral, advance(), type);
+    }
+
+    return fail(DiagnosticCode::IllegalStartOfExpression);
+}
+
+u32 Parser::parse_selectors(u32 expression)
+{
+    while (expression)
+    {
+        switch (kind())
+        {
+        case TokenKind::Dot: {
+            advance();
+            TokenKind kind = this->kind();
+            if (is_name(kind) || kind == TokenKind::KwThis || kind == TokenKind::KwSuper)
+            {
+                expression = m_ast.add(NodeKind::Select, advance(), expression);
+                if (this->kind() == TokenKind::LParen)
+                {
+                    expression = parse_call(expression, 0);
+                }
+            }
+            else if (kind == TokenKind::KwClass)
+            {
+                expression = m_ast.add(NodeKind::ClassLiteral, advance(), expression);
+            }
+            else if (kind == TokenKind::KwNew)
+            {
+                expression = parse_new(expression);
+            }
+            else if (kind == TokenKind::Less)
+            {
+                // Explicit type arguments, as in Collections.<T>emptyList()
+                u32 type_arguments;
+                if (!parse_type_arguments(false, type_arguments))
+                {
+                    return 0;
+                }
+
+                if (!is_name(this->kind()) && this->kind() != TokenKind::KwSuper &&
+                    this->kind() != TokenKind::KwThis)
+                {
+                    return fail_expected(TokenKind::Identifier);
+                }
+
+                expression = m_ast.add(NodeKind::Select, advance(), expression);
+                if (this->kind() != TokenKind::LParen)
+                {
+                    return fail_expected(TokenKind::LParen);
+                }
+
+                expression = parse_call(expression, type_arguments);
+            }
+            else
+            {
+                return fail_expected(TokenKind::Identifier);
+            }
+            break;
+        }
+        case TokenKind::LBracket: {
+            if (peek(1) == TokenKind::RBracket)
+            {
+                // A qualified name was an array type all along, as in
+                // java.lang.String[].class
+                expression = parse_dims(expression);
+                if (!expression)
+                {
+                    return 0;
+                }
+
+                if (kind() == TokenKind::ColonColon)
+                {
+                    return parse_method_reference(expression);
+                }
+
+                if (kind() != TokenKind::Dot || peek(1) != TokenKind::KwClass)
+                {
+                    return fail_expected(TokenKind::KwClass);
+                }
+
+                advance();
+                expression = m_ast.add(NodeKind::ClassLiteral, advance(), expression);
+                break;
+            }
+
+            u32 token = advance();
+            u32 index = parse_expression();
+            if (!index || !expect(TokenKind::RBracket))
+            {
+                return 0;
+            }
+
+            expression = m_ast.add(NodeKind::ArrayAccess, token, expression, index);
+            break;
+        }
+        case TokenKind::ColonColon:
+            expression = parse_method_reference(expression);
+            break;
+        default:
+            return expression;
+        }
+    }
+
+    return 0;
+}
+
+u32 Parser::parse_call(u32 callee, u32 type_arguments)
+{
+    u32 token = m_pos;
+    CallRecord record{};
+    record.type_arguments = type_arguments;
+    if (!parse_arguments(record.arguments))
+    {
+        return 0;
+    }
+
+    return m_ast.add(NodeKind::MethodCall, token, callee, m_ast.add_record(record));
+}
+
+bool Parser::parse_arguments(u32 &list)
+{
+    if (!expect(TokenKind::LParen))
+    {
+        return false;
+    }
+
+    // Arguments of a call in a case label or guard may be lambdas
+    bool no_lambda = m_no_lambda;
+    m_no_lambda = false;
+    u32 mark = u32(m_scratch.size());
+    if (!accept(TokenKind::RParen))
+    {
+        do
+        {
+            u32 argument = parse_expression();
+            if (!argument)
+            {
+                return false;
+            }
+
+            m_scratch.push_back(argument);
+        } while (accept(TokenKind::Comma));
+
+        if (!expect(TokenKind::RParen))
+        {
+            return false;
+        }
+    }
+
+    m_no_lambda = no_lambda;
+    list = finish_list(mark);
+    return true;
+}
+
+// JLS 15.9 and 15.10.1, from "new" on
+u32 Parser::parse_new(u32 outer)
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 token = advance();
+    NewRecord record{};
+    if (kind() == TokenKind::Less && !parse_type_arguments(false, record.type_arguments))
+    {
+        return 0;
+    }
+
+    u32 annotations_token = m_pos;
+    u32 annotations;
+    if (!parse_annotations(annotations))
+    {
+        return 0;
+    }
+
+    u32 type;
+    if (is_primitive_type(kind()))
+    {
+        type = m_ast.add(NodeKind::PrimitiveType, advance());
+    }
+    else if (is_name(kind()))
+    {
+        type = parse_class_type(true);
+        if (!type)
+        {
+            return 0;
+        }
+    }
+    else
+    {
+        return fail_expected(TokenKind::Identifier);
+    }
+
+    if (annotations)
+    {
+        type = m_ast.add(NodeKind::AnnotatedType, annotations_token, type, annotations);
+    }
+
+    if (kind() == TokenKind::LBracket)
+    {
+        NewArrayRecord array{};
+        u32 mark = u32(m_scratch.size());
+        while (kind() == TokenKind::LBracket && peek(1) != TokenKind::RBracket)
+        {
+            advance();
+            u32 dimension = parse_expression();
+            if (!dimension || !expect(TokenKind::RBracket))
+            {
+                return 0;
+            }
+
+            m_scratch.push_back(dimension);
+        }
+
+        array.dimensions = finish_list(mark);
+        type = parse_dims(type);
+        if (!type)
+        {
+            return 0;
+        }
+
+        if (!array.dimensions)
+        {
+            if (kind() != TokenKind::LBrace)
+            {
+                return fail_expected(TokenKind::LBrace);
+            }
+
+            array.initializer = parse_array_initializer(false);
+            if (!array.initializer)
+            {
+                return 0;
+            }
+        }
+
+        return m_ast.add(NodeKind::NewArray, token, type, m_ast.add_record(array));
+    }
+
+    record.type = type;
+    if (kind() != TokenKind::LParen)
+    {
+        return fail_expected(TokenKind::LParen);
+    }
+
+    if (!parse_arguments(record.arguments))
+    {
+        return 0;
+    }
+
+    if (kind() == TokenKind::LBrace)
+    {
+        u32 body_token = m_pos;
+        u32 members;
+        if (!parse_class_body(NodeKind::ClassDecl, members))
+        {
+            return 0;
+        }
+
+        record.body = m_ast.add(NodeKind::ClassBody, body_token, Ast::NONE, members);
+    }
+
+    return m_ast.add(NodeKind::New, token, outer, m_ast.add_record(record));
+}
+
+// JLS 10.6, and element values of annotations, JLS 9.7.1
+u32 Parser::parse_array_initializer(bool element_values)
+{
+    NestingScope nesting{m_depth};
+    if (m_depth > PARSER_MAX_NESTING)
+    {
+        return fail(DiagnosticCode::NestingTooDeep);
+    }
+
+    u32 token = advance();
+    u32 mark = u32(m_scratch.size());
+    while (kind() != TokenKind::RBrace)
+    {
+        u32 element;
+        if (element_values)
+        {
+            element = parse_element_value();
+        }
+        else
+        {
+            element = kind() == TokenKind::LBrace ? parse_array_initializer(false) : parse_expression();
+        }
+
+        if (!element)
+        {
+            return 0;
+        }
+
+        m_scratch.push_back(element);
+        if (!accept(TokenKind::Comma))
+        {
+            break;
+        }
+    }
+
+    if (!expect(TokenKind::RBrace))
+    {
+        return 0;
+    }
+
+    return m_ast.add(NodeKind::ArrayInitializer, token, Ast::NONE, finish_list(mark));
+}
+
+// JLS 15.13, from the "::" on
+u32 Parser::parse_method_reference(u32 qualifier)
+{
+    advance();
+    u32 type_arguments = 0;
+    if (kind() == TokenKind::Less && !parse_type_arguments(false, type_arguments))
+    {
+        return 0;
+    }
+
+    if (!is_name(kind()) && kind() != TokenKind::KwNew)
+    {
+        return fail_expected(TokenKind::Identifier);
+    }
+
+    return m_ast.add(NodeKind::MethodReference, advance(), qualifier, type_arguments);
+}
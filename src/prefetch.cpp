@@ -0,0 +1,495 @@
+#include "ujavac.h"
+
+#include <bit>
+
+#ifdef __linux__
+#include <cerrno>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+// Reading is blocking, so a handful of threads is enough to keep the
+// window full without crowding out the workers
+constexpr u32 PREFETCH_THREADS = 4;
+} // namespace
+
+#ifdef __linux__
+namespace
+{
+// The submission and completion rings, set up with raw system calls so
+// that there's no dependency on liburing
+class IoUring
+{
+  public:
+    IoUring(const IoUring &) = delete;
+    IoUring &operator=(const IoUring &) = delete;
+
+    IoUring() = default;
+
+    ~IoUring()
+    {
+        if (m_sqes)
+        {
+            munmap(m_sqes, m_sqes_size);
+        }
+
+        if (m_cq_ring && m_cq_ring != m_sq_ring)
+        {
+            munmap(m_cq_ring, m_cq_ring_size);
+        }
+
+        if (m_sq_ring)
+        {
+            munmap(m_sq_ring, m_sq_ring_size);
+        }
+
+        if (m_fd >= 0)
+        {
+            close(m_fd);
+        }
+    }
+
+    // False if io_uring is missing, forbidden (e.g. by seccomp), or too
+    // old for the requests used here
+    bool setup(u32 entries)
+    {
+        io_uring_params params{};
+        m_fd = int(syscall(__NR_io_uring_setup, entries, &params));
+        if (m_fd < 0 || !supports({IORING_OP_OPENAT, IORING_OP_STATX, IORING_OP_READ}))
+        {
+            return false;
+        }
+
+        m_sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(u32);
+        m_cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        if (params.features & IORING_FEAT_SINGLE_MMAP)
+        {
+            m_sq_ring_size = m_cq_ring_size = std::max(m_sq_ring_size, m_cq_ring_size);
+        }
+
+        m_sq_ring = map(m_sq_ring_size, IORING_OFF_SQ_RING);
+        m_cq_ring = params.features & IORING_FEAT_SINGLE_MMAP ? m_sq_ring : map(m_cq_ring_size, IORING_OFF_CQ_RING);
+        m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        m_sqes = static_cast<io_uring_sqe *>(map(m_sqes_size, IORING_OFF_SQES));
+        if (!m_sq_ring || !m_cq_ring || !m_sqes)
+        {
+            return false;
+        }
+
+        m_sq_tail = field(m_sq_ring, params.sq_off.tail);
+        m_sq_mask = *field(m_sq_ring, params.sq_off.ring_mask);
+        m_sq_array = field(m_sq_ring, params.sq_off.array);
+        m_cq_head = field(m_cq_ring, params.cq_off.head);
+        m_cq_tail = field(m_cq_ring, params.cq_off.tail);
+        m_cq_mask = *field(m_cq_ring, params.cq_off.ring_mask);
+        m_cqes = reinterpret_cast<io_uring_cqe *>(static_cast<u8 *>(m_cq_ring) + params.cq_off.cqes);
+        m_local_tail = *m_sq_tail;
+        return true;
+    }
+
+    // The caller keeps no more requests in flight than there are entries
+    io_uring_sqe &queue(u64 user_data)
+    {
+        u32 index = m_local_tail & m_sq_mask;
+        io_uring_sqe &sqe = m_sqes[index];
+        sqe = {};
+        sqe.user_data = user_data;
+        m_sq_array[index] = index;
+        m_local_tail++;
+        m_queued++;
+        return sqe;
+    }
+
+    // Submits what's queued and waits for at least one completion
+    bool submit_and_wait()
+    {
+        std::atomic_ref<u32>{*m_sq_tail}.store(m_local_tail, std::memory_order_release);
+
+        for (;;)
+        {
+            long n = syscall(__NR_io_uring_enter, m_fd, m_queued, 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+            if (n >= 0)
+            {
+                m_queued -= u32(n);
+                return true;
+            }
+
+            if (errno != EINTR)
+            {
+                return false;
+            }
+        }
+    }
+
+    template <class F> void reap(F &&f)
+    {
+        u32 head = *m_cq_head;
+        u32 tail = std::atomic_ref<u32>{*m_cq_tail}.load(std::memory_order_acquire);
+
+        for (; head != tail; head++)
+        {
+            const io_uring_cqe &cqe = m_cqes[head & m_cq_mask];
+            f(cqe.user_data, cqe.res);
+        }
+
+        std::atomic_ref<u32>{*m_cq_head}.store(head, std::memory_order_release);
+    }
+
+  private:
+    bool supports(std::initializer_list<u8> ops)
+    {
+        constexpr u32 PROBE_OPS = 256;
+        std::vector<u8> storage(sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op));
+        io_uring_probe *probe = reinterpret_cast<io_uring_probe *>(storage.data());
+
+        if (syscall(__NR_io_uring_register, m_fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) < 0)
+        {
+            return false;
+        }
+
+        for (u8 op : ops)
+        {
+            if (op > probe->last_op || !(probe->ops[op].flags & IO_URING_OP_SUPPORTED))
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    void *map(u64 size, u64 offset)
+    {
+        void *p = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, offset);
+        return p == MAP_FAILED ? nullptr : p;
+    }
+
+    static u32 *field(void *ring, u32 offset)
+    {
+        return reinterpret_cast<u32 *>(static_cast<u8 *>(ring) + offset);
+    }
+
+    int m_fd = -1;
+    void *m_sq_ring = nullptr;
+    void *m_cq_ring = nullptr;
+    io_uring_sqe *m_sqes = nullptr;
+    u64 m_sq_ring_size = 0;
+    u64 m_cq_ring_size = 0;
+    u64 m_sqes_size = 0;
+
+    u32 *m_sq_tail = nullptr;
+    u32 *m_sq_array = nullptr;
+    u32 m_sq_mask = 0;
+    u32 *m_cq_head = nullptr;
+    u32 *m_cq_tail = nullptr;
+    u32 m_cq_mask = 0;
+    io_uring_cqe *m_cqes = nullptr;
+
+    u32 m_local_tail = 0;
+    u32 m_queued = 0;
+};
+
+enum class PrefetchOp : u8
+{
+    Open,
+    Stat,
+    Read,
+};
+
+// An input somewhere between being opened and fully read
+struct PendingInput
+{
+    int fd;
+    // Open and stat go out together; reading starts once both are back
+    u32 waiting;
+    bool failed;
+    struct statx stat;
+    std::vector<u8> contents;
+    u64 done;
+};
+
+u64 prefetch_user_data(u32 input, PrefetchOp op)
+{
+    return u64(input) << 8 | u64(op);
+}
+} // namespace
+
+bool InputPrefetcher::start_io_uring()
+{
+    // Each input has at most two requests in flight
+    auto ring = std::make_unique<IoUring>();
+    if (!ring->setup(std::bit_ceil(2 * m_depth)))
+    {
+        return false;
+    }
+
+    m_io_uring = true;
+    m_threads.emplace_back([this, ring = std::move(ring)] {
+        u32 count = m_paths.size();
+        std::vector<PendingInput> pending(m_depth);
+        u32 next = 0;
+        u32 in_flight = 0;
+
+        auto queue_read = [&](u32 input, PendingInput &p) {
+            io_uring_sqe &sqe = ring->queue(prefetch_user_data(input, PrefetchOp::Read));
+            sqe.opcode = IORING_OP_READ;
+            sqe.fd = p.fd;
+            sqe.addr = reinterpret_cast<u64>(p.contents.data() + p.done);
+            sqe.len = u32(std::min<u64>(p.contents.size() - p.done, 1u << 30));
+            sqe.off = p.done;
+        };
+
+        auto finish = [&](u32 input, PendingInput &p, bool ok) {
+            if (p.fd >= 0)
+            {
+                close(p.fd);
+            }
+
+            SourceBuffer source;
+            if (ok)
+            {
+                source.adopt(std::move(p.contents), InputStrategy::IoUring);
+            }
+
+            p.contents = {};
+            publish(input, std::move(source), ok);
+            in_flight--;
+        };
+
+        auto opened = [&](u32 input, PendingInput &p) {
+            // Anything but a regular file is left to the caller
+            if (p.failed || !S_ISREG(p.stat.stx_mode))
+            {
+                finish(input, p, false);
+                return;
+            }
+
+            p.contents.resize(p.stat.stx_size);
+            if (p.contents.empty())
+            {
+                finish(input, p, true);
+                return;
+            }
+
+            queue_read(input, p);
+        };
+
+        auto complete = [&](u64 user_data, s32 res) {
+            u32 input = u32(user_data >> 8);
+            PendingInput &p = pending[input % m_depth];
+
+            switch (PrefetchOp(user_data & 0xFF))
+            {
+            case PrefetchOp::Open:
+                p.failed |= res < 0;
+                p.fd = res < 0 ? -1 : res;
+                if (!--p.waiting)
+                {
+                    opened(input, p);
+                }
+                break;
+            case PrefetchOp::Stat:
+                p.failed |= res < 0;
+                if (!--p.waiting)
+                {
+                    opened(input, p);
+                }
+                break;
+            case PrefetchOp::Read:
+                if (res < 0)
+                {
+                    finish(input, p, false);
+                }
+                else if (res == 0 || (p.done += res) == p.contents.size())
+                {
+                    // Files that shrank since the stat end early
+                    p.contents.resize(p.done);
+                    finish(input, p, true);
+                }
+                else
+                {
+                    queue_read(input, p);
+                }
+                break;
+            }
+        };
+
+        for (;;)
+        {
+            u32 limit;
+            bool stopping;
+            {
+                std::unique_lock lock{m_mutex};
+                if (!in_flight && next < count && !m_stopping)
+                {
+                    m_space.wait(lock, [&] { return m_stopping || next < m_taken + m_depth; });
+                }
+
+                limit = std::min(count, m_taken + m_depth);
+                stopping = m_stopping;
+            }
+
+            for (; !stopping && next < limit; next++)
+            {
+                if (!m_paths[next])
+                {
+                    publish(next, {}, false);
+                    continue;
+                }
+
+                PendingInput &p = pending[next % m_depth];
+                p = {-1, 2, false, {}, {}, 0};
+
+                io_uring_sqe &open = ring->queue(prefetch_user_data(next, PrefetchOp::Open));
+                open.opcode = IORING_OP_OPENAT;
+                open.fd = AT_FDCWD;
+                open.addr = reinterpret_cast<u64>(m_paths[next]);
+                open.open_flags = O_RDONLY | O_CLOEXEC;
+
+                io_uring_sqe &stat = ring->queue(prefetch_user_data(next, PrefetchOp::Stat));
+                stat.opcode = IORING_OP_STATX;
+                stat.fd = AT_FDCWD;
+                stat.addr = reinterpret_cast<u64>(m_paths[next]);
+                stat.len = STATX_TYPE | STATX_SIZE;
+                stat.off = reinterpret_cast<u64>(&p.stat);
+
+                in_flight++;
+            }
+
+            // Requests in flight own their buffers, so they're waited
+            // for even when stopping
+            if (!in_flight)
+            {
+                if (stopping || next == count)
+                {
+                    break;
+                }
+
+                continue;
+            }
+
+            if (!ring->submit_and_wait())
+            {
+                // Not expected once the ring is set up; the caller
+                // reads whatever is left
+                std::lock_guard lock{m_mutex};
+                m_stopping = true;
+                m_ready.notify_all();
+                break;
+            }
+
+            ring->reap(complete);
+        }
+    });
+
+    return true;
+}
+#else
+bool InputPrefetcher::start_io_uring()
+{
+    return false;
+}
+#endif
+
+InputPrefetcher::InputPrefetcher(std::vector<const char *> paths, u32 depth)
+    : m_paths(std::move(paths)), m_depth(std::max(depth, 1u)), m_slots(m_depth)
+{
+    if (!start_io_uring())
+    {
+        for (u32 i = 0; i < std::min(m_depth, PREFETCH_THREADS); i++)
+        {
+            m_threads.emplace_back([this] { read_inputs(); });
+        }
+    }
+}
+
+InputPrefetcher::~InputPrefetcher()
+{
+    {
+        std::lock_guard lock{m_mutex};
+        m_stopping = true;
+    }
+
+    m_space.notify_all();
+
+    for (std::thread &thread : m_threads)
+    {
+        thread.join();
+    }
+}
+
+void InputPrefetcher::read_inputs()
+{
+    for (;;)
+    {
+        u32 input;
+        {
+            std::unique_lock lock{m_mutex};
+            m_space.wait(lock, [&] { return m_stopping || m_next == m_paths.size() || m_next < m_taken + m_depth; });
+            if (m_stopping || m_next == m_paths.size())
+            {
+                return;
+            }
+
+            input = m_next++;
+        }
+
+        SourceBuffer source;
+        bool ok = m_paths[input] && source.open(m_paths[input], false);
+        publish(input, std::move(source), ok);
+    }
+}
+
+void InputPrefetcher::publish(u32 input, SourceBuffer &&source, bool ok)
+{
+    {
+        std::lock_guard lock{m_mutex};
+        Slot &slot = m_slots[input % m_depth];
+        slot.source = std::move(source);
+        slot.ok = ok;
+        slot.ready = true;
+    }
+
+    if (ok)
+    {
+        m_prefetched++;
+    }
+
+    m_ready.notify_all();
+}
+
+bool InputPrefetcher::next(SourceBuffer &source)
+{
+    std::unique_lock lock{m_mutex};
+    if (m_taken == m_paths.size())
+    {
+        return false;
+    }
+
+    Slot &slot = m_slots[m_taken % m_depth];
+    m_ready.wait(lock, [&] { return slot.ready || m_stopping; });
+    if (!slot.ready)
+    {
+        return false;
+    }
+
+    bool ok = slot.ok;
+    if (ok)
+    {
+        source = std::move(slot.source);
+    }
+
+    slot.source.close();
+    slot.ready = false;
+    m_taken++;
+    lock.unlock();
+
+    m_space.notify_all();
+    return ok;
+}
@@ -0,0 +1,631 @@
+#include "ujavac.h"
+
+#include <algorithm>
+#include <format>
+
+namespace
+{
+// Longer chains of supertypes are taken to be cyclic, JLS 8.1.4
+constexpr u32 MAX_SUPERTYPE_DEPTH = 64;
+
+// Looks through annotations and type arguments at the type they're on
+u32 strip_type(const Ast &ast, u32 node)
+{
+    while (node && (ast.kinds[node] == NodeKind::AnnotatedType || ast.kinds[node] == NodeKind::ParameterizedType))
+    {
+        node = ast.lhs[node];
+    }
+
+    return node;
+}
+
+// Simple names of a possibly qualified name, outermost first; false if
+// it's qualified by something other than a name
+bool name_parts(const Ast &ast, const TokenBuffer &tokens, u32 node, std::vector<Symbol> &parts)
+{
+    parts.clear();
+    for (node = strip_type(ast, node); node; node = strip_type(ast, ast.lhs[node]))
+    {
+        NodeKind kind = ast.kinds[node];
+        if (kind != NodeKind::TypeName && kind != NodeKind::Select && kind != NodeKind::Identifier)
+        {
+            return false;
+        }
+
+        parts.push_back(tokens.values[ast.tokens[node]]);
+    }
+
+    std::reverse(parts.begin(), parts.end());
+    return !parts.empty();
+}
+
+u64 member_key(Symbol owner, Symbol name)
+{
+    return u64(owner) << 32 | name;
+}
+} // namespace
+
+u32 ClassTable::add(const SourceClass &declared)
+{
+    return u32(m_classes.push_back(declared) - m_classes.begin());
+}
+
+bool ClassTable::add_member(Symbol owner, Symbol name, u32 index)
+{
+    return m_members.insert({member_key(owner, name), index});
+}
+
+u32 ClassTable::find_member(Symbol owner, Symbol name) const
+{
+    decltype(m_members)::const_accessor found;
+    return m_members.find(found, member_key(owner, name)) ? found->second : ClassRef::NO_SOURCE;
+}
+
+void Compiler::use_class_table(ClassTable &classes, u32 unit)
+{
+    m_classes = &classes;
+    m_unit = unit;
+}
+
+template <class F> void Compiler::for_each_scoped_node(F &&f) const
+{
+    std::vector<u32> enclosing;
+    u32 next = 0;
+
+    for (u32 node = 1; node < m_ast.size(); node++)
+    {
+        while (!enclosing.empty() && m_declared[enclosing.back()].node < node)
+        {
+            enclosing.pop_back();
+        }
+
+        while (next < m_declared.size() && m_declared[next].start <= node)
+        {
+            enclosing.push_back(next++);
+        }
+
+        f(node, enclosing.empty() ? NONE : enclosing.back());
+    }
+}
+
+// JLS 7.6 and 8.5: top-level classes are members of the package, and
+// classes among the members of another are members of that one; any
+// other class is local, and can't be named from outside its unit
+bool Compiler::enter()
+{
+    if (!m_classes)
+    {
+        m_own_classes = std::make_unique<ClassTable>();
+        m_classes = m_own_classes.get();
+    }
+
+    Interner &interner = global_interner();
+    std::vector<Symbol> parts;
+    std::string package;
+    u32 package_decl = m_ast.lhs[0];
+    if (package_decl && name_parts(m_ast, m_tokens, m_ast.lhs[package_decl], parts))
+    {
+        for (Symbol part : parts)
+        {
+            package.append(package.empty() ? "" : "/").append(interner.text(part));
+        }
+    }
+
+    m_package = interner.intern(package);
+
+    for (u32 node = 1; node < m_ast.size(); node++)
+    {
+        if (is_type_declaration(m_ast.kinds[node]))
+        {
+            TypeDeclRecord record = m_ast.record<TypeDeclRecord>(m_ast.rhs[node]);
+            m_declared.push_back({node, record.start, NONE, 0, m_tokens.values[m_ast.tokens[node]], false});
+        }
+    }
+
+    // A class that starts where its enclosing class does ends before it
+    std::sort(m_declared.begin(), m_declared.end(), [](const DeclaredClass &a, const DeclaredClass &b) {
+        return a.start != b.start ? a.start < b.start : a.node > b.node;
+    });
+
+    bool ok = true;
+    u32 locals = 0;
+    std::vector<u32> enclosing;
+
+    for (u32 i = 0; i < m_declared.size(); i++)
+    {
+        DeclaredClass &declared = m_declared[i];
+        while (!enclosing.empty() && m_declared[enclosing.back()].node < declared.start)
+        {
+            enclosing.pop_back();
+        }
+
+        declared.outer = enclosing.empty() ? NONE : enclosing.back();
+        enclosing.push_back(i);
+
+        Symbol owner = m_package;
+        std::string name = package;
+        if (declared.outer == NONE)
+        {
+            declared.member = true;
+            name.append(name.empty() ? "" : "/");
+        }
+        else
+        {
+            const DeclaredClass &outer = m_declared[declared.outer];
+            std::span<const u32> members = m_ast.list(m_ast.record<TypeDeclRecord>(m_ast.rhs[outer.node]).members);
+            declared.member = std::find(members.begin(), members.end(), declared.node) != members.end();
+            owner = (*m_classes)[outer.entry].name;
+            name = interner.text(owner);
+            name.append(declared.member ? "$" : std::format("${}", ++locals));
+        }
+
+        name.append(interner.text(declared.name));
+        SourceClass source{interner.intern(name), m_unit, declared.node, this, i};
+        declared.entry = m_classes->add(source);
+
+        if (declared.member && !m_classes->add_member(owner, declared.name, declared.entry))
+        {
+            m_diagnostics.report(DiagnosticCode::DuplicateClass, m_tokens.offsets[m_ast.tokens[declared.node]],
+                                 source.name);
+            declared.member = false;
+            ok = false;
+        }
+    }
+
+    if (m_options.verbose)
+    {
+        println("[entered {} ({} classes)]", m_input, m_declared.size());
+    }
+
+    return ok;
+}
+
+std::vector<bool> Compiler::find_qualifiers() const
+{
+    std::vector<bool> qualifiers(m_ast.size());
+    for (u32 node = 1; node < m_ast.size(); node++)
+    {
+        if (m_ast.kinds[node] == NodeKind::TypeName && m_ast.lhs[node])
+        {
+            qualifiers[m_ast.lhs[node]] = true;
+        }
+    }
+
+    return qualifiers;
+}
+
+void Compiler::resolve_imports()
+{
+    m_imports_resolved = true;
+    std::vector<Symbol> parts;
+
+    for (u32 node : m_ast.list(m_ast.rhs[0]))
+    {
+        if (m_ast.kinds[node] != NodeKind::ImportDecl || !name_parts(m_ast, m_tokens, m_ast.lhs[node], parts))
+        {
+            continue;
+        }
+
+        u32 flags = m_ast.rhs[node];
+        bool on_demand = flags & IMPORT_ON_DEMAND;
+        bool static_member = (flags & IMPORT_STATIC) && !on_demand;
+        if (static_member && parts.size() < 2)
+        {
+            continue;
+        }
+
+        std::span<const Symbol> name{parts.data(), parts.size() - static_member};
+        Import imported{on_demand ? 0 : parts.back(), static_member, resolve_qualified(name, {}, {}), {}};
+
+        if (on_demand && !imported.type)
+        {
+            for (Symbol part : parts)
+            {
+                imported.package.append(imported.package.empty() ? "" : "/").append(global_interner().text(part));
+            }
+        }
+
+        m_imports.push_back(std::move(imported));
+    }
+}
+
+void Compiler::find_dependencies(std::vector<u32> &units)
+{
+    if (!m_imports_resolved)
+    {
+        resolve_imports();
+    }
+
+    auto add = [&](ClassRef type) {
+        if (type.source != ClassRef::NO_SOURCE && (*m_classes)[type.source].unit != m_unit)
+        {
+            units.push_back((*m_classes)[type.source].unit);
+        }
+    };
+
+    for (const Import &imported : m_imports)
+    {
+        add(imported.type);
+    }
+
+    std::vector<bool> qualifiers = find_qualifiers();
+    std::vector<Symbol> parts;
+
+    for_each_scoped_node([&](u32 node, u32 scope) {
+        switch (m_ast.kinds[node])
+        {
+        case NodeKind::TypeName:
+            if (!qualifiers[node])
+            {
+                add(resolve_type(node, scope).type);
+            }
+
+            break;
+        case NodeKind::Select:
+        case NodeKind::MethodReference: {
+            // A simple name qualifying an expression may be a class's,
+            // JLS 6.5.2
+            u32 qualifier = m_ast.lhs[node];
+            if (qualifier && m_ast.kinds[qualifier] == NodeKind::Identifier)
+            {
+                add(resolve_simple_name(m_tokens.values[m_ast.tokens[qualifier]], scope).type);
+            }
+
+            break;
+        }
+        case NodeKind::Annotation:
+            if (name_parts(m_ast, m_tokens, m_ast.lhs[node], parts))
+            {
+                add(resolve_name(parts, scope).type);
+            }
+
+            break;
+        default:
+            break;
+        }
+    });
+
+    std::sort(units.begin(), units.end());
+    units.erase(std::unique(units.begin(), units.end()), units.end());
+}
+
+void Compiler::resolve_supertypes()
+{
+    if (m_supertypes_resolved)
+    {
+        return;
+    }
+
+    for (u32 i = 0; i < m_declared.size(); i++)
+    {
+        resolve_supertypes(i);
+    }
+
+    m_supertypes_resolved = true;
+}
+
+void Compiler::resolve_supertypes(u32 declared)
+{
+    const DeclaredClass &type = m_declared[declared];
+    SourceClass &source = (*m_classes)[type.entry];
+    if (source.state != SupertypeState::Unresolved)
+    {
+        return;
+    }
+
+    source.state = SupertypeState::Resolving;
+
+    // Whoever calls this has made sure that the classes this unit's
+    // names resolve to have their supertypes resolved, or can do so
+    if (!m_inherited)
+    {
+        m_inherited = true;
+        m_resolved_names.clear();
+    }
+
+    if (!m_imports_resolved)
+    {
+        resolve_imports();
+    }
+
+    // Supertypes are named in the scope around the class, where its own
+    // members aren't yet, JLS 6.3
+    TypeDeclRecord record = m_ast.record<TypeDeclRecord>(m_ast.rhs[type.node]);
+    if (record.super_class)
+    {
+        source.super_class = resolve_type(record.super_class, type.outer).type;
+    }
+
+    for (u32 node : m_ast.list(record.interfaces))
+    {
+        if (ClassRef interface = resolve_type(node, type.outer).type)
+        {
+            source.interfaces.push_back(interface);
+        }
+    }
+
+    source.state = SupertypeState::Resolved;
+}
+
+u64 Compiler::resolution_key() const
+{
+    const Interner &interner = global_interner();
+    std::string names;
+
+    for (const DeclaredClass &declared : m_declared)
+    {
+        const SourceClass &source = (*m_classes)[declared.entry];
+        names.append(interner.text(source.super_class.name)).push_back(':');
+        for (ClassRef interface : source.interfaces)
+        {
+            names.append(interner.text(interface.name)).push_back(',');
+        }
+
+        names.push_back('\n');
+    }
+
+    return xxh64(names.data(), names.size());
+}
+
+// JLS 6.5.5; names aren't resolved any further than to a class yet,
+// so that's the whole of the analysis for now
+bool Compiler::analyze()
+{
+    resolve_supertypes();
+
+    if (!m_inherited)
+    {
+        m_inherited = true;
+        m_resolved_names.clear();
+    }
+
+    std::vector<bool> qualifiers = find_qualifiers();
+    u32 names = 0;
+    u32 unresolved = 0;
+
+    for_each_scoped_node([&](u32 node, u32 scope) {
+        if (m_ast.kinds[node] == NodeKind::TypeName && !qualifiers[node])
+        {
+            ResolvedType resolved = resolve_type(node, scope);
+            names++;
+            unresolved += !resolved.type && !resolved.type_variable;
+        }
+    });
+
+    if (cancelled())
+    {
+        return false;
+    }
+
+    if (m_options.verbose)
+    {
+        println("[analyzed {} ({} type names, {} unresolved)]", m_input, names, unresolved);
+    }
+
+    return true;
+}
+
+Compiler::ResolvedType Compiler::resolve_type(u32 node, u32 scope)
+{
+    node = strip_type(m_ast, node);
+    if (m_ast.kinds[node] == NodeKind::TypeName && !m_ast.lhs[node])
+    {
+        return resolve_simple_name(m_tokens.values[m_ast.tokens[node]], scope);
+    }
+
+    std::vector<Symbol> parts;
+    return name_parts(m_ast, m_tokens, node, parts) ? resolve_name(parts, scope) : ResolvedType{};
+}
+
+// A qualified name starts with a class if its first name is one in
+// scope, and with a package otherwise, JLS 6.5.2
+Compiler::ResolvedType Compiler::resolve_name(std::span<const Symbol> names, u32 scope)
+{
+    ResolvedType first = resolve_simple_name(names[0], scope);
+    if (names.size() == 1)
+    {
+        return first;
+    }
+
+    if (first.type_variable)
+    {
+        return {};
+    }
+
+    std::string package = first.type ? "" : std::string(global_interner().text(names[0]));
+    return {resolve_qualified(names.subspan(1), first.type, std::move(package))};
+}
+
+ClassRef Compiler::resolve_qualified(std::span<const Symbol> names, ClassRef type, std::string package)
+{
+    for (Symbol name : names)
+    {
+        if (type)
+        {
+            type = find_member_type(type, name);
+            if (!type)
+            {
+                return {};
+            }
+        }
+        else if (!(type = find_package_class(package, name)))
+        {
+            package.append(package.empty() ? "" : "/").append(global_interner().text(name));
+        }
+    }
+
+    return type;
+}
+
+// JLS 6.4.1: type variables and classes of the enclosing classes, from
+// the innermost out, then those of the unit
+Compiler::ResolvedType Compiler::resolve_simple_name(Symbol name, u32 scope)
+{
+    u64 key = u64(scope) << 32 | name;
+    if (auto found = m_resolved_names.find(key); found != m_resolved_names.end())
+    {
+        return found->second;
+    }
+
+    ResolvedType resolved;
+    for (u32 s = scope; s != NONE; s = m_declared[s].outer)
+    {
+        const DeclaredClass &declared = m_declared[s];
+        TypeDeclRecord record = m_ast.record<TypeDeclRecord>(m_ast.rhs[declared.node]);
+        std::span<const u32> parameters = m_ast.list(record.type_parameters);
+        if (std::any_of(parameters.begin(), parameters.end(),
+                        [&](u32 parameter) { return m_tokens.values[m_ast.tokens[parameter]] == name; }))
+        {
+            resolved.type_variable = true;
+            break;
+        }
+
+        // Local classes are taken to be in scope all over the class
+        // they're declared in, not just after their declarations
+        auto local = std::find_if(m_declared.begin(), m_declared.end(), [&](const DeclaredClass &type) {
+            return type.outer == s && !type.member && type.name == name;
+        });
+        if (local != m_declared.end())
+        {
+            resolved.type = {(*m_classes)[local->entry].name, local->entry};
+            break;
+        }
+
+        if ((resolved.type = find_member_type({(*m_classes)[declared.entry].name, declared.entry}, name)))
+        {
+            break;
+        }
+    }
+
+    if (!resolved.type && !resolved.type_variable)
+    {
+        resolved = scope == NONE ? ResolvedType{find_in_unit(name)} : resolve_simple_name(name, NONE);
+    }
+
+    m_resolved_names.emplace(key, resolved);
+    return resolved;
+}
+
+// JLS 6.4.1 and 7.5: single-type imports shadow the package's classes,
+// which shadow on-demand imports, java.lang's included
+ClassRef Compiler::find_in_unit(Symbol name)
+{
+    for (const Import &imported : m_imports)
+    {
+        if (imported.name == name)
+        {
+            if (ClassRef type = imported.static_member ? find_member_type(imported.type, name) : imported.type)
+            {
+                return type;
+            }
+        }
+    }
+
+    if (ClassRef type = find_package_class(global_interner().text(m_package), name))
+    {
+        return type;
+    }
+
+    for (const Import &imported : m_imports)
+    {
+        if (!imported.name)
+        {
+            ClassRef type = imported.type ? find_member_type(imported.type, name) : find_package_class(imported.package, name);
+            if (type)
+            {
+                return type;
+            }
+        }
+    }
+
+    return find_package_class("java/lang", name);
+}
+
+ClassRef Compiler::find_member_type(ClassRef owner, Symbol name, u32 depth)
+{
+    if (!owner || depth > MAX_SUPERTYPE_DEPTH)
+    {
+        return {};
+    }
+
+    Interner &interner = global_interner();
+    if (owner.source != ClassRef::NO_SOURCE)
+    {
+        u32 index = m_classes->find_member(owner.name, name);
+        if (index != ClassRef::NO_SOURCE)
+        {
+            return {(*m_classes)[index].name, index};
+        }
+
+        if (!m_inherited)
+        {
+            return {};
+        }
+
+        // Inherited member classes, JLS 8.5; a class in a cycle of
+        // supertypes is left with the ones resolved so far
+        SourceClass &source = (*m_classes)[owner.source];
+        if (source.state == SupertypeState::Unresolved)
+        {
+            source.compiler->resolve_supertypes(source.declared);
+        }
+
+        ClassRef type = find_member_type(source.super_class, name, depth + 1);
+        for (u32 i = 0; i < source.interfaces.size() && !type; i++)
+        {
+            type = find_member_type(source.interfaces[i], name, depth + 1);
+        }
+
+        return type;
+    }
+
+    const SystemIndex *system = m_classes->system();
+    std::string_view binary = interner.text(owner.name);
+    u64 slash = binary.rfind('/');
+    if (!system || slash == std::string_view::npos)
+    {
+        return {};
+    }
+
+    std::string_view package = binary.substr(0, slash);
+    std::string nested = std::format("{}${}", binary, interner.text(name));
+    if (system->find_class(package, std::string_view(nested).substr(slash + 1)))
+    {
+        return {interner.intern(nested)};
+    }
+
+    // The index only has superclasses, so member classes inherited from
+    // the JDK's interfaces aren't found
+    const SystemClass *type = m_inherited ? system->find_class(package, binary.substr(slash + 1)) : nullptr;
+    if (!type || !type->super_class.size)
+    {
+        return {};
+    }
+
+    return find_member_type({interner.intern(system->text(type->super_class))}, name, depth + 1);
+}
+
+ClassRef Compiler::find_package_class(std::string_view package, Symbol name) const
+{
+    Interner &interner = global_interner();
+
+    // A package that no unit declares may not have a symbol at all, and
+    // zero is the unnamed package's
+    Symbol owner = interner.find(package);
+    if (owner || package.empty())
+    {
+        u32 index = m_classes->find_member(owner, name);
+        if (index != ClassRef::NO_SOURCE)
+        {
+            return {(*m_classes)[index].name, index};
+        }
+    }
+
+    const SystemIndex *system = m_classes->system();
+    if (system && !package.empty() && system->find_class(package, interner.text(name)))
+    {
+        return {interner.intern(std::format("{}/{}", package, interner.text(name)))};
+    }
+
+    return {};
+}
@@ -0,0 +1,418 @@
+#include "ujavac.h"
+
+#include <bit>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define UJAVAC_X86 1
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define UJAVAC_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define UJAVAC_TARGET_AVX2
+#endif
+
+namespace
+{
+constexpr u64 broadcast(u8 b)
+{
+    return 0x0101010101010101ull * b;
+}
+
+// Sets the high bit of every byte in w that equals b (SWAR)
+constexpr u64 match_bytes(u64 w, u8 b)
+{
+    u64 x = w ^ broadcast(b);
+    return (x - broadcast(0x01)) & ~x & broadcast(0x80);
+}
+
+u64 load_u64(const u8 *p)
+{
+    u64 w;
+    std::memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+constexpr bool is_ascii_run_byte(u8 b)
+{
+    return b < 0x80 && b != '\\';
+}
+
+u64 ascii_run_tail(const u8 *data, u64 pos, u64 size)
+{
+    while (pos < size && is_ascii_run_byte(data[pos]))
+    {
+        pos++;
+    }
+
+    return pos;
+}
+
+u64 ascii_run_scalar(const u8 *data, u64 size)
+{
+    u64 pos = 0;
+
+    // Word-at-a-time; the exact stop is found by the byte loop
+    for (; pos + 8 <= size; pos += 8)
+    {
+        u64 w = load_u64(data + pos);
+        if ((w & broadcast(0x80)) | match_bytes(w, '\\'))
+        {
+            break;
+        }
+    }
+
+    return ascii_run_tail(data, pos, size);
+}
+
+u64 comment_run_scalar(const u8 *data, u64 size)
+{
+    for (u64 pos = 0; pos < size; pos++)
+    {
+        u8 b = data[pos];
+        if (b >= 0x80 || b == '\\' || b == '\r' || (b == '*' && pos + 1 < size && data[pos + 1] == '/'))
+        {
+            return pos;
+        }
+    }
+
+    return size;
+}
+
+u64 line_comment_run_scalar(const u8 *data, u64 size)
+{
+    for (u64 pos = 0; pos < size; pos++)
+    {
+        u8 b = data[pos];
+        if (b >= 0x80 || b == '\\' || b == '\r' || b == '\n')
+        {
+            return pos;
+        }
+    }
+
+    return size;
+}
+
+u64 whitespace_run_scalar(const u8 *data, u64 size)
+{
+    for (u64 pos = 0; pos < size; pos++)
+    {
+        u8 b = data[pos];
+        if (b != ' ' && b != '\t' && b != '\f' && b != '\n')
+        {
+            return pos;
+        }
+    }
+
+    return size;
+}
+
+void collect_newlines_scalar(const u8 *data, u64 size, u32 base, std::vector<u32> &line_starts)
+{
+    for (u64 pos = 0; pos < size; pos++)
+    {
+        if (data[pos] == '\n')
+        {
+            line_starts.push_back(base + pos + 1);
+        }
+    }
+}
+
+#ifdef UJAVAC_X86
+u64 ascii_run_sse2(const u8 *data, u64 size)
+{
+    const __m128i backslash = _mm_set1_epi8('\\');
+    u64 pos = 0;
+
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        // Non-ASCII bytes already have their high bit set
+        u32 mask = _mm_movemask_epi8(_mm_or_si128(v, _mm_cmpeq_epi8(v, backslash)));
+        if (mask)
+        {
+            return pos + std::countr_zero(mask);
+        }
+    }
+
+    return ascii_run_tail(data, pos, size);
+}
+
+u32 sse2_eq(__m128i v, char c)
+{
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+}
+
+u64 comment_run_sse2(const u8 *data, u64 size)
+{
+    u64 pos = 0;
+
+    // Each block is compared against the block one byte ahead to find "*/"
+    for (; pos + 17 <= size; pos += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos + 1));
+        u32 mask = _mm_movemask_epi8(v) | sse2_eq(v, '\\') | sse2_eq(v, '\r') |
+                   (sse2_eq(v, '*') & sse2_eq(next, '/'));
+        if (mask)
+        {
+            return pos + std::countr_zero(mask);
+        }
+    }
+
+    return comment_run_scalar(data + pos, size - pos) + pos;
+}
+
+u64 line_comment_run_sse2(const u8 *data, u64 size)
+{
+    u64 pos = 0;
+
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        u32 mask = _mm_movemask_epi8(v) | sse2_eq(v, '\\') | sse2_eq(v, '\r') | sse2_eq(v, '\n');
+        if (mask)
+        {
+            return pos + std::countr_zero(mask);
+        }
+    }
+
+    return line_comment_run_scalar(data + pos, size - pos) + pos;
+}
+
+u64 whitespace_run_sse2(const u8 *data, u64 size)
+{
+    u64 pos = 0;
+
+    for (; pos + 16 <= size; pos += 16)
+    {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos));
+        u32 mask = ~(sse2_eq(v, ' ') | sse2_eq(v, '\t') | sse2_eq(v, '\f') | sse2_eq(v, '\n')) & 0xFFFF;
+        if (mask)
+        {
+            return pos + std::countr_zero(mask);
+        }
+    }
+
+    return whitespace_run_scalar(data + pos, size - pos) + pos;
+}
+
+void push_mask_offsets(u32 mask, u32 base, std::vector<u32> &line_starts)
+{
+    for (; mask; mask &= mask - 1)
+    {
+        line_starts.push_back(base + std::countr_zero(mask) + 1);
+    }
+}
+
+void collect_newlines_sse2(const u8 *data, u64 size, u32 base, std::vector<u32> &line_starts)
+{
+    u64 pos = 0;
+
+    for (; pos + 16 <= size; pos += 16)
+    {
+        push_mask_offsets(sse2_eq(_mm_loadu_si128(reinterpret_cast<const __m128i *>(data + pos)), '\n'), base + pos,
+                          line_starts);
+    }
+
+    collect_newlines_scalar(data + pos, size - pos, base + pos, line_starts);
+}
+
+UJAVAC_TARGET_AVX2 u64 ascii_run_avx2(const u8 *data, u64 size)
+{
+    const __m256i backslash = _mm256_set1_epi8('\\');
+    u64 pos = 0;
+
+    for (; pos + 32 <= size; pos += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+        u32 mask = _mm256_movemask_epi8(_mm256_or_si256(v, _mm256_cmpeq_epi8(v, backslash)));
+        if (mask)
+        {
+            return pos + std::countr_zero(mask);
+        }
+    }
+
+    return ascii_run_sse2(data + pos, size - pos) + pos;
+}
+
+UJAVAC_TARGET_AVX2 u32 avx2_eq(__m256i v, char c)
+{
+    return _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+}
+
+UJAVAC_TARGET_AVX2 u64 comment_run_avx2(const u8 *data, u64 size)
+{
+    u64 pos = 0;
+
+    for (; pos + 33 <= size; pos += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos + 1));
+        u32 mask = _mm256_movemask_epi8(v) | avx2_eq(v, '\\') | avx2_eq(v, '\r') |
+                   (avx2_eq(v, '*') & avx2_eq(next, '/'));
+        if (mask)
+        {
+            return pos + std::countr_zero(mask);
+        }
+    }
+
+    return comment_run_sse2(data + pos, size - pos) + pos;
+}
+
+UJAVAC_TARGET_AVX2 u64 line_comment_run_avx2(const u8 *data, u64 size)
+{
+    u64 pos = 0;
+
+    for (; pos + 32 <= size; pos += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+        u32 mask = _mm256_movemask_epi8(v) | avx2_eq(v, '\\') | avx2_eq(v, '\r') | avx2_eq(v, '\n');
+        if (mask)
+        {
+            return pos + std::countr_zero(mask);
+        }
+    }
+
+    return line_comment_run_sse2(data + pos, size - pos) + pos;
+}
+
+UJAVAC_TARGET_AVX2 u64 whitespace_run_avx2(const u8 *data, u64 size)
+{
+    u64 pos = 0;
+
+    for (; pos + 32 <= size; pos += 32)
+    {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos));
+        u32 mask = ~(avx2_eq(v, ' ') | avx2_eq(v, '\t') | avx2_eq(v, '\f') | avx2_eq(v, '\n'));
+        if (mask)
+        {
+            return pos + std::countr_zero(mask);
+        }
+    }
+
+    return whitespace_run_sse2(data + pos, size - pos) + pos;
+}
+
+UJAVAC_TARGET_AVX2 void collect_newlines_avx2(const u8 *data, u64 size, u32 base, std::vector<u32> &line_starts)
+{
+    u64 pos = 0;
+
+    for (; pos + 32 <= size; pos += 32)
+    {
+        push_mask_offsets(avx2_eq(_mm256_loadu_si256(reinterpret_cast<const __m256i *>(data + pos)), '\n'),
+                          base + pos, line_starts);
+    }
+
+    collect_newlines_sse2(data + pos, size - pos, base + pos, line_starts);
+}
+
+bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+    int regs[4];
+    __cpuid(regs, 0);
+    if (regs[0] < 7)
+    {
+        return false;
+    }
+
+    __cpuid(regs, 1);
+    // OSXSAVE and AVX, then check the OS saves YMM state
+    if ((regs[2] & (1 << 27 | 1 << 28)) != (1 << 27 | 1 << 28) || (_xgetbv(0) & 6) != 6)
+    {
+        return false;
+    }
+
+    __cpuidex(regs, 7, 0);
+    return regs[1] & (1 << 5);
+#else
+    return __builtin_cpu_supports("avx2");
+#endif
+}
+#endif
+
+constexpr SimdKernels scalar_kernels = {
+    SimdLevel::Scalar,       ascii_run_scalar,      comment_run_scalar,
+    line_comment_run_scalar, whitespace_run_scalar, collect_newlines_scalar,
+};
+#ifdef UJAVAC_X86
+constexpr SimdKernels sse2_kernels = {
+    SimdLevel::SSE2,       ascii_run_sse2,      comment_run_sse2,
+    line_comment_run_sse2, whitespace_run_sse2, collect_newlines_sse2,
+};
+constexpr SimdKernels avx2_kernels = {
+    SimdLevel::AVX2,       ascii_run_avx2,      comment_run_avx2,
+    line_comment_run_avx2, whitespace_run_avx2, collect_newlines_avx2,
+};
+#endif
+
+const SimdKernels *kernels_for(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return &scalar_kernels;
+#ifdef UJAVAC_X86
+    case SimdLevel::SSE2:
+        return &sse2_kernels;
+    case SimdLevel::AVX2:
+        return cpu_has_avx2() ? &avx2_kernels : nullptr;
+#endif
+    default:
+        return nullptr;
+    }
+}
+
+const SimdKernels *detect_kernels()
+{
+    for (auto level : {SimdLevel::AVX2, SimdLevel::SSE2})
+    {
+        if (auto kernels = kernels_for(level))
+        {
+            return kernels;
+        }
+    }
+
+    return &scalar_kernels;
+}
+
+const SimdKernels *g_kernels = detect_kernels();
+} // namespace
+
+const SimdKernels &simd_kernels()
+{
+    return *g_kernels;
+}
+
+bool set_simd_level(SimdLevel level)
+{
+    auto kernels = kernels_for(level);
+    if (!kernels)
+    {
+        return false;
+    }
+
+    g_kernels = kernels;
+    return true;
+}
+
+const char *simd_level_name(SimdLevel level)
+{
+    switch (level)
+    {
+    case SimdLevel::Scalar:
+        return "scalar";
+    case SimdLevel::SSE2:
+        return "sse2";
+    case SimdLevel::AVX2:
+        return "avx2";
+    }
+
+    return "unknown";
+}
@@ -0,0 +1,555 @@
+#include "ujavac.h"
+
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <unordered_map>
+
+#include <tbb/parallel_for.h>
+
+#ifdef UJAVAC_ZLIB
+#include <zlib.h>
+#endif
+
+namespace fs = std::filesystem;
+
+namespace
+{
+// jimage, the format of a JDK's lib/modules (src/java.base/share/native/
+// libjimage/imageFile.hpp). Fields are in the byte order of the platform
+// the image was built for; only images in this platform's are read.
+constexpr u32 JIMAGE_MAGIC = 0xCAFEDADA;
+constexpr u32 JIMAGE_MAJOR_VERSION = 1;
+constexpr u32 JIMAGE_HEADER_SIZE = 7 * 4;
+constexpr u32 JIMAGE_RESOURCE_MAGIC = 0xCAFEFAFA;
+constexpr u32 JIMAGE_RESOURCE_HEADER_SIZE = 29;
+// Far beyond any class file; a larger size means a corrupt image
+constexpr u64 JIMAGE_MAX_CLASS_SIZE = 64 * 1024 * 1024;
+
+enum JimageAttribute : u8
+{
+    JIMAGE_END,
+    JIMAGE_MODULE,
+    JIMAGE_PARENT,
+    JIMAGE_BASE,
+    JIMAGE_EXTENSION,
+    JIMAGE_OFFSET,
+    JIMAGE_COMPRESSED,
+    JIMAGE_UNCOMPRESSED,
+    JIMAGE_ATTRIBUTE_COUNT,
+};
+
+constexpr u32 SYSTEM_INDEX_MAGIC = 0x58444955; // "UIDX"
+// Bumped whenever the layout or what goes into the index changes
+constexpr u32 SYSTEM_INDEX_VERSION = 1;
+
+// JVMS 4.1-B and 4.5-A
+constexpr u16 ACC_PUBLIC = 0x0001;
+constexpr u16 ACC_PRIVATE = 0x0002;
+constexpr u16 ACC_SYNTHETIC = 0x1000;
+
+struct SystemIndexHeader
+{
+    u32 magic;
+    u32 version;
+    u64 key;
+    u32 package_count;
+    u32 class_count;
+    u32 member_count;
+    u32 string_size;
+    u64 packages_offset;
+    u64 classes_offset;
+    u64 members_offset;
+    u64 strings_offset;
+};
+
+template <class T> T read_native(const u8 *p)
+{
+    T value;
+    std::memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+// A class file of the image, found by its location
+struct ImageClass
+{
+    std::string_view module;
+    std::string_view package;
+    std::string_view name;
+    u64 offset;
+    u64 compressed_size;
+    u64 size;
+};
+
+class Jimage
+{
+  public:
+    bool open(const std::string &path, std::string &error)
+    {
+        if (!m_file.open(path.c_str()))
+        {
+            error = std::format("can't read {}", path);
+            return false;
+        }
+
+        std::span<const u8> bytes = m_file.bytes();
+        if (bytes.size() < JIMAGE_HEADER_SIZE || read_native<u32>(bytes.data()) != JIMAGE_MAGIC ||
+            read_native<u32>(bytes.data() + 4) >> 16 != JIMAGE_MAJOR_VERSION)
+        {
+            error = std::format("{} isn't a jimage of a supported version", path);
+            return false;
+        }
+
+        u64 table_length = read_native<u32>(bytes.data() + 16);
+        u64 locations_size = read_native<u32>(bytes.data() + 20);
+        u64 strings_size = read_native<u32>(bytes.data() + 24);
+
+        m_offsets = JIMAGE_HEADER_SIZE + 4 * table_length;
+        m_locations = m_offsets + 4 * table_length;
+        m_strings = m_locations + locations_size;
+        m_index_size = m_strings + strings_size;
+        m_table_length = u32(table_length);
+
+        if (m_index_size > bytes.size())
+        {
+            error = std::format("{} is truncated", path);
+            return false;
+        }
+
+        return true;
+    }
+
+    // Every class file but module-info, in no particular order
+    std::vector<ImageClass> classes() const
+    {
+        std::span<const u8> bytes = m_file.bytes();
+        std::vector<ImageClass> classes;
+
+        for (u32 i = 0; i < m_table_length; i++)
+        {
+            u64 attributes[JIMAGE_ATTRIBUTE_COUNT] = {};
+            u64 pos = m_locations + read_native<u32>(bytes.data() + m_offsets + 4 * u64(i));
+
+            // Each attribute is a kind and length byte, then its value
+            // in big-endian order
+            while (pos < m_strings && bytes[pos] != JIMAGE_END)
+            {
+                u8 kind = bytes[pos] >> 3;
+                u32 size = (bytes[pos] & 7) + 1;
+                if (kind >= JIMAGE_ATTRIBUTE_COUNT || m_strings - pos <= size)
+                {
+                    break;
+                }
+
+                u64 value = 0;
+                for (u32 j = 1; j <= size; j++)
+                {
+                    value = value << 8 | bytes[pos + j];
+                }
+
+                attributes[kind] = value;
+                pos += 1 + size;
+            }
+
+            std::string_view base = string(attributes[JIMAGE_BASE]);
+            if (string(attributes[JIMAGE_EXTENSION]) != "class" || base == "module-info")
+            {
+                continue;
+            }
+
+            classes.push_back({string(attributes[JIMAGE_MODULE]), string(attributes[JIMAGE_PARENT]), base,
+                               m_index_size + attributes[JIMAGE_OFFSET], attributes[JIMAGE_COMPRESSED],
+                               attributes[JIMAGE_UNCOMPRESSED]});
+        }
+
+        return classes;
+    }
+
+    // The class file's bytes, decompressed into storage if need be;
+    // empty if they can't be had
+    std::span<const u8> read(const ImageClass &image_class, std::vector<u8> &storage) const
+    {
+        std::span<const u8> bytes = m_file.bytes();
+        u64 stored_size = image_class.compressed_size ? image_class.compressed_size : image_class.size;
+        if (image_class.offset > bytes.size() || bytes.size() - image_class.offset < stored_size)
+        {
+            return {};
+        }
+
+        std::span<const u8> data = bytes.subspan(image_class.offset, stored_size);
+        if (!image_class.compressed_size)
+        {
+            return data;
+        }
+
+        // Compressed resources are a chain of headers, each naming the
+        // plugin that undoes it. Only zip is read; compact-cp images
+        // are rare enough to leave their classes out.
+        std::vector<u8> layer;
+        for (;;)
+        {
+            if (data.size() < JIMAGE_RESOURCE_HEADER_SIZE || read_native<u32>(data.data()) != JIMAGE_RESOURCE_MAGIC)
+            {
+                return data;
+            }
+
+            u64 size = read_native<u64>(data.data() + 12);
+            std::string_view decompressor = string(read_native<u32>(data.data() + 20));
+            std::span<const u8> payload = data.subspan(JIMAGE_RESOURCE_HEADER_SIZE);
+            if (decompressor != "zip" || size > JIMAGE_MAX_CLASS_SIZE || !inflate_zlib(payload, size, layer))
+            {
+                return {};
+            }
+
+            storage.swap(layer);
+            data = storage;
+        }
+    }
+
+  private:
+    std::string_view string(u64 offset) const
+    {
+        std::span<const u8> bytes = m_file.bytes();
+        u64 begin = m_strings + offset;
+        if (begin >= m_index_size)
+        {
+            return {};
+        }
+
+        const char *text = reinterpret_cast<const char *>(bytes.data() + begin);
+        return {text, strnlen(text, m_index_size - begin)};
+    }
+
+    static bool inflate_zlib(std::span<const u8> in, u64 size, std::vector<u8> &out)
+    {
+#ifdef UJAVAC_ZLIB
+        out.resize(size);
+        uLongf out_size = uLongf(size);
+        return uncompress(out.data(), &out_size, in.data(), uLong(in.size())) == Z_OK && out_size == size;
+#else
+        (void)in;
+        (void)size;
+        (void)out;
+        return false;
+#endif
+    }
+
+    SourceBuffer m_file;
+    u32 m_table_length = 0;
+    u64 m_offsets = 0;
+    u64 m_locations = 0;
+    u64 m_strings = 0;
+    u64 m_index_size = 0;
+};
+
+// Strings of the index under construction, each stored once
+class IndexStrings
+{
+  public:
+    SystemIndexString add(std::string_view text)
+    {
+        auto [it, added] = m_offsets.try_emplace(text, SystemIndexString{u32(m_chars.size()), u32(text.size())});
+        if (added)
+        {
+            m_chars.append(text);
+        }
+
+        return it->second;
+    }
+
+    const std::string &chars() const
+    {
+        return m_chars;
+    }
+
+  private:
+    std::string m_chars;
+    std::unordered_map<std::string_view, SystemIndexString> m_offsets;
+};
+
+// A public class of the image, read from its class file
+struct IndexedClass
+{
+    const ImageClass *image_class;
+    ClassFileSummary summary;
+    std::vector<u8> storage;
+    bool ok;
+};
+
+u64 align_up(u64 value, u64 alignment)
+{
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+template <class T> void append_records(std::vector<u8> &out, u64 offset, const std::vector<T> &records)
+{
+    out.resize(offset);
+    const u8 *p = reinterpret_cast<const u8 *>(records.data());
+    out.insert(out.end(), p, p + records.size() * sizeof(T));
+}
+
+// Reads every class file of the image in parallel, then lays out the
+// sorted tables
+std::vector<u8> build_index(const Jimage &image, u64 key)
+{
+    std::vector<ImageClass> image_classes = image.classes();
+    std::vector<IndexedClass> classes(image_classes.size());
+
+    tbb::parallel_for(u64(0), u64(image_classes.size()), [&](u64 i) {
+        IndexedClass &c = classes[i];
+        c.image_class = &image_classes[i];
+        std::span<const u8> data = image.read(image_classes[i], c.storage);
+        c.ok = !data.empty() && read_class_file(data, c.summary) && (c.summary.access_flags & ACC_PUBLIC);
+        if (!c.ok)
+        {
+            return;
+        }
+
+        // Members nothing outside the class can refer to are left out
+        std::erase_if(c.summary.members, [](const ClassFileMember &member) {
+            return member.access_flags & (ACC_PRIVATE | ACC_SYNTHETIC);
+        });
+        std::sort(c.summary.members.begin(), c.summary.members.end(),
+                  [](const ClassFileMember &a, const ClassFileMember &b) {
+                      return std::tie(a.name, a.descriptor) < std::tie(b.name, b.descriptor);
+                  });
+    });
+
+    std::erase_if(classes, [](const IndexedClass &c) { return !c.ok; });
+    std::sort(classes.begin(), classes.end(), [](const IndexedClass &a, const IndexedClass &b) {
+        return std::tie(a.image_class->package, a.image_class->name) <
+               std::tie(b.image_class->package, b.image_class->name);
+    });
+
+    IndexStrings strings;
+    std::vector<SystemPackage> packages;
+    std::vector<SystemClass> class_records;
+    std::vector<SystemMember> members;
+
+    for (const IndexedClass &c : classes)
+    {
+        std::string_view package = c.image_class->package;
+        if (packages.empty() || strings.chars().compare(packages.back().name.offset, packages.back().name.size,
+                                                        package) != 0)
+        {
+            packages.push_back({strings.add(package), u32(class_records.size()), 0});
+        }
+
+        packages.back().class_count++;
+        class_records.push_back({strings.add(c.image_class->name), strings.add(c.image_class->module),
+                                 strings.add(c.summary.super_class), u32(members.size()),
+                                 u32(c.summary.members.size()), c.summary.access_flags, 0});
+
+        for (const ClassFileMember &member : c.summary.members)
+        {
+            members.push_back(
+                {strings.add(member.name), strings.add(member.descriptor), member.access_flags, member.is_method, 0});
+        }
+    }
+
+    SystemIndexHeader header{};
+    header.magic = SYSTEM_INDEX_MAGIC;
+    header.version = SYSTEM_INDEX_VERSION;
+    header.key = key;
+    header.package_count = u32(packages.size());
+    header.class_count = u32(class_records.size());
+    header.member_count = u32(members.size());
+    header.string_size = u32(strings.chars().size());
+    header.packages_offset = align_up(sizeof(header), 8);
+    header.classes_offset = align_up(header.packages_offset + packages.size() * sizeof(SystemPackage), 8);
+    header.members_offset = align_up(header.classes_offset + class_records.size() * sizeof(SystemClass), 8);
+    header.strings_offset = align_up(header.members_offset + members.size() * sizeof(SystemMember), 8);
+
+    std::vector<u8> out(reinterpret_cast<const u8 *>(&header), reinterpret_cast<const u8 *>(&header + 1));
+    append_records(out, header.packages_offset, packages);
+    append_records(out, header.classes_offset, class_records);
+    append_records(out, header.members_offset, members);
+    out.resize(header.strings_offset);
+    out.insert(out.end(), strings.chars().begin(), strings.chars().end());
+    return out;
+}
+
+// Where the index goes when there's no --cache-dir
+std::string default_cache_dir()
+{
+#ifdef _WIN32
+    const char *base = std::getenv("LOCALAPPDATA");
+    return base ? std::format("{}\\ujavac", base) : std::string{};
+#else
+    if (const char *base = std::getenv("XDG_CACHE_HOME"); base && *base)
+    {
+        return std::format("{}/ujavac", base);
+    }
+
+    const char *home = std::getenv("HOME");
+    return home && *home ? std::format("{}/.cache/ujavac", home) : std::string{};
+#endif
+}
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+} // namespace
+
+bool SystemIndex::open(const char *jdk, const char *cache_dir, std::string &error)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    std::error_code ec;
+    fs::path image_path = fs::canonical(fs::path(jdk) / "lib" / "modules", ec);
+    fs::file_time_type mtime = ec ? fs::file_time_type{} : fs::last_write_time(image_path, ec);
+    u64 image_size = ec ? 0 : fs::file_size(image_path, ec);
+    if (ec)
+    {
+        error = std::format("{} has no lib/modules image", jdk);
+        return false;
+    }
+
+    // Another JDK, or the same one updated in place, gets another index
+    std::string identity = std::format("{}\n{}\n{}\n{}", image_path.string(), mtime.time_since_epoch().count(),
+                                       image_size, SYSTEM_INDEX_VERSION);
+    u64 key = xxh64(identity.data(), identity.size());
+
+    std::string dir = cache_dir ? cache_dir : default_cache_dir();
+    std::string index_path = dir.empty() ? std::string{} : std::format("{}/system-{:016x}.idx", dir, key);
+
+    SourceBuffer cached;
+    if (!index_path.empty() && cached.open(index_path.c_str()) && use(std::move(cached), key))
+    {
+        m_stats.built = false;
+        m_stats.seconds = seconds_since(start);
+        return true;
+    }
+
+    Jimage image;
+    if (!image.open(image_path.string(), error))
+    {
+        return false;
+    }
+
+    std::vector<u8> index = build_index(image, key);
+
+    // Failing to cache the index only costs the next run some time
+    if (!index_path.empty())
+    {
+        fs::create_directories(dir, ec);
+        write_file_atomically(index_path.c_str(), index);
+    }
+
+    SourceBuffer built;
+    built.adopt(std::move(index), InputStrategy::Read);
+    if (!use(std::move(built), key))
+    {
+        error = std::format("can't index {}", image_path.string());
+        return false;
+    }
+
+    m_stats.built = true;
+    m_stats.seconds = seconds_since(start);
+    return true;
+}
+
+bool SystemIndex::use(SourceBuffer &&data, u64 key)
+{
+    std::span<const u8> bytes = data.bytes();
+    if (bytes.size() < sizeof(SystemIndexHeader))
+    {
+        return false;
+    }
+
+    // The tables are only checked to lie within the file; text() checks
+    // each string on its own
+    SystemIndexHeader header = read_native<SystemIndexHeader>(bytes.data());
+    auto fits = [&](u64 offset, u64 count, u64 size) {
+        return offset % 8 == 0 && offset <= bytes.size() && (bytes.size() - offset) / size >= count;
+    };
+
+    if (header.magic != SYSTEM_INDEX_MAGIC || header.version != SYSTEM_INDEX_VERSION || header.key != key ||
+        !fits(header.packages_offset, header.package_count, sizeof(SystemPackage)) ||
+        !fits(header.classes_offset, header.class_count, sizeof(SystemClass)) ||
+        !fits(header.members_offset, header.member_count, sizeof(SystemMember)) ||
+        !fits(header.strings_offset, header.string_size, 1))
+    {
+        return false;
+    }
+
+    m_data = std::move(data);
+    bytes = m_data.bytes();
+    m_packages = {reinterpret_cast<const SystemPackage *>(bytes.data() + header.packages_offset), header.package_count};
+    m_classes = {reinterpret_cast<const SystemClass *>(bytes.data() + header.classes_offset), header.class_count};
+    m_members = {reinterpret_cast<const SystemMember *>(bytes.data() + header.members_offset), header.member_count};
+    m_strings = {reinterpret_cast<const char *>(bytes.data() + header.strings_offset), header.string_size};
+    m_stats.packages = header.package_count;
+    m_stats.classes = header.class_count;
+    m_stats.members = header.member_count;
+    m_stats.bytes = bytes.size();
+    return true;
+}
+
+std::string_view SystemIndex::text(SystemIndexString string) const
+{
+    if (string.offset > m_strings.size() || m_strings.size() - string.offset < string.size)
+    {
+        return {};
+    }
+
+    return m_strings.substr(string.offset, string.size);
+}
+
+const SystemPackage *SystemIndex::find_package(std::string_view name) const
+{
+    auto it = std::lower_bound(m_packages.begin(), m_packages.end(), name,
+                               [this](const SystemPackage &package, std::string_view name) {
+                                   return text(package.name) < name;
+                               });
+    return it != m_packages.end() && text(it->name) == name ? &*it : nullptr;
+}
+
+std::span<const SystemClass> SystemIndex::classes(const SystemPackage &package) const
+{
+    if (package.first_class > m_classes.size() || m_classes.size() - package.first_class < package.class_count)
+    {
+        return {};
+    }
+
+    return m_classes.subspan(package.first_class, package.class_count);
+}
+
+const SystemClass *SystemIndex::find_class(std::string_view package, std::string_view name) const
+{
+    const SystemPackage *p = find_package(package);
+    if (!p)
+    {
+        return nullptr;
+    }
+
+    std::span<const SystemClass> candidates = classes(*p);
+    auto it = std::lower_bound(
+        candidates.begin(), candidates.end(), name,
+        [this](const SystemClass &type, std::string_view name) { return text(type.name) < name; });
+    return it != candidates.end() && text(it->name) == name ? &*it : nullptr;
+}
+
+std::span<const SystemMember> SystemIndex::members(const SystemClass &type) const
+{
+    if (type.first_member > m_members.size() || m_members.size() - type.first_member < type.member_count)
+    {
+        return {};
+    }
+
+    return m_members.subspan(type.first_member, type.member_count);
+}
+
+std::span<const SystemMember> SystemIndex::find_members(const SystemClass &type, std::string_view name) const
+{
+    std::span<const SystemMember> all = members(type);
+    auto begin = std::lower_bound(all.begin(), all.end(), name, [this](const SystemMember &member, std::string_view name) {
+        return text(member.name) < name;
+    });
+    auto end = std::upper_bound(begin, all.end(), name, [this](std::string_view name, const SystemMember &member) {
+        return name < text(member.name);
+    });
+    return {begin, end};
+}
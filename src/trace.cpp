@@ -0,0 +1,148 @@
+#include "ujavac.h"
+
+#include <chrono>
+
+#ifdef UJAVAC_ITTNOTIFY
+#include <ittnotify.h>
+#endif
+
+u64 trace_clock()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+#ifdef UJAVAC_ITTNOTIFY
+namespace
+{
+struct IttHandles
+{
+    __itt_domain *domain;
+    __itt_string_handle *phases[COMPILE_PHASE_COUNT];
+
+    IttHandles()
+    {
+        domain = __itt_domain_create("ujavac");
+        for (u32 phase = 0; phase < COMPILE_PHASE_COUNT; phase++)
+        {
+            phases[phase] = __itt_string_handle_create(compile_phase_name(CompilePhase(phase)));
+        }
+    }
+};
+
+IttHandles &itt_handles()
+{
+    static IttHandles handles;
+    return handles;
+}
+} // namespace
+
+void itt_phase_begin(CompilePhase phase)
+{
+    IttHandles &handles = itt_handles();
+    __itt_task_begin(handles.domain, __itt_null, __itt_null, handles.phases[u32(phase)]);
+}
+
+void itt_phase_end()
+{
+    __itt_task_end(itt_handles().domain);
+}
+#endif
+
+bool Tracer::write_chrome_trace(const char *path, const InputList &inputs) const
+{
+    std::FILE *f = std::fopen(path, "wb");
+    if (!f)
+    {
+        return false;
+    }
+
+    // Timestamps are in microseconds, relative to the first event
+    u64 origin = ~0ull;
+    for (const std::vector<TraceEvent> &events : m_events)
+    {
+        for (const TraceEvent &event : events)
+        {
+            origin = std::min(origin, event.begin_ns);
+        }
+    }
+
+    std::string out = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    u32 thread = 0;
+    bool first = true;
+
+    for (const std::vector<TraceEvent> &events : m_events)
+    {
+        thread++;
+        if (events.empty())
+        {
+            continue;
+        }
+
+        out.append(std::format("{}{{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":1,\"tid\":{},"
+                               "\"args\":{{\"name\":\"worker {}\"}}}}",
+                               first ? "" : ",\n", thread, thread));
+        first = false;
+
+        for (const TraceEvent &event : events)
+        {
+            out.append(std::format(",\n{{\"ph\":\"X\",\"cat\":\"phase\",\"name\":\"{}\",\"pid\":1,\"tid\":{},"
+                                   "\"ts\":{:.3f},\"dur\":{:.3f},\"args\":{{\"file\":",
+                                   compile_phase_name(event.phase), thread, (event.begin_ns - origin) * 1e-3,
+                                   (event.end_ns - event.begin_ns) * 1e-3));
+            append_json_string(out, inputs[event.unit]);
+            out.append(std::format(",\"bytes\":{}}}}}", event.bytes));
+
+            // Flushed in pieces, traces of big builds run to megabytes
+            if (out.size() >= 64 * 1024)
+            {
+                std::fwrite(out.data(), 1, out.size(), f);
+                out.clear();
+            }
+        }
+    }
+
+    out.append("\n]}\n");
+    std::fwrite(out.data(), 1, out.size(), f);
+    return !std::ferror(f) & !std::fclose(f);
+}
+
+void Tracer::print_time_report() const
+{
+    std::vector<u64> durations[COMPILE_PHASE_COUNT];
+    u64 bytes[COMPILE_PHASE_COUNT] = {};
+
+    for (const std::vector<TraceEvent> &events : m_events)
+    {
+        for (const TraceEvent &event : events)
+        {
+            durations[u32(event.phase)].push_back(event.end_ns - event.begin_ns);
+            bytes[u32(event.phase)] += event.bytes;
+        }
+    }
+
+    println("{:<10} {:>8} {:>12} {:>10} {:>10} {:>10}", "phase", "units", "total ms", "p50 ms", "p99 ms", "MB/s");
+
+    for (u32 phase = 0; phase < COMPILE_PHASE_COUNT; phase++)
+    {
+        std::vector<u64> &times = durations[phase];
+        if (times.empty())
+        {
+            continue;
+        }
+
+        // Nearest-rank percentiles
+        std::sort(times.begin(), times.end());
+        auto percentile = [&](u32 p) { return times[(times.size() * p + 99) / 100 - 1] * 1e-6; };
+
+        u64 total_ns = 0;
+        for (u64 ns : times)
+        {
+            total_ns += ns;
+        }
+
+        println("{:<10} {:>8} {:>12.3f} {:>10.3f} {:>10.3f} {:>10.1f}", compile_phase_name(CompilePhase(phase)),
+                times.size(), total_ns * 1e-6, percentile(50), percentile(99),
+                total_ns ? bytes[phase] * 1e3 / total_ns : 0.0);
+    }
+}
@@ -1,13 +1,30 @@
 #ifndef UJAVAC_H_
 #define UJAVAC_H_
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
 #include <cstdio>
+#include <cstring>
 #include <format>
+#include <memory>
+#include <mutex>
+#include <new>
 #include <span>
 #include <string>
 #include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#include <tbb/concurrent_hash_map.h>
+#include <tbb/concurrent_vector.h>
+#include <tbb/enumerable_thread_specific.h>
+#include <tbb/task_group.h>
+
 using s8 = signed char;
 using u8 = unsigned char;
 using s16 = signed short;
@@ -17,6 +34,8 @@ using u32 = unsigned int;
 using s64 = signed long long;
 using u64 = unsigned long long;
 
+constexpr const char *UJAVAC_VERSION = "1.0.0";
+
 template <class... Args> u32 print(std::FILE *f, std::format_string<Args...> fmt, Args &&...args)
 {
     int ret =
@@ -41,6 +60,819 @@ template <class... Args> u32 println(std::format_string<Args...> fmt, Args &&...
     return println(stdout, fmt, std::forward<Args>(args)...);
 }
 
+enum class DiagnosticFormat
+{
+    Text,
+    // One JSON object per line, for tools
+    Json,
+};
+
+struct CompilerOptions
+{
+    bool verbose = false;
+    bool werror = false;
+    DiagnosticFormat diagnostic_format = DiagnosticFormat::Text;
+    // Worker thread limit, or zero to use every available core
+    u32 threads = 0;
+    // Stop compiling other units after the first one fails
+    bool fail_fast = false;
+    // Directory of outputs from earlier builds, keyed by source content
+    const char *cache_dir = nullptr;
+    // Root of the tree of class files, mirroring the directories of the
+    // sources; null puts each class file next to its source
+    const char *output_dir = nullptr;
+    // Keep class files in memory rather than writing them, for benchmarks
+    bool memory_output = false;
+    // Single jar that takes every class file instead of the file system
+    const char *output_jar = nullptr;
+    // Compress jar entries, if built with zlib
+    bool jar_deflate = true;
+    // JDK whose system modules are indexed, or "none"
+    const char *system = nullptr;
+    // Hand runs of plain ASCII to the lexer without going through
+    // the UTF-8 and escape decoders, and skip over comments and white
+    // space in bulk. Only disabled for benchmarking.
+    bool ascii_fast_path = true;
+    // Print every token with its position after lexing
+    bool dump_tokens = false;
+    // Stop each unit after parsing, without writing anything
+    bool parse_only = false;
+    // Inputs read ahead of the units that need them; zero reads each
+    // input only once its unit starts
+    u32 prefetch_depth = 32;
+    // Inputs at least this large are lexed in chunks on several
+    // threads; zero lexes every input on one thread
+    u64 chunked_lex_threshold = 8 * 1024 * 1024;
+    // Chrome trace-event file of every unit's phases
+    const char *trace_file = nullptr;
+    // Print time spent per phase after compiling
+    bool time_report = false;
+    // Directories searched for more .java sources, as they're compiled
+    std::vector<std::string> source_paths;
+};
+
+enum class SimdLevel
+{
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+// Byte scanning kernels, specialized per instruction set. The active
+// set is chosen at startup from what the CPU supports.
+struct SimdKernels
+{
+    SimdLevel level;
+    // Length of the longest prefix that is ASCII and has no backslash.
+    u64 (*ascii_run)(const u8 *data, u64 size);
+    // Lengths of the longest prefixes that can be skipped inside a
+    // traditional comment (stops at "*/"), an end-of-line comment
+    // (stops at a line terminator) and white space. They also stop
+    // at non-ASCII, backslashes and CRs, which need the slow path.
+    u64 (*comment_run)(const u8 *data, u64 size);
+    u64 (*line_comment_run)(const u8 *data, u64 size);
+    u64 (*whitespace_run)(const u8 *data, u64 size);
+    // Appends base + i + 1 for every LF at data[i], i.e. the offsets
+    // where the lines following them start.
+    void (*collect_newlines)(const u8 *data, u64 size, u32 base, std::vector<u32> &line_starts);
+};
+
+const SimdKernels &simd_kernels();
+// Returns false if the CPU doesn't support the requested level.
+bool set_simd_level(SimdLevel level);
+const char *simd_level_name(SimdLevel level);
+
+enum class InputStrategy
+{
+    MemoryMap,
+    Read,
+    // Read ahead by an InputPrefetcher
+    IoUring,
+};
+
+// Bump allocator for data that lives as long as a compilation unit and
+// is released all at once. Pages are taken from a pool owned by the
+// current worker thread and returned to it on release, so that units
+// compiled one after another on a thread keep reusing the same pages.
+class Arena
+{
+  public:
+    // Allocation state to rewind to, for scratch data that is only
+    // needed for a while
+    struct Mark
+    {
+        u32 page;
+        u64 offset;
+        u64 live_bytes;
+    };
+
+    Arena() = default;
+    Arena(const Arena &) = delete;
+    Arena &operator=(const Arena &) = delete;
+    ~Arena();
+
+    void *allocate(u64 size, u64 align = alignof(std::max_align_t))
+    {
+        if (m_page < m_pages.size())
+        {
+            const Page &page = m_pages[m_page];
+            u64 begin = align_offset(page, m_offset, align);
+
+            if (begin + size <= page.size)
+            {
+                m_live_bytes += begin + size - m_offset;
+                m_total_bytes += begin + size - m_offset;
+                m_peak_bytes = std::max(m_peak_bytes, m_live_bytes);
+                m_offset = begin + size;
+                return page.data + begin;
+            }
+        }
+
+        return allocate_slow(size, align);
+    }
+
+    template <class T, class... Args> T *make(Args &&...args)
+    {
+        return new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+    }
+
+    // Value-initialized, like new T[count]()
+    template <class T> std::span<T> make_array(u64 count)
+    {
+        T *data = static_cast<T *>(allocate(sizeof(T) * count, alignof(T)));
+        std::uninitialized_value_construct_n(data, count);
+        return {data, count};
+    }
+
+    Mark mark() const
+    {
+        return {m_page, m_offset, m_live_bytes};
+    }
+
+    // Pages past the mark are kept for the allocations that follow
+    void rewind(Mark mark);
+    // Returns all pages to the current thread's pool
+    void release();
+
+    // Most bytes in use at once, and all bytes ever handed out
+    u64 peak_bytes() const
+    {
+        return m_peak_bytes;
+    }
+
+    u64 total_bytes() const
+    {
+        return m_total_bytes;
+    }
+
+    u64 reserved_bytes() const;
+
+  private:
+    struct Page
+    {
+        u8 *data;
+        u64 size;
+    };
+
+    static u64 align_offset(const Page &page, u64 offset, u64 align)
+    {
+        return ((uintptr_t(page.data) + offset + align - 1) & ~uintptr_t(align - 1)) - uintptr_t(page.data);
+    }
+
+    void *allocate_slow(u64 size, u64 align);
+
+    std::vector<Page> m_pages;
+    u32 m_page = 0;
+    u64 m_offset = 0;
+    u64 m_live_bytes = 0;
+    u64 m_peak_bytes = 0;
+    u64 m_total_bytes = 0;
+};
+
+// Lets standard containers allocate from an arena. Memory is only
+// reclaimed when the arena itself is rewound or released.
+template <class T> class ArenaAllocator
+{
+  public:
+    using value_type = T;
+
+    ArenaAllocator(Arena &arena) : m_arena(&arena)
+    {
+    }
+
+    template <class U> ArenaAllocator(const ArenaAllocator<U> &other) : m_arena(other.arena())
+    {
+    }
+
+    T *allocate(std::size_t count)
+    {
+        return static_cast<T *>(m_arena->allocate(sizeof(T) * count, alignof(T)));
+    }
+
+    void deallocate(T *, std::size_t)
+    {
+    }
+
+    Arena *arena() const
+    {
+        return m_arena;
+    }
+
+    template <class U> bool operator==(const ArenaAllocator<U> &other) const
+    {
+        return m_arena == other.arena();
+    }
+
+  private:
+    Arena *m_arena;
+};
+
+template <class T> using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+using ArenaString = std::basic_string<char, std::char_traits<char>, ArenaAllocator<char>>;
+
+// Rewinds an arena to where it was on construction
+class ArenaScope
+{
+  public:
+    explicit ArenaScope(Arena &arena) : m_arena(arena), m_mark(arena.mark())
+    {
+    }
+
+    ArenaScope(const ArenaScope &) = delete;
+    ArenaScope &operator=(const ArenaScope &) = delete;
+
+    ~ArenaScope()
+    {
+        m_arena.rewind(m_mark);
+    }
+
+  private:
+    Arena &m_arena;
+    Arena::Mark m_mark;
+};
+
+// Read-only, contiguous view of a source file's bytes. Regular
+// files are memory mapped; anything that can't be mapped (pipes,
+// special files) is slurped into an owned buffer with large reads.
+class SourceBuffer
+{
+  public:
+    SourceBuffer() = default;
+    SourceBuffer(const SourceBuffer &) = delete;
+    SourceBuffer(SourceBuffer &&other) noexcept;
+    SourceBuffer &operator=(const SourceBuffer &) = delete;
+    SourceBuffer &operator=(SourceBuffer &&other) noexcept;
+    ~SourceBuffer();
+
+    // Small inputs are better read than mapped when they're about to
+    // be needed anyway, which map = false forces
+    bool open(const char *path, bool map = true);
+    // Takes over contents that were read some other way
+    void adopt(std::vector<u8> &&contents, InputStrategy strategy);
+    void close();
+
+    std::span<const u8> bytes() const
+    {
+        return {m_data, m_size};
+    }
+
+    InputStrategy strategy() const
+    {
+        return m_strategy;
+    }
+
+    static const char *strategy_name(InputStrategy strategy);
+
+  private:
+    const u8 *m_data = nullptr;
+    u64 m_size = 0;
+    InputStrategy m_strategy = InputStrategy::Read;
+    std::vector<u8> m_storage;
+};
+
+// Reads inputs ahead of the units that need them, in the order they're
+// compiled, so that workers don't wait on the file system. On Linux the
+// opens, stats and reads of a whole window of inputs go out as batches
+// of io_uring requests from a single thread; elsewhere, or where
+// io_uring is unavailable, a few I/O threads read the inputs instead.
+class InputPrefetcher
+{
+  public:
+    // Inputs with a null path are skipped and left to the caller
+    InputPrefetcher(std::vector<const char *> paths, u32 depth);
+    InputPrefetcher(const InputPrefetcher &) = delete;
+    InputPrefetcher &operator=(const InputPrefetcher &) = delete;
+    ~InputPrefetcher();
+
+    // Waits for the next input in order. Returns false if it couldn't
+    // be read ahead, in which case the caller reads it on its own and
+    // reports any error.
+    bool next(SourceBuffer &source);
+
+    const char *backend_name() const
+    {
+        return m_io_uring ? "io_uring" : "threads";
+    }
+
+    u32 prefetched() const
+    {
+        return m_prefetched;
+    }
+
+  private:
+    struct Slot
+    {
+        SourceBuffer source;
+        bool ok = false;
+        bool ready = false;
+    };
+
+    bool start_io_uring();
+    void read_inputs();
+    void publish(u32 input, SourceBuffer &&source, bool ok);
+
+    std::vector<const char *> m_paths;
+    u32 m_depth;
+    // Input i waits in slot i % depth until it's taken
+    std::vector<Slot> m_slots;
+    std::mutex m_mutex;
+    std::condition_variable m_ready;
+    std::condition_variable m_space;
+    u32 m_taken = 0;
+    // Next input for the I/O threads to pick up
+    u32 m_next = 0;
+    bool m_stopping = false;
+    bool m_io_uring = false;
+    std::atomic<u32> m_prefetched = 0;
+    std::vector<std::thread> m_threads;
+};
+
+// Paths of the units of a compilation, in unit order. Sources found
+// while compiling are appended as other threads read earlier paths.
+using InputList = tbb::concurrent_vector<const char *>;
+
+// Finds the .java files under a set of directories, each directory a
+// task of its own in an arena of the given number of threads, on Linux
+// listed with batched getdents64 calls. Files are handed out in batches
+// as their directories are listed, so that compiling can start long
+// before the walk is done. Symbolic links to files are followed, links
+// to directories aren't, as they could lead back up the tree.
+class SourceDiscovery
+{
+  public:
+    struct Source
+    {
+        std::string path;
+        // Length of the directory it was found under, with the separator
+        u32 root_size;
+    };
+
+    struct Stats
+    {
+        u32 files;
+        u32 directories;
+        u32 unreadable;
+        double seconds;
+    };
+
+    SourceDiscovery(std::vector<std::string> roots, u32 threads);
+    SourceDiscovery(const SourceDiscovery &) = delete;
+    SourceDiscovery &operator=(const SourceDiscovery &) = delete;
+    ~SourceDiscovery();
+
+    // Waits for the next file found; false once every one was taken
+    bool next(Source &source);
+    // Has the walk leave out directories it hasn't started on, and
+    // waits for it to end
+    void stop();
+
+    // Only complete once next() returned false, or after stop()
+    Stats stats() const;
+
+  private:
+    void walk(const std::string &directory, u32 root_size, tbb::task_group &group);
+
+    std::vector<std::string> m_roots;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_found;
+    std::vector<Source> m_sources;
+    // Next source for next() to take
+    u64 m_taken = 0;
+    bool m_done = false;
+    double m_seconds = 0;
+    std::atomic_bool m_stopping = false;
+    std::atomic<u32> m_directories = 0;
+    std::atomic<u32> m_unreadable = 0;
+    std::thread m_thread;
+};
+
+// Identifier spellings are interned once per process and referred to
+// by these IDs from then on. Symbol zero is always the empty string.
+using Symbol = u32;
+
+// Concurrent string interner shared by all compilation units. Lookups
+// only take a read lock on a single hash map element. New spellings
+// are copied into the calling thread's own storage chunks, so storing
+// them never contends with other threads; symbol IDs and the texts
+// they refer to stay valid for the rest of the process.
+class Interner
+{
+  public:
+    struct Stats
+    {
+        u64 lookups;
+        u64 hits;
+        u64 symbols;
+        // Bytes held in storage chunks, and an estimate of the table's
+        // own footprint
+        u64 storage_bytes;
+        u64 table_bytes;
+    };
+
+    Interner();
+    Interner(const Interner &) = delete;
+    Interner &operator=(const Interner &) = delete;
+
+    Symbol intern(std::string_view text);
+    // Symbol of text if it has been interned, or zero, without adding it
+    Symbol find(std::string_view text) const;
+
+    std::string_view text(Symbol symbol) const
+    {
+        return m_texts[symbol];
+    }
+
+    // Only exact while no other thread is interning
+    Stats stats() const;
+
+  private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        u64 size;
+    };
+
+    struct ThreadStorage
+    {
+        std::vector<Chunk> chunks;
+        u64 used = 0;
+        u64 bytes = 0;
+        u64 lookups = 0;
+        u64 hits = 0;
+    };
+
+    char *store(ThreadStorage &storage, std::string_view text);
+
+    tbb::concurrent_hash_map<std::string_view, Symbol> m_table;
+    tbb::concurrent_vector<std::string_view> m_texts;
+    tbb::enumerable_thread_specific<ThreadStorage> m_storage;
+};
+
+Interner &global_interner();
+
+enum class TokenKind : u8
+{
+    Identifier,
+
+    // JLS 3.9, reserved keywords
+    KwAbstract,
+    KwAssert,
+    KwBoolean,
+    KwBreak,
+    KwByte,
+    KwCase,
+    KwCatch,
+    KwChar,
+    KwClass,
+    KwConst,
+    KwContinue,
+    KwDefault,
+    KwDo,
+    KwDouble,
+    KwElse,
+    KwEnum,
+    KwExtends,
+    KwFinal,
+    KwFinally,
+    KwFloat,
+    KwFor,
+    KwIf,
+    KwGoto,
+    KwImplements,
+    KwImport,
+    KwInstanceof,
+    KwInt,
+    KwInterface,
+    KwLong,
+    KwNative,
+    KwNew,
+    KwPackage,
+    KwPrivate,
+    KwProtected,
+    KwPublic,
+    KwReturn,
+    KwShort,
+    KwStatic,
+    KwStrictfp,
+    KwSuper,
+    KwSwitch,
+    KwSynchronized,
+    KwThis,
+    KwThrow,
+    KwThrows,
+    KwTransient,
+    KwTry,
+    KwVoid,
+    KwVolatile,
+    KwWhile,
+    KwUnderscore,
+
+    // JLS 3.9, contextual keywords. These are only keywords in
+    // specific syntactic positions and are identifiers elsewhere.
+    // "non-sealed" is lexed as three tokens and left to the parser.
+    KwExports,
+    KwModule,
+    KwOpen,
+    KwOpens,
+    KwPermits,
+    KwProvides,
+    KwRecord,
+    KwRequires,
+    KwSealed,
+    KwTo,
+    KwTransitive,
+    KwUses,
+    KwVar,
+    KwWhen,
+    KwWith,
+    KwYield,
+
+    // JLS 3.10.3, 3.10.8
+    TrueLiteral,
+    FalseLiteral,
+    NullLiteral,
+
+    // JLS 3.10
+    IntegerLiteral,
+    FloatingPointLiteral,
+    CharacterLiteral,
+    StringLiteral,
+    TextBlock,
+
+    // JLS 3.11
+    LParen,
+    RParen,
+    LBrace,
+    RBrace,
+    LBracket,
+    RBracket,
+    Semicolon,
+    Comma,
+    Dot,
+    Ellipsis,
+    At,
+    ColonColon,
+
+    // JLS 3.12
+    Assign,
+    Greater,
+    Less,
+    Bang,
+    Tilde,
+    Question,
+    Colon,
+    Arrow,
+    EqualEqual,
+    GreaterEqual,
+    LessEqual,
+    BangEqual,
+    AmpAmp,
+    BarBar,
+    PlusPlus,
+    MinusMinus,
+    Plus,
+    Minus,
+    Star,
+    Slash,
+    Amp,
+    Bar,
+    Caret,
+    Percent,
+    LessLess,
+    GreaterGreater,
+    GreaterGreaterGreater,
+    PlusEqual,
+    MinusEqual,
+    StarEqual,
+    SlashEqual,
+    AmpEqual,
+    BarEqual,
+    CaretEqual,
+    PercentEqual,
+    LessLessEqual,
+    GreaterGreaterEqual,
+    GreaterGreaterGreaterEqual,
+
+    EndOfFile,
+};
+
+const char *token_kind_name(TokenKind kind);
+// How the token is spelled in source, or a description such as
+// <identifier> for tokens that have no fixed spelling
+const char *token_kind_text(TokenKind kind);
+
+constexpr bool is_contextual_keyword(TokenKind kind)
+{
+    return kind >= TokenKind::KwExports && kind <= TokenKind::KwYield;
+}
+
+struct Keyword
+{
+    std::string_view text;
+    TokenKind kind;
+};
+
+// Every word that IdentifierChars can turn into other than an identifier.
+std::span<const Keyword> keywords();
+// Classifies IdentifierChars with a single perfect hash probe; anything
+// that isn't a keyword or a boolean or null literal is an Identifier.
+TokenKind lookup_keyword(std::string_view chars);
+
+struct SourcePosition
+{
+    u32 line;
+    u32 col;
+};
+
+// Tokens of a compilation unit, stored as parallel arrays so that
+// passes over a single attribute stay dense in cache. Offsets and
+// lengths are in bytes of the raw input, before any decoding.
+struct TokenBuffer
+{
+    std::vector<TokenKind> kinds;
+    std::vector<u32> offsets;
+    std::vector<u32> lengths;
+    // Symbol of identifiers and contextual keywords, index into the
+    // literal pool for literals; zero for everything else.
+    std::vector<u32> values;
+
+    // Byte offset at which each line starts, in order. Line and column
+    // numbers are only computed from these when they're asked for.
+    std::vector<u32> line_starts;
+
+    // Decoded literal values, back to back.
+    std::string value_chars;
+    std::vector<u32> value_ends;
+
+    void clear();
+
+    u32 size() const
+    {
+        return u32(kinds.size());
+    }
+
+    void push(TokenKind kind, u32 offset, u32 length, u32 value)
+    {
+        kinds.push_back(kind);
+        offsets.push_back(offset);
+        lengths.push_back(length);
+        values.push_back(value);
+    }
+
+    u32 add_value(std::string_view text);
+    std::string_view value(u32 index) const;
+    // Appends the tokens, lines and values of a later part of the input
+    void append(const TokenBuffer &other);
+
+    // Columns count code points, so the source bytes are needed
+    SourcePosition position(u32 offset, std::span<const u8> src) const;
+    u64 memory_usage() const;
+};
+
+enum class Severity : u8
+{
+    Warning,
+    Error,
+};
+
+enum class DiagnosticCode : u8
+{
+    ReadError,
+    WriteError,
+    TooManyConstants,
+    ConstantTooLong,
+    InputTooLarge,
+    InvalidUtf8,
+    IllegalUnicodeEscapeChar,
+    ExpectedBmpUnicodeEscape,
+    InvalidUnicodeEscape,
+    UnterminatedUnicodeEscape,
+    IllegalCharacter,
+    UnexpectedConst,
+    UnexpectedGoto,
+    IllegalUnderscore,
+    MalformedHexLiteral,
+    MalformedBinaryLiteral,
+    MalformedIntegerLiteral,
+    IllegalOctalDigit,
+    MalformedFloatLiteral,
+    IllegalEscape,
+    EmptyCharLiteral,
+    UnclosedCharLiteral,
+    UnclosedStringLiteral,
+    UnclosedComment,
+    UnclosedTextBlock,
+    IllegalTextBlockOpen,
+    InconsistentTextBlockIndentation,
+    ExpectedToken,
+    IllegalStartOfExpression,
+    IllegalStartOfType,
+    ExpectedTypeDeclaration,
+    NotAStatement,
+    ElseWithoutIf,
+    TryWithoutCatch,
+    RepeatedModifier,
+    NestingTooDeep,
+    DuplicateClass,
+};
+
+Severity diagnostic_severity(DiagnosticCode code);
+// Stable name for machine-readable output
+const char *diagnostic_name(DiagnosticCode code);
+
+// A diagnostic as recorded; the message is only formatted from the
+// code and its argument when the diagnostic is written out.
+struct Diagnostic
+{
+    // NO_OFFSET for diagnostics about the whole file
+    u32 offset;
+    // Filled in from the offset before the source goes away
+    u32 line;
+    u32 col;
+    Severity severity;
+    DiagnosticCode code;
+    u32 arg;
+
+    static constexpr u32 NO_OFFSET = ~u32(0);
+};
+
+void format_diagnostic(std::string &out, const char *file, const Diagnostic &diagnostic, DiagnosticFormat format);
+void append_json_string(std::string &out, std::string_view text);
+
+// Diagnostics of a single compilation unit. Only the thread compiling
+// the unit writes to it, so recording takes no locks.
+struct DiagnosticBuffer
+{
+    std::vector<Diagnostic> records;
+    u32 errors = 0;
+    u32 warnings = 0;
+
+    void report(DiagnosticCode code, u32 offset, u32 arg = 0);
+    void append(const DiagnosticBuffer &other);
+    void resolve_positions(const TokenBuffer &tokens, std::span<const u8> src);
+};
+
+// Collects the diagnostics of all units and writes them out in input
+// order, each unit as soon as all units before it have finished.
+class DiagnosticEngine
+{
+  public:
+    DiagnosticEngine(const InputList &inputs, const CompilerOptions &options);
+
+    // Makes room for units added to the inputs since, before any of
+    // them is submitted
+    void add_units(u32 count);
+    // Called once per unit, from any thread
+    void submit(u32 unit, DiagnosticBuffer &&buffer);
+    // Writes out what's left, e.g. units after one that never finished
+    void flush();
+
+    u32 error_count() const
+    {
+        return m_errors.load(std::memory_order_relaxed);
+    }
+
+    u32 warning_count() const
+    {
+        return m_warnings.load(std::memory_order_relaxed);
+    }
+
+  private:
+    void write_unit(u32 unit);
+
+    const InputList &m_inputs;
+    const CompilerOptions &m_options;
+    tbb::concurrent_vector<DiagnosticBuffer> m_units;
+    tbb::concurrent_vector<std::atomic_bool> m_submitted;
+    std::atomic<u32> m_unit_count = 0;
+    std::atomic<u32> m_errors = 0;
+    std::atomic<u32> m_warnings = 0;
+
+    // Guards writing out; units are only ever written in order
+    std::mutex m_write_mutex;
+    std::atomic<u32> m_next_unit = 0;
+};
+
 enum class LexerItem
 {
     WhiteSpace,
@@ -50,66 +882,1571 @@ enum class LexerItem
     // of: indentifier, reserved keyword, or literal
     IdentifierChars,
     Identifier,
+    // Operators are munched greedily, which also
+    // covers "/" turning into the start of a comment
+    Operator,
+    // A "." may start an ellipsis or a floating-point literal
+    Dot,
+    DotDot,
+    NumericLiteral,
+    CharacterLiteral,
+    StringLiteral,
+    // "" is either an empty string or the start of a text block
+    EmptyString,
+    TextBlockOpen,
+    TextBlock,
 };
 
-class Compiler
+// Decodes UTF-8 and Unicode escapes and splits the result into tokens.
+// Lexing stops at the first error.
+class Lexer
 {
   public:
-    Compiler(const char *input, const char *output);
-    bool compile();
+    // Lexing gives up without a diagnostic once *cancelled is set
+    Lexer(std::span<const u8> src, TokenBuffer &tokens, Arena &arena, DiagnosticBuffer &diagnostics,
+          const CompilerOptions &options, const std::atomic_bool *cancelled = nullptr);
+    bool run();
+    // The first step of run(), for callers that go on to scan() the
+    // input a part at a time
+    bool start();
+    // Size of the input, without any trailing Ctrl-Z once started
+    u64 size() const
+    {
+        return m_src.size();
+    }
 
-  private:
-    void push_diagnostic(std::string_view msg);
+    // Lexing in chunks, see lex_chunked(). A chunk starts out as if at
+    // the start of the input, but without a first line, and scan()
+    // carries on from wherever the last call stopped.
+    void start_chunk();
+    bool scan(u64 begin, u64 end);
+    // Whether lexing could start over from scratch at this point, as
+    // it's outside of any token and escape
+    bool at_chunk_boundary() const;
+    bool finish();
 
-    void ascii_token_append(char c);
-    bool ascii_token_contains(std::string_view token) const;
+  private:
+    void reset();
+    bool fail(u32 offset, DiagnosticCode code, u32 arg = 0);
 
-    const char *m_input;
-    const char *m_output;
+    void track_line(u32 raw_unicode, u64 pos);
+    u64 skippable_run(u64 pos, u64 end) const;
+    bool unescape(u32 raw_unicode, u32 begin, u32 end);
+    bool lex_char(u32 unicode, u32 begin, u32 end);
+    bool start_token(u32 unicode, u32 begin, u32 end);
 
-    // Reconstructed Unicode code point from UTF-8 input.
-    u32 m_raw_unicode;
-    // State counter for Unicode code point reconstruction.
-    u32 m_raw_unicode_remaining;
+    void append_text(u32 unicode);
+    void emit(TokenKind kind, u32 value = 0);
+    bool end_identifier();
+    void end_operator();
+    bool end_number();
+    bool continues_number(u32 unicode) const;
+    bool end_quoted(TokenKind kind);
 
-    // Source code line segmentation state.
-    u64 m_line_num;
-    u64 m_col_num;
-    bool prev_raw_cr;
+    std::span<const u8> m_src;
+    TokenBuffer &m_tokens;
+    // Scratch space for literal values, rewound after each token
+    Arena &m_arena;
+    DiagnosticBuffer &m_diagnostics;
+    const CompilerOptions &m_options;
+    Interner &m_interner;
+    const std::atomic_bool *m_cancelled;
 
     // State variables responsible for keeping track of
     // Unicode escape sequences (i.e. \uXXXX).
     u16 m_esc_utf16[2];
     u32 m_esc_utf16_len;
     u32 m_esc_utf16_remaining;
-    bool m_prev_from_esc;
+    u32 m_esc_begin;
 
     // Backslashes need special care during parsing because
     // they're used in escape sequences at various stages.
     bool m_prev_backslash;
     u64 m_raw_backslash_count;
-
-    char m_ascii_tok_buf[sizeof("synchronized")];
-    u32 m_ascii_tok_buf_len;
-    // Position of the current token's first character in the input stream.
-    u64 m_ascii_tok_buf_line_num;
-    u64 m_ascii_tok_buf_col_num;
+    u32 m_backslash_begin;
 
     LexerItem m_lexer_item;
     bool m_prev_trad_comment_end_star;
+
+    // The token being built: its raw extent and decoded text.
+    u32 m_tok_begin;
+    u32 m_tok_end;
+    std::string m_tok_text;
+    // Second "." of a pending "..", which may turn into an ellipsis
+    u32 m_dot2_begin;
+
+    // Numeric literal shape, tracked for continuation decisions
+    u32 m_num_radix;
+    bool m_num_dot;
+    bool m_num_exponent;
+
+    // Quoted literal state; text is kept raw until the closing quote
+    bool m_lit_backslash;
+    u32 m_tb_quotes;
+    bool m_tb_skip_lf;
+};
+
+// Lexes a large input with the same result as Lexer::run(), but split
+// into chunks of about chunk_size that are lexed in parallel. Each chunk
+// but the first starts at a line, assuming that it's outside of any
+// comment, literal or escape; a chunk where that's wrong is lexed again,
+// following on from the chunk before it.
+bool lex_chunked(std::span<const u8> src, TokenBuffer &tokens, DiagnosticBuffer &diagnostics,
+                 const CompilerOptions &options, const std::atomic_bool *cancelled, u64 chunk_size);
+
+// Lexes on demand, a slice of input at a time, for passes that only ever
+// look a few tokens ahead. Consumed tokens and their values are dropped
+// as the next slice is lexed, so memory follows the longest line rather
+// than the input. The tokens are the same as Lexer::run()'s.
+class TokenStream
+{
+  public:
+    // Slices end just past a line feed, so none splits a UTF-8 sequence
+    static constexpr u64 DEFAULT_SLICE_SIZE = 4 * 1024;
+
+    TokenStream(std::span<const u8> src, DiagnosticBuffer &diagnostics, const CompilerOptions &options,
+                const std::atomic_bool *cancelled = nullptr, u64 slice_size = DEFAULT_SLICE_SIZE);
+
+    // Kind of the token the given number past the current one. Lexing
+    // errors end the stream early, which reads as EndOfFile with ok()
+    // false.
+    TokenKind peek(u32 ahead = 0);
+    void advance();
+    bool ok() const
+    {
+        return m_ok;
+    }
+
+    // Of a token already peeked at
+    u32 offset(u32 ahead = 0) const;
+    u32 length(u32 ahead = 0) const;
+    u32 value(u32 ahead = 0) const;
+    std::string_view literal(u32 ahead = 0) const;
+    SourcePosition position(u32 ahead = 0) const;
+
+    u64 memory_usage() const;
+
+  private:
+    bool fill(u32 count);
+    void compact();
+
+    std::span<const u8> m_src;
+    u64 m_slice_size;
+    TokenBuffer m_tokens;
+    Arena m_arena;
+    Lexer m_lexer;
+
+    // Index of the current token in m_tokens, and how far lexing got
+    u32 m_pos = 0;
+    u64 m_scanned = 0;
+    // Line starts dropped from m_tokens along with consumed tokens
+    u32 m_dropped_lines = 0;
+    bool m_ok;
+    bool m_done = false;
+};
+
+// Modifier flags of a Modifiers node, JLS 8.1.1, 8.3.1, 8.4.3 and 9.4
+constexpr u32 MODIFIER_PUBLIC = 1 << 0;
+constexpr u32 MODIFIER_PROTECTED = 1 << 1;
+constexpr u32 MODIFIER_PRIVATE = 1 << 2;
+constexpr u32 MODIFIER_STATIC = 1 << 3;
+constexpr u32 MODIFIER_ABSTRACT = 1 << 4;
+constexpr u32 MODIFIER_FINAL = 1 << 5;
+constexpr u32 MODIFIER_NATIVE = 1 << 6;
+constexpr u32 MODIFIER_SYNCHRONIZED = 1 << 7;
+constexpr u32 MODIFIER_TRANSIENT = 1 << 8;
+constexpr u32 MODIFIER_VOLATILE = 1 << 9;
+constexpr u32 MODIFIER_STRICTFP = 1 << 10;
+constexpr u32 MODIFIER_DEFAULT = 1 << 11;
+constexpr u32 MODIFIER_SEALED = 1 << 12;
+constexpr u32 MODIFIER_NON_SEALED = 1 << 13;
+
+// Flags of an ImportDecl node
+constexpr u32 IMPORT_STATIC = 1 << 0;
+constexpr u32 IMPORT_ON_DEMAND = 1 << 1;
+
+// Flags of a RequiresDirective node
+constexpr u32 REQUIRES_TRANSITIVE = 1 << 0;
+constexpr u32 REQUIRES_STATIC = 1 << 1;
+
+// Bound of a Wildcard node
+constexpr u32 WILDCARD_EXTENDS = 1;
+constexpr u32 WILDCARD_SUPER = 2;
+
+// Kinds of syntax tree nodes. Besides its kind, every node has a token,
+// the one it's about (a name, operator or keyword), and two fields whose
+// meaning depends on the kind, given here as "lhs; rhs". Fields refer to
+// nodes by index, and to lists and records by their place in Ast::extra.
+// An optional node is zero when it's missing, and an empty list is zero.
+enum class NodeKind : u8
+{
+    // JLS 7.3, always node zero; package or none; list of imports,
+    // types and the module
+    CompilationUnit,
+    // Name; Modifiers with its annotations, or none
+    PackageDecl,
+    // Name; IMPORT_* flags
+    ImportDecl,
+    // JLS 7.7, open if the token before "module" is "open"; name;
+    // ModuleRecord
+    ModuleDecl,
+    // Module name; REQUIRES_* flags
+    RequiresDirective,
+    // Package name; list of module names it's exported or opened to
+    ExportsDirective,
+    OpensDirective,
+    // Service name; none
+    UsesDirective,
+    // Service name; list of implementation names
+    ProvidesDirective,
+
+    // JLS 8.1, 8.9, 8.10, 9.1 and 9.6; the token is the name. Modifiers
+    // or none; TypeDeclRecord
+    ClassDecl,
+    InterfaceDecl,
+    EnumDecl,
+    RecordDecl,
+    AnnotationDecl,
+    // MODIFIER_* flags; list of annotations
+    Modifiers,
+    // JLS 9.7; name; list of arguments, values or ElementValuePairs
+    Annotation,
+    // The token is the element's name; value; none
+    ElementValuePair,
+    // The token is the name; list of annotations; list of bounds
+    TypeParameter,
+    // The token is the name; Modifiers or none; EnumConstantRecord
+    EnumConstant,
+    // Body of an anonymous class or enum constant; none; list of members
+    ClassBody,
+    // Block; nonzero if static
+    Initializer,
+    // The token is the name. Modifiers or none; MethodRecord, whose
+    // result is none for constructors
+    MethodDecl,
+    ConstructorDecl,
+    // Record constructor without a parameter list
+    CompactConstructorDecl,
+    // Formal parameter, record component, lambda parameter or catch
+    // parameter; the token is the name. Type, or none if implicit;
+    // Modifiers or none
+    Parameter,
+    // Fields or local variables declared together; Modifiers or none;
+    // list of VariableDecls
+    Variables,
+    // The token is the name; type; initializer or none
+    VariableDecl,
+
+    // JLS 4; the token is the type's keyword, including void
+    PrimitiveType,
+    // JLS 6.5.5, a class, interface or type variable, or a package
+    // qualifying one; the token is the name; qualifier or none
+    TypeName,
+    // Type; list of type arguments, empty for <>
+    ParameterizedType,
+    // Element type; list of annotations on the brackets
+    ArrayType,
+    // The ... of a variable arity parameter; element type; list of
+    // annotations
+    VarargsType,
+    // Bound or none; WILDCARD_* or zero
+    Wildcard,
+    // Type; list of annotations
+    AnnotatedType,
+    // Alternatives in a catch clause; none; list of types
+    UnionType,
+    // Bounds in a cast; none; list of types
+    IntersectionType,
+
+    // JLS 14; none; list of statements
+    Block,
+    EmptyStatement,
+    // Expression; none
+    ExpressionStatement,
+    // Condition; BranchRecord
+    If,
+    // Condition; body
+    While,
+    // Body; condition
+    DoWhile,
+    // None; ForRecord
+    For,
+    // Variables with the loop variable; ForEachRecord
+    ForEach,
+    // The token is the label; statement
+    Labeled,
+    // Token of the label, or zero; none
+    Break,
+    Continue,
+    // Expression or none; none
+    Return,
+    Throw,
+    Yield,
+    // Condition; message or none
+    Assert,
+    // Lock; block
+    Synchronized,
+    // Block; TryRecord
+    Try,
+    // Parameter; block
+    Catch,
+    // Selector; list of SwitchCases or SwitchRules
+    Switch,
+    // Group of statements after "case ...:"; list of labels; list of
+    // statements
+    SwitchCase,
+    // "case ... ->"; list of labels; expression statement, block or
+    // throw statement
+    SwitchRule,
+    // "default" among the labels of a case
+    DefaultLabel,
+    // "when" after a pattern label; pattern; condition
+    Guard,
+
+    // JLS 15; the token is the name
+    Identifier,
+    Literal,
+    This,
+    Super,
+    // Field access or qualified name, including Outer.this; the token is
+    // the name; qualifier
+    Select,
+    // The token is "class"; type
+    ClassLiteral,
+    // Identifier, Select, This or Super called; CallRecord
+    MethodCall,
+    // Class instance creation; outer instance or none; NewRecord
+    New,
+    // Array creation; type of the array minus the dimensions given by
+    // expressions; NewArrayRecord
+    NewArray,
+    // None; list of elements
+    ArrayInitializer,
+    // Array; index
+    ArrayAccess,
+    // The token is the operator. Operand; none
+    Unary,
+    Postfix,
+    // Left operand; right operand
+    Binary,
+    Assign,
+    // Condition; BranchRecord
+    Conditional,
+    // Expression; type or pattern
+    InstanceOf,
+    // Type; operand
+    Cast,
+    // The token is the arrow; list of Parameters; expression or block
+    Lambda,
+    // The token is the method name or "new"; qualifier; list of type
+    // arguments
+    MethodReference,
+    // Expression; none
+    Parenthesized,
+    // As Switch
+    SwitchExpression,
+    // JLS 14.30; the token is the name. Type, or none for "_"; Modifiers
+    // or none
+    TypePattern,
+    // Type; list of patterns
+    RecordPattern,
+};
+
+const char *node_kind_name(NodeKind kind);
+
+inline bool is_type_declaration(NodeKind kind)
+{
+    return kind >= NodeKind::ClassDecl && kind <= NodeKind::AnnotationDecl;
+}
+
+// Records in Ast::extra, for kinds that need more than two fields
+struct ModuleRecord
+{
+    u32 modifiers;
+    u32 directives;
+};
+
+struct TypeDeclRecord
+{
+    // First node of the declaration, not counting its modifiers; the
+    // nodes from there up to the declaration's own are inside it
+    u32 start;
+    u32 type_parameters;
+    // Classes only
+    u32 super_class;
+    // Implemented interfaces, or extended ones for interfaces
+    u32 interfaces;
+    u32 permits;
+    // Records only, as Parameters
+    u32 components;
+    u32 members;
+};
+
+struct EnumConstantRecord
+{
+    u32 arguments;
+    // ClassBody or none
+    u32 body;
+};
+
+struct MethodRecord
+{
+    u32 type_parameters;
+    u32 result;
+    u32 parameters;
+    u32 throws;
+    // Block or none
+    u32 body;
+    // Default of an annotation element, or none
+    u32 default_value;
+};
+
+struct BranchRecord
+{
+    u32 then;
+    // Else branch, or none
+    u32 otherwise;
+};
+
+struct ForRecord
+{
+    // ExpressionStatements, or a single Variables
+    u32 init;
+    // Optional
+    u32 condition;
+    // ExpressionStatements
+    u32 update;
+    u32 body;
+};
+
+struct ForEachRecord
+{
+    u32 iterable;
+    u32 body;
+};
+
+struct TryRecord
+{
+    // Variables or expressions
+    u32 resources;
+    u32 catches;
+    // Block or none
+    u32 finally_block;
+};
+
+struct CallRecord
+{
+    u32 arguments;
+    u32 type_arguments;
+};
+
+struct NewRecord
+{
+    u32 type;
+    u32 arguments;
+    // ClassBody or none
+    u32 body;
+    // Of the constructor, as in new <T>Foo()
+    u32 type_arguments;
+};
+
+struct NewArrayRecord
+{
+    u32 dimensions;
+    // ArrayInitializer or none
+    u32 initializer;
+};
+
+// Syntax tree of a compilation unit, as parallel arrays indexed by node
+// like the tokens. Apart from the CompilationUnit, children are created
+// before their parents, so a linear pass over the arrays sees them
+// bottom-up. Everything is in the unit's arena and goes away with it;
+// nothing needs to be destroyed.
+struct Ast
+{
+    static constexpr u32 NONE = 0;
+
+    ArenaVector<NodeKind> kinds;
+    ArenaVector<u32> tokens;
+    ArenaVector<u32> lhs;
+    ArenaVector<u32> rhs;
+    // Lists, as a count followed by the nodes, and records. Index zero
+    // holds the empty list.
+    ArenaVector<u32> extra;
+
+    explicit Ast(Arena &arena) : kinds(arena), tokens(arena), lhs(arena), rhs(arena), extra(arena)
+    {
+    }
+
+    u32 size() const
+    {
+        return u32(kinds.size());
+    }
+
+    u32 add(NodeKind kind, u32 token, u32 left = NONE, u32 right = NONE)
+    {
+        kinds.push_back(kind);
+        tokens.push_back(token);
+        lhs.push_back(left);
+        rhs.push_back(right);
+        return u32(kinds.size() - 1);
+    }
+
+    u32 add_list(std::span<const u32> nodes);
+
+    std::span<const u32> list(u32 index) const
+    {
+        return {extra.data() + index + 1, extra[index]};
+    }
+
+    template <class T> u32 add_record(const T &record)
+    {
+        static_assert(sizeof(T) % sizeof(u32) == 0);
+        u32 index = u32(extra.size());
+        extra.resize(index + sizeof(T) / sizeof(u32));
+        std::memcpy(extra.data() + index, &record, sizeof(T));
+        return index;
+    }
+
+    template <class T> T record(u32 index) const
+    {
+        T record;
+        std::memcpy(&record, extra.data() + index, sizeof(T));
+        return record;
+    }
+
+    u64 memory_usage() const;
+};
+
+// Recursive-descent parser of a unit's tokens, JLS 7 to 15, building
+// its Ast. Parsing stops at the first error, like lexing.
+class Parser
+{
+  public:
+    // Parsing gives up without a diagnostic once *cancelled is set
+    Parser(const TokenBuffer &tokens, Ast &ast, DiagnosticBuffer &diagnostics,
+           const std::atomic_bool *cancelled = nullptr);
+    bool run();
+
+  private:
+    TokenKind kind() const;
+    TokenKind peek(u32 ahead) const;
+    TokenKind at(u32 token) const;
+    u32 advance();
+    bool accept(TokenKind kind);
+    bool expect(TokenKind kind);
+    bool close_type_arguments();
+    u32 fail(DiagnosticCode code);
+    u32 fail_expected(TokenKind kind);
+    bool poll();
+    u32 finish_list(u32 mark);
+
+    // Lookahead over tokens, without building anything. These return the
+    // token after what they skip, or zero if it's not there.
+    u32 skip_annotations(u32 token) const;
+    u32 skip_type_arguments(u32 token) const;
+    u32 skip_type(u32 token) const;
+    bool is_non_sealed() const;
+    bool is_sealed_modifier() const;
+    bool is_type_declaration_start() const;
+    bool is_local_declaration_start() const;
+    bool is_yield_statement() const;
+    bool is_lambda() const;
+    bool is_cast() const;
+    bool is_pattern_start() const;
+    bool is_statement_expression(u32 node) const;
+
+    bool parse_compilation_unit();
+    u32 parse_package(u32 modifiers);
+    u32 parse_import();
+    u32 parse_module(u32 modifiers);
+    u32 parse_directive();
+    u32 parse_qualified_name();
+    bool parse_name_list(u32 &list);
+    bool parse_modifiers(u32 &modifiers);
+    u32 parse_annotation();
+    bool parse_annotations(u32 &list);
+    u32 parse_element_value();
+
+    u32 parse_type_declaration(u32 modifiers);
+    bool parse_type_parameters(u32 &list);
+    bool parse_type_list(u32 &list);
+    bool parse_class_body(NodeKind type_kind, u32 &members);
+    u32 parse_enum_constant();
+    bool parse_member(NodeKind type_kind, u32 &member);
+    u32 parse_method(NodeKind kind, u32 name, u32 modifiers, MethodRecord record);
+    bool parse_formal_parameters(u32 &list);
+    u32 parse_formal_parameter();
+    bool parse_variable_declarators(u32 type, u32 &list);
+    u32 parse_variable_name();
+
+    u32 parse_type();
+    u32 parse_class_type(bool allow_diamond);
+    bool parse_type_arguments(bool allow_diamond, u32 &list);
+    u32 parse_type_argument();
+    u32 parse_dims(u32 type);
+
+    u32 parse_block();
+    u32 parse_block_statement();
+    u32 parse_local_declaration();
+    u32 parse_statement();
+    u32 parse_for();
+    u32 parse_try();
+    u32 parse_switch(bool expression);
+    u32 parse_case_label();
+    u32 parse_pattern();
+
+    u32 parse_expression();
+    u32 parse_conditional();
+    u32 parse_binary(u32 min_precedence);
+    u32 parse_unary();
+    u32 parse_cast();
+    u32 parse_lambda();
+    u32 parse_primary();
+    u32 parse_selectors(u32 expression);
+    u32 parse_call(u32 callee, u32 type_arguments);
+    bool parse_arguments(u32 &list);
+    u32 parse_new(u32 outer);
+    u32 parse_array_initializer(bool element_values);
+    u32 parse_method_reference(u32 qualifier);
+    u32 parse_type_expression();
+
+    const TokenBuffer &m_tokens;
+    const TokenKind *m_kinds;
+    u32 m_size;
+    Ast &m_ast;
+    DiagnosticBuffer &m_diagnostics;
+    const std::atomic_bool *m_cancelled;
+    // Spelling of the "non" in non-sealed
+    Symbol m_non;
+
+    u32 m_pos = 0;
+    // ">" already taken from a ">>" or ">>>" token that closes nested
+    // type arguments
+    u32 m_split = 0;
+    u32 m_depth = 0;
+    u32 m_next_poll = 0;
+    // Case labels and guards end in an arrow that isn't a lambda's
+    bool m_no_lambda = false;
+    // Children of the lists being parsed, most nested last
+    std::vector<u32> m_scratch;
+};
+
+// XXH64 of the data; fast enough to hash every source on every build
+u64 xxh64(const void *data, u64 size, u64 seed = 0);
+
+// Outputs of earlier compilations on disk, keyed by a hash of the
+// source together with everything else that affects the output. A
+// unit whose key is found doesn't need to be compiled again; its
+// outputs are hardlinked (or copied) from the cache instead.
+class BuildCache
+{
+  public:
+    struct Stats
+    {
+        u64 hits;
+        u64 misses;
+        u64 stores;
+    };
+
+    // Returns false if the cache directory can't be created
+    bool open(const char *dir);
+
+    // Class files name the source file they came from, so its name is
+    // part of the key
+    u64 key(std::span<const u8> source, std::string_view file_name) const;
+    // Places the cached output at path; false on a miss
+    bool restore(u64 key, const char *path);
+    void store(u64 key, const char *path);
+
+    Stats stats() const
+    {
+        return {m_hits.load(), m_misses.load(), m_stores.load()};
+    }
+
+  private:
+    std::string entry_path(u64 key) const;
+
+    std::string m_dir;
+    // Hash of the compiler version and options, seeding every key
+    u64 m_seed = 0;
+    std::atomic<u64> m_hits = 0;
+    std::atomic<u64> m_misses = 0;
+    std::atomic<u64> m_stores = 0;
+};
+
+// Constant pool of a class file being built. Equal constants are
+// stored once: each entry is looked up by a hash of its encoding
+// before it's added. Indexes are as in the class file, starting at 1;
+// zero means that the pool is full or, for text, that it's too long.
+class ConstantPool
+{
+  public:
+    ConstantPool();
+
+    // Text is UTF-8, stored as the class file's modified UTF-8
+    u16 utf8(std::string_view text);
+    u16 integer(s32 value);
+    // Internal form, e.g. java/lang/Object
+    u16 class_ref(std::string_view name);
+    u16 string(std::string_view text);
+    u16 name_and_type(std::string_view name, std::string_view descriptor);
+    u16 field_ref(std::string_view owner, std::string_view name, std::string_view descriptor);
+    u16 method_ref(std::string_view owner, std::string_view name, std::string_view descriptor);
+
+    // constant_pool_count, one more than the last index
+    u16 count() const
+    {
+        return u16(m_entry_offsets.size());
+    }
+
+    bool full() const
+    {
+        return m_full;
+    }
+
+    // The entries in order, as they appear in the class file
+    std::span<const u8> bytes() const
+    {
+        return m_bytes;
+    }
+
+  private:
+    u16 add(const u8 *entry, u32 size);
+    u16 add_pair(u8 tag, u16 first, u16 second);
+
+    std::vector<u8> m_bytes;
+    // Start of each entry in m_bytes, indexed by pool index
+    std::vector<u32> m_entry_offsets;
+    // Open addressing, pool index or zero for an empty slot
+    std::vector<u16> m_table;
+    bool m_full = false;
+};
+
+// Big-endian writes into a class file's buffer
+class ClassFileBuffer
+{
+  public:
+    void u1(u8 value)
+    {
+        m_bytes.push_back(value);
+    }
+
+    void u2(u16 value)
+    {
+        m_bytes.push_back(u8(value >> 8));
+        m_bytes.push_back(u8(value));
+    }
+
+    void u4(u32 value)
+    {
+        u2(u16(value >> 16));
+        u2(u16(value));
+    }
+
+    void bytes(std::span<const u8> data)
+    {
+        m_bytes.insert(m_bytes.end(), data.begin(), data.end());
+    }
+
+    std::vector<u8> &contents()
+    {
+        return m_bytes;
+    }
+
+  private:
+    std::vector<u8> m_bytes;
+};
+
+// JVMS 4.5 and 4.6
+struct ClassFileMember
+{
+    std::string_view name;
+    std::string_view descriptor;
+    u16 access_flags;
+    bool is_method;
+};
+
+// The parts of a class file that other classes can refer to. Names are
+// in internal form and modified UTF-8, viewing the class file's bytes.
+struct ClassFileSummary
+{
+    std::string_view name;
+    // Empty for java/lang/Object
+    std::string_view super_class;
+    u16 access_flags;
+    std::vector<ClassFileMember> members;
+};
+
+// False if the class file is malformed or truncated
+bool read_class_file(std::span<const u8> data, ClassFileSummary &summary);
+
+// Writes the whole file with a single write to a temporary file next to
+// it, then renames that into place. Readers never see a partial file,
+// and a failure leaves any old file as it was.
+bool write_file_atomically(const char *path, std::span<const u8> contents);
+
+// CRC-32 as used by zip archives
+u32 crc32(std::span<const u8> data, u32 crc = 0);
+
+// Whether jar entries can be compressed, which takes zlib
+bool jar_deflate_supported();
+
+// A jar written as its entries come in from the workers. Each entry is
+// compressed by the thread that adds it, then pushed onto a lock-free
+// list; whichever thread finds the next entry in order there writes it
+// out, along with any that follow and are ready. The order is fixed up
+// front, so the archive is the same however the threads are scheduled.
+class JarWriter
+{
+  public:
+    JarWriter(const JarWriter &) = delete;
+    JarWriter &operator=(const JarWriter &) = delete;
+
+    JarWriter() = default;
+    ~JarWriter();
+
+    // The archive is written to a temporary file until finish()
+    bool open(const char *path, u32 entry_count, bool deflate);
+    // Entry number order is its place in the archive; entry_count is
+    // only what's expected, as more entries may be found while compiling
+    void add(u32 order, std::string name, std::span<const u8> contents);
+    // Marks an entry that won't be added, so that later ones can go on
+    void skip(u32 order);
+    // With keep, writes the central directory and renames the archive
+    // into place; without, removes it. False on any write error.
+    bool finish(bool keep);
+
+    u32 entries() const
+    {
+        return u32(m_directory.size());
+    }
+
+    u32 duplicates() const
+    {
+        return m_duplicates;
+    }
+
+  private:
+    struct Entry
+    {
+        u32 order;
+        // Skipped entries have no name
+        std::string name;
+        std::vector<u8> data;
+        u32 crc;
+        u32 size;
+        bool deflated;
+        Entry *next;
+    };
+
+    struct DirectoryEntry
+    {
+        std::string name;
+        u32 crc;
+        u32 compressed_size;
+        u32 size;
+        bool deflated;
+        u64 offset;
+    };
+
+    void push(Entry *entry);
+    // Only called by the thread draining
+    void take_added();
+    void drain();
+    void write_entry(const Entry &entry);
+    void write_bytes(const void *data, u64 size);
+
+    std::string m_path;
+    std::string m_temp_path;
+    std::FILE *m_file = nullptr;
+    bool m_deflate = false;
+
+    // Entries added but not yet written, newest first
+    std::atomic<Entry *> m_added = nullptr;
+    std::atomic_flag m_draining;
+
+    // Only touched by the thread that holds m_draining
+    std::vector<std::unique_ptr<Entry>> m_waiting;
+    u32 m_next = 0;
+    u64 m_offset = 0;
+    bool m_write_failed = false;
+    std::vector<DirectoryEntry> m_directory;
+    std::unordered_set<std::string> m_names;
+    u32 m_duplicates = 0;
+};
+
+enum class OutputMode
+{
+    Disk,
+    // Outputs are only kept in memory, for benchmarks
+    Memory,
+    // Outputs are entries of a single jar
+    Jar,
+};
+
+// Where the class files of a compilation go
+class OutputWriter
+{
+  public:
+    struct File
+    {
+        std::string path;
+        std::vector<u8> contents;
+    };
+
+    explicit OutputWriter(OutputMode mode = OutputMode::Disk) : m_mode(mode)
+    {
+    }
+
+    // Switches to jar mode, expecting unit_count class files
+    bool open_jar(const char *path, u32 unit_count, bool deflate);
+
+    // Order is the unit's place in a jar, class_name its internal name
+    bool write(u32 order, const char *path, std::string_view class_name, std::vector<u8> &&contents);
+    // The unit with this order won't write anything
+    void skip(u32 order);
+    // Completes a jar, keeping it only if the compilation succeeded
+    bool finish(bool keep);
+
+    OutputMode mode() const
+    {
+        return m_mode;
+    }
+
+    // Files written in memory mode, in no particular order
+    const tbb::concurrent_vector<File> &files() const
+    {
+        return m_files;
+    }
+
+    u64 bytes_written() const
+    {
+        return m_bytes_written;
+    }
+
+    u32 jar_entries() const
+    {
+        return m_jar ? m_jar->entries() : 0;
+    }
+
+    u32 jar_duplicates() const
+    {
+        return m_jar ? m_jar->duplicates() : 0;
+    }
+
+  private:
+    OutputMode m_mode;
+    tbb::concurrent_vector<File> m_files;
+    std::unique_ptr<JarWriter> m_jar;
+    std::atomic<u64> m_bytes_written = 0;
+};
+
+// Where in a system index's string area a name is
+struct SystemIndexString
+{
+    u32 offset;
+    u32 size;
+};
+
+struct SystemPackage
+{
+    // Internal form, e.g. java/util
+    SystemIndexString name;
+    u32 first_class;
+    u32 class_count;
+};
+
+struct SystemClass
+{
+    // Binary name without the package, e.g. Map$Entry
+    SystemIndexString name;
+    SystemIndexString module;
+    SystemIndexString super_class;
+    u32 first_member;
+    u32 member_count;
+    u16 access_flags;
+    u16 reserved;
+};
+
+struct SystemMember
+{
+    SystemIndexString name;
+    SystemIndexString descriptor;
+    u16 access_flags;
+    u8 is_method;
+    u8 reserved;
+};
+
+// Public classes of the JDK's system modules, by package, with their
+// accessible members. The index is built from the lib/modules image
+// once and cached as a file that's used right where it's mapped:
+// sorted tables of fixed-size records and a string area. It's never
+// written once open, so workers look things up in it without locks.
+class SystemIndex
+{
+  public:
+    struct Stats
+    {
+        u32 packages;
+        u32 classes;
+        u32 members;
+        u64 bytes;
+        // Built from the image on this run, rather than opened
+        bool built;
+        double seconds;
+    };
+
+    // Opens the index of the JDK's modules, building it first if it
+    // isn't cached in cache_dir or the image has changed since. Without
+    // a cache directory the index is only kept in memory. Returns false
+    // with a message if the JDK has no usable image.
+    bool open(const char *jdk, const char *cache_dir, std::string &error);
+
+    bool is_open() const
+    {
+        return !m_data.bytes().empty();
+    }
+
+    // Package names are in internal form
+    const SystemPackage *find_package(std::string_view name) const;
+    std::span<const SystemClass> classes(const SystemPackage &package) const;
+    const SystemClass *find_class(std::string_view package, std::string_view name) const;
+    // Sorted by name, then descriptor
+    std::span<const SystemMember> members(const SystemClass &type) const;
+    std::span<const SystemMember> find_members(const SystemClass &type, std::string_view name) const;
+    std::string_view text(SystemIndexString string) const;
+
+    std::span<const SystemPackage> packages() const
+    {
+        return m_packages;
+    }
+
+    const Stats &stats() const
+    {
+        return m_stats;
+    }
+
+  private:
+    bool use(SourceBuffer &&data, u64 key);
+
+    // Cache file, mapped, or the index just built
+    SourceBuffer m_data;
+    std::span<const SystemPackage> m_packages;
+    std::span<const SystemClass> m_classes;
+    std::span<const SystemMember> m_members;
+    std::string_view m_strings;
+    Stats m_stats{};
+};
+
+class Compiler;
+
+// A class that a name resolved to: one declared in the sources, or one
+// of the JDK's
+struct ClassRef
+{
+    static constexpr u32 NO_SOURCE = ~u32(0);
+
+    // Binary name in internal form, JLS 13.1, or zero if the name
+    // didn't resolve
+    Symbol name = 0;
+    // Place in the class table, for classes from the sources
+    u32 source = NO_SOURCE;
+
+    explicit operator bool() const
+    {
+        return name != 0;
+    }
+};
+
+enum class SupertypeState : u8
+{
+    Unresolved,
+    Resolving,
+    Resolved,
+};
+
+// A class declared in one of the units being compiled, JLS 8.1 and 9.1
+struct SourceClass
+{
+    // Local classes get a name like javac's, e.g. a/b/Outer$1Local
+    Symbol name;
+    // The unit, as the manager numbers them, and the declaration's node
+    // in the unit's tree
+    u32 unit;
+    u32 node;
+    // The unit's compiler, which resolves the supertypes on demand,
+    // and the class's place among the unit's classes; only used until
+    // the supertypes are resolved
+    Compiler *compiler;
+    u32 declared;
+    SupertypeState state = SupertypeState::Unresolved;
+    // Filled in once resolved; unresolved ones are left out
+    ClassRef super_class;
+    std::vector<ClassRef> interfaces;
+};
+
+// Classes of every unit being compiled. Units add their classes
+// concurrently while they're entered; after that, each unit only fills
+// in the supertypes of its own classes, which the dependency graph
+// orders before any other unit reads them.
+class ClassTable
+{
+  public:
+    explicit ClassTable(const SystemIndex *system = nullptr) : m_system(system)
+    {
+    }
+
+    ClassTable(const ClassTable &) = delete;
+    ClassTable &operator=(const ClassTable &) = delete;
+
+    // Every class is added, local ones included. Member classes are
+    // then made known by their owner, a package or the enclosing class,
+    // and their simple name, which fails if the owner already has one.
+    u32 add(const SourceClass &declared);
+    bool add_member(Symbol owner, Symbol name, u32 index);
+    // ClassRef::NO_SOURCE if there's no such class
+    u32 find_member(Symbol owner, Symbol name) const;
+
+    SourceClass &operator[](u32 index)
+    {
+        return m_classes[index];
+    }
+
+    const SourceClass &operator[](u32 index) const
+    {
+        return m_classes[index];
+    }
+
+    u32 size() const
+    {
+        return u32(m_classes.size());
+    }
+
+    // The JDK's classes, if there's an index of them
+    const SystemIndex *system() const
+    {
+        return m_system && m_system->is_open() ? m_system : nullptr;
+    }
+
+  private:
+    const SystemIndex *m_system;
+    tbb::concurrent_vector<SourceClass> m_classes;
+    tbb::concurrent_hash_map<u64, u32> m_members;
+};
+
+// Units and the units they depend on, condensed into a DAG of strongly
+// connected components: units that depend on each other, directly or
+// through others, share a component. Components are numbered so that
+// each one comes after every component it depends on.
+class DependencyGraph
+{
+  public:
+    // dependencies[u] lists the units that unit u depends on, in any
+    // order and possibly repeated or including u itself
+    explicit DependencyGraph(std::span<const std::vector<u32>> dependencies);
+
+    u32 component_count() const
+    {
+        return u32(m_component_starts.size() - 1);
+    }
+
+    u32 component(u32 unit) const
+    {
+        return m_components[unit];
+    }
+
+    std::span<const u32> units(u32 component) const
+    {
+        return std::span(m_units).subspan(m_component_starts[component],
+                                          m_component_starts[component + 1] - m_component_starts[component]);
+    }
+
+    // Components that a component depends on, each once
+    std::span<const u32> dependencies(u32 component) const
+    {
+        return std::span(m_dependencies)
+            .subspan(m_dependency_starts[component],
+                     m_dependency_starts[component + 1] - m_dependency_starts[component]);
+    }
+
+    // Dependencies between distinct units, each counted once
+    u64 edge_count() const
+    {
+        return m_edges;
+    }
+
+    // Cost of the most costly chain of components, each depending on
+    // the one before. Nothing can finish sooner than that, however many
+    // threads there are; the chain is stored in path, first to run first.
+    double critical_path(std::span<const double> costs, std::vector<u32> &path) const;
+    // For each component, the cost of the most costly chain from it to
+    // a component that nothing depends on, itself included
+    std::vector<double> bottom_levels(std::span<const double> costs) const;
+
+  private:
+    std::vector<u32> m_components;
+    // Units by component, and components' dependencies, each indexed by
+    // the starts
+    std::vector<u32> m_component_starts;
+    std::vector<u32> m_units;
+    std::vector<u32> m_dependency_starts;
+    std::vector<u32> m_dependencies;
+    u64 m_edges = 0;
+};
+
+// Phases of compiling a unit, in the order they run. The manager runs
+// the phases up to Enter as pipeline stages, and the rest once every
+// unit has entered its classes, since analysis looks up the classes of
+// other units.
+enum class CompilePhase : u8
+{
+    Read,
+    Lex,
+    Parse,
+    Enter,
+    Analyze,
+    Emit,
+    Write,
+};
+
+constexpr u32 COMPILE_PHASE_COUNT = u32(CompilePhase::Write) + 1;
+
+const char *compile_phase_name(CompilePhase phase);
+
+// Steady clock in nanoseconds, the time base of every trace event
+u64 trace_clock();
+
+#ifdef UJAVAC_ITTNOTIFY
+// Marks phases as ITT tasks, so they show up in VTune and the like
+void itt_phase_begin(CompilePhase phase);
+void itt_phase_end();
+#else
+inline void itt_phase_begin(CompilePhase)
+{
+}
+
+inline void itt_phase_end()
+{
+}
+#endif
+
+struct TraceEvent
+{
+    CompilePhase phase;
+    u32 unit;
+    u64 begin_ns;
+    u64 end_ns;
+    u64 bytes;
+};
+
+// Phases of every unit as timed by the worker threads. Each thread
+// appends to a buffer of its own, so recording takes no locks; the
+// buffers are only read once compiling is done.
+class Tracer
+{
+  public:
+    void enable()
+    {
+        m_enabled = true;
+    }
+
+    bool enabled() const
+    {
+        return m_enabled;
+    }
+
+    void record(const TraceEvent &event)
+    {
+        m_events.local().push_back(event);
+    }
+
+    // Chrome trace-event JSON, also read by Perfetto
+    bool write_chrome_trace(const char *path, const InputList &inputs) const;
+    // Total, median and 99th percentile time per phase
+    void print_time_report() const;
+
+  private:
+    bool m_enabled = false;
+    tbb::enumerable_thread_specific<std::vector<TraceEvent>> m_events;
+};
+
+// Times one phase of one unit, recording it if tracing is enabled
+class PhaseTimer
+{
+  public:
+    PhaseTimer(Tracer &tracer, CompilePhase phase, u32 unit)
+        : m_tracer(tracer), m_phase(phase), m_unit(unit), m_begin(trace_clock())
+    {
+        itt_phase_begin(phase);
+    }
+
+    // Returns the time taken in seconds; bytes is the size of the unit
+    double stop(u64 bytes)
+    {
+        u64 end = trace_clock();
+        itt_phase_end();
+
+        if (m_tracer.enabled())
+        {
+            m_tracer.record({m_phase, m_unit, m_begin, end, bytes});
+        }
+
+        return (end - m_begin) * 1e-9;
+    }
+
+  private:
+    Tracer &m_tracer;
+    CompilePhase m_phase;
+    u32 m_unit;
+    u64 m_begin;
+};
+
+class Compiler
+{
+  public:
+    // Compilation stops early, without diagnostics, once *cancelled is
+    // set. Without a writer, the class file goes straight to disk;
+    // output_order is the unit's place among the writer's outputs.
+    Compiler(const char *input, const char *output, const CompilerOptions &options,
+             const std::atomic_bool *cancelled = nullptr, OutputWriter *writer = nullptr, u32 output_order = 0);
+
+    // Runs every phase, then finish()
+    bool compile();
+    // Phases have to run in order, and none after one has failed
+    bool run_phase(CompilePhase phase);
+    // Releases the unit's front-end data; only diagnostics remain
+    void finish();
+
+    bool lex(std::span<const u8> src);
+    // Hands over an input that was already read, which the read phase
+    // then takes instead of opening the file
+    void use_source(SourceBuffer &&source);
+    // Has the unit enter its classes into a table shared with other
+    // units, as the given unit; without one, it gets a table of its own
+    void use_class_table(ClassTable &classes, u32 unit);
+
+    // Units with classes that this one's names may refer to, once every
+    // unit has been entered. That's more than analysis will look at,
+    // but never less, apart from classes inherited through them.
+    void find_dependencies(std::vector<u32> &units);
+    // Resolves the supertypes of the unit's classes, JLS 8.1.4, 8.1.5
+    // and 9.1.3. Analysis starts with that, but where units depend on
+    // each other, all of them have to be done before any is analyzed.
+    void resolve_supertypes();
+    // Hash of the names that the class file takes from other units, to
+    // go with the source into a build cache key
+    u64 resolution_key() const;
+
+    bool cancelled() const
+    {
+        return m_cancelled && m_cancelled->load(std::memory_order_relaxed);
+    }
+
+    std::span<const u8> source() const
+    {
+        return m_src;
+    }
+
+    const TokenBuffer &tokens() const
+    {
+        return m_tokens;
+    }
+
+    const Ast &ast() const
+    {
+        return m_ast;
+    }
+
+    DiagnosticBuffer &diagnostics()
+    {
+        return m_diagnostics;
+    }
+
+  private:
+    // A class declared in the unit, member or local
+    struct DeclaredClass
+    {
+        u32 node;
+        // Its nodes are the ones from start to node
+        u32 start;
+        // Innermost class that it's declared in, or NONE
+        u32 outer;
+        // Place in the class table
+        u32 entry;
+        Symbol name;
+        bool member;
+    };
+
+    // A name in a type, resolved to a class or a type variable, or to
+    // neither
+    struct ResolvedType
+    {
+        ClassRef type;
+        bool type_variable = false;
+    };
+
+    // JLS 7.5: a single-type import's class, the class whose member is
+    // imported by a single static import, or the class or package whose
+    // classes an on-demand import brings in
+    struct Import
+    {
+        // Simple name imported; zero for on-demand imports
+        Symbol name;
+        bool static_member;
+        ClassRef type;
+        // For on-demand imports of a package
+        std::string package;
+    };
+
+    static constexpr u32 NONE = ~u32(0);
+
+    bool read();
+    bool parse();
+    bool enter();
+    bool analyze();
+    bool emit();
+    bool write();
+    void dump_tokens() const;
+
+    // Calls f(node, scope) for every node after the first, where scope
+    // is the innermost class containing the node, or NONE
+    template <class F> void for_each_scoped_node(F &&f) const;
+    // Type names that qualify another, which resolve along with it
+    std::vector<bool> find_qualifiers() const;
+    void resolve_imports();
+    void resolve_supertypes(u32 declared);
+    ResolvedType resolve_type(u32 node, u32 scope);
+    ResolvedType resolve_name(std::span<const Symbol> names, u32 scope);
+    // Rest of a qualified name, after a class or a package
+    ClassRef resolve_qualified(std::span<const Symbol> names, ClassRef type, std::string package);
+    ResolvedType resolve_simple_name(Symbol name, u32 scope);
+    ClassRef find_in_unit(Symbol name);
+    ClassRef find_member_type(ClassRef owner, Symbol name, u32 depth = 0);
+    ClassRef find_package_class(std::string_view package, Symbol name) const;
+
+    const char *m_input;
+    const char *m_output;
+    const CompilerOptions &m_options;
+    const std::atomic_bool *m_cancelled;
+    OutputWriter *m_writer;
+    u32 m_output_order;
+
+    // Token offsets point into the source, so it's kept until the
+    // compiler goes away
+    SourceBuffer m_source;
+    bool m_source_ready = false;
+    std::span<const u8> m_src;
+    TokenBuffer m_tokens;
+    // Front-end data of this unit, released by finish()
+    Arena m_arena;
+    Ast m_ast{m_arena};
+    DiagnosticBuffer m_diagnostics;
+
+    ClassTable *m_classes = nullptr;
+    std::unique_ptr<ClassTable> m_own_classes;
+    u32 m_unit = 0;
+    Symbol m_package = 0;
+    // Sorted by start, so that outer classes come first
+    std::vector<DeclaredClass> m_declared;
+    std::vector<Import> m_imports;
+    bool m_imports_resolved = false;
+    bool m_supertypes_resolved = false;
+    // Whether member types are looked for in supertypes too, which is
+    // only safe once the units that declare those have resolved theirs
+    bool m_inherited = false;
+    // Simple names already resolved, by scope and name
+    std::unordered_map<u64, ResolvedType> m_resolved_names;
+
+    // Built whole by emit() and written with a single write
+    std::vector<u8> m_class_file;
+    std::string m_class_name;
 };
 
 class CompilerManager
 {
   public:
-    explicit CompilerManager(std::span<const char *> inputs);
-    u8 run() const;
+    // How units depended on each other in the last run
+    struct DependencyStats
+    {
+        u32 units;
+        u64 edges;
+        u32 components;
+        // Components of more than one unit, and the most units in one
+        u32 cycles;
+        u32 largest_component;
+        // Analysis onwards, summed over all components and along the
+        // most costly chain of them
+        double work_seconds;
+        double critical_path_seconds;
+        u32 critical_path_components;
+    };
+
+    CompilerManager(std::span<const char *> inputs, const CompilerOptions &options);
+    u8 run();
+
+    const OutputWriter &outputs() const
+    {
+        return m_writer;
+    }
+
+    const DependencyStats &dependency_stats() const
+    {
+        return m_dependency_stats;
+    }
+
+    // Of the last run's walk of the source paths, if any
+    const SourceDiscovery::Stats &discovery_stats() const
+    {
+        return m_discovery_stats;
+    }
 
   private:
-    bool compile_unit(u32 i) const;
+    struct Unit;
+    std::string output_path(std::string_view input, u32 root_size) const;
+    // Adds a unit for a source found while compiling; only called by
+    // the stage reading inputs
+    u32 add_input(SourceDiscovery::Source &&source);
+    void create_output_directories();
+    void finish_unit(Unit &unit, std::atomic_bool &status, tbb::task_group_context &context);
+
+    // The inputs given, then those found under the source paths
+    InputList m_inputs;
+    tbb::concurrent_vector<std::string> m_found_inputs;
+    const CompilerOptions &m_options;
+    tbb::concurrent_vector<std::string> m_outputs;
+    OutputWriter m_writer;
+    // Units given in the order they're started: largest input first,
+    // so that a big unit can't be the last one to start (LPT
+    // scheduling). Units found follow in the order they're found.
+    std::vector<u32> m_schedule;
+    tbb::concurrent_vector<u64> m_input_sizes;
+    tbb::concurrent_vector<double> m_unit_seconds;
 
-    const std::span<const char *> m_inputs;
-    std::vector<std::string> m_outputs;
+    // Set by the first unit to fail with --fail-fast
+    std::atomic_bool m_cancelled = false;
+    std::atomic<u32> m_skipped = 0;
+    DiagnosticEngine m_diagnostics;
+
+    BuildCache m_cache;
+    bool m_use_cache = false;
+    SystemIndex m_system_index;
+    ClassTable m_classes{&m_system_index};
+    DependencyStats m_dependency_stats{};
+    SourceDiscovery::Stats m_discovery_stats{};
+    Tracer m_tracer;
 };
 
+// Entry point for a request handled by the compile server, taking the
+// client's arguments as main() would
+using DaemonHandler = int (*)(int argc, char **argv);
+
+// Serves requests on a Unix socket until idle for idle_seconds, or for
+// good if that's 0. The client's working directory and streams stand in
+// for the daemon's own while a request runs.
+int daemon_serve(const char *socket_path, u32 idle_seconds, DaemonHandler handler);
+// Has the daemon listening on socket_path run the arguments, after the
+// program name. Returns false if there's no daemon to take them.
+bool daemon_request(const char *socket_path, int argc, char **argv, int &exit_code);
+
 #endif
@@ -0,0 +1,110 @@
+#!/usr/bin/env python3
+"""Generates src/unicode_tables.h, the identifier character tables used by
+the lexer (JLS 3.8), from the Unicode database that ships with Python.
+
+The classification follows Character.isJavaIdentifierStart/Part and
+Character.isIdentifierIgnorable over the full code point range. Run it
+again, or build the ujavac_unicode_tables target, after moving to a
+Python with a newer Unicode version.
+
+    python3 tools/gen_unicode_tables.py src/unicode_tables.h
+"""
+
+import sys
+import unicodedata
+
+MAX_CODE_POINT = 0x10FFFF
+BLOCK_SHIFT = 8
+BLOCK_SIZE = 1 << BLOCK_SHIFT
+WORDS_PER_BLOCK = BLOCK_SIZE // 64
+
+START_CATEGORIES = {"Lu", "Ll", "Lt", "Lm", "Lo", "Nl", "Sc", "Pc"}
+PART_CATEGORIES = START_CATEGORIES | {"Nd", "Mn", "Mc"}
+
+
+def is_ignorable(c):
+    return c <= 0x08 or 0x0E <= c <= 0x1B or 0x7F <= c <= 0x9F or unicodedata.category(chr(c)) == "Cf"
+
+
+def is_start(c):
+    return unicodedata.category(chr(c)) in START_CATEGORIES
+
+
+def is_part(c):
+    return unicodedata.category(chr(c)) in PART_CATEGORIES or is_ignorable(c)
+
+
+def block_words(first, predicate):
+    words = []
+    for word in range(WORDS_PER_BLOCK):
+        bits = 0
+        for bit in range(64):
+            c = first + word * 64 + bit
+            if c <= MAX_CODE_POINT and predicate(c):
+                bits |= 1 << bit
+        words.append(bits)
+    return words
+
+
+def main():
+    if len(sys.argv) != 2:
+        sys.exit(f"usage: {sys.argv[0]} <output header>")
+
+    blocks = []
+    block_ids = {}
+    index = []
+
+    for first in range(0, MAX_CODE_POINT + 1, BLOCK_SIZE):
+        block = tuple(block_words(first, is_start) + block_words(first, is_part) + block_words(first, is_ignorable))
+        if block not in block_ids:
+            block_ids[block] = len(blocks)
+            blocks.append(block)
+        index.append(block_ids[block])
+
+    assert len(blocks) < 1 << 16
+
+    out = []
+    out.append(f"// Generated by tools/gen_unicode_tables.py from Unicode {unicodedata.unidata_version}; do not edit.")
+    out.append("")
+    out.append("#ifndef UJAVAC_UNICODE_TABLES_H_")
+    out.append("#define UJAVAC_UNICODE_TABLES_H_")
+    out.append("")
+    out.append('#include "ujavac.h"')
+    out.append("")
+    out.append(f"constexpr u32 UNICODE_CODE_POINTS = 0x{MAX_CODE_POINT + 1:X};")
+    out.append(f"constexpr u32 UNICODE_BLOCK_SHIFT = {BLOCK_SHIFT};")
+    out.append("")
+    out.append("// Properties of each code point, one bit per code point of a block.")
+    out.append("// Blocks that are alike, most of them, are stored once.")
+    out.append("struct UnicodeBlock")
+    out.append("{")
+    out.append(f"    u64 identifier_start[{WORDS_PER_BLOCK}];")
+    out.append(f"    u64 identifier_part[{WORDS_PER_BLOCK}];")
+    out.append(f"    u64 identifier_ignorable[{WORDS_PER_BLOCK}];")
+    out.append("};")
+    out.append("")
+    out.append(f"// Block of each run of {BLOCK_SIZE} code points")
+    out.append(f"constexpr u16 unicode_block_index[{len(index)}] = {{")
+    for row in range(0, len(index), 16):
+        out.append("    " + ", ".join(str(i) for i in index[row : row + 16]) + ",")
+    out.append("};")
+    out.append("")
+    out.append(f"constexpr UnicodeBlock unicode_blocks[{len(blocks)}] = {{")
+    for block in blocks:
+        groups = []
+        for group in range(3):
+            words = block[group * WORDS_PER_BLOCK : (group + 1) * WORDS_PER_BLOCK]
+            groups.append("{" + ", ".join(f"0x{w:016x}" for w in words) + "}")
+        out.append("    {" + groups[0] + ",")
+        out.append("     " + groups[1] + ",")
+        out.append("     " + groups[2] + "},")
+    out.append("};")
+    out.append("")
+    out.append("#endif")
+
+    with open(sys.argv[1], "w", newline="\n") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()